@@ -273,7 +273,7 @@ static int read_packet_sec_TCP(struct sec_TCP_con *con, uint8_t *data, uint16_t
     return rlen;
 }
 
-START_TEST(test_some)
+static void run_some(bool use_io_uring)
 {
     Mono_Time *mono_time = mono_time_new();
     Logger *logger = logger_new();
@@ -281,7 +281,7 @@ START_TEST(test_some)
     uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
     crypto_new_keypair(self_public_key, self_secret_key);
-    TCP_Server *tcp_s = new_TCP_server(logger, USE_IPV6, NUM_PORTS, ports, self_secret_key, nullptr);
+    TCP_Server *tcp_s = new_TCP_server_ex(logger, USE_IPV6, NUM_PORTS, ports, self_secret_key, nullptr, use_io_uring);
     ck_assert_msg(tcp_s != nullptr, "Failed to create TCP relay server");
     ck_assert_msg(tcp_server_listen_count(tcp_s) == NUM_PORTS, "Failed to bind to all ports.");
 
@@ -379,6 +379,18 @@ START_TEST(test_some)
     logger_kill(logger);
     mono_time_free(mono_time);
 }
+
+START_TEST(test_some)
+{
+    run_some(false);
+}
+END_TEST
+
+// Falls back to the default event loop where io_uring is unavailable.
+START_TEST(test_some_io_uring)
+{
+    run_some(true);
+}
 END_TEST
 
 static int response_callback_good;
@@ -858,6 +870,7 @@ static Suite *TCP_suite(void)
 
     DEFTESTCASE_SLOW(basic, 5);
     DEFTESTCASE_SLOW(some, 10);
+    DEFTESTCASE_SLOW(some_io_uring, 10);
     DEFTESTCASE_SLOW(client, 10);
     DEFTESTCASE_SLOW(client_invalid, 15);
     DEFTESTCASE_SLOW(tcp_connection, 20);
@@ -807,6 +807,334 @@ static void test_dht_node_packing(void)
     free(data);
 }
 
+#define BENCH_QUERIES 10000
+
+/* Make a random public key in bucket `bucket` of the close list of self_pk. */
+static void key_in_bucket(uint8_t *public_key, const uint8_t *self_pk, uint32_t bucket)
+{
+    random_bytes(public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    const uint32_t byte = bucket / 8;
+    const uint8_t bit = 0x80 >> (bucket % 8);
+    const uint8_t prefix = (uint8_t)~(0xff >> (bucket % 8));
+
+    memcpy(public_key, self_pk, byte);
+    public_key[byte] = (self_pk[byte] & prefix) | (~self_pk[byte] & bit) | (public_key[byte] & ~(prefix | bit));
+}
+
+/* Offer num_nodes nodes spread over all buckets to a DHT and time
+ * get_close_nodes() for random keys against a scan of every node in the
+ * close list, checking that both find the same nodes.
+ */
+static void bench_get_close_nodes(uint32_t num_nodes)
+{
+    Mono_Time *mono_time = mono_time_new();
+    IP ip;
+    ip_init(&ip, 1);
+    Networking_Core *net = new_networking(nullptr, ip, DHT_DEFAULT_PORT);
+    DHT *dht = new_dht(nullptr, mono_time, net, true);
+    ck_assert_msg(dht != nullptr, "failed to create DHT");
+
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        key_in_bucket(public_key, dht->self_public_key, i % LCLIENT_LENGTH);
+
+        IP_Port ip_port;
+        random_ip(&ip_port, TOX_AF_INET);
+        addto_lists(dht, ip_port, public_key);
+    }
+
+    const uint32_t max_candidates = LCLIENT_LIST + dht->num_friends * MAX_FRIEND_CLIENTS;
+    Node_format *candidates = (Node_format *)malloc(max_candidates * sizeof(Node_format));
+    ck_assert(candidates != nullptr);
+    const uint32_t num_candidates = dht_copy_close_candidates(dht, candidates, max_candidates);
+
+    uint8_t (*targets)[CRYPTO_PUBLIC_KEY_SIZE] = (uint8_t (*)[CRYPTO_PUBLIC_KEY_SIZE])malloc(BENCH_QUERIES *
+            CRYPTO_PUBLIC_KEY_SIZE);
+    ck_assert(targets != nullptr);
+
+    for (uint32_t i = 0; i < BENCH_QUERIES; ++i) {
+        /* Half of the queries close to us, as in the lookups for our own key. */
+        if (i % 2 == 0) {
+            key_in_bucket(targets[i], dht->self_public_key, random_u32() % LCLIENT_LENGTH);
+        } else {
+            random_bytes(targets[i], CRYPTO_PUBLIC_KEY_SIZE);
+        }
+    }
+
+    Node_format nodes[MAX_SENT_NODES];
+    Node_format expected[MAX_SENT_NODES];
+
+    for (uint32_t i = 0; i < BENCH_QUERIES; ++i) {
+        const int num = get_close_nodes(dht, targets[i], nodes, net_family_unspec, true, 0);
+        const int num_expected = get_close_nodes_from(candidates, num_candidates, targets[i], expected, true);
+        ck_assert_msg(num == num_expected, "found %d nodes instead of %d", num, num_expected);
+
+        for (int j = 0; j < num; ++j) {
+            ck_assert_msg(index_of_node_pk(nodes, num, expected[j].public_key) != UINT32_MAX,
+                          "get_close_nodes() missed one of the closest nodes");
+        }
+    }
+
+    uint64_t start = current_time_monotonic(mono_time);
+
+    for (uint32_t i = 0; i < BENCH_QUERIES; ++i) {
+        get_close_nodes(dht, targets[i], nodes, net_family_unspec, true, 0);
+    }
+
+    const uint64_t bucketed_time = current_time_monotonic(mono_time) - start;
+    start = current_time_monotonic(mono_time);
+
+    for (uint32_t i = 0; i < BENCH_QUERIES; ++i) {
+        get_close_nodes_from(candidates, num_candidates, targets[i], nodes, true);
+    }
+
+    const uint64_t linear_time = current_time_monotonic(mono_time) - start;
+
+    printf("%6u nodes offered, %4u known: get_close_nodes %.2f us/query, full scan %.2f us/query\n",
+           num_nodes, num_candidates, bucketed_time * 1000.0 / BENCH_QUERIES, linear_time * 1000.0 / BENCH_QUERIES);
+
+    free(targets);
+    free(candidates);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+}
+
+static void test_get_close_nodes(void)
+{
+    bench_get_close_nodes(1000);
+    bench_get_close_nodes(10000);
+    bench_get_close_nodes(100000);
+}
+
+#define NUM_INDEX_FRIENDS 4000
+
+static void check_friends_index(const DHT *dht)
+{
+    for (uint32_t i = 0; i < dht->num_friends; ++i) {
+        ck_assert_msg(index_of_friend_pk(dht, dht->friends_list[i].public_key) == i,
+                      "friend %u not found in the friends index", i);
+    }
+}
+
+static void test_dht_friends_index(void)
+{
+    Mono_Time *mono_time = mono_time_new();
+    IP ip;
+    ip_init(&ip, 1);
+    Networking_Core *net = new_networking(nullptr, ip, DHT_DEFAULT_PORT);
+    DHT *dht = new_dht(nullptr, mono_time, net, true);
+    ck_assert_msg(dht != nullptr, "failed to create DHT");
+
+    uint8_t (*keys)[CRYPTO_PUBLIC_KEY_SIZE] = (uint8_t (*)[CRYPTO_PUBLIC_KEY_SIZE])malloc(NUM_INDEX_FRIENDS *
+            CRYPTO_PUBLIC_KEY_SIZE);
+    ck_assert(keys != nullptr);
+    bool added[NUM_INDEX_FRIENDS] = {false};
+    const uint16_t num_fake_friends = dht->num_friends;
+
+    for (uint32_t i = 0; i < NUM_INDEX_FRIENDS; ++i) {
+        random_bytes(keys[i], CRYPTO_PUBLIC_KEY_SIZE);
+        ck_assert(dht_addfriend(dht, keys[i], &ip_callback, nullptr, i, nullptr) == 0);
+        added[i] = true;
+
+        if (i % 500 == 0) {
+            check_friends_index(dht);
+        }
+    }
+
+    check_friends_index(dht);
+    ck_assert(dht->num_friends == num_fake_friends + NUM_INDEX_FRIENDS);
+
+    /* Remove and re-add friends in random order, so that entries are moved
+     * both in the friends list and in the index.
+     */
+    for (uint32_t i = 0; i < NUM_INDEX_FRIENDS * 2; ++i) {
+        const uint32_t num = random_u32() % NUM_INDEX_FRIENDS;
+
+        if (added[num]) {
+            ck_assert(dht_delfriend(dht, keys[num], 0) == 0);
+            ck_assert(index_of_friend_pk(dht, keys[num]) == UINT32_MAX);
+        } else {
+            ck_assert(dht_addfriend(dht, keys[num], &ip_callback, nullptr, num, nullptr) == 0);
+        }
+
+        added[num] = !added[num];
+
+        if (i % 500 == 0) {
+            check_friends_index(dht);
+        }
+    }
+
+    check_friends_index(dht);
+
+    for (uint32_t i = 0; i < NUM_INDEX_FRIENDS; ++i) {
+        ck_assert((index_of_friend_pk(dht, keys[i]) != UINT32_MAX) == added[i]);
+    }
+
+    free(keys);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+}
+
+#define NUM_ORDER_NODES 2000
+
+static void check_client_list_order(const Client_data *list, uint32_t length, const uint8_t *comp_public_key)
+{
+    for (uint32_t i = 1; i < length; ++i) {
+        ck_assert_msg(id_closest(comp_public_key, list[i - 1].public_key, list[i].public_key) != 1,
+                      "client %u is closer than client %u", i - 1, i);
+    }
+}
+
+static void test_friend_client_list_order(void)
+{
+    Mono_Time *mono_time = mono_time_new();
+    IP ip;
+    ip_init(&ip, 1);
+    Networking_Core *net = new_networking(nullptr, ip, DHT_DEFAULT_PORT);
+    DHT *dht = new_dht(nullptr, mono_time, net, true);
+    ck_assert_msg(dht != nullptr, "failed to create DHT");
+
+    uint8_t friend_pk[CRYPTO_PUBLIC_KEY_SIZE];
+    random_bytes(friend_pk, sizeof(friend_pk));
+    ck_assert(dht_addfriend(dht, friend_pk, &ip_callback, nullptr, 0, nullptr) == 0);
+    const DHT_Friend *const dht_friend = &dht->friends_list[index_of_friend_pk(dht, friend_pk)];
+
+    uint8_t closest[MAX_FRIEND_CLIENTS][CRYPTO_PUBLIC_KEY_SIZE];
+    uint32_t num_closest = 0;
+
+    for (uint32_t i = 0; i < NUM_ORDER_NODES; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(public_key, sizeof(public_key));
+
+        IP_Port ip_port;
+
+        if (i % 10 == 9) {
+            /* A new key at the address of a node in the list takes over its entry. */
+            ip_port = dht_friend->client_list[random_u32() % MAX_FRIEND_CLIENTS].assoc4.ip_port;
+        } else {
+            random_ip(&ip_port, TOX_AF_INET);
+        }
+
+        addto_lists(dht, ip_port, public_key);
+        check_client_list_order(dht_friend->client_list, MAX_FRIEND_CLIENTS, friend_pk);
+
+        for (uint32_t j = 0; j < DHT_FAKE_FRIEND_NUMBER; ++j) {
+            check_client_list_order(dht->friends_list[j].client_list, MAX_FRIEND_CLIENTS, dht->friends_list[j].public_key);
+        }
+    }
+
+    /* Without address collisions, the list ends up with the closest nodes. */
+    for (uint32_t i = 0; i < NUM_ORDER_NODES; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(public_key, sizeof(public_key));
+
+        IP_Port ip_port;
+        random_ip(&ip_port, TOX_AF_INET);
+        addto_lists(dht, ip_port, public_key);
+
+        if (num_closest < MAX_FRIEND_CLIENTS) {
+            memcpy(closest[num_closest], public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            ++num_closest;
+            continue;
+        }
+
+        uint32_t farthest = 0;
+
+        for (uint32_t j = 1; j < MAX_FRIEND_CLIENTS; ++j) {
+            if (id_closest(friend_pk, closest[farthest], closest[j]) == 1) {
+                farthest = j;
+            }
+        }
+
+        if (id_closest(friend_pk, public_key, closest[farthest]) == 1) {
+            memcpy(closest[farthest], public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        }
+    }
+
+    for (uint32_t i = 0; i < MAX_FRIEND_CLIENTS; ++i) {
+        ck_assert_msg(index_of_client_pk(dht_friend->client_list, MAX_FRIEND_CLIENTS, closest[i]) != UINT32_MAX
+                      || id_closest(friend_pk, closest[i], dht_friend->client_list[0].public_key) == 2,
+                      "a closer node was dropped from the friend's client list");
+    }
+
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+}
+
+#define NUM_LOOKUP_DHT 30
+
+static void iterate_dhts(DHT **dhts, uint32_t num, Mono_Time *mono_time, uint64_t *clock)
+{
+    for (uint32_t i = 0; i < num; ++i) {
+        networking_poll(dhts[i]->net, nullptr);
+        do_dht(dhts[i]);
+    }
+
+    *clock += 50;
+    mono_time_update(mono_time);
+}
+
+static void test_bootstrap_lookup(void)
+{
+    DHT *dhts[NUM_LOOKUP_DHT + 1];
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+    uint64_t clock = current_time_monotonic(mono_time);
+    mono_time_set_current_time_callback(mono_time, get_clock_callback, &clock);
+
+    IP ip;
+    ip_init(&ip, 1);
+
+    for (uint32_t i = 0; i <= NUM_LOOKUP_DHT; ++i) {
+        dhts[i] = new_dht(log, mono_time, new_networking(log, ip, DHT_DEFAULT_PORT + i), true);
+        ck_assert_msg(dhts[i] != nullptr, "failed to create DHT %u", i);
+    }
+
+    IP_Port first;
+    first.ip = get_loopback();
+    first.port = net_port(dhts[0]->net);
+
+    for (uint32_t i = 1; i < NUM_LOOKUP_DHT; ++i) {
+        dht_bootstrap(dhts[i], first, dhts[0]->self_public_key);
+    }
+
+    for (uint32_t i = 0; i < 2000 && good_close_nodes(dhts[0], NUM_LOOKUP_DHT - 1) < NUM_LOOKUP_DHT - 1; ++i) {
+        iterate_dhts(dhts, NUM_LOOKUP_DHT, mono_time, &clock);
+    }
+
+    /* A new node joins the network through the first one. */
+    DHT *dht = dhts[NUM_LOOKUP_DHT];
+    dht_bootstrap(dht, first, dhts[0]->self_public_key);
+    ck_assert(dht->bootstrap.active);
+
+    const uint64_t start = clock;
+
+    while (dht->bootstrap.active) {
+        iterate_dhts(dhts, NUM_LOOKUP_DHT + 1, mono_time, &clock);
+        ck_assert_msg(clock - start < BOOTSTRAP_LOOKUP_MAX_TIME * 1000, "bootstrap lookup did not end by itself");
+    }
+
+    printf("bootstrap lookup took %u ms, %u requests, %u answers\n", (unsigned)(clock - start),
+           dht->bootstrap.requests, dht->bootstrap.answers);
+
+    ck_assert_msg(good_close_nodes(dht, BOOTSTRAP_LOOKUP_DONE_NODES) == BOOTSTRAP_LOOKUP_DONE_NODES,
+                  "close list not populated after the bootstrap lookup");
+    ck_assert_msg(dht->bootstrap.answers > 1, "bootstrap lookup asked only the bootstrap node");
+
+    for (uint32_t i = 0; i <= NUM_LOOKUP_DHT; ++i) {
+        Networking_Core *net = dhts[i]->net;
+        kill_dht(dhts[i]);
+        kill_networking(net);
+    }
+
+    mono_time_free(mono_time);
+    logger_kill(log);
+}
+
 int main(void)
 {
     setvbuf(stdout, nullptr, _IONBF, 0);
@@ -816,6 +1144,10 @@ int main(void)
 
     test_list();
     test_DHT_test();
+    test_get_close_nodes();
+    test_dht_friends_index();
+    test_friend_client_list_order();
+    test_bootstrap_lookup();
 
     if (enable_broken_tests) {
         test_addto_lists_ipv4();
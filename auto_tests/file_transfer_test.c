@@ -154,18 +154,27 @@ static void write_file(Tox *tox, uint32_t friendnumber, uint32_t filenumber, uin
     size_recv += length;
 }
 
-static void file_transfer_test(void)
+/* The sender and the receiver encrypt and decrypt on crypto_threads threads
+ * and pace their packets if send_pacing is set.
+ */
+static void file_transfer_test(uint16_t crypto_threads, bool send_pacing)
 {
-    printf("Starting test: few_clients\n");
+    printf("Starting test: few_clients, %u crypto threads, send pacing %s\n", crypto_threads,
+           send_pacing ? "on" : "off");
     uint32_t index[] = { 1, 2, 3 };
     long long unsigned int cur_time = time(nullptr);
     Tox_Err_New t_n_error;
     Tox *tox1 = tox_new_log(nullptr, &t_n_error, &index[0]);
     ck_assert_msg(t_n_error == TOX_ERR_NEW_OK, "wrong error");
-    Tox *tox2 = tox_new_log(nullptr, &t_n_error, &index[1]);
+    struct Tox_Options *opts = tox_options_new(nullptr);
+    ck_assert(opts != nullptr);
+    tox_options_set_experimental_crypto_threads(opts, crypto_threads);
+    tox_options_set_experimental_send_pacing(opts, send_pacing);
+    Tox *tox2 = tox_new_log(opts, &t_n_error, &index[1]);
     ck_assert_msg(t_n_error == TOX_ERR_NEW_OK, "wrong error");
-    Tox *tox3 = tox_new_log(nullptr, &t_n_error, &index[2]);
+    Tox *tox3 = tox_new_log(opts, &t_n_error, &index[2]);
     ck_assert_msg(t_n_error == TOX_ERR_NEW_OK, "wrong error");
+    tox_options_free(opts);
 
     ck_assert_msg(tox1 && tox2 && tox3, "Failed to create 3 tox instances");
 
@@ -206,6 +215,8 @@ static void file_transfer_test(void)
 
     file_accepted = file_size = sendf_ok = size_recv = 0;
     file_recv = 0;
+    file_sending_done = 0;
+    num = sending_num = 0;
     max_sending = UINT64_MAX;
     uint64_t f_time = time(nullptr);
     tox_callback_file_recv_chunk(tox3, write_file);
@@ -365,6 +376,8 @@ static void file_transfer_test(void)
 int main(void)
 {
     setvbuf(stdout, nullptr, _IONBF, 0);
-    file_transfer_test();
+    file_transfer_test(0, false);
+    file_transfer_test(2, false);
+    file_transfer_test(0, true);
     return 0;
 }
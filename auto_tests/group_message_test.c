@@ -81,6 +81,15 @@ static void group_message_handler(Tox *tox, uint32_t groupnumber, uint32_t peer_
     ck_assert(q_err == TOX_ERR_GROUP_PEER_QUERY_OK);
     ck_assert(memcmp(peer_name, PEER0_NICK, peer_name_len) == 0);
 
+    Tox_Transport_Stats stats;
+    tox_group_peer_get_transport_stats(tox, groupnumber, peer_id, &stats, &q_err);
+
+    ck_assert(q_err == TOX_ERR_GROUP_PEER_QUERY_OK);
+    ck_assert(stats.connection != TOX_CONNECTION_NONE);
+
+    ck_assert(!tox_group_peer_get_transport_stats(tox, groupnumber, peer_id, nullptr, &q_err));
+    ck_assert(q_err == TOX_ERR_GROUP_PEER_QUERY_NULL);
+
     TOX_ERR_GROUP_SELF_QUERY s_err;
     size_t self_name_len = tox_group_self_get_name_size(tox, groupnumber, &s_err);
     ck_assert(s_err == TOX_ERR_GROUP_SELF_QUERY_OK);
@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include "../testing/misc_tools.h"
+#include "../toxcore/logger.h"
 #include "../toxcore/network.h"
 #include "check_compat.h"
 
@@ -165,6 +166,115 @@ START_TEST(test_ip_equal)
 }
 END_TEST
 
+static int count_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    uint32_t *received = (uint32_t *)object;
+    ++received[packet[0]];
+    return 0;
+}
+
+/* Packets with a second byte of 1 stand for data from unknown sources. */
+static bool from_known_source(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length)
+{
+    return packet[1] == 0;
+}
+
+static void send_marked_packets(Networking_Core *net, IP_Port ip_port, uint8_t packet_id, uint8_t mark,
+                                uint32_t count)
+{
+    uint8_t packet[64] = {0};
+    packet[0] = packet_id;
+    packet[1] = mark;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        ck_assert_msg(sendpacket(net, ip_port, packet, sizeof(packet)) == sizeof(packet), "failed to send packet");
+    }
+}
+
+static void send_packets(Networking_Core *net, IP_Port ip_port, uint8_t packet_id, uint32_t count)
+{
+    send_marked_packets(net, ip_port, packet_id, 0, count);
+}
+
+static void poll_all(Networking_Core *net)
+{
+    /* Give the kernel time to deliver everything, so that one poll sees it all. */
+    c_sleep(100);
+    networking_poll(net, nullptr);
+}
+
+START_TEST(test_poll_budget)
+{
+    Logger *log = logger_new();
+    IP ip;
+    ip_init(&ip, 0);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Networking_Core *receiver = new_networking(log, ip, 33545);
+    Networking_Core *sender = new_networking(log, ip, 33546);
+    ck_assert_msg(receiver != nullptr && sender != nullptr, "failed to create sockets");
+
+    uint32_t received[256] = {0};
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        networking_registerhandler(receiver, i, &count_packet, received);
+    }
+
+    networking_register_source_check(receiver, NET_PACKET_CRYPTO_DATA, &from_known_source, nullptr);
+
+    IP_Port ip_port;
+    ip_port.ip = ip;
+    ip_port.port = net_port(receiver);
+
+    networking_set_poll_budget(receiver, 10);
+    send_packets(sender, ip_port, NET_PACKET_GET_NODES, 20);
+    send_packets(sender, ip_port, NET_PACKET_COOKIE_REQUEST, 3);
+    send_packets(sender, ip_port, NET_PACKET_CRYPTO_DATA, 5);
+    poll_all(receiver);
+
+    ck_assert_msg(received[NET_PACKET_CRYPTO_DATA] == 5, "crypto data was dropped: %u of 5 handled",
+                  received[NET_PACKET_CRYPTO_DATA]);
+    ck_assert_msg(networking_class_handled(receiver, NET_CLASS_CRYPTO_DATA) == 5, "wrong crypto data count");
+
+    /* Without recvmmsg the DHT packets that came first spend the budget, with
+     * it the crypto data is handled first. Either way the socket is drained
+     * and the budget holds.
+     */
+    ck_assert_msg(received[NET_PACKET_GET_NODES] + received[NET_PACKET_COOKIE_REQUEST] <= 10,
+                  "budget exceeded: %u DHT packets and %u handshakes handled",
+                  received[NET_PACKET_GET_NODES], received[NET_PACKET_COOKIE_REQUEST]);
+    ck_assert_msg(networking_class_handled(receiver, NET_CLASS_DHT)
+                  + networking_class_dropped(receiver, NET_CLASS_DHT) == 20, "DHT packets were lost");
+    ck_assert_msg(networking_class_handled(receiver, NET_CLASS_HANDSHAKE)
+                  + networking_class_dropped(receiver, NET_CLASS_HANDSHAKE) == 3, "handshakes were lost");
+
+    /* The budget is per poll. */
+    const uint32_t dht_handled = received[NET_PACKET_GET_NODES];
+    send_packets(sender, ip_port, NET_PACKET_GET_NODES, 10);
+    poll_all(receiver);
+    ck_assert_msg(received[NET_PACKET_GET_NODES] == dht_handled + 10, "budget was not reset");
+
+    /* Crypto data from unknown sources is dropped over the budget. */
+    const uint32_t data_handled = received[NET_PACKET_CRYPTO_DATA];
+    send_marked_packets(sender, ip_port, NET_PACKET_CRYPTO_DATA, 1, 15);
+    poll_all(receiver);
+    ck_assert_msg(received[NET_PACKET_CRYPTO_DATA] == data_handled + 10,
+                  "budget exceeded: %u of 15 crypto data packets from unknown sources handled",
+                  received[NET_PACKET_CRYPTO_DATA] - data_handled);
+    ck_assert_msg(networking_class_dropped(receiver, NET_CLASS_CRYPTO_DATA) == 5,
+                  "crypto data from unknown sources was not dropped");
+
+    networking_set_poll_budget(receiver, 0);
+    send_packets(sender, ip_port, NET_PACKET_GET_NODES, 20);
+    poll_all(receiver);
+    ck_assert_msg(received[NET_PACKET_GET_NODES] == dht_handled + 30, "packets dropped without a budget");
+
+    kill_networking(sender);
+    kill_networking(receiver);
+    logger_kill(log);
+}
+END_TEST
+
 static Suite *network_suite(void)
 {
     Suite *s = suite_create("Network");
@@ -173,6 +283,7 @@ static Suite *network_suite(void)
 
     DEFTESTCASE(addr_resolv_localhost);
     DEFTESTCASE(ip_equal);
+    DEFTESTCASE(poll_budget);
 
     return s;
 }
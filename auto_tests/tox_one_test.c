@@ -7,6 +7,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "../testing/misc_tools.h"
 #include "../toxcore/ccompat.h"
@@ -132,12 +133,36 @@ static void test_one(void)
     tox_kill(tox2);
 }
 
+/* A Tox with nothing to do should sleep until its once per second timers. */
+static void test_idle_iteration_interval(void)
+{
+    uint32_t index[] = { 3 };
+    Tox *tox = tox_new_log(nullptr, nullptr, &index[0]);
+    ck_assert(tox != nullptr);
+
+    const time_t start = time(nullptr);
+    uint32_t iterations = 0;
+
+    while (time(nullptr) - start < 4) {
+        tox_iterate(tox, nullptr);
+        const uint32_t interval = tox_iteration_interval(tox);
+        ck_assert_msg(interval <= 1000, "iteration interval %u is longer than a second", interval);
+        c_sleep(interval);
+        ++iterations;
+    }
+
+    /* Waking up every 50 ms, as before there were deadlines, would take 80. */
+    ck_assert_msg(iterations < 40, "idle Tox iterated %u times in 4 seconds", iterations);
+
+    tox_kill(tox);
+}
 
 int main(void)
 {
     setvbuf(stdout, nullptr, _IONBF, 0);
 
     test_one();
+    test_idle_iteration_interval();
 
     return 0;
 }
@@ -0,0 +1,76 @@
+/* Tests the transport statistics of friend connections.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../testing/misc_tools.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "check_compat.h"
+
+typedef struct State {
+    uint32_t index;
+    uint64_t clock;
+
+    uint32_t packets_received;
+} State;
+
+#include "run_auto_test.h"
+
+#define TRANSPORT_STATS_PACKETS 32
+
+static void handle_lossless_packet(Tox *tox, uint32_t friend_number, const uint8_t *data, size_t length,
+                                   void *user_data)
+{
+    State *state = (State *)user_data;
+    ++state->packets_received;
+}
+
+static void test_transport_stats(Tox **toxes, State *state)
+{
+    Tox_Transport_Stats stats;
+    Tox_Err_Friend_Query err;
+
+    bool ret = tox_friend_get_transport_stats(toxes[0], 1, &stats, &err);
+    ck_assert_msg(!ret && err == TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND, "stats of a missing friend: %d", err);
+
+    ret = tox_friend_get_transport_stats(toxes[0], 0, nullptr, &err);
+    ck_assert_msg(!ret && err == TOX_ERR_FRIEND_QUERY_NULL, "stats written to NULL: %d", err);
+
+    tox_callback_friend_lossless_packet(toxes[1], &handle_lossless_packet);
+    uint8_t packet[TOX_MAX_CUSTOM_PACKET_SIZE];
+    memset(packet, 160, sizeof(packet));
+
+    for (uint32_t i = 0; i < TRANSPORT_STATS_PACKETS; ++i) {
+        ck_assert(tox_friend_send_lossless_packet(toxes[0], 0, packet, sizeof(packet), nullptr));
+    }
+
+    do {
+        iterate_all_wait(2, toxes, state, ITERATION_INTERVAL);
+        ret = tox_friend_get_transport_stats(toxes[0], 0, &stats, &err);
+        ck_assert_msg(ret && err == TOX_ERR_FRIEND_QUERY_OK, "failed to get transport stats: %d", err);
+    } while (state[1].packets_received < TRANSPORT_STATS_PACKETS || stats.rtt == 0 || stats.send_queue != 0);
+
+    printf("rtt %u ms, send rate %u/s, recv rate %u/s, send rate limit %u/s, %lu resent\n", stats.rtt,
+           stats.send_rate, stats.recv_rate, stats.send_rate_limit, (unsigned long)stats.packets_resent);
+    ck_assert_msg(stats.connection != TOX_CONNECTION_NONE, "connected friend has no connection");
+    ck_assert_msg(stats.send_rate_limit != 0, "connected friend has no send rate limit");
+
+    ret = tox_friend_get_transport_stats(toxes[1], 0, &stats, &err);
+    ck_assert_msg(ret && err == TOX_ERR_FRIEND_QUERY_OK, "failed to get transport stats: %d", err);
+    ck_assert_msg(stats.connection != TOX_CONNECTION_NONE, "connected friend has no connection");
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    run_auto_test(2, test_transport_stats, false);
+    return 0;
+}
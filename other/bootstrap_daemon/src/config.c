@@ -12,6 +12,7 @@
 #include "config_defaults.h"
 #include "log.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,6 +20,54 @@
 
 #include "../../bootstrap_node_packets.h"
 
+typedef struct Udp_Rate_Limit_Setting {
+    const char *name;
+    uint8_t packet_id;
+    int default_rate;
+} Udp_Rate_Limit_Setting;
+
+static const Udp_Rate_Limit_Setting udp_rate_limit_settings[] = {
+    {"ping_request",       NET_PACKET_PING_REQUEST,       DEFAULT_UDP_RATE_LIMIT_PING_REQUEST},
+    {"get_nodes",          NET_PACKET_GET_NODES,          DEFAULT_UDP_RATE_LIMIT_GET_NODES},
+    {"onion_send_initial", NET_PACKET_ONION_SEND_INITIAL, DEFAULT_UDP_RATE_LIMIT_ONION_SEND_INITIAL},
+    {"onion_send_1",       NET_PACKET_ONION_SEND_1,       0},
+    {"onion_send_2",       NET_PACKET_ONION_SEND_2,       0},
+    {"announce_request",   NET_PACKET_ANNOUNCE_REQUEST,   0},
+    {"onion_data_request", NET_PACKET_ONION_DATA_REQUEST, 0},
+    {"lan_discovery",      NET_PACKET_LAN_DISCOVERY,      0},
+};
+
+/**
+ * Parses the per packet rate limits in the `udp_rate_limits` group of `cfg`
+ * and puts them into `udp_rate_limits`, indexed by packet ID.
+ *
+ * Supposed to be called from get_general_config only.
+ */
+static void parse_udp_rate_limits_config(config_t *cfg, uint32_t *udp_rate_limits)
+{
+    const char *NAME_UDP_RATE_LIMITS = "udp_rate_limits";
+
+    memset(udp_rate_limits, 0, 256 * sizeof(uint32_t));
+
+    for (size_t i = 0; i < sizeof(udp_rate_limit_settings) / sizeof(udp_rate_limit_settings[0]); ++i) {
+        const Udp_Rate_Limit_Setting *const setting = &udp_rate_limit_settings[i];
+        char path[64];
+        snprintf(path, sizeof(path), "%s.%s", NAME_UDP_RATE_LIMITS, setting->name);
+
+        int rate;
+
+        if (config_lookup_int(cfg, path, &rate) == CONFIG_FALSE) {
+            rate = setting->default_rate;
+        } else if (rate < 0) {
+            log_write(LOG_LEVEL_WARNING, "Invalid rate limit '%s': %d, should not be negative. Using default: %d\n",
+                      path, rate, setting->default_rate);
+            rate = setting->default_rate;
+        }
+
+        udp_rate_limits[setting->packet_id] = rate;
+    }
+}
+
 /**
  * Parses tcp relay ports from `cfg` and puts them into `tcp_relay_ports` array.
  *
@@ -128,7 +177,8 @@ static void parse_tcp_relay_ports_config(config_t *cfg, uint16_t **tcp_relay_por
 
 int get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                        int *enable_ipv6, int *enable_ipv4_fallback, int *enable_lan_discovery, int *enable_tcp_relay,
-                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *enable_motd, char **motd)
+                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *enable_motd, char **motd,
+                       int *udp_worker_threads, uint32_t *udp_rate_limits)
 {
     config_t cfg;
 
@@ -141,6 +191,7 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
     const char *NAME_ENABLE_TCP_RELAY     = "enable_tcp_relay";
     const char *NAME_ENABLE_MOTD          = "enable_motd";
     const char *NAME_MOTD                 = "motd";
+    const char *NAME_UDP_WORKER_THREADS   = "udp_worker_threads";
 
     config_init(&cfg);
 
@@ -244,6 +295,15 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
         (*motd)[motd_length - 1] = '\0';
     }
 
+    // Get number of UDP worker threads
+    if (config_lookup_int(&cfg, NAME_UDP_WORKER_THREADS, udp_worker_threads) == CONFIG_FALSE) {
+        log_write(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_UDP_WORKER_THREADS);
+        log_write(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_UDP_WORKER_THREADS, DEFAULT_UDP_WORKER_THREADS);
+        *udp_worker_threads = DEFAULT_UDP_WORKER_THREADS;
+    }
+
+    parse_udp_rate_limits_config(&cfg, udp_rate_limits);
+
     config_destroy(&cfg);
 
     log_write(LOG_LEVEL_INFO, "Successfully read:\n");
@@ -276,6 +336,13 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
         log_write(LOG_LEVEL_INFO, "'%s': %s\n", NAME_MOTD, *motd);
     }
 
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_UDP_WORKER_THREADS, *udp_worker_threads);
+
+    for (size_t i = 0; i < sizeof(udp_rate_limit_settings) / sizeof(udp_rate_limit_settings[0]); ++i) {
+        log_write(LOG_LEVEL_INFO, "'udp_rate_limits.%s': %u\n", udp_rate_limit_settings[i].name,
+                  udp_rate_limits[udp_rate_limit_settings[i].packet_id]);
+    }
+
     return 1;
 }
 
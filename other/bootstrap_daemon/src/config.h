@@ -19,12 +19,16 @@
  *            also, iff `tcp_relay_ports_count` > 0, then you are responsible for freeing `tcp_relay_ports`
  *            and also `motd` iff `enable_motd` is set.
  *
+ * `udp_rate_limits` has room for 256 entries and is filled with the number of
+ * packets per second each source IP may send for every packet ID, 0 for no limit.
+ *
  * @return 1 on success,
  *         0 on failure, doesn't modify any data pointed by arguments.
  */
 int get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                        int *enable_ipv6, int *enable_ipv4_fallback, int *enable_lan_discovery, int *enable_tcp_relay,
-                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *enable_motd, char **motd);
+                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *enable_motd, char **motd,
+                       int *udp_worker_threads, uint32_t *udp_rate_limits);
 
 /**
  * Bootstraps off nodes listed in the config file.
@@ -23,5 +23,10 @@
 #define DEFAULT_TCP_RELAY_PORTS_COUNT 3
 #define DEFAULT_ENABLE_MOTD           1 // 1 - true, 0 - false
 #define DEFAULT_MOTD                  DAEMON_NAME
+#define DEFAULT_UDP_WORKER_THREADS    0 // 0 - handle all UDP packets on the main thread
+// Packets per second each source IP may send of the packets the daemon answers directly, 0 - no limit
+#define DEFAULT_UDP_RATE_LIMIT_PING_REQUEST       32
+#define DEFAULT_UDP_RATE_LIMIT_GET_NODES          32
+#define DEFAULT_UDP_RATE_LIMIT_ONION_SEND_INITIAL 32
 
 #endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_CONFIG_DEFAULTS_H
@@ -19,6 +19,7 @@
 
 // C
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,9 +29,11 @@
 #include "../../../toxcore/tox.h"
 #include "../../../toxcore/LAN_discovery.h"
 #include "../../../toxcore/TCP_server.h"
+#include "../../../toxcore/dht_workers.h"
 #include "../../../toxcore/logger.h"
 #include "../../../toxcore/mono_time.h"
 #include "../../../toxcore/onion_announce.h"
+#include "../../../toxcore/rate_limit.h"
 #include "../../../toxcore/util.h"
 
 // misc
@@ -44,6 +47,9 @@
 
 #define SLEEP_MILLISECONDS(MS) usleep(1000*MS)
 
+// Sources may send this many seconds' worth of packets at once before their rate limit applies.
+#define UDP_RATE_LIMIT_BURST_SECONDS 4
+
 // Uses the already existing key or creates one if it didn't exist
 //
 // returns 1 on success
@@ -239,9 +245,12 @@ int main(int argc, char *argv[])
     int tcp_relay_port_count;
     int enable_motd;
     char *motd = nullptr;
+    int udp_worker_threads;
+    uint32_t udp_rate_limits[256];
 
     if (get_general_config(cfg_file_path, &pid_file_path, &keys_file_path, &port, &enable_ipv6, &enable_ipv4_fallback,
-                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd)) {
+                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd,
+                           &udp_worker_threads, udp_rate_limits)) {
         log_write(LOG_LEVEL_INFO, "General config read successfully\n");
     } else {
         log_write(LOG_LEVEL_ERROR, "Couldn't read config file: %s. Exiting.\n", cfg_file_path);
@@ -258,6 +267,16 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (udp_worker_threads < 0 || udp_worker_threads > MAX_DHT_WORKERS) {
+        log_write(LOG_LEVEL_ERROR, "Invalid number of UDP worker threads: %d, should be in [0, %d]. Exiting.\n",
+                  udp_worker_threads, MAX_DHT_WORKERS);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
     if (!run_in_foreground) {
         daemonize(log_backend, pid_file_path);
     }
@@ -273,14 +292,16 @@ int main(int argc, char *argv[])
         logger_callback_log(logger, toxcore_logger_callback, nullptr, nullptr);
     }
 
-    Networking_Core *net = new_networking(logger, ip, port);
+    Networking_Core *net = udp_worker_threads > 0 ? new_networking_reuseport(logger, ip, port)
+                           : new_networking(logger, ip, port);
 
     if (net == nullptr) {
         if (enable_ipv6 && enable_ipv4_fallback) {
             log_write(LOG_LEVEL_WARNING, "Couldn't initialize IPv6 networking. Falling back to using IPv4.\n");
             enable_ipv6 = 0;
             ip_init(&ip, enable_ipv6);
-            net = new_networking(logger, ip, port);
+            net = udp_worker_threads > 0 ? new_networking_reuseport(logger, ip, port)
+                  : new_networking(logger, ip, port);
 
             if (net == nullptr) {
                 log_write(LOG_LEVEL_ERROR, "Couldn't fallback to IPv4. Exiting.\n");
@@ -466,6 +487,56 @@ int main(int argc, char *argv[])
 
     print_public_key(dht_get_self_public_key(dht));
 
+    Rate_Limit *rate_limit = nullptr;
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        if (udp_rate_limits[i] == 0) {
+            continue;
+        }
+
+        if (rate_limit == nullptr) {
+            rate_limit = rate_limit_new(mono_time);
+
+            if (rate_limit == nullptr) {
+                log_write(LOG_LEVEL_ERROR, "Couldn't initialize UDP rate limits. Exiting.\n");
+                kill_TCP_server(tcp_server);
+                kill_onion_announce(onion_a);
+                kill_onion(onion);
+                kill_dht(dht);
+                mono_time_free(mono_time);
+                kill_networking(net);
+                logger_kill(logger);
+                return 1;
+            }
+        }
+
+        rate_limit_set(rate_limit, i, udp_rate_limits[i], udp_rate_limits[i] * UDP_RATE_LIMIT_BURST_SECONDS);
+    }
+
+    // Set before starting the workers, which share it.
+    networking_set_rate_limit(net, rate_limit);
+
+    DHT_Workers *dht_workers = nullptr;
+
+    if (udp_worker_threads > 0) {
+        dht_workers = new_dht_workers(logger, mono_time, dht, udp_worker_threads);
+
+        if (dht_workers != nullptr) {
+            log_write(LOG_LEVEL_INFO, "Started %d UDP worker threads successfully.\n", udp_worker_threads);
+        } else {
+            log_write(LOG_LEVEL_ERROR, "Couldn't start UDP worker threads. Exiting.\n");
+            kill_TCP_server(tcp_server);
+            kill_onion_announce(onion_a);
+            kill_onion(onion);
+            kill_dht(dht);
+            mono_time_free(mono_time);
+            kill_networking(net);
+            rate_limit_kill(rate_limit);
+            logger_kill(logger);
+            return 1;
+        }
+    }
+
     uint64_t last_LANdiscovery = 0;
     const uint16_t net_htons_port = net_htons(port);
 
@@ -510,6 +581,10 @@ int main(int argc, char *argv[])
 
         networking_poll(dht_get_net(dht), nullptr);
 
+        if (dht_workers != nullptr) {
+            do_dht_workers(dht_workers, nullptr);
+        }
+
         if (waiting_for_dht_connection && dht_isconnected(dht)) {
             log_write(LOG_LEVEL_INFO, "Connected to another bootstrap node successfully.\n");
             waiting_for_dht_connection = 0;
@@ -531,6 +606,25 @@ int main(int argc, char *argv[])
             log_write(LOG_LEVEL_INFO, "Received (%d) signal. Exiting.\n", caught_signal);
     }
 
+    if (dht_workers != nullptr) {
+        log_write(LOG_LEVEL_INFO, "UDP worker threads answered %" PRIu64 " requests, passed on %" PRIu64
+                  " packets and dropped %" PRIu64 " packets.\n", dht_workers_answered(dht_workers),
+                  dht_workers_forwarded(dht_workers), dht_workers_dropped(dht_workers));
+        kill_dht_workers(dht_workers);
+    }
+
+    if (rate_limit != nullptr) {
+        log_write(LOG_LEVEL_INFO, "UDP rate limits dropped %" PRIu64 " packets.\n", rate_limit_dropped_total(rate_limit));
+
+        for (uint32_t i = 0; i < 256; ++i) {
+            const uint64_t dropped = rate_limit_dropped(rate_limit, i);
+
+            if (dropped > 0) {
+                log_write(LOG_LEVEL_INFO, "Dropped %" PRIu64 " packets with ID %u.\n", dropped, i);
+            }
+        }
+    }
+
     if (enable_lan_discovery) {
         lan_discovery_kill(dht);
     }
@@ -541,6 +635,7 @@ int main(int argc, char *argv[])
     kill_dht(dht);
     mono_time_free(mono_time);
     kill_networking(net);
+    rate_limit_kill(rate_limit);
     logger_kill(logger);
 
     return 0;
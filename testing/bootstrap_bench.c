@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/* Time to UDP connection benchmark.
+ *
+ * Runs a network of tox instances on the loopback interface until all of
+ * them are connected, then starts several clients that each bootstrap from
+ * one random node of the network. Reports how long the clients took until
+ * tox_self_get_connection_status first said TOX_CONNECTION_UDP, as measured
+ * by tox_self_get_time_to_udp. Unlike the DHT benchmarks this one runs in
+ * real time, so it includes the onion path setup the status depends on.
+ *
+ * Usage: bootstrap_bench [network nodes] [clients]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "../toxcore/tox_private.h"
+
+#define BENCH_PORT 33445
+/* Seconds after which clients that are not connected yet count as timed out. */
+#define BENCH_MAX_CONNECT_TIME 60
+
+static void sleep_ms(uint32_t ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&ts, nullptr);
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static Tox *start_tox(uint16_t port)
+{
+    struct Tox_Options *options = tox_options_new(nullptr);
+
+    if (options == nullptr) {
+        return nullptr;
+    }
+
+    tox_options_set_ipv6_enabled(options, false);
+    tox_options_set_local_discovery_enabled(options, false);
+    tox_options_set_start_port(options, port);
+    tox_options_set_end_port(options, port);
+
+    Tox *tox = tox_new(options, nullptr);
+    tox_options_free(options);
+    return tox;
+}
+
+static void bootstrap_tox(Tox *tox, const Tox *from)
+{
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(from, dht_key);
+    tox_bootstrap(tox, "127.0.0.1", tox_self_get_udp_port(from, nullptr), dht_key, nullptr);
+}
+
+/* Iterate all instances once and sleep for the shortest interval any of them asked for. */
+static void iterate_all(Tox *const *toxes, uint32_t num)
+{
+    uint32_t interval = 50;
+
+    for (uint32_t i = 0; i < num; ++i) {
+        if (toxes[i] == nullptr) {
+            continue;
+        }
+
+        tox_iterate(toxes[i], nullptr);
+        const uint32_t tox_interval = tox_iteration_interval(toxes[i]);
+
+        if (tox_interval < interval) {
+            interval = tox_interval;
+        }
+    }
+
+    sleep_ms(interval);
+}
+
+static bool all_connected(Tox *const *toxes, uint32_t num)
+{
+    for (uint32_t i = 0; i < num; ++i) {
+        if (toxes[i] != nullptr && tox_self_get_time_to_udp(toxes[i]) == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const int num_nodes = argc > 1 ? atoi(argv[1]) : 16;
+    const int num_clients = argc > 2 ? atoi(argv[2]) : 16;
+
+    if (num_nodes < 2 || num_clients < 1 || num_nodes + num_clients > 1000) {
+        printf("need at least 2 network nodes, 1 client and at most 1000 instances\n");
+        return 1;
+    }
+
+    const uint32_t num = num_nodes + num_clients;
+    Tox **toxes = (Tox **)calloc(num, sizeof(Tox *));
+
+    if (toxes == nullptr) {
+        return 1;
+    }
+
+    for (int i = 0; i < num_nodes; ++i) {
+        toxes[i] = start_tox(BENCH_PORT + i);
+
+        if (toxes[i] == nullptr) {
+            printf("failed to start node %d\n", i);
+            return 1;
+        }
+
+        if (i > 0) {
+            bootstrap_tox(toxes[i], toxes[0]);
+        }
+    }
+
+    const uint64_t network_start = now_ms();
+
+    while (!all_connected(toxes, num_nodes)) {
+        if (now_ms() - network_start > BENCH_MAX_CONNECT_TIME * 1000) {
+            printf("the network did not connect\n");
+            return 1;
+        }
+
+        iterate_all(toxes, num_nodes);
+    }
+
+    printf("%d nodes connected after %llu ms\n", num_nodes, (unsigned long long)(now_ms() - network_start));
+
+    for (uint32_t i = num_nodes; i < num; ++i) {
+        toxes[i] = start_tox(BENCH_PORT + i);
+
+        if (toxes[i] == nullptr) {
+            printf("failed to start client %u\n", i - num_nodes);
+            return 1;
+        }
+
+        bootstrap_tox(toxes[i], toxes[rand() % num_nodes]);
+    }
+
+    const uint64_t clients_start = now_ms();
+
+    while (!all_connected(toxes + num_nodes, num_clients)
+            && now_ms() - clients_start <= BENCH_MAX_CONNECT_TIME * 1000) {
+        iterate_all(toxes, num);
+    }
+
+    uint64_t total = 0;
+    uint64_t max = 0;
+    uint32_t failed = 0;
+
+    for (uint32_t i = num_nodes; i < num; ++i) {
+        const uint64_t time_to_udp = tox_self_get_time_to_udp(toxes[i]);
+
+        if (time_to_udp == 0) {
+            ++failed;
+            continue;
+        }
+
+        total += time_to_udp;
+
+        if (time_to_udp > max) {
+            max = time_to_udp;
+        }
+    }
+
+    printf("time to UDP: mean %6.0f ms, max %6llu ms, %u of %d timed out\n",
+           num_clients > failed ? (double)total / (num_clients - failed) : 0.0, (unsigned long long)max, failed,
+           num_clients);
+
+    for (uint32_t i = 0; i < num; ++i) {
+        tox_kill(toxes[i]);
+    }
+
+    free(toxes);
+    return failed == 0 ? 0 : 1;
+}
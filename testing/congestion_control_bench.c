@@ -0,0 +1,1109 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/* Congestion control benchmark.
+ *
+ * Runs a bulk transfer over a simulated link once with each congestion
+ * controller and reports the goodput and the queueing delay at the
+ * bottleneck. The link has a bandwidth, a tail drop buffer in front of it, a
+ * round trip time and a random loss rate in both directions.
+ *
+ * The sender and receiver follow net_crypto step by step: the sender refills
+ * its send budget from the rates the controller sets, resends the packets
+ * the receiver asked for and then queues new packets until the budget runs
+ * out, like a file transfer in Messenger. The receiver sends request packets
+ * listing the packets it is missing as often as net_crypto does. Both run on
+ * simulated time, and the loss comes from a seeded generator, so every run
+ * gives the same result.
+ *
+ * Each controller runs with the byte per missing packet request packets
+ * ("legacy"), with range requests ("ranges") and with range requests and send
+ * pacing ("paced"). For each the benchmark reports how long a lost packet
+ * took to arrive after it was first sent, the size of the request packets
+ * and the processor time spent making and handling them for each MiB that
+ * arrived.
+ *
+ * Usage: congestion_control_bench [bandwidth in KiB/s] [round trip time in ms]
+ *            [loss in percent] [buffer in ms] [seconds]
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/congestion_control.h"
+#include "../toxcore/net_crypto.h"
+#include "../toxcore/request_ranges.h"
+
+/* Same as in net_crypto.c. */
+#define PACKET_COUNTER_AVERAGE_INTERVAL CONGESTION_SAMPLE_INTERVAL
+#define REQUEST_PACKETS_COMPARE_CONSTANT (0.125 * 100.0)
+#define CRYPTO_PACING_GAIN 1.25
+#define CRYPTO_PACING_MIN_RATE (CRYPTO_MIN_QUEUE_LENGTH * 1000.0 / CONGESTION_SAMPLE_INTERVAL)
+#define CRYPTO_PACING_MAX_CREDIT 50.0
+
+/* Same as in Messenger.c: file data is only queued while more slots are
+ * free.
+ */
+#define MIN_SLOTS_FREE (CRYPTO_MIN_QUEUE_LENGTH / 4)
+
+/* Simulated time starts here, in us, as mono_time never returns 0. */
+#define SIM_START 1000000
+
+/* The receiver runs every SIM_RECEIVER_TICK us. */
+#define SIM_RECEIVER_TICK 1000
+
+/* Queueing delays are counted in 1 ms buckets up to SIM_DELAY_BUCKETS ms. */
+#define SIM_DELAY_BUCKETS 10000
+
+typedef struct Sim_Config {
+    /* Packets per second through the bottleneck. */
+    double bandwidth;
+    /* Round trip time of an empty link in ms. */
+    uint32_t rtt;
+    /* Chance of losing a packet in either direction. */
+    double loss;
+    /* Packets the bottleneck buffer holds. */
+    uint32_t buffer;
+    uint32_t seconds;
+    /* Send range requests instead of PACKET_ID_REQUEST packets. */
+    bool request_ranges;
+    bool send_pacing;
+} Sim_Config;
+
+typedef struct Sim_Data_Packet {
+    uint64_t arrival;
+    uint32_t number;
+} Sim_Data_Packet;
+
+/* A request packet and the ack in its header. */
+typedef struct Sim_Request {
+    uint64_t arrival;
+    uint32_t buffer_start;
+    uint16_t length;
+    uint8_t data[MAX_CRYPTO_DATA_SIZE];
+} Sim_Request;
+
+/* FIFO of packets on their way. Arrival times are in the order packets went
+ * out, so the head always arrives first.
+ */
+typedef struct Sim_Queue {
+    uint8_t *items;
+    size_t item_size;
+    uint32_t head;
+    uint32_t count;
+    uint32_t capacity;
+} Sim_Queue;
+
+/* The sending side of a crypto connection. */
+typedef struct Sim_Sender {
+    Congestion_Control congestion;
+
+    /* Send array: sent time in ms of each packet, 0 if it has to be sent
+     * (again), whether the peer still has to acknowledge it and whether the
+     * peer asked for it again, and the time in us it was first sent.
+     */
+    uint64_t *sent_time;
+    uint64_t *first_sent_time;
+    bool *unacked;
+    bool *resent;
+    uint32_t buffer_start;
+    uint32_t buffer_end;
+
+    double packet_send_rate;
+    uint32_t packets_left;
+    uint64_t last_packets_left_set;
+    double last_packets_left_rem;
+
+    double packet_send_rate_requested;
+    uint32_t packets_left_requested;
+    uint64_t last_packets_left_requested_set;
+    double last_packets_left_requested_rem;
+
+    uint32_t packets_sent;
+    uint32_t packets_resent;
+    uint32_t packets_delivered;
+    uint64_t packet_counter_set;
+    uint64_t last_congestion_event;
+    uint64_t rtt_time;
+    uint64_t last_rtt_time;
+
+    /* Packets from new_packets_start on wait for send pacing. */
+    bool has_new_packets;
+    uint32_t new_packets_start;
+    double next_send_time;
+    bool pacing_held_back;
+
+    uint64_t next_run;
+} Sim_Sender;
+
+/* The receiving side of a crypto connection. */
+typedef struct Sim_Receiver {
+    bool *received;
+    uint32_t buffer_start;
+    uint32_t buffer_end;
+
+    uint32_t packet_counter;
+    double packet_recv_rate;
+    uint64_t packet_counter_set;
+    uint64_t last_request_packet_sent;
+
+    uint64_t next_run;
+} Sim_Receiver;
+
+typedef struct Sim_Stats {
+    uint64_t packets_sent;
+    uint64_t packets_resent;
+    uint64_t packets_delivered;
+    uint64_t buffer_drops;
+    uint64_t random_drops;
+    uint64_t queue_delay_sum;
+    uint64_t queue_delays;
+    uint32_t queue_delay_counts[SIM_DELAY_BUCKETS + 1];
+    /* Time in us from the first sending of resent packets to their arrival. */
+    uint64_t recovery_time_sum;
+    uint64_t packets_recovered;
+    uint64_t requests;
+    uint64_t request_bytes;
+    clock_t request_cpu_time;
+} Sim_Stats;
+
+typedef struct Sim {
+    const Sim_Config *config;
+    uint64_t now;
+    uint64_t rng;
+
+    /* Time in us at which the bottleneck is done with the packets queued so
+     * far.
+     */
+    double link_free_at;
+    Sim_Queue data_packets;
+    Sim_Queue requests;
+
+    Sim_Sender sender;
+    Sim_Receiver receiver;
+    Sim_Stats stats;
+} Sim;
+
+static uint64_t now_ms(const Sim *sim)
+{
+    return sim->now / 1000;
+}
+
+static double random_unit(Sim *sim)
+{
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return (double)((sim->rng * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+static bool sim_queue_init(Sim_Queue *queue, size_t item_size)
+{
+    queue->item_size = item_size;
+    queue->head = 0;
+    queue->count = 0;
+    queue->capacity = 64;
+    queue->items = (uint8_t *)malloc(queue->capacity * item_size);
+    return queue->items != nullptr;
+}
+
+/* return a slot at the tail for a new item, NULL if memory ran out. */
+static void *sim_queue_push(Sim_Queue *queue)
+{
+    if (queue->count == queue->capacity) {
+        uint8_t *items = (uint8_t *)malloc(queue->capacity * 2 * queue->item_size);
+
+        if (items == nullptr) {
+            return nullptr;
+        }
+
+        for (uint32_t i = 0; i < queue->count; ++i) {
+            memcpy(items + i * queue->item_size, queue->items + ((queue->head + i) % queue->capacity) * queue->item_size,
+                   queue->item_size);
+        }
+
+        free(queue->items);
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity *= 2;
+    }
+
+    void *item = queue->items + ((queue->head + queue->count) % queue->capacity) * queue->item_size;
+    ++queue->count;
+    return item;
+}
+
+static void *sim_queue_head(const Sim_Queue *queue)
+{
+    if (queue->count == 0) {
+        return nullptr;
+    }
+
+    return queue->items + queue->head * queue->item_size;
+}
+
+static void sim_queue_pop(Sim_Queue *queue)
+{
+    queue->head = (queue->head + 1) % queue->capacity;
+    --queue->count;
+}
+
+/* Put a data packet on the link: through the bottleneck buffer, then across
+ * the link.
+ */
+static void link_send_data(Sim *sim, uint32_t number)
+{
+    const double service_time = 1000000.0 / sim->config->bandwidth;
+    const double start = sim->link_free_at > sim->now ? sim->link_free_at : sim->now;
+    const double queued = (start - sim->now) / service_time;
+
+    if (queued >= sim->config->buffer) {
+        ++sim->stats.buffer_drops;
+        return;
+    }
+
+    sim->link_free_at = start + service_time;
+
+    const uint64_t queue_delay = (uint64_t)((start - sim->now) / 1000.0);
+    ++sim->stats.queue_delay_counts[queue_delay < SIM_DELAY_BUCKETS ? queue_delay : SIM_DELAY_BUCKETS];
+    sim->stats.queue_delay_sum += queue_delay;
+    ++sim->stats.queue_delays;
+
+    if (random_unit(sim) < sim->config->loss) {
+        ++sim->stats.random_drops;
+        return;
+    }
+
+    Sim_Data_Packet *packet = (Sim_Data_Packet *)sim_queue_push(&sim->data_packets);
+
+    if (packet != nullptr) {
+        packet->arrival = (uint64_t)sim->link_free_at + sim->config->rtt * 1000 / 2;
+        packet->number = number;
+    }
+}
+
+/* Send a packet of the send array, as send_data_packet_helper() does. */
+static void sender_transmit(Sim *sim, uint32_t number)
+{
+    sim->sender.sent_time[number % CRYPTO_PACKET_BUFFER_SIZE] = now_ms(sim);
+    ++sim->stats.packets_sent;
+    link_send_data(sim, number);
+}
+
+/* Same as pacing_rate(). */
+static double sender_pacing_rate(const Sim_Sender *sender)
+{
+    const double rate = sender->packet_send_rate_requested * CRYPTO_PACING_GAIN;
+    return rate > CRYPTO_PACING_MIN_RATE ? rate : CRYPTO_PACING_MIN_RATE;
+}
+
+/* Same as limit_pacing_credit(). */
+static void sender_limit_pacing_credit(Sim_Sender *sender, uint64_t temp_time)
+{
+    const double interval = 1000.0 / sender_pacing_rate(sender);
+    const double earliest = temp_time - (interval > CRYPTO_PACING_MAX_CREDIT ? interval : CRYPTO_PACING_MAX_CREDIT);
+
+    if (sender->next_send_time < earliest) {
+        sender->next_send_time = earliest;
+    }
+}
+
+/* Same as paced_packets(). */
+static uint32_t sender_paced_packets(Sim *sim)
+{
+    Sim_Sender *sender = &sim->sender;
+    const uint64_t temp_time = now_ms(sim);
+
+    if (!sim->config->send_pacing) {
+        return UINT32_MAX;
+    }
+
+    sender_limit_pacing_credit(sender, temp_time);
+
+    if (sender->next_send_time > temp_time) {
+        return 0;
+    }
+
+    return (uint32_t)((temp_time - sender->next_send_time) * sender_pacing_rate(sender) / 1000.0) + 1;
+}
+
+/* Same as pace_sent_packets(). */
+static void sender_pace_sent_packets(Sim *sim, uint32_t num_sent, bool idle)
+{
+    Sim_Sender *sender = &sim->sender;
+    const uint64_t temp_time = now_ms(sim);
+
+    if (!sim->config->send_pacing) {
+        return;
+    }
+
+    if (idle && sender->next_send_time < temp_time) {
+        sender->next_send_time = temp_time;
+    }
+
+    sender_limit_pacing_credit(sender, temp_time);
+    sender->next_send_time += num_sent * 1000.0 / sender_pacing_rate(sender);
+}
+
+/* Same as send_requested_packets() and send_new_packets(): send up to max_num
+ * unsent packets from first on and stop at end.
+ */
+static uint32_t sender_send_unsent(Sim *sim, uint32_t first, uint32_t end, uint32_t max_num, bool resend)
+{
+    Sim_Sender *sender = &sim->sender;
+    uint32_t num_sent = 0;
+
+    for (uint32_t i = first; i != end && num_sent < max_num; ++i) {
+        const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+
+        if (!sender->unacked[num] || sender->sent_time[num] != 0) {
+            continue;
+        }
+
+        sender_transmit(sim, i);
+        ++num_sent;
+
+        if (resend) {
+            ++sim->stats.packets_resent;
+        }
+    }
+
+    return num_sent;
+}
+
+/* Same as send_requested_packets(). */
+static int sender_send_requested(Sim *sim, uint32_t max_num)
+{
+    Sim_Sender *sender = &sim->sender;
+
+    if (max_num == 0) {
+        return -1;
+    }
+
+    const uint32_t end = sender->has_new_packets ? sender->new_packets_start : sender->buffer_end;
+    return sender_send_unsent(sim, sender->buffer_start, end, max_num, true);
+}
+
+/* Same as send_new_packets(). */
+static void sender_send_new(Sim *sim)
+{
+    Sim_Sender *sender = &sim->sender;
+
+    if (!sender->has_new_packets) {
+        return;
+    }
+
+    const uint32_t max_num = sender_paced_packets(sim);
+
+    if (max_num == 0) {
+        return;
+    }
+
+    const uint32_t num_sent = sender_send_unsent(sim, sender->new_packets_start, sender->buffer_end, max_num, false);
+    sender->has_new_packets = false;
+    sender_pace_sent_packets(sim, num_sent, num_sent < max_num);
+
+    if (num_sent == max_num) {
+        for (uint32_t i = sender->new_packets_start; i != sender->buffer_end; ++i) {
+            const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+
+            if (sender->unacked[num] && sender->sent_time[num] == 0) {
+                sender->has_new_packets = true;
+                sender->new_packets_start = i;
+                break;
+            }
+        }
+    }
+}
+
+/* Same as the sending part of send_crypto_packets(). */
+static void sender_run(Sim *sim)
+{
+    Sim_Sender *sender = &sim->sender;
+    const uint64_t temp_time = now_ms(sim);
+
+    if ((PACKET_COUNTER_AVERAGE_INTERVAL + sender->packet_counter_set) < temp_time) {
+        Congestion_Sample sample;
+        sample.time = temp_time;
+        sample.interval = temp_time - sender->packet_counter_set;
+        sample.packets_sent = sender->packets_sent;
+        sample.packets_resent = sender->packets_resent;
+        sample.packets_delivered = sender->packets_delivered;
+        sample.send_queue = sender->buffer_end - sender->buffer_start;
+        sample.min_rtt = sender->rtt_time;
+        sample.rtt = sender->last_rtt_time;
+        sample.last_congestion_event = sender->last_congestion_event;
+        sample.hold_rate = false;
+
+        sender->packet_counter_set = temp_time;
+        sender->packets_sent = 0;
+        sender->packets_resent = 0;
+        sender->packets_delivered = 0;
+        sender->last_rtt_time = 0;
+
+        congestion_control_update(&sender->congestion, &sample, &sender->packet_send_rate,
+                                  &sender->packet_send_rate_requested);
+    }
+
+    if (sender->last_packets_left_set == 0 || sender->last_packets_left_requested_set == 0) {
+        sender->last_packets_left_requested_set = temp_time;
+        sender->last_packets_left_set = temp_time;
+        sender->packets_left_requested = CRYPTO_MIN_QUEUE_LENGTH;
+        sender->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
+    } else {
+        if (((uint64_t)((1000.0 / sender->packet_send_rate) + 0.5) + sender->last_packets_left_set) <= temp_time) {
+            double n_packets = sender->packet_send_rate * (((double)(temp_time - sender->last_packets_left_set)) / 1000.0);
+            n_packets += sender->last_packets_left_rem;
+
+            const uint32_t num_packets = n_packets;
+            const double rem = n_packets - (double)num_packets;
+
+            if (sender->packets_left > num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH) {
+                sender->packets_left = num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH;
+            } else {
+                sender->packets_left += num_packets;
+            }
+
+            sender->last_packets_left_set = temp_time;
+            sender->last_packets_left_rem = rem;
+        }
+
+        if (((uint64_t)((1000.0 / sender->packet_send_rate_requested) + 0.5) + sender->last_packets_left_requested_set) <=
+                temp_time) {
+            double n_packets = sender->packet_send_rate_requested * (((double)(temp_time -
+                               sender->last_packets_left_requested_set)) / 1000.0);
+            n_packets += sender->last_packets_left_requested_rem;
+
+            const uint32_t num_packets = n_packets;
+            const double rem = n_packets - (double)num_packets;
+            sender->packets_left_requested = num_packets;
+
+            sender->last_packets_left_requested_set = temp_time;
+            sender->last_packets_left_requested_rem = rem;
+        }
+
+        if (sender->packets_left > sender->packets_left_requested) {
+            sender->packets_left_requested = sender->packets_left;
+        }
+    }
+
+    const uint32_t paced = sender_paced_packets(sim);
+    const int ret = sender_send_requested(sim, sender->packets_left_requested < paced
+                                          ? sender->packets_left_requested : paced);
+    sender->pacing_held_back = paced < sender->packets_left_requested && (ret == -1 || (uint32_t)ret == paced);
+
+    if (ret != -1) {
+        sender_pace_sent_packets(sim, ret, false);
+        sender->packets_left_requested -= ret;
+        sender->packets_resent += ret;
+
+        if ((unsigned int)ret < sender->packets_left) {
+            sender->packets_left -= ret;
+        } else {
+            sender->last_congestion_event = temp_time;
+            sender->packets_left = 0;
+        }
+    }
+
+    /* The file transfer queues new packets with write_cryptpacket(). */
+    while (sender->packets_left != 0
+            && CRYPTO_PACKET_BUFFER_SIZE - (sender->buffer_end - sender->buffer_start) > MIN_SLOTS_FREE) {
+        const uint32_t number = sender->buffer_end;
+        sender->unacked[number % CRYPTO_PACKET_BUFFER_SIZE] = true;
+        sender->resent[number % CRYPTO_PACKET_BUFFER_SIZE] = false;
+        sender->first_sent_time[number % CRYPTO_PACKET_BUFFER_SIZE] = sim->now;
+        sender->sent_time[number % CRYPTO_PACKET_BUFFER_SIZE] = 0;
+        ++sender->buffer_end;
+
+        if (!sender->has_new_packets && sender_paced_packets(sim) != 0) {
+            sender_transmit(sim, number);
+            sender_pace_sent_packets(sim, 1, true);
+        } else if (!sender->has_new_packets) {
+            sender->has_new_packets = true;
+            sender->new_packets_start = number;
+        }
+
+        --sender->packets_left;
+        --sender->packets_left_requested;
+        ++sender->packets_sent;
+    }
+
+    /* Same as do_net_crypto_send(). */
+    sender_send_new(sim);
+
+    /* Same as the sleep time net_crypto asks for. */
+    uint64_t interval = PACKET_COUNTER_AVERAGE_INTERVAL;
+
+    if (sender->packet_send_rate > CRYPTO_PACKET_MIN_RATE * 1.5) {
+        const uint64_t rate_interval = (uint64_t)(1000.0 / sender->packet_send_rate) + 1;
+
+        if (rate_interval < interval) {
+            interval = rate_interval;
+        }
+    }
+
+    sender->next_run = sim->now + interval * 1000;
+
+    if (sender->has_new_packets || sender->pacing_held_back) {
+        const uint64_t pacing_next_run = sender->next_send_time < temp_time ? temp_time + 1
+                                         : (uint64_t)sender->next_send_time + 1;
+
+        if (pacing_next_run < temp_time + interval) {
+            sender->next_run = pacing_next_run * 1000;
+        }
+    }
+}
+
+/* Same as handle_request_packet(). */
+static void sender_handle_request_packet(Sim *sim, const uint8_t *data, uint16_t length, uint64_t *latest_send_time)
+{
+    Sim_Sender *sender = &sim->sender;
+
+    if (length <= 1) {
+        return;
+    }
+
+    ++data;
+    --length;
+
+    uint32_t n = 1;
+    const uint64_t temp_time = now_ms(sim);
+    uint64_t l_sent_time = 0;
+
+    for (uint32_t i = sender->buffer_start; i != sender->buffer_end; ++i) {
+        if (length == 0) {
+            break;
+        }
+
+        const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+
+        if (n == data[0]) {
+            if (sender->unacked[num] && sender->sent_time[num] + sender->rtt_time < temp_time) {
+                sender->sent_time[num] = 0;
+                sender->resent[num] = true;
+            }
+
+            ++data;
+            --length;
+            n = 0;
+        } else if (sender->unacked[num]) {
+            if (!sender->resent[num] && l_sent_time < sender->sent_time[num]) {
+                l_sent_time = sender->sent_time[num];
+            }
+
+            sender->unacked[num] = false;
+            ++sender->packets_delivered;
+        }
+
+        if (n == 255) {
+            n = 1;
+
+            if (data[0] != 0) {
+                return;
+            }
+
+            ++data;
+            --length;
+        } else {
+            ++n;
+        }
+    }
+
+    if (*latest_send_time < l_sent_time) {
+        *latest_send_time = l_sent_time;
+    }
+}
+
+/* Same as handle_request_ranges_packet(). */
+static void sender_handle_request_ranges_packet(Sim *sim, const uint8_t *data, uint16_t length,
+        uint64_t *latest_send_time)
+{
+    Sim_Sender *sender = &sim->sender;
+    uint16_t offset = 1;
+    const uint64_t temp_time = now_ms(sim);
+    uint64_t l_sent_time = 0;
+    uint32_t i = sender->buffer_start;
+
+    while (offset < length && i != sender->buffer_end) {
+        uint32_t received;
+        uint32_t missing;
+
+        if (!request_range_read(data, length, &offset, &received, &missing)) {
+            return;
+        }
+
+        if (received > sender->buffer_end - i) {
+            received = sender->buffer_end - i;
+        }
+
+        for (const uint32_t end = i + received; i != end; ++i) {
+            const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+
+            if (sender->unacked[num]) {
+                if (!sender->resent[num] && l_sent_time < sender->sent_time[num]) {
+                    l_sent_time = sender->sent_time[num];
+                }
+
+                sender->unacked[num] = false;
+                ++sender->packets_delivered;
+            }
+        }
+
+        if (missing > sender->buffer_end - i) {
+            missing = sender->buffer_end - i;
+        }
+
+        for (const uint32_t end = i + missing; i != end; ++i) {
+            const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+
+            if (sender->unacked[num] && sender->sent_time[num] + sender->rtt_time < temp_time) {
+                sender->sent_time[num] = 0;
+                sender->resent[num] = true;
+            }
+        }
+    }
+
+    if (*latest_send_time < l_sent_time) {
+        *latest_send_time = l_sent_time;
+    }
+}
+
+/* Same as the request handling of handle_data_packet_core(). */
+static void sender_handle_request(Sim *sim, const Sim_Request *request)
+{
+    Sim_Sender *sender = &sim->sender;
+    uint64_t rtt_calc_time = 0;
+    const bool precise_rtt = sender->congestion.type == CONGESTION_CONTROL_DELAY;
+
+    if (request->buffer_start != sender->buffer_start) {
+        const uint32_t num_spots = sender->buffer_end - sender->buffer_start;
+
+        if (sender->buffer_end - request->buffer_start > num_spots
+                || request->buffer_start - sender->buffer_start > num_spots) {
+            return;
+        }
+
+        const uint32_t first = sender->buffer_start;
+
+        for (; sender->buffer_start != request->buffer_start; ++sender->buffer_start) {
+            const uint32_t num = sender->buffer_start % CRYPTO_PACKET_BUFFER_SIZE;
+
+            if (sender->unacked[num]) {
+                if (precise_rtt) {
+                    if (!sender->resent[num] && rtt_calc_time < sender->sent_time[num]) {
+                        rtt_calc_time = sender->sent_time[num];
+                    }
+                } else if (sender->buffer_start == first) {
+                    rtt_calc_time = sender->sent_time[num];
+                }
+
+                sender->unacked[num] = false;
+                ++sender->packets_delivered;
+            }
+        }
+    }
+
+    if (request->data[0] == PACKET_ID_REQUEST_RANGES) {
+        sender_handle_request_ranges_packet(sim, request->data, request->length, &rtt_calc_time);
+    } else {
+        sender_handle_request_packet(sim, request->data, request->length, &rtt_calc_time);
+    }
+
+    if (!precise_rtt) {
+        rtt_calc_time = 0;
+    }
+
+    if (rtt_calc_time != 0) {
+        const uint64_t rtt_time = now_ms(sim) - rtt_calc_time;
+
+        sender->last_rtt_time = rtt_time;
+
+        if (rtt_time < sender->rtt_time) {
+            sender->rtt_time = rtt_time;
+        }
+    }
+}
+
+/* Same as generate_request_packet(). */
+static uint16_t receiver_generate_request(const Sim_Receiver *receiver, uint8_t *data, uint16_t length)
+{
+    data[0] = PACKET_ID_REQUEST;
+
+    uint16_t cur_len = 1;
+    uint32_t n = 1;
+
+    for (uint32_t i = receiver->buffer_start; i != receiver->buffer_end; ++i) {
+        if (!receiver->received[i % CRYPTO_PACKET_BUFFER_SIZE]) {
+            data[cur_len] = n;
+            n = 0;
+            ++cur_len;
+
+            if (length <= cur_len) {
+                return cur_len;
+            }
+        } else if (n == 255) {
+            data[cur_len] = 0;
+            n = 0;
+            ++cur_len;
+
+            if (length <= cur_len) {
+                return cur_len;
+            }
+        }
+
+        ++n;
+    }
+
+    return cur_len;
+}
+
+/* Same as generate_request_ranges_packet(). */
+static uint16_t receiver_generate_request_ranges(const Sim_Receiver *receiver, uint8_t *data, uint16_t length)
+{
+    data[0] = PACKET_ID_REQUEST_RANGES;
+
+    uint16_t cur_len = 1;
+    uint32_t received = 0;
+    uint32_t missing = 0;
+
+    for (uint32_t i = receiver->buffer_start; i != receiver->buffer_end; ++i) {
+        if (!receiver->received[i % CRYPTO_PACKET_BUFFER_SIZE]) {
+            ++missing;
+            continue;
+        }
+
+        if (missing != 0) {
+            const uint16_t new_len = request_range_write(data, cur_len, length, received, missing);
+
+            if (new_len == 0) {
+                return cur_len;
+            }
+
+            cur_len = new_len;
+            received = 0;
+            missing = 0;
+        }
+
+        ++received;
+    }
+
+    if (received != 0 || missing != 0) {
+        const uint16_t new_len = request_range_write(data, cur_len, length, received, missing);
+
+        if (new_len != 0) {
+            cur_len = new_len;
+        }
+    }
+
+    return cur_len;
+}
+
+static void receiver_send_request(Sim *sim)
+{
+    const Sim_Receiver *receiver = &sim->receiver;
+
+    if (random_unit(sim) < sim->config->loss) {
+        return;
+    }
+
+    Sim_Request *request = (Sim_Request *)sim_queue_push(&sim->requests);
+
+    if (request == nullptr) {
+        return;
+    }
+
+    request->arrival = sim->now + sim->config->rtt * 1000 / 2;
+    request->buffer_start = receiver->buffer_start;
+
+    const clock_t start = clock();
+
+    if (sim->config->request_ranges) {
+        request->length = receiver_generate_request_ranges(receiver, request->data, sizeof(request->data));
+    } else {
+        request->length = receiver_generate_request(receiver, request->data, sizeof(request->data));
+    }
+
+    sim->stats.request_cpu_time += clock() - start;
+    ++sim->stats.requests;
+    sim->stats.request_bytes += request->length;
+}
+
+/* Same as add_data_to_buffer() and the reading of the received packets in
+ * order.
+ */
+static void receiver_handle_data(Sim *sim, uint32_t number)
+{
+    Sim_Receiver *receiver = &sim->receiver;
+
+    if (number - receiver->buffer_start >= CRYPTO_PACKET_BUFFER_SIZE) {
+        return;
+    }
+
+    const uint32_t num = number % CRYPTO_PACKET_BUFFER_SIZE;
+
+    if (receiver->received[num]) {
+        return;
+    }
+
+    receiver->received[num] = true;
+
+    if (number - receiver->buffer_start >= receiver->buffer_end - receiver->buffer_start) {
+        receiver->buffer_end = number + 1;
+    }
+
+    while (receiver->buffer_start != receiver->buffer_end
+            && receiver->received[receiver->buffer_start % CRYPTO_PACKET_BUFFER_SIZE]) {
+        const uint32_t delivered = receiver->buffer_start % CRYPTO_PACKET_BUFFER_SIZE;
+        receiver->received[delivered] = false;
+        ++receiver->buffer_start;
+        ++sim->stats.packets_delivered;
+
+        if (sim->sender.resent[delivered]) {
+            sim->stats.recovery_time_sum += sim->now - sim->sender.first_sent_time[delivered];
+            ++sim->stats.packets_recovered;
+        }
+    }
+
+    ++receiver->packet_counter;
+}
+
+/* Same as the request packet part of send_crypto_packets(). */
+static void receiver_run(Sim *sim)
+{
+    Sim_Receiver *receiver = &sim->receiver;
+    const uint64_t temp_time = now_ms(sim);
+
+    if ((CRYPTO_SEND_PACKET_INTERVAL + receiver->last_request_packet_sent) < temp_time) {
+        receiver_send_request(sim);
+        receiver->last_request_packet_sent = temp_time;
+    }
+
+    if (receiver->packet_recv_rate > CRYPTO_PACKET_MIN_RATE) {
+        double request_packet_interval = (REQUEST_PACKETS_COMPARE_CONSTANT / (((receiver->buffer_end -
+                                          receiver->buffer_start) + 1.0) / (receiver->packet_recv_rate + 1.0)));
+
+        const double request_packet_interval2 = ((CRYPTO_PACKET_MIN_RATE / receiver->packet_recv_rate) *
+                                                (double)CRYPTO_SEND_PACKET_INTERVAL) + (double)PACKET_COUNTER_AVERAGE_INTERVAL;
+
+        if (request_packet_interval2 < request_packet_interval) {
+            request_packet_interval = request_packet_interval2;
+        }
+
+        if (request_packet_interval < PACKET_COUNTER_AVERAGE_INTERVAL) {
+            request_packet_interval = PACKET_COUNTER_AVERAGE_INTERVAL;
+        }
+
+        if (request_packet_interval > CRYPTO_SEND_PACKET_INTERVAL) {
+            request_packet_interval = CRYPTO_SEND_PACKET_INTERVAL;
+        }
+
+        if (temp_time - receiver->last_request_packet_sent > (uint64_t)request_packet_interval) {
+            receiver_send_request(sim);
+            receiver->last_request_packet_sent = temp_time;
+        }
+    }
+
+    if ((PACKET_COUNTER_AVERAGE_INTERVAL + receiver->packet_counter_set) < temp_time) {
+        const double dt = temp_time - receiver->packet_counter_set;
+
+        receiver->packet_recv_rate = (double)receiver->packet_counter / (dt / 1000.0);
+        receiver->packet_counter = 0;
+        receiver->packet_counter_set = temp_time;
+    }
+
+    receiver->next_run = sim->now + SIM_RECEIVER_TICK;
+}
+
+static void kill_sim(Sim *sim)
+{
+    free(sim->data_packets.items);
+    free(sim->requests.items);
+    free(sim->sender.sent_time);
+    free(sim->sender.first_sent_time);
+    free(sim->sender.unacked);
+    free(sim->sender.resent);
+    free(sim->receiver.received);
+}
+
+static bool init_sim(Sim *sim, const Sim_Config *config, Congestion_Control_Type type)
+{
+    memset(sim, 0, sizeof(Sim));
+    sim->config = config;
+    sim->now = SIM_START;
+    sim->rng = 0x9e3779b97f4a7c15ULL;
+    sim->link_free_at = 0;
+
+    Sim_Sender *sender = &sim->sender;
+    congestion_control_init(&sender->congestion, type);
+    sender->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
+    sender->packet_send_rate_requested = CRYPTO_PACKET_MIN_RATE;
+    sender->last_packets_left_rem = 0;
+    sender->last_packets_left_requested_rem = 0;
+    sender->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
+    sender->rtt_time = DEFAULT_PING_CONNECTION;
+    sender->next_run = sim->now;
+    sender->sent_time = (uint64_t *)calloc(CRYPTO_PACKET_BUFFER_SIZE, sizeof(uint64_t));
+    sender->first_sent_time = (uint64_t *)calloc(CRYPTO_PACKET_BUFFER_SIZE, sizeof(uint64_t));
+    sender->unacked = (bool *)calloc(CRYPTO_PACKET_BUFFER_SIZE, sizeof(bool));
+    sender->resent = (bool *)calloc(CRYPTO_PACKET_BUFFER_SIZE, sizeof(bool));
+
+    Sim_Receiver *receiver = &sim->receiver;
+    receiver->packet_recv_rate = 0;
+    receiver->next_run = sim->now;
+    receiver->received = (bool *)calloc(CRYPTO_PACKET_BUFFER_SIZE, sizeof(bool));
+
+    if (!sim_queue_init(&sim->data_packets, sizeof(Sim_Data_Packet))
+            || !sim_queue_init(&sim->requests, sizeof(Sim_Request))
+            || sender->sent_time == nullptr || sender->first_sent_time == nullptr || sender->unacked == nullptr || sender->resent == nullptr
+            || receiver->received == nullptr) {
+        kill_sim(sim);
+        return false;
+    }
+
+    return true;
+}
+
+static uint64_t sim_min_u64(uint64_t a, uint64_t b)
+{
+    return a < b ? a : b;
+}
+
+static void run_sim(Sim *sim)
+{
+    const uint64_t end = SIM_START + (uint64_t)sim->config->seconds * 1000000;
+
+    while (sim->now < end) {
+        uint64_t next = sim_min_u64(sim->sender.next_run, sim->receiver.next_run);
+        const Sim_Data_Packet *packet = (const Sim_Data_Packet *)sim_queue_head(&sim->data_packets);
+        const Sim_Request *request = (const Sim_Request *)sim_queue_head(&sim->requests);
+
+        if (packet != nullptr) {
+            next = sim_min_u64(next, packet->arrival);
+        }
+
+        if (request != nullptr) {
+            next = sim_min_u64(next, request->arrival);
+        }
+
+        sim->now = next;
+
+        while ((packet = (const Sim_Data_Packet *)sim_queue_head(&sim->data_packets)) != nullptr
+                && packet->arrival <= sim->now) {
+            receiver_handle_data(sim, packet->number);
+            sim_queue_pop(&sim->data_packets);
+        }
+
+        while ((request = (const Sim_Request *)sim_queue_head(&sim->requests)) != nullptr
+                && request->arrival <= sim->now) {
+            const clock_t start = clock();
+            sender_handle_request(sim, request);
+            sim->stats.request_cpu_time += clock() - start;
+            sim_queue_pop(&sim->requests);
+        }
+
+        if (sim->receiver.next_run <= sim->now) {
+            receiver_run(sim);
+        }
+
+        if (sim->sender.next_run <= sim->now) {
+            sender_run(sim);
+        }
+    }
+}
+
+static uint32_t queue_delay_percentile(const Sim_Stats *stats, double percentile)
+{
+    const uint64_t rank = (uint64_t)(stats->queue_delays * percentile);
+    uint64_t count = 0;
+
+    for (uint32_t i = 0; i < SIM_DELAY_BUCKETS; ++i) {
+        count += stats->queue_delay_counts[i];
+
+        if (count > rank) {
+            return i;
+        }
+    }
+
+    return SIM_DELAY_BUCKETS;
+}
+
+static const char *variant_name(const Sim_Config *config)
+{
+    if (config->send_pacing) {
+        return "paced";
+    }
+
+    return config->request_ranges ? "ranges" : "legacy";
+}
+
+static void print_stats(const Sim_Config *config, Congestion_Control_Type type, const Sim_Stats *stats)
+{
+    const double goodput = (double)stats->packets_delivered / config->seconds;
+    const double sent = stats->packets_sent != 0 ? (double)stats->packets_sent : 1.0;
+
+    const double requests = stats->requests != 0 ? (double)stats->requests : 1.0;
+
+    printf("%-6s %-6s: goodput %8.1f KiB/s (%5.1f%% of the link), queueing delay %6.1f ms average %5u ms p95, "
+           "%5.1f%% resent, %5.1f%% dropped by the buffer\n",
+           congestion_control_name(type), variant_name(config),
+           goodput * MAX_CRYPTO_DATA_SIZE / 1024.0, goodput * 100.0 / config->bandwidth,
+           stats->queue_delays != 0 ? (double)stats->queue_delay_sum / stats->queue_delays : 0.0,
+           queue_delay_percentile(stats, 0.95), stats->packets_resent * 100.0 / sent, stats->buffer_drops * 100.0 / sent);
+    const double delivered_mib = stats->packets_delivered != 0
+                                 ? stats->packets_delivered * (double)MAX_CRYPTO_DATA_SIZE / (1024 * 1024) : 1.0;
+
+    printf("               lost packets arrive after %7.1f ms average, %6.1f bytes per request packet, "
+           "%6.3f ms processor time on request packets per MiB\n",
+           stats->packets_recovered != 0 ? stats->recovery_time_sum / 1000.0 / stats->packets_recovered : 0.0,
+           stats->request_bytes / requests, stats->request_cpu_time * 1000.0 / CLOCKS_PER_SEC / delivered_mib);
+}
+
+int main(int argc, char *argv[])
+{
+    const double bandwidth_kib = argc > 1 ? atof(argv[1]) : 1024;
+    const int rtt = argc > 2 ? atoi(argv[2]) : 100;
+    const double loss = argc > 3 ? atof(argv[3]) : 0;
+    const int buffer_ms = argc > 4 ? atoi(argv[4]) : 500;
+    const int seconds = argc > 5 ? atoi(argv[5]) : 60;
+
+    if (bandwidth_kib <= 0 || rtt < 0 || loss < 0 || loss >= 100 || buffer_ms < 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s [bandwidth in KiB/s] [round trip time in ms] [loss in percent] [buffer in ms] "
+                "[seconds]\n", argv[0]);
+        return 1;
+    }
+
+    Sim_Config config;
+    config.bandwidth = bandwidth_kib * 1024 / MAX_CRYPTO_PACKET_SIZE;
+    config.rtt = rtt;
+    config.loss = loss / 100;
+    config.buffer = (uint32_t)(config.bandwidth * buffer_ms / 1000) + 1;
+    config.seconds = seconds;
+
+    printf("%.0f KiB/s link, %u ms round trip, %.1f%% loss, %d ms (%u packets) buffer, %u s\n", bandwidth_kib,
+           config.rtt, loss, buffer_ms, config.buffer, config.seconds);
+
+    for (uint32_t type = 0; type < NUM_CONGESTION_CONTROL_TYPES; ++type) {
+        for (uint32_t variant = 0; variant < 3; ++variant) {
+            config.request_ranges = variant != 0;
+            config.send_pacing = variant == 2;
+            Sim *sim = (Sim *)malloc(sizeof(Sim));
+
+            if (sim == nullptr || !init_sim(sim, &config, (Congestion_Control_Type)type)) {
+                free(sim);
+                fprintf(stderr, "Failed to set up the simulation\n");
+                return 1;
+            }
+
+            run_sim(sim);
+            print_stats(&config, (Congestion_Control_Type)type, &sim->stats);
+            kill_sim(sim);
+            free(sim);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/* Crypto connection lookup benchmark.
+ *
+ * Creates a Net_Crypto with many connections to made up peers, then looks up
+ * each peer by its real public key the way an incoming handshake does, in
+ * random order. Reports the CPU time of creating a connection, of a lookup,
+ * and of killing a connection. Half of the connections are killed before the
+ * other half, which must still be found in between.
+ *
+ * Lookups go through new_crypto_connection(), which returns the existing
+ * connection for a known key. Creating and killing a connection also include
+ * the TCP_Connections bookkeeping of the connection.
+ *
+ * Usage: crypto_connections_bench [number of connections] [lookup rounds]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/logger.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/net_crypto.h"
+
+#define BENCH_PORT 33445
+
+typedef struct Bench_Peer {
+    uint8_t real_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t dht_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    int crypt_connection_id;
+} Bench_Peer;
+
+static uint64_t thread_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void shuffle(uint32_t *order, uint32_t length)
+{
+    for (uint32_t i = length; i > 1; --i) {
+        const uint32_t j = random_u32() % i;
+        const uint32_t tmp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = tmp;
+    }
+}
+
+static bool run_bench(Net_Crypto *c, Bench_Peer *peers, uint32_t *order, uint32_t num_peers, uint32_t rounds)
+{
+    uint64_t start = thread_nanoseconds();
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        peers[i].crypt_connection_id = new_crypto_connection(c, peers[i].real_public_key, peers[i].dht_public_key);
+
+        if (peers[i].crypt_connection_id == -1) {
+            printf("failed to create connection %u\n", i);
+            return false;
+        }
+    }
+
+    const uint64_t create_time = thread_nanoseconds() - start;
+    uint64_t lookup_time = 0;
+
+    for (uint32_t round = 0; round < rounds; ++round) {
+        shuffle(order, num_peers);
+        start = thread_nanoseconds();
+
+        for (uint32_t i = 0; i < num_peers; ++i) {
+            const Bench_Peer *peer = &peers[order[i]];
+
+            if (new_crypto_connection(c, peer->real_public_key, peer->dht_public_key) != peer->crypt_connection_id) {
+                printf("lookup of connection %u returned another connection\n", order[i]);
+                return false;
+            }
+        }
+
+        lookup_time += thread_nanoseconds() - start;
+    }
+
+    /* Kill half of the connections, check that the others are still found,
+     * then kill them too.
+     */
+    shuffle(order, num_peers);
+    start = thread_nanoseconds();
+
+    for (uint32_t i = 0; i < num_peers / 2; ++i) {
+        crypto_kill(c, peers[order[i]].crypt_connection_id);
+    }
+
+    uint64_t kill_time = thread_nanoseconds() - start;
+
+    for (uint32_t i = num_peers / 2; i < num_peers; ++i) {
+        const Bench_Peer *peer = &peers[order[i]];
+
+        if (new_crypto_connection(c, peer->real_public_key, peer->dht_public_key) != peer->crypt_connection_id) {
+            printf("connection %u was lost when others were killed\n", order[i]);
+            return false;
+        }
+    }
+
+    start = thread_nanoseconds();
+
+    for (uint32_t i = num_peers / 2; i < num_peers; ++i) {
+        crypto_kill(c, peers[order[i]].crypt_connection_id);
+    }
+
+    kill_time += thread_nanoseconds() - start;
+
+    printf("%u connections: %8.2f us per new connection, %8.2f ns per lookup, %8.2f us per kill\n", num_peers,
+           create_time / 1000.0 / num_peers, (double)lookup_time / ((uint64_t)num_peers * rounds),
+           kill_time / 1000.0 / num_peers);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_peers = argc > 1 ? (uint32_t)atoi(argv[1]) : 10000;
+    const uint32_t rounds = argc > 2 ? (uint32_t)atoi(argv[2]) : 10;
+
+    if (num_peers == 0 || rounds == 0) {
+        fprintf(stderr, "Usage: %s [number of connections] [lookup rounds]\n", argv[0]);
+        return 1;
+    }
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new();
+    Networking_Core *net = new_networking_ex(log, ip, BENCH_PORT, BENCH_PORT + 100, false, nullptr);
+
+    if (log == nullptr || mono_time == nullptr || net == nullptr) {
+        fprintf(stderr, "Failed to create the socket\n");
+        return 1;
+    }
+
+    TCP_Proxy_Info proxy_info = {{{{0}}}};
+    DHT *dht = new_dht(log, mono_time, net, true);
+    Net_Crypto *c = dht != nullptr ? new_net_crypto(log, mono_time, dht, &proxy_info) : nullptr;
+    Bench_Peer *peers = (Bench_Peer *)calloc(num_peers, sizeof(Bench_Peer));
+    uint32_t *order = (uint32_t *)calloc(num_peers, sizeof(uint32_t));
+
+    if (c == nullptr || peers == nullptr || order == nullptr) {
+        fprintf(stderr, "Failed to create the connections\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        random_bytes(peers[i].real_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        random_bytes(peers[i].dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        order[i] = i;
+    }
+
+    const bool ok = run_bench(c, peers, order, num_peers, rounds);
+
+    free(order);
+    free(peers);
+    kill_net_crypto(c);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return ok ? 0 : 1;
+}
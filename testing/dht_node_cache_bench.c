@@ -0,0 +1,365 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/* DHT time to connected benchmark.
+ *
+ * Runs a network of DHT nodes on the loopback interface with a simulated
+ * clock, so that minutes of network time pass in seconds. A few long lived
+ * nodes start the network and many short lived ones join later. A client
+ * takes part in all of it, then saves its DHT state and stops. Then most of
+ * the short lived nodes leave, like they do on the real network, and the
+ * client restarts several times: from its saved state alone, and from its
+ * saved state together with its node cache. Reports how long each restart
+ * took until dht_isconnected(), and until the client knew enough live nodes
+ * to answer a getnodes request for its own key with a full list.
+ *
+ * Usage: dht_node_cache_bench [long lived nodes] [short lived nodes] [percentage that leaves] [restarts]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/util.h"
+
+#define BENCH_PORT 33445
+#define BENCH_CLIENT_PORT (BENCH_PORT + 2000)
+/* Simulated milliseconds between two iterations, as in tox_iterate. */
+#define BENCH_INTERVAL 50
+/* Simulated seconds the long lived nodes run alone, then with the others. */
+#define BENCH_OLD_TIME (10 * 60)
+#define BENCH_YOUNG_TIME (2 * 60)
+/* Restarts that take longer than this many simulated seconds give up. */
+#define BENCH_MAX_CONNECT_TIME 60
+
+typedef struct Bench_Node {
+    Networking_Core *net;
+    DHT *dht;
+} Bench_Node;
+
+typedef struct Bench_Times {
+    uint64_t connected;
+    uint64_t well_connected;
+} Bench_Times;
+
+typedef struct Bench_Network {
+    Mono_Time *mono_time;
+    uint64_t time;
+
+    Bench_Node *nodes;
+    uint32_t num_nodes;
+} Bench_Network;
+
+static uint64_t get_time(Mono_Time *mono_time, void *user_data)
+{
+    return *(uint64_t *)user_data;
+}
+
+static IP loopback(void)
+{
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+    return ip;
+}
+
+static bool start_node(Bench_Network *network, Bench_Node *node, uint16_t port)
+{
+    node->net = new_networking(nullptr, loopback(), port);
+
+    if (node->net == nullptr) {
+        return false;
+    }
+
+    node->dht = new_dht(nullptr, network->mono_time, node->net, true);
+    return node->dht != nullptr;
+}
+
+static void stop_node(Bench_Node *node)
+{
+    kill_dht(node->dht);
+    kill_networking(node->net);
+    node->dht = nullptr;
+    node->net = nullptr;
+}
+
+static void bootstrap_node(Bench_Node *node, const Bench_Node *from)
+{
+    IP_Port ip_port;
+    ip_port.ip = loopback();
+    ip_port.port = net_port(from->net);
+    dht_bootstrap(node->dht, ip_port, dht_get_self_public_key(from->dht));
+}
+
+static void run_node(Bench_Node *node)
+{
+    if (node != nullptr && node->dht != nullptr) {
+        networking_poll(node->net, nullptr);
+        do_dht(node->dht);
+    }
+}
+
+/* Run the network and the client for one iteration. */
+static void iterate(Bench_Network *network, Bench_Node *client)
+{
+    for (uint32_t i = 0; i < network->num_nodes; ++i) {
+        run_node(&network->nodes[i]);
+    }
+
+    run_node(client);
+
+    network->time += BENCH_INTERVAL;
+    mono_time_update(network->mono_time);
+}
+
+static void run_for(Bench_Network *network, Bench_Node *client, uint64_t seconds)
+{
+    for (uint64_t i = 0; i < seconds * 1000 / BENCH_INTERVAL; ++i) {
+        iterate(network, client);
+    }
+}
+
+static bool write_file(const char *path, const uint8_t *data, size_t length)
+{
+    FILE *file = fopen(path, "wb");
+
+    if (file == nullptr) {
+        return false;
+    }
+
+    const bool ok = fwrite(data, 1, length, file) == length;
+    return fclose(file) == 0 && ok;
+}
+
+static uint8_t *read_file(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (file == nullptr) {
+        return nullptr;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = (uint8_t *)malloc(size > 0 ? size : 1);
+
+    if (data == nullptr || fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        fclose(file);
+        return nullptr;
+    }
+
+    fclose(file);
+    *length = size;
+    return data;
+}
+
+/* Restart the client from its saved state, and from a fresh copy of its node
+ * cache if cache_path is not NULL. The client gets a port the network doesn't
+ * know yet, so that it can't be found before it finds the network. Times are
+ * in simulated milliseconds, and UINT64_MAX for what didn't happen within
+ * BENCH_MAX_CONNECT_TIME.
+ */
+static Bench_Times restart(Bench_Network *network, uint16_t port, const uint8_t *savedata, uint32_t savedata_length,
+                           const char *cache_path)
+{
+    Bench_Times times = {UINT64_MAX, UINT64_MAX};
+    Bench_Node client;
+
+    if (!start_node(network, &client, port)) {
+        return times;
+    }
+
+    dht_load(client.dht, savedata, savedata_length);
+
+    if (cache_path != nullptr && !dht_open_node_cache(client.dht, cache_path)) {
+        stop_node(&client);
+        return times;
+    }
+
+    const uint64_t start = network->time;
+    Node_format nodes[MAX_SENT_NODES];
+
+    while (network->time - start < BENCH_MAX_CONNECT_TIME * 1000 && times.well_connected == UINT64_MAX) {
+        iterate(network, &client);
+
+        if (times.connected == UINT64_MAX && dht_isconnected(client.dht)) {
+            times.connected = network->time - start;
+        }
+
+        if (get_close_nodes(client.dht, dht_get_self_public_key(client.dht), nodes, net_family_unspec, true,
+                            false) == MAX_SENT_NODES) {
+            times.well_connected = network->time - start;
+        }
+    }
+
+    stop_node(&client);
+    return times;
+}
+
+static void print_times(const char *name, const uint64_t *times, uint32_t num)
+{
+    uint64_t total = 0;
+    uint64_t max = 0;
+    uint32_t failed = 0;
+
+    for (uint32_t i = 0; i < num; ++i) {
+        if (times[i] == UINT64_MAX) {
+            ++failed;
+            continue;
+        }
+
+        total += times[i];
+        max = max_u64(max, times[i]);
+    }
+
+    printf("%-40s mean %6.0f ms, max %6llu ms, %u of %u timed out\n", name,
+           num > failed ? (double)total / (num - failed) : 0.0, (unsigned long long)max, failed, num);
+}
+
+int main(int argc, char *argv[])
+{
+    const int num_old = argc > 1 ? atoi(argv[1]) : 8;
+    const int num_young = argc > 2 ? atoi(argv[2]) : 900;
+    const int churn = argc > 3 ? atoi(argv[3]) : 95;
+    const int num_restarts = argc > 4 ? atoi(argv[4]) : 20;
+
+    if (num_old < 1 || num_young < 0 || num_old + num_young > 1000 || churn < 0 || churn > 100
+            || num_restarts < 1 || num_restarts > 1000) {
+        printf("need at least 1 long lived node, at most 1000 nodes, a percentage and 1 to 1000 restarts\n");
+        return 1;
+    }
+
+    char cache_path[] = "/tmp/dht_node_cache_bench.XXXXXX";
+    const int fd = mkstemp(cache_path);
+
+    if (fd == -1) {
+        printf("failed to create the node cache file\n");
+        return 1;
+    }
+
+    close(fd);
+
+    Bench_Network network;
+    memset(&network, 0, sizeof(network));
+    network.time = 1000;
+    network.mono_time = mono_time_new();
+    mono_time_set_current_time_callback(network.mono_time, get_time, &network.time);
+    mono_time_update(network.mono_time);
+    network.nodes = (Bench_Node *)calloc(num_old + num_young, sizeof(Bench_Node));
+
+    for (int i = 0; i < num_old; ++i) {
+        if (!start_node(&network, &network.nodes[i], BENCH_PORT + i)) {
+            printf("failed to start node %d\n", i);
+            return 1;
+        }
+
+        if (i > 0) {
+            bootstrap_node(&network.nodes[i], &network.nodes[0]);
+        }
+    }
+
+    network.num_nodes = num_old;
+
+    Bench_Node client;
+
+    if (!start_node(&network, &client, BENCH_CLIENT_PORT) || !dht_open_node_cache(client.dht, cache_path)) {
+        printf("failed to start the client\n");
+        return 1;
+    }
+
+    bootstrap_node(&client, &network.nodes[0]);
+    run_for(&network, &client, BENCH_OLD_TIME);
+
+    for (int i = num_old; i < num_old + num_young; ++i) {
+        if (!start_node(&network, &network.nodes[i], BENCH_PORT + i)) {
+            printf("failed to start node %d\n", i);
+            return 1;
+        }
+
+        bootstrap_node(&network.nodes[i], &network.nodes[rand() % num_old]);
+    }
+
+    network.num_nodes = num_old + num_young;
+    run_for(&network, &client, BENCH_YOUNG_TIME);
+
+    const uint32_t savedata_length = dht_size(client.dht);
+    uint8_t *savedata = (uint8_t *)malloc(savedata_length);
+    dht_save(client.dht, savedata);
+    stop_node(&client);
+
+    size_t cache_length;
+    uint8_t *cache = read_file(cache_path, &cache_length);
+
+    if (savedata == nullptr || cache == nullptr) {
+        printf("failed to save the client\n");
+        return 1;
+    }
+
+    uint32_t left = 0;
+
+    for (int i = num_old; i < num_old + num_young; ++i) {
+        if (rand() % 100 < churn) {
+            stop_node(&network.nodes[i]);
+            ++left;
+        }
+    }
+
+    printf("%d long lived and %d short lived nodes, %u of which left, %u bytes of saved state\n",
+           num_old, num_young, left, savedata_length);
+
+    /* Connected and well connected times, without and with the cache. */
+    uint64_t *times[4];
+
+    for (int i = 0; i < 4; ++i) {
+        times[i] = (uint64_t *)calloc(num_restarts, sizeof(uint64_t));
+    }
+
+    for (int i = 0; i < num_restarts; ++i) {
+        const uint16_t port = BENCH_CLIENT_PORT + 1 + i * 2;
+        const Bench_Times saved = restart(&network, port, savedata, savedata_length, nullptr);
+
+        if (!write_file(cache_path, cache, cache_length)) {
+            printf("failed to restore the node cache\n");
+            return 1;
+        }
+
+        const Bench_Times cached = restart(&network, port + 1, savedata, savedata_length, cache_path);
+
+        times[0][i] = saved.connected;
+        times[1][i] = cached.connected;
+        times[2][i] = saved.well_connected;
+        times[3][i] = cached.well_connected;
+    }
+
+    print_times("connected, saved state", times[0], num_restarts);
+    print_times("connected, saved state and cache", times[1], num_restarts);
+    print_times("well connected, saved state", times[2], num_restarts);
+    print_times("well connected, saved state and cache", times[3], num_restarts);
+
+    for (uint32_t i = 0; i < network.num_nodes; ++i) {
+        if (network.nodes[i].dht != nullptr) {
+            stop_node(&network.nodes[i]);
+        }
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        free(times[i]);
+    }
+
+    free(cache);
+    free(savedata);
+    free(network.nodes);
+    mono_time_free(network.mono_time);
+    remove(cache_path);
+    return 0;
+}
@@ -0,0 +1,284 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/* DHT request throughput benchmark.
+ *
+ * Runs a DHT node on the loopback interface with a close list of made up
+ * nodes, first answering everything on its own thread, then with 1, 2, 4, ...
+ * worker threads sharing its port through SO_REUSEPORT. A client thread sends
+ * getnodes requests from several sockets, keeping a window of requests in
+ * flight on each, and counts the responses. Reports answered requests per
+ * second of wall clock time. The client needs a core of its own, so expect
+ * the figures to grow up to one worker less than the number of cores.
+ *
+ * Usage: dht_workers_bench [maximum number of workers] [seconds per run]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/dht_workers.h"
+#include "../toxcore/mono_time.h"
+
+#define BENCH_PORT 33445
+#define BENCH_CLIENTS 16
+#define BENCH_WINDOW 64
+#define BENCH_CLOSE_NODES 256
+/* Milliseconds without a response after which a client assumes its requests were dropped. */
+#define BENCH_RESEND_TIMEOUT 100
+
+typedef struct Bench_Client {
+    Networking_Core *net;
+    uint8_t packet[1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t)
+                   + CRYPTO_MAC_SIZE];
+    int length;
+    uint64_t sent;
+    uint64_t received;
+    uint64_t last_received;
+    uint64_t last_progress;
+} Bench_Client;
+
+typedef struct Bench_Load {
+    IP_Port server;
+    Mono_Time *mono_time;
+    Bench_Client clients[BENCH_CLIENTS];
+    uint64_t duration;
+
+    pthread_mutex_t lock;
+    bool done;
+} Bench_Load;
+
+static int handle_sendnodes(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    Bench_Client *client = (Bench_Client *)object;
+    ++client->received;
+    return 0;
+}
+
+static bool create_client(Bench_Client *client, IP ip, uint16_t port, const uint8_t *server_public_key)
+{
+    client->net = new_networking_ex(nullptr, ip, port, port + 100, false, nullptr);
+
+    if (client->net == nullptr) {
+        return false;
+    }
+
+    networking_registerhandler(client->net, NET_PACKET_SEND_NODES_IPV6, &handle_sendnodes, client);
+
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(public_key, secret_key);
+
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    encrypt_precompute(server_public_key, secret_key, shared_key);
+
+    /* Ask for the nodes closest to a random key. */
+    uint8_t plain[CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t)];
+    random_bytes(plain, sizeof(plain));
+
+    client->length = dht_create_packet(public_key, shared_key, NET_PACKET_GET_NODES, plain, sizeof(plain),
+                                       client->packet);
+    return client->length == sizeof(client->packet);
+}
+
+static void *run_load(void *arg)
+{
+    Bench_Load *load = (Bench_Load *)arg;
+    const uint64_t start = current_time_monotonic(load->mono_time);
+    uint64_t now = start;
+
+    for (uint32_t i = 0; i < BENCH_CLIENTS; ++i) {
+        load->clients[i].last_progress = now;
+    }
+
+    while (now - start < load->duration) {
+        for (uint32_t i = 0; i < BENCH_CLIENTS; ++i) {
+            Bench_Client *client = &load->clients[i];
+
+            if (client->received != client->last_received) {
+                client->last_received = client->received;
+                client->last_progress = now;
+            } else if (now - client->last_progress > BENCH_RESEND_TIMEOUT) {
+                /* Give up on requests dropped by the server. */
+                client->sent = client->received;
+                client->last_progress = now;
+            }
+
+            networking_batch_start(client->net);
+
+            while (client->sent - client->received < BENCH_WINDOW) {
+                sendpacket_batch(client->net, load->server, client->packet, client->length);
+                ++client->sent;
+            }
+
+            networking_batch_end(client->net);
+        }
+
+        uint64_t received = 0;
+
+        for (uint32_t i = 0; i < BENCH_CLIENTS; ++i) {
+            networking_poll(load->clients[i].net, nullptr);
+            received += load->clients[i].received - load->clients[i].last_received;
+        }
+
+        /* Leave the CPU to the server while it works through the requests. */
+        if (received == 0) {
+            networking_wait(load->clients[0].net, 1);
+        }
+
+        now = current_time_monotonic(load->mono_time);
+    }
+
+    pthread_mutex_lock(&load->lock);
+    load->done = true;
+    pthread_mutex_unlock(&load->lock);
+    return nullptr;
+}
+
+static bool load_done(Bench_Load *load)
+{
+    pthread_mutex_lock(&load->lock);
+    const bool done = load->done;
+    pthread_mutex_unlock(&load->lock);
+    return done;
+}
+
+static void run_bench(Bench_Load *load, Mono_Time *mono_time, DHT *dht, uint16_t num_workers)
+{
+    DHT_Workers *workers = nullptr;
+
+    if (num_workers > 0) {
+        workers = new_dht_workers(nullptr, mono_time, dht, num_workers);
+
+        if (workers == nullptr) {
+            printf("failed to start %u workers\n", num_workers);
+            return;
+        }
+    }
+
+    uint64_t received_before = 0;
+
+    for (uint32_t i = 0; i < BENCH_CLIENTS; ++i) {
+        load->clients[i].sent = load->clients[i].received;
+        received_before += load->clients[i].received;
+    }
+
+    load->done = false;
+
+    pthread_t thread;
+
+    if (pthread_create(&thread, nullptr, run_load, load) != 0) {
+        printf("failed to start the client thread\n");
+        kill_dht_workers(workers);
+        return;
+    }
+
+    while (!load_done(load)) {
+        networking_wait(dht_get_net(dht), 1);
+        mono_time_update(mono_time);
+        networking_poll(dht_get_net(dht), nullptr);
+
+        if (workers != nullptr) {
+            do_dht_workers(workers, nullptr);
+        }
+    }
+
+    pthread_join(thread, nullptr);
+
+    uint64_t received = 0;
+
+    for (uint32_t i = 0; i < BENCH_CLIENTS; ++i) {
+        received += load->clients[i].received;
+    }
+
+    received -= received_before;
+
+    printf("%2u workers: %.0f requests/s", num_workers, received * 1000.0 / load->duration);
+
+    if (workers != nullptr) {
+        printf(" (%llu answered by workers, %llu dropped)", (unsigned long long)dht_workers_answered(workers),
+               (unsigned long long)dht_workers_dropped(workers));
+    }
+
+    printf("\n");
+
+    kill_dht_workers(workers);
+}
+
+int main(int argc, char *argv[])
+{
+    const int max_workers = argc > 1 ? atoi(argv[1]) : 8;
+    const int seconds = argc > 2 ? atoi(argv[2]) : 3;
+
+    if (max_workers < 0 || max_workers > MAX_DHT_WORKERS || seconds < 1) {
+        printf("number of workers must be between 0 and %d, seconds at least 1\n", MAX_DHT_WORKERS);
+        return 1;
+    }
+
+    /* The workers bind to the unspecified address, so the DHT must too. */
+    IP any_ip;
+    ip_init(&any_ip, false);
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Mono_Time *mono_time = mono_time_new();
+    Networking_Core *net = new_networking_reuseport(nullptr, any_ip, BENCH_PORT);
+
+    if (mono_time == nullptr || net == nullptr) {
+        printf("failed to create the DHT socket (SO_REUSEPORT may be unsupported)\n");
+        return 1;
+    }
+
+    DHT *dht = new_dht(nullptr, mono_time, net, true);
+
+    for (uint32_t i = 0; i < BENCH_CLOSE_NODES; ++i) {
+        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(public_key, sizeof(public_key));
+
+        IP_Port ip_port;
+        ip_port.ip = ip;
+        ip_port.port = net_htons(BENCH_PORT + 1000 + i);
+        addto_lists(dht, ip_port, public_key);
+    }
+
+    Bench_Load load;
+    memset(&load, 0, sizeof(load));
+    load.server.ip = ip;
+    load.server.port = net_port(net);
+    load.mono_time = mono_time_new();
+    load.duration = seconds * 1000;
+    pthread_mutex_init(&load.lock, nullptr);
+
+    for (uint32_t i = 0; i < BENCH_CLIENTS; ++i) {
+        if (!create_client(&load.clients[i], ip, BENCH_PORT + 1, dht_get_self_public_key(dht))) {
+            printf("failed to create client sockets\n");
+            return 1;
+        }
+    }
+
+    run_bench(&load, mono_time, dht, 0);
+
+    for (int num_workers = 1; num_workers <= max_workers; num_workers *= 2) {
+        run_bench(&load, mono_time, dht, num_workers);
+    }
+
+    for (uint32_t i = 0; i < BENCH_CLIENTS; ++i) {
+        kill_networking(load.clients[i].net);
+    }
+
+    pthread_mutex_destroy(&load.lock);
+    mono_time_free(load.mono_time);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/* Mono_Time read benchmark.
+ *
+ * Runs 1, 2, 4, ... reader threads calling mono_time_get() in a loop on a
+ * shared Mono_Time, while another thread calls mono_time_update() as fast as
+ * it can. Reports the average CPU time of one read, which should stay flat as
+ * readers are added, and the cost of reading the clock itself through
+ * current_time_monotonic() and current_time_monotonic_coarse().
+ *
+ * Usage: mono_time_bench [maximum number of readers] [seconds per run]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/mono_time.h"
+
+/* Reads between two looks at the stop flag. */
+#define BENCH_BATCH 1024
+
+#define BENCH_MAX_READERS 64
+
+typedef struct Bench_State {
+    Mono_Time *mono_time;
+
+    pthread_mutex_t lock;
+    bool done;
+} Bench_State;
+
+typedef struct Bench_Reader {
+    Bench_State *state;
+    uint64_t reads;
+    uint64_t sum;
+    uint64_t nanoseconds;
+} Bench_Reader;
+
+/* CPU time of the calling thread, so that time spent waiting for a core
+ * doesn't count as time spent reading.
+ */
+static uint64_t thread_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static bool is_done(Bench_State *state)
+{
+    pthread_mutex_lock(&state->lock);
+    const bool done = state->done;
+    pthread_mutex_unlock(&state->lock);
+    return done;
+}
+
+static void *run_reader(void *arg)
+{
+    Bench_Reader *reader = (Bench_Reader *)arg;
+    const uint64_t start = thread_nanoseconds();
+
+    while (!is_done(reader->state)) {
+        for (uint32_t i = 0; i < BENCH_BATCH; ++i) {
+            /* Sum the results so the calls can't be left out. */
+            reader->sum += mono_time_get(reader->state->mono_time);
+        }
+
+        reader->reads += BENCH_BATCH;
+    }
+
+    reader->nanoseconds = thread_nanoseconds() - start;
+    return nullptr;
+}
+
+static void *run_updater(void *arg)
+{
+    Bench_State *state = (Bench_State *)arg;
+
+    while (!is_done(state)) {
+        for (uint32_t i = 0; i < BENCH_BATCH; ++i) {
+            mono_time_update(state->mono_time);
+        }
+    }
+
+    return nullptr;
+}
+
+static void sleep_ms(uint32_t ms)
+{
+    struct timespec duration;
+    duration.tv_sec = ms / 1000;
+    duration.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&duration, nullptr);
+}
+
+static bool bench_readers(Mono_Time *mono_time, uint32_t num_readers, uint32_t seconds)
+{
+    Bench_State state;
+    state.mono_time = mono_time;
+    state.done = false;
+    pthread_mutex_init(&state.lock, nullptr);
+
+    Bench_Reader readers[BENCH_MAX_READERS] = {{nullptr}};
+    pthread_t reader_threads[BENCH_MAX_READERS];
+    pthread_t updater_thread;
+
+    if (pthread_create(&updater_thread, nullptr, run_updater, &state) != 0) {
+        pthread_mutex_destroy(&state.lock);
+        return false;
+    }
+
+    uint32_t started = 0;
+
+    for (; started < num_readers; ++started) {
+        readers[started].state = &state;
+
+        if (pthread_create(&reader_threads[started], nullptr, run_reader, &readers[started]) != 0) {
+            break;
+        }
+    }
+
+    sleep_ms(seconds * 1000);
+
+    pthread_mutex_lock(&state.lock);
+    state.done = true;
+    pthread_mutex_unlock(&state.lock);
+
+    pthread_join(updater_thread, nullptr);
+
+    uint64_t reads = 0;
+    uint64_t nanoseconds = 0;
+
+    for (uint32_t i = 0; i < started; ++i) {
+        pthread_join(reader_threads[i], nullptr);
+        reads += readers[i].reads;
+        nanoseconds += readers[i].nanoseconds;
+    }
+
+    pthread_mutex_destroy(&state.lock);
+
+    if (started != num_readers || reads == 0) {
+        return false;
+    }
+
+    printf("%3u readers: %12llu reads, %8.2f ns per mono_time_get\n", num_readers,
+           (unsigned long long)reads, (double)nanoseconds / reads);
+    return true;
+}
+
+static void bench_clock(Mono_Time *mono_time, const char *name, uint64_t (*read_clock)(Mono_Time *mono_time))
+{
+    const uint32_t calls = 1000000;
+    uint64_t sum = 0;
+    const uint64_t start = thread_nanoseconds();
+
+    for (uint32_t i = 0; i < calls; ++i) {
+        sum += read_clock(mono_time);
+    }
+
+    const uint64_t nanoseconds = thread_nanoseconds() - start;
+    printf("%s: %8.2f ns per call (%llu)\n", name, (double)nanoseconds / calls, (unsigned long long)(sum & 1));
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t max_readers = argc > 1 ? (uint32_t)atoi(argv[1]) : 8;
+    const uint32_t seconds = argc > 2 ? (uint32_t)atoi(argv[2]) : 2;
+
+    if (max_readers == 0 || max_readers > BENCH_MAX_READERS || seconds == 0) {
+        fprintf(stderr, "Usage: %s [maximum number of readers (1-%d)] [seconds per run]\n", argv[0], BENCH_MAX_READERS);
+        return 1;
+    }
+
+    Mono_Time *mono_time = mono_time_new();
+
+    if (mono_time == nullptr) {
+        fprintf(stderr, "Failed to create mono_time\n");
+        return 1;
+    }
+
+    bench_clock(mono_time, "current_time_monotonic       ", current_time_monotonic);
+    bench_clock(mono_time, "current_time_monotonic_coarse", current_time_monotonic_coarse);
+
+    for (uint32_t num_readers = 1; num_readers <= max_readers; num_readers *= 2) {
+        if (!bench_readers(mono_time, num_readers, seconds)) {
+            fprintf(stderr, "Failed to run %u readers\n", num_readers);
+            mono_time_free(mono_time);
+            return 1;
+        }
+    }
+
+    mono_time_free(mono_time);
+    return 0;
+}
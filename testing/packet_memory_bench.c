@@ -0,0 +1,269 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/* Packet buffer memory benchmark.
+ *
+ * Keeps the lossless packet buffers of many active connections busy the way
+ * net_crypto does: each connection adds packets to the end of its buffer and
+ * frees the oldest ones as they get acknowledged. Most connections carry short
+ * chat messages, every fourth one a file transfer filling whole packets.
+ *
+ * The same traffic runs twice, each in its own process: once allocating a
+ * whole packet for every buffer with malloc(), as net_crypto used to, and
+ * once with the size classes of the slab allocator net_crypto uses now.
+ * Reports the resident memory of each run after the traffic and the CPU time
+ * of adding and freeing one packet.
+ *
+ * Usage: packet_memory_bench [number of connections] [rounds]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/net_crypto.h"
+#include "../toxcore/slab_allocator.h"
+
+/* Packets a connection holds at most, acknowledged or not. */
+#define BENCH_WINDOW 64
+
+/* Same layout as the Packet_Data of net_crypto.c. */
+typedef struct Bench_Packet {
+    uint64_t sent_time;
+    uint16_t length;
+    uint8_t data[MAX_CRYPTO_DATA_SIZE];
+} Bench_Packet;
+
+#define BENCH_PACKET_SIZE(length) (offsetof(Bench_Packet, data) + (length))
+
+typedef struct Bench_Connection {
+    Bench_Packet *buffer[BENCH_WINDOW];
+    uint32_t buffer_start;
+    uint32_t buffer_end;
+    bool file_transfer;
+} Bench_Connection;
+
+typedef struct Bench_Allocator {
+    const char *name;
+    Slab_Allocator *slab;
+} Bench_Allocator;
+
+static uint64_t thread_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t resident_bytes(void)
+{
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == nullptr) {
+        return 0;
+    }
+
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    const int read = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+
+    if (read != 2) {
+        return 0;
+    }
+
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+/* Same as the allocation in add_data_end_of_buffer() before and after the
+ * slab allocator.
+ */
+static Bench_Packet *add_packet(Bench_Allocator *allocator, const Bench_Packet *packet)
+{
+    Bench_Packet *new_p;
+
+    if (allocator->slab == nullptr) {
+        new_p = (Bench_Packet *)malloc(sizeof(Bench_Packet));
+
+        if (new_p != nullptr) {
+            memcpy(new_p, packet, sizeof(Bench_Packet));
+        }
+    } else {
+        new_p = (Bench_Packet *)slab_alloc(allocator->slab, BENCH_PACKET_SIZE(packet->length));
+
+        if (new_p != nullptr) {
+            memcpy(new_p, packet, BENCH_PACKET_SIZE(packet->length));
+        }
+    }
+
+    return new_p;
+}
+
+static void free_packet(Bench_Allocator *allocator, Bench_Packet *packet)
+{
+    if (allocator->slab == nullptr) {
+        free(packet);
+    } else {
+        slab_free(allocator->slab, packet);
+    }
+}
+
+static uint16_t packet_length(const Bench_Connection *conn)
+{
+    if (conn->file_transfer) {
+        return MAX_CRYPTO_DATA_SIZE - 2;
+    }
+
+    return 16 + rand() % 112;
+}
+
+/* Runs the traffic and prints the result.
+ *
+ * return false if memory ran out.
+ */
+static bool run_traffic(Bench_Allocator *allocator, uint32_t num_connections, uint32_t rounds)
+{
+    Bench_Connection *connections = (Bench_Connection *)calloc(num_connections, sizeof(Bench_Connection));
+
+    if (connections == nullptr) {
+        return false;
+    }
+
+    const uint64_t start_rss = resident_bytes();
+    Bench_Packet packet = {0};
+    memset(packet.data, 0x42, sizeof(packet.data));
+    uint64_t packets = 0;
+    uint64_t nanoseconds = 0;
+    bool ok = true;
+
+    srand(1);
+
+    for (uint32_t i = 0; i < num_connections; ++i) {
+        connections[i].file_transfer = i % 4 == 0;
+    }
+
+    for (uint32_t round = 0; round < rounds && ok; ++round) {
+        for (uint32_t i = 0; i < num_connections && ok; ++i) {
+            Bench_Connection *conn = &connections[i];
+            const uint64_t begin = thread_nanoseconds();
+
+            /* The other side acknowledges some of the oldest packets. */
+            const uint32_t acked = rand() % (conn->buffer_end - conn->buffer_start + 1);
+
+            for (uint32_t j = 0; j < acked; ++j) {
+                const uint32_t num = conn->buffer_start % BENCH_WINDOW;
+                free_packet(allocator, conn->buffer[num]);
+                conn->buffer[num] = nullptr;
+                ++conn->buffer_start;
+            }
+
+            while (conn->buffer_end - conn->buffer_start < BENCH_WINDOW) {
+                packet.length = packet_length(conn);
+                Bench_Packet *new_p = add_packet(allocator, &packet);
+
+                if (new_p == nullptr) {
+                    ok = false;
+                    break;
+                }
+
+                conn->buffer[conn->buffer_end % BENCH_WINDOW] = new_p;
+                ++conn->buffer_end;
+                ++packets;
+            }
+
+            nanoseconds += thread_nanoseconds() - begin;
+        }
+    }
+
+    const uint64_t rss = resident_bytes();
+
+    if (ok) {
+        printf("%-6s: %6.1f MiB resident for %u connections, %6.2f ns per packet added and freed\n", allocator->name,
+               (double)(rss - start_rss) / (1024 * 1024), num_connections, packets != 0 ? (double)nanoseconds / packets : 0);
+    }
+
+    for (uint32_t i = 0; i < num_connections; ++i) {
+        for (uint32_t j = connections[i].buffer_start; j != connections[i].buffer_end; ++j) {
+            free_packet(allocator, connections[i].buffer[j % BENCH_WINDOW]);
+        }
+    }
+
+    free(connections);
+    return ok;
+}
+
+/* Runs the traffic in a child process so each run starts from the same
+ * resident memory.
+ */
+static bool run_child(bool use_slab, uint32_t num_connections, uint32_t rounds)
+{
+    fflush(stdout);
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+        return false;
+    }
+
+    if (pid == 0) {
+        Bench_Allocator allocator = {"malloc", nullptr};
+
+        if (use_slab) {
+            const uint32_t sizes[] = {
+                BENCH_PACKET_SIZE(112), BENCH_PACKET_SIZE(496), sizeof(Bench_Packet)
+            };
+            allocator.name = "slab";
+            allocator.slab = new_slab_allocator(sizes, sizeof(sizes) / sizeof(sizes[0]));
+
+            if (allocator.slab == nullptr) {
+                _exit(1);
+            }
+        }
+
+        const bool ok = run_traffic(&allocator, num_connections, rounds);
+
+        if (ok && use_slab) {
+            printf("        %u blocks in use at most, %u slabs left\n", slab_allocator_peak_in_use(allocator.slab),
+                   slab_allocator_slabs(allocator.slab));
+        }
+
+        kill_slab_allocator(allocator.slab);
+        fflush(stdout);
+        _exit(ok ? 0 : 1);
+    }
+
+    int status;
+
+    if (waitpid(pid, &status, 0) != pid) {
+        return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_connections = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000;
+    const uint32_t rounds = argc > 2 ? (uint32_t)atoi(argv[2]) : 200;
+
+    if (num_connections == 0 || rounds == 0) {
+        fprintf(stderr, "Usage: %s [number of connections] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    if (!run_child(false, num_connections, rounds) || !run_child(true, num_connections, rounds)) {
+        fprintf(stderr, "Failed to run the traffic\n");
+        return 1;
+    }
+
+    return 0;
+}
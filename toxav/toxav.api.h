@@ -125,7 +125,8 @@ tox::this *tox { get(); }
 
 /**
  * Returns the interval in milliseconds when the next toxav_iterate call should
- * be. If no call is active at the moment, this function returns 200.
+ * be, counted from now until the next audio or video frame is due. If no call
+ * is active at the moment, this function returns 200.
  */
 const uint32_t iteration_interval();
 
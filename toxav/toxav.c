@@ -99,7 +99,7 @@ struct ToxAV {
     int32_t dmsst; /** Last cycle total */
     int32_t dmssa; /** Average decoding time in ms */
 
-    uint32_t interval; /** Calculated interval */
+    uint64_t next_iteration; /** Time in ms at which the next toxav_iterate is due */
     Mono_Time *toxav_mono_time; /** ToxAV's own mono_time instance */
 };
 
@@ -166,7 +166,7 @@ ToxAV *toxav_new(Tox *tox, Toxav_Err_New *error)
         goto RETURN;
     }
 
-    av->interval = 200;
+    av->next_iteration = 0;
     av->msi->av = av;
 
     msi_register_callback(av->msi, callback_invite, MSI_ON_INVITE);
@@ -228,7 +228,12 @@ Tox *toxav_get_tox(const ToxAV *av)
 uint32_t toxav_iteration_interval(const ToxAV *av)
 {
     /* If no call is active interval is 200 */
-    return av->calls ? av->interval : 200;
+    if (!av->calls) {
+        return 200;
+    }
+
+    const uint64_t now = current_time_monotonic(av->toxav_mono_time);
+    return av->next_iteration > now ? av->next_iteration - now : 0;
 }
 void toxav_iterate(ToxAV *av)
 {
@@ -276,7 +281,7 @@ void toxav_iterate(ToxAV *av)
         }
     }
 
-    av->interval = rc < av->dmssa ? 0 : (rc - av->dmssa);
+    av->next_iteration = start + (rc < av->dmssa ? 0 : (rc - av->dmssa));
     av->dmsst += current_time_monotonic(av->toxav_mono_time) - start;
 
     if (++av->dmssc == 3) {
@@ -140,7 +140,8 @@ Tox *toxav_get_tox(const ToxAV *av);
 
 /**
  * Returns the interval in milliseconds when the next toxav_iterate call should
- * be. If no call is active at the moment, this function returns 200.
+ * be, counted from now until the next audio or video frame is due. If no call
+ * is active at the moment, this function returns 200.
  */
 uint32_t toxav_iteration_interval(const ToxAV *av);
 
@@ -16,6 +16,7 @@
 #include "logger.h"
 #include "mono_time.h"
 #include "network.h"
+#include "node_cache.h"
 #include "ping.h"
 #include "state.h"
 #include "util.h"
@@ -27,6 +28,20 @@
 /* The timeout after which a node is discarded completely. */
 #define KILL_NODE_TIMEOUT (BAD_NODE_TIMEOUT + PING_INTERVAL)
 
+/* Nodes the bootstrap lookup keeps track of, closest to our key first. */
+#define BOOTSTRAP_LOOKUP_NODES 64
+/* Requests the bootstrap lookup starts with in flight, and the most it lets
+ * grow to while the nodes answer. */
+#define BOOTSTRAP_LOOKUP_WINDOW 3
+#define BOOTSTRAP_LOOKUP_MAX_WINDOW 32
+/* Milliseconds after which a bootstrap lookup request counts as lost. */
+#define BOOTSTRAP_LOOKUP_TIMEOUT 1000
+/* Seconds after which the bootstrap lookup gives up. */
+#define BOOTSTRAP_LOOKUP_MAX_TIME 30
+/* The lookup is done when this many of the closest nodes have answered or
+ * timed out and the close list has this many good nodes. */
+#define BOOTSTRAP_LOOKUP_DONE_NODES 8
+
 /* Ping interval in seconds for each random sending of a get nodes request. */
 #define GET_NODE_INTERVAL 20
 
@@ -71,6 +86,38 @@ struct DHT_Friend {
     unsigned int num_to_bootstrap;
 };
 
+typedef enum Bootstrap_Node_State {
+    BOOTSTRAP_NODE_NEW,
+    BOOTSTRAP_NODE_ASKED,
+    BOOTSTRAP_NODE_ANSWERED,
+    BOOTSTRAP_NODE_TIMED_OUT,
+} Bootstrap_Node_State;
+
+typedef struct Bootstrap_Node {
+    Node_format node;
+    Bootstrap_Node_State state;
+    uint64_t sent_time;
+} Bootstrap_Node;
+
+/* Iterative lookup of our own key that runs after bootstrapping, keeping up
+ * to window getnodes requests in flight to the closest nodes not asked yet.
+ * The window grows by one for every answer and halves for every request
+ * that times out.
+ */
+typedef struct Bootstrap_Lookup {
+    bool active;
+    uint64_t start_time;
+
+    Bootstrap_Node nodes[BOOTSTRAP_LOOKUP_NODES];
+    uint32_t num_nodes;
+
+    uint32_t in_flight;
+    uint32_t window;
+
+    uint32_t requests;
+    uint32_t answers;
+} Bootstrap_Lookup;
+
 typedef struct Cryptopacket_Handler {
     cryptopacket_handler_cb *function;
     void *object;
@@ -93,13 +140,19 @@ struct DHT {
 
     DHT_Friend    *friends_list;
     uint16_t       num_friends;
+    /* Friend numbers keyed by public key. */
+    Pk_Index       friends_index;
 
     Node_format   *loaded_nodes_list;
     uint32_t       loaded_num_nodes;
     unsigned int   loaded_nodes_index;
 
-    Shared_Keys shared_keys_recv;
-    Shared_Keys shared_keys_sent;
+    Shared_Keys *shared_keys_recv;
+    Shared_Keys *shared_keys_sent;
+    Shared_Key_Pool *shared_key_pool;
+
+    Node_Cache    *node_cache;
+    bool           node_cache_seeded;
 
     struct Ping   *ping;
     Ping_Array    *dht_ping_array;
@@ -110,6 +163,8 @@ struct DHT {
 
     Node_format to_bootstrap[MAX_CLOSE_TO_BOOTSTRAP_NODES];
     unsigned int num_to_bootstrap;
+
+    Bootstrap_Lookup bootstrap;
 };
 
 const uint8_t *dht_friend_public_key(const DHT_Friend *dht_friend)
@@ -178,6 +233,65 @@ static bool assoc_timeout(const Mono_Time *mono_time, const IPPTsPng *assoc)
     return mono_time_is_timeout(mono_time, assoc->timestamp, BAD_NODE_TIMEOUT);
 }
 
+/* Word i of pk as a big endian integer, so that comparing words compares the
+ * key bytes in order.
+ */
+static uint64_t pk_word(const uint8_t *pk, size_t i)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t word;
+    memcpy(&word, pk + i * sizeof(uint64_t), sizeof(uint64_t));
+    return __builtin_bswap64(word);
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t word;
+    memcpy(&word, pk + i * sizeof(uint64_t), sizeof(uint64_t));
+    return word;
+#else
+    uint64_t word = 0;
+
+    for (size_t j = 0; j < sizeof(uint64_t); ++j) {
+        word = (word << 8) | pk[i * sizeof(uint64_t) + j];
+    }
+
+    return word;
+#endif
+}
+
+/* Number of leading zero bits in a non-zero word. */
+static unsigned int word_leading_zeros(uint64_t word)
+{
+#ifdef __GNUC__
+    return __builtin_clzll(word);
+#else
+    unsigned int zeros = 0;
+
+    while ((word & (UINT64_C(1) << 63)) == 0) {
+        word <<= 1;
+        ++zeros;
+    }
+
+    return zeros;
+#endif
+}
+
+void pk_distance(Pk_Distance *distance, const uint8_t *pk, const uint8_t *pk1)
+{
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        distance->words[i] = pk_word(pk, i) ^ pk_word(pk1, i);
+    }
+}
+
+int pk_distance_cmp(const Pk_Distance *distance1, const Pk_Distance *distance2)
+{
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        if (distance1->words[i] != distance2->words[i]) {
+            return distance1->words[i] < distance2->words[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
 /* Compares pk1 and pk2 with pk.
  *
  *  return 0 if both are same distance.
@@ -186,9 +300,10 @@ static bool assoc_timeout(const Mono_Time *mono_time, const IPPTsPng *assoc)
  */
 int id_closest(const uint8_t *pk, const uint8_t *pk1, const uint8_t *pk2)
 {
-    for (size_t i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; ++i) {
-        const uint8_t distance1 = pk[i] ^ pk1[i];
-        const uint8_t distance2 = pk[i] ^ pk2[i];
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        const uint64_t word = pk_word(pk, i);
+        const uint64_t distance1 = word ^ pk_word(pk1, i);
+        const uint64_t distance2 = word ^ pk_word(pk2, i);
 
         if (distance1 < distance2) {
             return 1;
@@ -206,26 +321,230 @@ int id_closest(const uint8_t *pk, const uint8_t *pk1, const uint8_t *pk2)
  */
 static unsigned int bit_by_bit_cmp(const uint8_t *pk1, const uint8_t *pk2)
 {
-    unsigned int i;
-    unsigned int j = 0;
+    for (size_t i = 0; i < PK_DISTANCE_WORDS; ++i) {
+        const uint64_t diff = pk_word(pk1, i) ^ pk_word(pk2, i);
 
-    for (i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; ++i) {
-        if (pk1[i] == pk2[i]) {
-            continue;
+        if (diff != 0) {
+            return i * 64 + word_leading_zeros(diff);
         }
+    }
 
-        for (j = 0; j < 8; ++j) {
-            const uint8_t mask = 1 << (7 - j);
+    return CRYPTO_PUBLIC_KEY_SIZE * 8;
+}
 
-            if ((pk1[i] & mask) != (pk2[i] & mask)) {
-                break;
-            }
+#define SHARED_KEY_NONE UINT32_MAX
+
+typedef struct Shared_Key {
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    /* Next key in the same hash bucket. */
+    uint32_t bucket_next;
+    /* Neighbours in the list of keys ordered from most to least recently used. */
+    uint32_t lru_prev;
+    uint32_t lru_next;
+} Shared_Key;
+
+struct Shared_Keys {
+    Shared_Key *keys;
+    uint32_t capacity;
+    uint32_t size;
+
+    /* First key of each bucket; the number of buckets is a power of two. */
+    uint32_t *buckets;
+    uint32_t bucket_mask;
+    /* Random hash key, so that peers can't choose public keys that fill one bucket. */
+    uint64_t hash_key;
+
+    uint32_t lru_first;
+    uint32_t lru_last;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+Shared_Keys *shared_keys_new(uint32_t capacity)
+{
+    if (capacity == 0 || capacity > UINT32_MAX / 2) {
+        return nullptr;
+    }
+
+    Shared_Keys *const shared_keys = (Shared_Keys *)calloc(1, sizeof(Shared_Keys));
+
+    if (shared_keys == nullptr) {
+        return nullptr;
+    }
+
+    uint32_t num_buckets = 1;
+
+    while (num_buckets < capacity) {
+        num_buckets *= 2;
+    }
+
+    shared_keys->keys = (Shared_Key *)calloc(capacity, sizeof(Shared_Key));
+    shared_keys->buckets = (uint32_t *)malloc(num_buckets * sizeof(uint32_t));
+
+    if (shared_keys->keys == nullptr || shared_keys->buckets == nullptr) {
+        shared_keys_free(shared_keys);
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < num_buckets; ++i) {
+        shared_keys->buckets[i] = SHARED_KEY_NONE;
+    }
+
+    shared_keys->capacity = capacity;
+    shared_keys->bucket_mask = num_buckets - 1;
+    shared_keys->hash_key = random_u64();
+    shared_keys->lru_first = SHARED_KEY_NONE;
+    shared_keys->lru_last = SHARED_KEY_NONE;
+
+    return shared_keys;
+}
+
+void shared_keys_free(Shared_Keys *shared_keys)
+{
+    if (shared_keys == nullptr) {
+        return;
+    }
+
+    if (shared_keys->keys != nullptr) {
+        crypto_memzero(shared_keys->keys, shared_keys->capacity * sizeof(Shared_Key));
+    }
+
+    free(shared_keys->keys);
+    free(shared_keys->buckets);
+    free(shared_keys);
+}
+
+uint64_t shared_keys_hits(const Shared_Keys *shared_keys)
+{
+    return shared_keys->hits;
+}
+
+uint64_t shared_keys_misses(const Shared_Keys *shared_keys)
+{
+    return shared_keys->misses;
+}
+
+uint64_t shared_keys_evictions(const Shared_Keys *shared_keys)
+{
+    return shared_keys->evictions;
+}
+
+static uint32_t shared_key_bucket(const Shared_Keys *shared_keys, const uint8_t *public_key)
+{
+    return id_hash(public_key, shared_keys->hash_key) & shared_keys->bucket_mask;
+}
+
+static void shared_key_lru_unlink(Shared_Keys *shared_keys, uint32_t index)
+{
+    Shared_Key *const key = &shared_keys->keys[index];
+
+    if (key->lru_prev != SHARED_KEY_NONE) {
+        shared_keys->keys[key->lru_prev].lru_next = key->lru_next;
+    } else {
+        shared_keys->lru_first = key->lru_next;
+    }
+
+    if (key->lru_next != SHARED_KEY_NONE) {
+        shared_keys->keys[key->lru_next].lru_prev = key->lru_prev;
+    } else {
+        shared_keys->lru_last = key->lru_prev;
+    }
+}
+
+static void shared_key_lru_push_front(Shared_Keys *shared_keys, uint32_t index)
+{
+    Shared_Key *const key = &shared_keys->keys[index];
+    key->lru_prev = SHARED_KEY_NONE;
+    key->lru_next = shared_keys->lru_first;
+
+    if (shared_keys->lru_first != SHARED_KEY_NONE) {
+        shared_keys->keys[shared_keys->lru_first].lru_prev = index;
+    } else {
+        shared_keys->lru_last = index;
+    }
+
+    shared_keys->lru_first = index;
+}
+
+/* Take the least recently used key out of its bucket and of the LRU list. */
+static uint32_t shared_key_evict(Shared_Keys *shared_keys)
+{
+    const uint32_t index = shared_keys->lru_last;
+    uint32_t *link = &shared_keys->buckets[shared_key_bucket(shared_keys, shared_keys->keys[index].public_key)];
+
+    while (*link != index) {
+        link = &shared_keys->keys[*link].bucket_next;
+    }
+
+    *link = shared_keys->keys[index].bucket_next;
+    shared_key_lru_unlink(shared_keys, index);
+    ++shared_keys->evictions;
+
+    return index;
+}
+
+static uint32_t shared_key_find(const Shared_Keys *shared_keys, uint32_t bucket, const uint8_t *public_key)
+{
+    for (uint32_t index = shared_keys->buckets[bucket]; index != SHARED_KEY_NONE;
+            index = shared_keys->keys[index].bucket_next) {
+        if (id_equal(public_key, shared_keys->keys[index].public_key)) {
+            return index;
         }
+    }
+
+    return SHARED_KEY_NONE;
+}
+
+static void shared_key_touch(Shared_Keys *shared_keys, uint32_t index)
+{
+    if (shared_keys->lru_first != index) {
+        shared_key_lru_unlink(shared_keys, index);
+        shared_key_lru_push_front(shared_keys, index);
+    }
+}
 
-        break;
+bool shared_keys_lookup(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *public_key)
+{
+    const uint32_t index = shared_key_find(shared_keys, shared_key_bucket(shared_keys, public_key), public_key);
+
+    if (index == SHARED_KEY_NONE) {
+        ++shared_keys->misses;
+        return false;
+    }
+
+    memcpy(shared_key, shared_keys->keys[index].shared_key, CRYPTO_SHARED_KEY_SIZE);
+    shared_key_touch(shared_keys, index);
+    ++shared_keys->hits;
+    return true;
+}
+
+void shared_keys_insert(Shared_Keys *shared_keys, const uint8_t *public_key, const uint8_t *shared_key)
+{
+    const uint32_t bucket = shared_key_bucket(shared_keys, public_key);
+    uint32_t index = shared_key_find(shared_keys, bucket, public_key);
+
+    if (index != SHARED_KEY_NONE) {
+        memcpy(shared_keys->keys[index].shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+        shared_key_touch(shared_keys, index);
+        return;
+    }
+
+    if (shared_keys->size < shared_keys->capacity) {
+        index = shared_keys->size;
+        ++shared_keys->size;
+    } else {
+        index = shared_key_evict(shared_keys);
     }
 
-    return i * 8 + j;
+    Shared_Key *const key = &shared_keys->keys[index];
+    memcpy(key->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(key->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+    key->bucket_next = shared_keys->buckets[bucket];
+    shared_keys->buckets[bucket] = index;
+    shared_key_lru_push_front(shared_keys, index);
 }
 
 /* Shared key generations are costly, it is therefore smart to store commonly used
@@ -234,49 +553,15 @@ static unsigned int bit_by_bit_cmp(const uint8_t *pk1, const uint8_t *pk2)
  * If shared key is already in shared_keys, copy it to shared_key.
  * else generate it into shared_key and copy it to shared_keys
  */
-void get_shared_key(const Mono_Time *mono_time, Shared_Keys *shared_keys, uint8_t *shared_key,
-                    const uint8_t *secret_key, const uint8_t *public_key)
-{
-    uint32_t num = -1;
-    uint32_t curr = 0;
-
-    for (uint32_t i = 0; i < MAX_KEYS_PER_SLOT; ++i) {
-        const int index = public_key[30] * MAX_KEYS_PER_SLOT + i;
-        Shared_Key *const key = &shared_keys->keys[index];
-
-        if (key->stored) {
-            if (id_equal(public_key, key->public_key)) {
-                memcpy(shared_key, key->shared_key, CRYPTO_SHARED_KEY_SIZE);
-                ++key->times_requested;
-                key->time_last_requested = mono_time_get(mono_time);
-                return;
-            }
-
-            if (num != 0) {
-                if (mono_time_is_timeout(mono_time, key->time_last_requested, KEYS_TIMEOUT)) {
-                    num = 0;
-                    curr = index;
-                } else if (num > key->times_requested) {
-                    num = key->times_requested;
-                    curr = index;
-                }
-            }
-        } else if (num != 0) {
-            num = 0;
-            curr = index;
-        }
+void get_shared_key(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *secret_key,
+                    const uint8_t *public_key)
+{
+    if (shared_keys_lookup(shared_keys, shared_key, public_key)) {
+        return;
     }
 
     encrypt_precompute(public_key, secret_key, shared_key);
-
-    if (num != UINT32_MAX) {
-        Shared_Key *const key = &shared_keys->keys[curr];
-        key->stored = true;
-        key->times_requested = 1;
-        memcpy(key->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-        memcpy(key->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
-        key->time_last_requested = mono_time_get(mono_time);
-    }
+    shared_keys_insert(shared_keys, public_key, shared_key);
 }
 
 /* Copy shared_key to encrypt/decrypt DHT packet from public_key into shared_key
@@ -284,7 +569,7 @@ void get_shared_key(const Mono_Time *mono_time, Shared_Keys *shared_keys, uint8_
  */
 void dht_get_shared_key_recv(DHT *dht, uint8_t *shared_key, const uint8_t *public_key)
 {
-    get_shared_key(dht->mono_time, &dht->shared_keys_recv, shared_key, dht->self_secret_key, public_key);
+    get_shared_key(dht->shared_keys_recv, shared_key, dht->self_secret_key, public_key);
 }
 
 /* Copy shared_key to encrypt/decrypt DHT packet from public_key into shared_key
@@ -292,7 +577,95 @@ void dht_get_shared_key_recv(DHT *dht, uint8_t *shared_key, const uint8_t *publi
  */
 void dht_get_shared_key_sent(DHT *dht, uint8_t *shared_key, const uint8_t *public_key)
 {
-    get_shared_key(dht->mono_time, &dht->shared_keys_sent, shared_key, dht->self_secret_key, public_key);
+    get_shared_key(dht->shared_keys_sent, shared_key, dht->self_secret_key, public_key);
+}
+
+bool dht_set_shared_keys_capacity(DHT *dht, uint32_t capacity)
+{
+    Shared_Keys *const shared_keys_recv = shared_keys_new(capacity);
+    Shared_Keys *const shared_keys_sent = shared_keys_new(capacity);
+
+    if (shared_keys_recv == nullptr || shared_keys_sent == nullptr) {
+        shared_keys_free(shared_keys_recv);
+        shared_keys_free(shared_keys_sent);
+        return false;
+    }
+
+    shared_keys_free(dht->shared_keys_recv);
+    shared_keys_free(dht->shared_keys_sent);
+    dht->shared_keys_recv = shared_keys_recv;
+    dht->shared_keys_sent = shared_keys_sent;
+    return true;
+}
+
+const Shared_Keys *dht_get_shared_keys_recv(const DHT *dht)
+{
+    return dht->shared_keys_recv;
+}
+
+const Shared_Keys *dht_get_shared_keys_sent(const DHT *dht)
+{
+    return dht->shared_keys_sent;
+}
+
+static void store_shared_key(void *cache, const uint8_t *public_key, const uint8_t *shared_key)
+{
+    shared_keys_insert((Shared_Keys *)cache, public_key, shared_key);
+}
+
+bool dht_start_shared_key_pool(DHT *dht, uint16_t num_threads)
+{
+    if (dht->shared_key_pool != nullptr) {
+        return false;
+    }
+
+    dht->shared_key_pool = new_shared_key_pool(dht->log, dht->net, num_threads, DEFAULT_SHARED_KEY_POOL_PARKED,
+                           &store_shared_key);
+    return dht->shared_key_pool != nullptr;
+}
+
+const Shared_Key_Pool *dht_get_shared_key_pool(const DHT *dht)
+{
+    return dht->shared_key_pool;
+}
+
+bool dht_get_shared_key_or_park(DHT *dht, Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *public_key,
+                                IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    if (shared_keys_lookup(shared_keys, shared_key, public_key)) {
+        return true;
+    }
+
+    if (dht->shared_key_pool == nullptr || shared_key_pool_replaying(dht->shared_key_pool)) {
+        encrypt_precompute(public_key, dht->self_secret_key, shared_key);
+        shared_keys_insert(shared_keys, public_key, shared_key);
+        return true;
+    }
+
+    if (shared_key_pool_park(dht->shared_key_pool, shared_keys, dht->self_secret_key, public_key, source, packet,
+                             length) == -1) {
+        LOGGER_TRACE(dht->log, "dropped packet %u waiting for a shared key", packet[0]);
+    }
+
+    return false;
+}
+
+bool dht_get_shared_key_recv_or_park(DHT *dht, uint8_t *shared_key, const uint8_t *public_key, IP_Port source,
+                                     const uint8_t *packet, uint16_t length)
+{
+    return dht_get_shared_key_or_park(dht, dht->shared_keys_recv, shared_key, public_key, source, packet, length);
+}
+
+void dht_forget_shared_keys(DHT *dht, const Shared_Keys *shared_keys)
+{
+    shared_key_pool_remove_cache(dht->shared_key_pool, shared_keys);
+}
+
+void do_dht_shared_key_pool(DHT *dht, void *userdata)
+{
+    if (dht->shared_key_pool != nullptr) {
+        do_shared_key_pool(dht->shared_key_pool, userdata);
+    }
 }
 
 #define CRYPTO_SIZE 1 + CRYPTO_PUBLIC_KEY_SIZE * 2 + CRYPTO_NONCE_SIZE
@@ -339,12 +712,32 @@ int create_request(const uint8_t *send_public_key, const uint8_t *send_secret_ke
     return len + CRYPTO_SIZE;
 }
 
-/* Puts the senders public key in the request in public_key, the data from the request
- * in data if a friend or ping request was sent to us and returns the length of the data.
- * packet is the request packet and length is its length.
+/* Decrypts the request packet of length bytes with shared_key, the key shared
+ * with the sender, and puts the id of the request in request_id and the data
+ * from the request in data.
  *
+ *  return the length of the data.
  *  return -1 if not valid request.
  */
+static int unpack_request(const uint8_t *shared_key, uint8_t *data, uint8_t *request_id, const uint8_t *packet,
+                          uint16_t length)
+{
+    const uint8_t *const nonce = packet + 1 + CRYPTO_PUBLIC_KEY_SIZE * 2;
+    uint8_t temp[MAX_CRYPTO_REQUEST_SIZE];
+    int len1 = decrypt_data_symmetric(shared_key, nonce, packet + CRYPTO_SIZE, length - CRYPTO_SIZE, temp);
+
+    if (len1 == -1 || len1 == 0) {
+        crypto_memzero(temp, MAX_CRYPTO_REQUEST_SIZE);
+        return -1;
+    }
+
+    request_id[0] = temp[0];
+    --len1;
+    memcpy(data, temp + 1, len1);
+    crypto_memzero(temp, MAX_CRYPTO_REQUEST_SIZE);
+    return len1;
+}
+
 int handle_request(const uint8_t *self_public_key, const uint8_t *self_secret_key, uint8_t *public_key, uint8_t *data,
                    uint8_t *request_id, const uint8_t *packet, uint16_t length)
 {
@@ -361,21 +754,11 @@ int handle_request(const uint8_t *self_public_key, const uint8_t *self_secret_ke
     }
 
     memcpy(public_key, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, CRYPTO_PUBLIC_KEY_SIZE);
-    const uint8_t *const nonce = packet + 1 + CRYPTO_PUBLIC_KEY_SIZE * 2;
-    uint8_t temp[MAX_CRYPTO_REQUEST_SIZE];
-    int len1 = decrypt_data(public_key, self_secret_key, nonce,
-                            packet + CRYPTO_SIZE, length - CRYPTO_SIZE, temp);
-
-    if (len1 == -1 || len1 == 0) {
-        crypto_memzero(temp, MAX_CRYPTO_REQUEST_SIZE);
-        return -1;
-    }
-
-    request_id[0] = temp[0];
-    --len1;
-    memcpy(data, temp + 1, len1);
-    crypto_memzero(temp, MAX_CRYPTO_REQUEST_SIZE);
-    return len1;
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    encrypt_precompute(public_key, self_secret_key, shared_key);
+    const int len = unpack_request(shared_key, data, request_id, packet, length);
+    crypto_memzero(shared_key, sizeof(shared_key));
+    return len;
 }
 
 #define PACKED_NODE_SIZE_IP4 (1 + SIZE_IP4 + sizeof(uint16_t) + CRYPTO_PUBLIC_KEY_SIZE)
@@ -454,8 +837,8 @@ int pack_ip_port(uint8_t *data, uint16_t length, const IP_Port *ip_port)
     }
 }
 
-static int dht_create_packet(const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE],
-                             const uint8_t *shared_key, const uint8_t type, uint8_t *plain, size_t plain_length, uint8_t *packet)
+int dht_create_packet(const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE], const uint8_t *shared_key,
+                      const uint8_t type, const uint8_t *plain, size_t plain_length, uint8_t *packet)
 {
     VLA(uint8_t, encrypted, plain_length + CRYPTO_MAC_SIZE);
     uint8_t nonce[CRYPTO_NONCE_SIZE];
@@ -636,9 +1019,19 @@ static uint32_t index_of_client_pk(const Client_data *array, uint32_t size, cons
     INDEX_OF_PK(array, size, pk);
 }
 
-static uint32_t index_of_friend_pk(const DHT_Friend *array, uint32_t size, const uint8_t *pk)
+static const uint8_t *dht_friend_pk(const void *object, uint32_t friend_num)
 {
-    INDEX_OF_PK(array, size, pk);
+    const DHT *dht = (const DHT *)object;
+    return dht->friends_list[friend_num].public_key;
+}
+
+/* Find the number of the friend with public key pk.
+ *
+ * return friend number or UINT32_MAX if not found.
+ */
+static uint32_t index_of_friend_pk(const DHT *dht, const uint8_t *pk)
+{
+    return pk_index_find(&dht->friends_index, pk);
 }
 
 static uint32_t index_of_node_pk(const Node_format *array, uint32_t size, const uint8_t *pk)
@@ -662,6 +1055,27 @@ static uint32_t index_of_client_ip_port(const Client_data *array, uint32_t size,
     return UINT32_MAX;
 }
 
+/* return the bucket of the close list that holds public_key: the length of
+ * the prefix it shares with our public key, the last bucket holding all keys
+ * that share a longer one.
+ */
+static unsigned int close_bucket_index(const DHT *dht, const uint8_t *public_key)
+{
+    const unsigned int index = bit_by_bit_cmp(public_key, dht->self_public_key);
+    return index < LCLIENT_LENGTH ? index : LCLIENT_LENGTH - 1;
+}
+
+/* Find public_key in its bucket of the close list.
+ *
+ * return index into the close list or UINT32_MAX if not found.
+ */
+static uint32_t index_of_close_client(const DHT *dht, const uint8_t *public_key)
+{
+    const uint32_t bucket = close_bucket_index(dht, public_key) * LCLIENT_NODES;
+    const uint32_t index = index_of_client_pk(&dht->close_clientlist[bucket], LCLIENT_NODES, public_key);
+    return index == UINT32_MAX ? UINT32_MAX : bucket + index;
+}
+
 /* Update ip_port of client if it's needed.
  */
 static void update_client(const Logger *log, const Mono_Time *mono_time, int index, Client_data *client,
@@ -750,6 +1164,34 @@ static int client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_ti
     return 1;
 }
 
+/* Same as client_or_ip_port_in_list() for the close list, keeping every node
+ * in the bucket of its public key. A node at ip_port in another bucket is
+ * dropped, so that add_to_close() can put public_key in its own bucket.
+ */
+static bool client_or_ip_port_in_close_list(DHT *dht, const uint8_t *public_key, IP_Port ip_port)
+{
+    uint32_t index = index_of_close_client(dht, public_key);
+
+    if (index != UINT32_MAX) {
+        update_client(dht->log, dht->mono_time, index, &dht->close_clientlist[index], ip_port);
+        return true;
+    }
+
+    index = index_of_client_ip_port(dht->close_clientlist, LCLIENT_LIST, &ip_port);
+
+    if (index == UINT32_MAX) {
+        return false;
+    }
+
+    if (index / LCLIENT_NODES == close_bucket_index(dht, public_key)) {
+        return client_or_ip_port_in_list(dht->log, dht->mono_time, &dht->close_clientlist[index], 1, public_key, ip_port);
+    }
+
+    LOGGER_DEBUG(dht->log, "close[%u]: dropping public_key of another bucket", index);
+    memset(&dht->close_clientlist[index], 0, sizeof(Client_data));
+    return false;
+}
+
 bool add_to_list(Node_format *nodes_list, uint32_t length, const uint8_t *pk, IP_Port ip_port,
                  const uint8_t *cmp_pk)
 {
@@ -857,8 +1299,27 @@ static int get_somewhat_close_nodes(const DHT *dht, const uint8_t *public_key, N
                                     Family sa_family, bool is_LAN, uint8_t want_good)
 {
     uint32_t num_nodes = 0;
+
+    /* Nodes in the bucket of public_key share a longer prefix with it than any
+     * other node in the close list, so search that bucket first. Next come
+     * the deeper buckets, whose nodes all differ from public_key in the same
+     * first bit, then the shallower ones from the deepest down. Once a bucket
+     * has filled the list, the buckets after it only hold nodes further away.
+     */
+    const unsigned int target = close_bucket_index(dht, public_key);
     get_close_nodes_inner(dht->mono_time, public_key, nodes_list, sa_family,
-                          dht->close_clientlist, LCLIENT_LIST, &num_nodes, is_LAN, 0);
+                          &dht->close_clientlist[target * LCLIENT_NODES], LCLIENT_NODES, &num_nodes, is_LAN, 0);
+
+    if (num_nodes < MAX_SENT_NODES) {
+        get_close_nodes_inner(dht->mono_time, public_key, nodes_list, sa_family,
+                              &dht->close_clientlist[(target + 1) * LCLIENT_NODES],
+                              (LCLIENT_LENGTH - target - 1) * LCLIENT_NODES, &num_nodes, is_LAN, 0);
+    }
+
+    for (unsigned int i = target; i > 0 && num_nodes < MAX_SENT_NODES; --i) {
+        get_close_nodes_inner(dht->mono_time, public_key, nodes_list, sa_family,
+                              &dht->close_clientlist[(i - 1) * LCLIENT_NODES], LCLIENT_NODES, &num_nodes, is_LAN, 0);
+    }
 
     /* TODO(irungentoo): uncomment this when hardening is added to close friend clients */
 #if 0
@@ -887,97 +1348,115 @@ int get_close_nodes(const DHT *dht, const uint8_t *public_key, Node_format *node
     return get_somewhat_close_nodes(dht, public_key, nodes_list, sa_family, is_LAN, want_good);
 }
 
-typedef struct DHT_Cmp_data {
-    const Mono_Time *mono_time;
-    const uint8_t *base_public_key;
-    Client_data entry;
-} DHT_Cmp_data;
-
-static bool incorrect_hardening(const IPPTsPng *assoc)
-{
-    return hardening_correct(&assoc->hardening) != HARDENING_ALL_OK;
-}
-
-static int cmp_dht_entry(const void *a, const void *b)
+static uint32_t copy_close_candidates(const Mono_Time *mono_time, const Client_data *client_list,
+                                      uint32_t client_list_length, Node_format *nodes, uint32_t num_nodes, uint32_t max_num)
 {
-    DHT_Cmp_data cmp1;
-    DHT_Cmp_data cmp2;
-    memcpy(&cmp1, a, sizeof(DHT_Cmp_data));
-    memcpy(&cmp2, b, sizeof(DHT_Cmp_data));
-    const Client_data entry1 = cmp1.entry;
-    const Client_data entry2 = cmp2.entry;
-    const uint8_t *cmp_public_key = cmp1.base_public_key;
+    for (uint32_t i = 0; i < client_list_length && num_nodes < max_num; ++i) {
+        const Client_data *const client = &client_list[i];
+        const IPPTsPng *const ipptp = client->assoc4.timestamp >= client->assoc6.timestamp
+                                      ? &client->assoc4 : &client->assoc6;
 
-    bool t1 = assoc_timeout(cmp1.mono_time, &entry1.assoc4) && assoc_timeout(cmp1.mono_time, &entry1.assoc6);
-    bool t2 = assoc_timeout(cmp2.mono_time, &entry2.assoc4) && assoc_timeout(cmp2.mono_time, &entry2.assoc6);
+        if (assoc_timeout(mono_time, ipptp)) {
+            continue;
+        }
 
-    if (t1 && t2) {
-        return 0;
+        memcpy(nodes[num_nodes].public_key, client->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        nodes[num_nodes].ip_port = ipptp->ip_port;
+        ++num_nodes;
     }
 
-    if (t1) {
-        return -1;
-    }
+    return num_nodes;
+}
 
-    if (t2) {
-        return 1;
+uint32_t dht_copy_close_candidates(const DHT *dht, Node_format *nodes, uint32_t max_num)
+{
+    uint32_t num_nodes = copy_close_candidates(dht->mono_time, dht->close_clientlist, LCLIENT_LIST, nodes, 0, max_num);
+
+    for (uint32_t i = 0; i < dht->num_friends; ++i) {
+        num_nodes = copy_close_candidates(dht->mono_time, dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS,
+                                          nodes, num_nodes, max_num);
     }
 
-    t1 = incorrect_hardening(&entry1.assoc4) && incorrect_hardening(&entry1.assoc6);
-    t2 = incorrect_hardening(&entry2.assoc4) && incorrect_hardening(&entry2.assoc6);
+    return num_nodes;
+}
 
-    if (t1 && !t2) {
-        return -1;
-    }
+int get_close_nodes_from(const Node_format *candidates, uint32_t num_candidates, const uint8_t *public_key,
+                         Node_format *nodes_list, bool is_LAN)
+{
+    memset(nodes_list, 0, MAX_SENT_NODES * sizeof(Node_format));
 
-    if (!t1 && t2) {
-        return 1;
-    }
+    uint32_t num_nodes = 0;
 
-    const int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
+    for (uint32_t i = 0; i < num_candidates; ++i) {
+        const Node_format *const candidate = &candidates[i];
 
-    if (close == 1) {
-        return 1;
-    }
+        if (index_of_node_pk(nodes_list, MAX_SENT_NODES, candidate->public_key) != UINT32_MAX) {
+            continue;
+        }
 
-    if (close == 2) {
-        return -1;
+        /* don't send LAN ips to non LAN peers */
+        if (ip_is_lan(candidate->ip_port.ip) && !is_LAN) {
+            continue;
+        }
+
+        if (num_nodes < MAX_SENT_NODES) {
+            nodes_list[num_nodes] = *candidate;
+            ++num_nodes;
+        } else {
+            add_to_list(nodes_list, MAX_SENT_NODES, candidate->public_key, candidate->ip_port, public_key);
+        }
     }
 
-    return 0;
+    return num_nodes;
 }
 
-/* Is it ok to store node with public_key in client.
+/* Find the entry in list that a node with public_key should replace: one that
+ * timed out, or else the one farthest from comp_public_key if public_key is
+ * closer. list is ordered from farthest to closest to comp_public_key.
  *
- * return 0 if node can't be stored.
- * return 1 if it can.
+ * return index into list or UINT32_MAX if the node should not be stored.
  */
-static unsigned int store_node_ok(const Client_data *client, const Mono_Time *mono_time, const uint8_t *public_key,
-                                  const uint8_t *comp_public_key)
+static uint32_t client_list_replaceable(const Mono_Time *mono_time, const Client_data *list, uint16_t length,
+                                        const uint8_t *public_key, const uint8_t *comp_public_key)
 {
-    return (assoc_timeout(mono_time, &client->assoc4)
-            && assoc_timeout(mono_time, &client->assoc6))
-           || id_closest(comp_public_key, client->public_key, public_key) == 2;
+    for (uint32_t i = 0; i < length; ++i) {
+        if (assoc_timeout(mono_time, &list[i].assoc4) && assoc_timeout(mono_time, &list[i].assoc6)) {
+            return i;
+        }
+    }
+
+    if (length > 0 && id_closest(comp_public_key, list[0].public_key, public_key) == 2) {
+        return 0;
+    }
+
+    return UINT32_MAX;
 }
 
-static void sort_client_list(Client_data *list, const Mono_Time *mono_time, unsigned int length,
-                             const uint8_t *comp_public_key)
+/* Move the entry at index, whose public key changed, to its place in list,
+ * keeping it ordered from farthest to closest to comp_public_key. Nodes timing
+ * out or coming back don't change the order, so only a new key moves an entry.
+ */
+static void client_list_move(Client_data *list, uint16_t length, uint32_t index, const uint8_t *comp_public_key)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
-    VLA(DHT_Cmp_data, cmp_list, length);
+    const Client_data entry = list[index];
+    memmove(&list[index], &list[index + 1], (length - index - 1) * sizeof(Client_data));
 
-    for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].mono_time = mono_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
-    }
+    /* Find the first of the other entries that is closer than the moved one. */
+    uint32_t low = 0;
+    uint32_t high = length - 1;
 
-    qsort(cmp_list, length, sizeof(DHT_Cmp_data), cmp_dht_entry);
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
 
-    for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
+        if (id_closest(comp_public_key, list[mid].public_key, entry.public_key) == 1) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
     }
+
+    memmove(&list[low + 1], &list[low], (length - 1 - low) * sizeof(Client_data));
+    list[low] = entry;
 }
 
 static void update_client_with_reset(const Mono_Time *mono_time, Client_data *client, const IP_Port *ip_port)
@@ -1005,17 +1484,8 @@ static void update_client_with_reset(const Mono_Time *mono_time, Client_data *cl
     memset(ipptp_clear, 0, sizeof(*ipptp_clear));
 }
 
-/* Replace a first bad (or empty) node with this one
- *  or replace a possibly bad node (tests failed or not done yet)
- *  that is further than any other in the list
- *  from the comp_public_key
- *  or replace a good node that is further
- *  than any other in the list from the comp_public_key
- *  and further than public_key.
- *
- * Do not replace any node if the list has no bad or possibly bad nodes
- *  and all nodes in the list are closer to comp_public_key
- *  than public_key.
+/* Replace a bad (or empty) node with this one, or else the node farthest
+ * from comp_public_key if this one is closer.
  *
  *  returns true when the item was stored, false otherwise */
 static bool replace_all(const Mono_Time *mono_time,
@@ -1029,17 +1499,17 @@ static bool replace_all(const Mono_Time *mono_time,
         return false;
     }
 
-    if (!store_node_ok(&list[1], mono_time, public_key, comp_public_key) &&
-            !store_node_ok(&list[0], mono_time, public_key, comp_public_key)) {
+    const uint32_t index = client_list_replaceable(mono_time, list, length, public_key, comp_public_key);
+
+    if (index == UINT32_MAX) {
         return false;
     }
 
-    sort_client_list(list, mono_time, length, comp_public_key);
-
-    Client_data *const client = &list[0];
+    Client_data *const client = &list[index];
     id_copy(client->public_key, public_key);
 
     update_client_with_reset(mono_time, client, &ip_port);
+    client_list_move(list, length, index, comp_public_key);
     return true;
 }
 
@@ -1052,15 +1522,9 @@ static bool replace_all(const Mono_Time *mono_time,
  */
 static int add_to_close(DHT *dht, const uint8_t *public_key, IP_Port ip_port, bool simulate)
 {
-    unsigned int index = bit_by_bit_cmp(public_key, dht->self_public_key);
-
-    if (index >= LCLIENT_LENGTH) {
-        index = LCLIENT_LENGTH - 1;
-    }
+    const unsigned int index = close_bucket_index(dht, public_key);
 
     for (uint32_t i = 0; i < LCLIENT_NODES; ++i) {
-        /* TODO(iphydf): write bounds checking test to catch the case that
-         * index is left as >= LCLIENT_LENGTH */
         Client_data *const client = &dht->close_clientlist[(index * LCLIENT_NODES) + i];
 
         if (!assoc_timeout(dht->mono_time, &client->assoc4) ||
@@ -1105,12 +1569,7 @@ static bool is_pk_in_client_list(const Client_data *list, unsigned int client_li
 
 static bool is_pk_in_close_list(DHT *dht, const uint8_t *public_key, IP_Port ip_port)
 {
-    unsigned int index = bit_by_bit_cmp(public_key, dht->self_public_key);
-
-    if (index >= LCLIENT_LENGTH) {
-        index = LCLIENT_LENGTH - 1;
-    }
-
+    const unsigned int index = close_bucket_index(dht, public_key);
     return is_pk_in_client_list(dht->close_clientlist + index * LCLIENT_NODES, LCLIENT_NODES, dht->mono_time, public_key,
                                 ip_port);
 }
@@ -1149,15 +1608,8 @@ static bool ping_node_from_getnodes_ok(DHT *dht, const uint8_t *public_key, IP_P
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
         DHT_Friend *dht_friend = &dht->friends_list[i];
 
-        bool store_ok = false;
-
-        if (store_node_ok(&dht_friend->client_list[1], dht->mono_time, public_key, dht_friend->public_key)) {
-            store_ok = true;
-        }
-
-        if (store_node_ok(&dht_friend->client_list[0], dht->mono_time, public_key, dht_friend->public_key)) {
-            store_ok = true;
-        }
+        const bool store_ok = client_list_replaceable(dht->mono_time, dht_friend->client_list, MAX_FRIEND_CLIENTS,
+                              public_key, dht_friend->public_key) != UINT32_MAX;
 
         unsigned int *const friend_num = &dht_friend->num_to_bootstrap;
         const uint32_t index = index_of_node_pk(dht_friend->to_bootstrap, *friend_num, public_key);
@@ -1196,11 +1648,14 @@ uint32_t addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *public_key)
         ip_port.ip.ip.v4.uint32 = ip_port.ip.ip.v6.uint32[3];
     }
 
+    if (dht->node_cache != nullptr) {
+        node_cache_seen(dht->node_cache, public_key, &ip_port, mono_time_get(dht->mono_time));
+    }
+
     /* NOTE: Current behavior if there are two clients with the same id is
      * to replace the first ip by the second.
      */
-    const bool in_close_list = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->close_clientlist, LCLIENT_LIST,
-                               public_key, ip_port);
+    const bool in_close_list = client_or_ip_port_in_close_list(dht, public_key, ip_port);
 
     /* add_to_close should be called only if !in_list (don't extract to variable) */
     if (in_close_list || add_to_close(dht, public_key, ip_port, 0)) {
@@ -1210,8 +1665,16 @@ uint32_t addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *public_key)
     DHT_Friend *friend_foundip = nullptr;
 
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
-        const bool in_list = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->friends_list[i].client_list,
-                             MAX_FRIEND_CLIENTS, public_key, ip_port);
+        Client_data *const client_list = dht->friends_list[i].client_list;
+        const bool known = index_of_client_pk(client_list, MAX_FRIEND_CLIENTS, public_key) != UINT32_MAX;
+        const bool in_list = client_or_ip_port_in_list(dht->log, dht->mono_time, client_list, MAX_FRIEND_CLIENTS,
+                             public_key, ip_port);
+
+        if (in_list && !known) {
+            /* public_key took over the entry of another key at ip_port. */
+            client_list_move(client_list, MAX_FRIEND_CLIENTS, index_of_client_pk(client_list, MAX_FRIEND_CLIENTS, public_key),
+                             dht->friends_list[i].public_key);
+        }
 
         /* replace_all should be called only if !in_list (don't extract to variable) */
         if (in_list
@@ -1281,18 +1744,20 @@ static void returnedip_ports(DHT *dht, IP_Port ip_port, const uint8_t *public_ke
     }
 
     if (id_equal(public_key, dht->self_public_key)) {
-        update_client_data(dht->mono_time, dht->close_clientlist, LCLIENT_LIST, ip_port, nodepublic_key, true);
+        const uint32_t index = index_of_close_client(dht, nodepublic_key);
+
+        if (index != UINT32_MAX) {
+            update_client_data(dht->mono_time, &dht->close_clientlist[index], 1, ip_port, nodepublic_key, true);
+        }
+
         return;
     }
 
-    for (uint32_t i = 0; i < dht->num_friends; ++i) {
-        if (id_equal(public_key, dht->friends_list[i].public_key)) {
-            Client_data *const client_list = dht->friends_list[i].client_list;
+    const uint32_t friend_num = index_of_friend_pk(dht, public_key);
 
-            if (update_client_data(dht->mono_time, client_list, MAX_FRIEND_CLIENTS, ip_port, nodepublic_key, false)) {
-                return;
-            }
-        }
+    if (friend_num != UINT32_MAX) {
+        Client_data *const client_list = dht->friends_list[friend_num].client_list;
+        update_client_data(dht->mono_time, client_list, MAX_FRIEND_CLIENTS, ip_port, nodepublic_key, false);
     }
 }
 
@@ -1306,20 +1771,25 @@ static int getnodes(DHT *dht, IP_Port ip_port, const uint8_t *public_key, const
         return -1;
     }
 
-    uint8_t plain_message[sizeof(Node_format) * 2] = {0};
+    /* The receiver, the node to send the response back to if any, and the
+     * time in milliseconds at which the request was sent. */
+    uint8_t plain_message[sizeof(Node_format) * 2 + sizeof(uint64_t)] = {0};
 
     Node_format receiver;
     memcpy(receiver.public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
     receiver.ip_port = ip_port;
     memcpy(plain_message, &receiver, sizeof(receiver));
 
+    const uint64_t sent_time = current_time_monotonic(dht->mono_time);
     uint64_t ping_id = 0;
 
     if (sendback_node != nullptr) {
         memcpy(plain_message + sizeof(receiver), sendback_node, sizeof(Node_format));
+        memcpy(plain_message + sizeof(receiver) * 2, &sent_time, sizeof(sent_time));
         ping_id = ping_array_add(dht->dht_harden_ping_array, dht->mono_time, plain_message, sizeof(plain_message));
     } else {
-        ping_id = ping_array_add(dht->dht_ping_array, dht->mono_time, plain_message, sizeof(receiver));
+        memcpy(plain_message + sizeof(receiver), &sent_time, sizeof(sent_time));
+        ping_id = ping_array_add(dht->dht_ping_array, dht->mono_time, plain_message, sizeof(receiver) + sizeof(sent_time));
     }
 
     if (ping_id == 0) {
@@ -1342,7 +1812,7 @@ static int getnodes(DHT *dht, IP_Port ip_port, const uint8_t *public_key, const
         return -1;
     }
 
-    return sendpacket(dht->net, ip_port, data, len);
+    return sendpacket_batch(dht->net, ip_port, data, len);
 }
 
 /* Send a send nodes response: message for IPv6 nodes */
@@ -1389,7 +1859,7 @@ static int sendnodes_ipv6(const DHT *dht, IP_Port ip_port, const uint8_t *public
         return -1;
     }
 
-    return sendpacket(dht->net, ip_port, data, len);
+    return sendpacket_batch(dht->net, ip_port, data, len);
 }
 
 #define CRYPTO_NODE_SIZE (CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t))
@@ -1410,7 +1880,10 @@ static int handle_getnodes(void *object, IP_Port source, const uint8_t *packet,
     uint8_t plain[CRYPTO_NODE_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
 
-    dht_get_shared_key_recv(dht, shared_key, packet + 1);
+    if (!dht_get_shared_key_recv_or_park(dht, shared_key, packet + 1, source, packet, length)) {
+        return true;
+    }
+
     const int len = decrypt_data_symmetric(
                         shared_key,
                         packet + 1 + CRYPTO_PUBLIC_KEY_SIZE,
@@ -1429,17 +1902,23 @@ static int handle_getnodes(void *object, IP_Port source, const uint8_t *packet,
     return false;
 }
 
-/* return false if no
+/* Check whether we sent a getnodes request to the node, and if so get the
+ * node to send the response back to and the time we sent the request at.
+ *
+ * return false if no
  * return true if yes */
 static bool sent_getnode_to_node(DHT *dht, const uint8_t *public_key, IP_Port node_ip_port, uint64_t ping_id,
-                                 Node_format *sendback_node)
+                                 Node_format *sendback_node, uint64_t *sent_time)
 {
-    uint8_t data[sizeof(Node_format) * 2];
+    uint8_t data[sizeof(Node_format) * 2 + sizeof(uint64_t)];
 
-    if (ping_array_check(dht->dht_ping_array, dht->mono_time, data, sizeof(data), ping_id) == sizeof(Node_format)) {
+    if (ping_array_check(dht->dht_ping_array, dht->mono_time, data, sizeof(data),
+                         ping_id) == sizeof(Node_format) + sizeof(uint64_t)) {
         memset(sendback_node, 0, sizeof(Node_format));
+        memcpy(sent_time, data + sizeof(Node_format), sizeof(uint64_t));
     } else if (ping_array_check(dht->dht_harden_ping_array, dht->mono_time, data, sizeof(data), ping_id) == sizeof(data)) {
         memcpy(sendback_node, data + sizeof(Node_format), sizeof(Node_format));
+        memcpy(sent_time, data + sizeof(Node_format) * 2, sizeof(uint64_t));
     } else {
         return false;
     }
@@ -1497,11 +1976,12 @@ static int handle_sendnodes_core(void *object, IP_Port source, const uint8_t *pa
     }
 
     Node_format sendback_node;
+    uint64_t sent_time;
 
     uint64_t ping_id;
     memcpy(&ping_id, plain + 1 + data_size, sizeof(ping_id));
 
-    if (!sent_getnode_to_node(dht, packet + 1, source, ping_id, &sendback_node)) {
+    if (!sent_getnode_to_node(dht, packet + 1, source, ping_id, &sendback_node, &sent_time)) {
         return 1;
     }
 
@@ -1523,12 +2003,201 @@ static int handle_sendnodes_core(void *object, IP_Port source, const uint8_t *pa
     /* store the address the *request* was sent to */
     addto_lists(dht, source, packet + 1);
 
+    if (dht->node_cache != nullptr) {
+        const uint64_t rtt = current_time_monotonic(dht->mono_time) - sent_time;
+        node_cache_answered(dht->node_cache, packet + 1, &source, min_u64(rtt, UINT32_MAX), mono_time_get(dht->mono_time));
+    }
+
     *num_nodes_out = num_nodes;
 
     send_hardening_getnode_res(dht, &sendback_node, packet + 1, plain + 1, data_size);
     return 0;
 }
 
+static void bootstrap_lookup_start(DHT *dht)
+{
+    if (dht->bootstrap.active) {
+        return;
+    }
+
+    memset(&dht->bootstrap, 0, sizeof(Bootstrap_Lookup));
+    dht->bootstrap.active = true;
+    dht->bootstrap.start_time = current_time_monotonic(dht->mono_time);
+    dht->bootstrap.window = BOOTSTRAP_LOOKUP_WINDOW;
+}
+
+/* Add a node to the nodes of the bootstrap lookup, keeping them ordered by
+ * distance to our key. Drops the farthest node if there is no room.
+ *
+ * return the index of the node, or UINT32_MAX if it is farther than all
+ *   nodes of a full list.
+ */
+static uint32_t bootstrap_lookup_add(DHT *dht, const uint8_t *public_key, IP_Port ip_port)
+{
+    Bootstrap_Lookup *const lookup = &dht->bootstrap;
+    uint32_t pos = 0;
+
+    for (; pos < lookup->num_nodes; ++pos) {
+        const uint8_t *const node_pk = lookup->nodes[pos].node.public_key;
+
+        if (id_equal(node_pk, public_key)) {
+            return pos;
+        }
+
+        if (id_closest(dht->self_public_key, public_key, node_pk) == 1) {
+            break;
+        }
+    }
+
+    if (pos == BOOTSTRAP_LOOKUP_NODES) {
+        return UINT32_MAX;
+    }
+
+    if (lookup->num_nodes == BOOTSTRAP_LOOKUP_NODES) {
+        if (lookup->nodes[lookup->num_nodes - 1].state == BOOTSTRAP_NODE_ASKED) {
+            --lookup->in_flight;
+        }
+
+        --lookup->num_nodes;
+    }
+
+    memmove(&lookup->nodes[pos + 1], &lookup->nodes[pos], (lookup->num_nodes - pos) * sizeof(Bootstrap_Node));
+    ++lookup->num_nodes;
+
+    Bootstrap_Node *const node = &lookup->nodes[pos];
+    memset(node, 0, sizeof(Bootstrap_Node));
+    memcpy(node->node.public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    node->node.ip_port = ip_port;
+    node->state = BOOTSTRAP_NODE_NEW;
+    return pos;
+}
+
+static void bootstrap_lookup_ask(DHT *dht, Bootstrap_Node *node)
+{
+    getnodes(dht, node->node.ip_port, node->node.public_key, dht->self_public_key, nullptr);
+    node->state = BOOTSTRAP_NODE_ASKED;
+    node->sent_time = current_time_monotonic(dht->mono_time);
+    ++dht->bootstrap.in_flight;
+    ++dht->bootstrap.requests;
+}
+
+/* Ask the closest nodes that haven't been asked yet until the window is full. */
+static void bootstrap_lookup_send(DHT *dht)
+{
+    Bootstrap_Lookup *const lookup = &dht->bootstrap;
+
+    for (uint32_t i = 0; i < lookup->num_nodes && lookup->in_flight < lookup->window; ++i) {
+        if (lookup->nodes[i].state == BOOTSTRAP_NODE_NEW) {
+            bootstrap_lookup_ask(dht, &lookup->nodes[i]);
+        }
+    }
+}
+
+/* Handle the answer of a node to a getnodes request. */
+static void bootstrap_lookup_answered(DHT *dht, const uint8_t *public_key, const Node_format *nodes,
+                                      uint32_t num_nodes)
+{
+    Bootstrap_Lookup *const lookup = &dht->bootstrap;
+
+    if (!lookup->active) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < lookup->num_nodes; ++i) {
+        Bootstrap_Node *const node = &lookup->nodes[i];
+
+        if (node->state == BOOTSTRAP_NODE_ASKED && id_equal(node->node.public_key, public_key)) {
+            node->state = BOOTSTRAP_NODE_ANSWERED;
+            --lookup->in_flight;
+            ++lookup->answers;
+            lookup->window = min_u32(lookup->window + 1, BOOTSTRAP_LOOKUP_MAX_WINDOW);
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        if (ipport_isset(&nodes[i].ip_port) && !id_equal(nodes[i].public_key, dht->self_public_key)) {
+            bootstrap_lookup_add(dht, nodes[i].public_key, nodes[i].ip_port);
+        }
+    }
+
+    bootstrap_lookup_send(dht);
+}
+
+static uint32_t good_close_nodes(const DHT *dht, uint32_t max_nodes)
+{
+    uint32_t num = 0;
+
+    for (uint32_t i = 0; i < LCLIENT_LIST && num < max_nodes; ++i) {
+        const Client_data *const client = &dht->close_clientlist[i];
+
+        if (!assoc_timeout(dht->mono_time, &client->assoc4) || !assoc_timeout(dht->mono_time, &client->assoc6)) {
+            ++num;
+        }
+    }
+
+    return num;
+}
+
+/* return true if the closest nodes have all answered or timed out and the
+ *   close list is populated, or if there is no node left to ask.
+ */
+static bool bootstrap_lookup_done(const DHT *dht)
+{
+    const Bootstrap_Lookup *const lookup = &dht->bootstrap;
+    bool closest_settled = true;
+    bool any_new = false;
+
+    for (uint32_t i = 0; i < lookup->num_nodes; ++i) {
+        const Bootstrap_Node_State state = lookup->nodes[i].state;
+
+        if (state == BOOTSTRAP_NODE_NEW) {
+            any_new = true;
+        }
+
+        if (i < BOOTSTRAP_LOOKUP_DONE_NODES && (state == BOOTSTRAP_NODE_NEW || state == BOOTSTRAP_NODE_ASKED)) {
+            closest_settled = false;
+        }
+    }
+
+    if (!any_new && lookup->in_flight == 0) {
+        return true;
+    }
+
+    return closest_settled && good_close_nodes(dht, BOOTSTRAP_LOOKUP_DONE_NODES) == BOOTSTRAP_LOOKUP_DONE_NODES;
+}
+
+/* Time out lost requests, send new ones and end the lookup when it is done. */
+static void do_bootstrap_lookup(DHT *dht)
+{
+    Bootstrap_Lookup *const lookup = &dht->bootstrap;
+
+    if (!lookup->active) {
+        return;
+    }
+
+    const uint64_t now = current_time_monotonic(dht->mono_time);
+
+    for (uint32_t i = 0; i < lookup->num_nodes; ++i) {
+        Bootstrap_Node *const node = &lookup->nodes[i];
+
+        if (node->state == BOOTSTRAP_NODE_ASKED && now - node->sent_time >= BOOTSTRAP_LOOKUP_TIMEOUT) {
+            node->state = BOOTSTRAP_NODE_TIMED_OUT;
+            --lookup->in_flight;
+            lookup->window = max_u32(lookup->window / 2, 1);
+        }
+    }
+
+    if (bootstrap_lookup_done(dht) || now - lookup->start_time >= BOOTSTRAP_LOOKUP_MAX_TIME * 1000) {
+        LOGGER_DEBUG(dht->log, "bootstrap lookup done after %lu ms: %u requests, %u answers",
+                     (unsigned long)(now - lookup->start_time), lookup->requests, lookup->answers);
+        lookup->active = false;
+        return;
+    }
+
+    bootstrap_lookup_send(dht);
+}
+
 static int handle_sendnodes_ipv6(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
 {
     DHT *const dht = (DHT *)object;
@@ -1539,6 +2208,8 @@ static int handle_sendnodes_ipv6(void *object, IP_Port source, const uint8_t *pa
         return 1;
     }
 
+    bootstrap_lookup_answered(dht, packet + 1, plain_nodes, num_nodes);
+
     if (num_nodes == 0) {
         return 0;
     }
@@ -1559,7 +2230,7 @@ static int handle_sendnodes_ipv6(void *object, IP_Port source, const uint8_t *pa
 int dht_addfriend(DHT *dht, const uint8_t *public_key, dht_ip_cb *ip_callback,
                   void *data, int32_t number, uint16_t *lock_count)
 {
-    const uint32_t friend_num = index_of_friend_pk(dht->friends_list, dht->num_friends, public_key);
+    const uint32_t friend_num = index_of_friend_pk(dht, public_key);
 
     uint16_t lock_num;
 
@@ -1583,6 +2254,14 @@ int dht_addfriend(DHT *dht, const uint8_t *public_key, dht_ip_cb *ip_callback,
         return 0;
     }
 
+    if (dht->num_friends == UINT16_MAX) {
+        return -1;
+    }
+
+    if (pk_index_reserve(&dht->friends_index, dht->num_friends + 1) == -1) {
+        return -1;
+    }
+
     DHT_Friend *const temp = (DHT_Friend *)realloc(dht->friends_list, sizeof(DHT_Friend) * (dht->num_friends + 1));
 
     if (temp == nullptr) {
@@ -1595,6 +2274,7 @@ int dht_addfriend(DHT *dht, const uint8_t *public_key, dht_ip_cb *ip_callback,
     memcpy(dht_friend->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
 
     dht_friend->nat.nat_ping_id = random_u64();
+    pk_index_add(&dht->friends_index, public_key, dht->num_friends);
     ++dht->num_friends;
 
     lock_num = dht_friend->lock_count;
@@ -1615,7 +2295,7 @@ int dht_addfriend(DHT *dht, const uint8_t *public_key, dht_ip_cb *ip_callback,
 
 int dht_delfriend(DHT *dht, const uint8_t *public_key, uint16_t lock_count)
 {
-    const uint32_t friend_num = index_of_friend_pk(dht->friends_list, dht->num_friends, public_key);
+    const uint32_t friend_num = index_of_friend_pk(dht, public_key);
 
     if (friend_num == UINT32_MAX) {
         return -1;
@@ -1632,9 +2312,11 @@ int dht_delfriend(DHT *dht, const uint8_t *public_key, uint16_t lock_count)
         return 0;
     }
 
+    pk_index_remove(&dht->friends_index, public_key);
     --dht->num_friends;
 
     if (dht->num_friends != friend_num) {
+        pk_index_move(&dht->friends_index, dht->friends_list[dht->num_friends].public_key, friend_num);
         memcpy(&dht->friends_list[friend_num],
                &dht->friends_list[dht->num_friends],
                sizeof(DHT_Friend));
@@ -1662,7 +2344,7 @@ int dht_getfriendip(const DHT *dht, const uint8_t *public_key, IP_Port *ip_port)
     ip_reset(&ip_port->ip);
     ip_port->port = 0;
 
-    const uint32_t friend_index = index_of_friend_pk(dht->friends_list, dht->num_friends, public_key);
+    const uint32_t friend_index = index_of_friend_pk(dht, public_key);
 
     if (friend_index == UINT32_MAX) {
         return -1;
@@ -1692,7 +2374,7 @@ int dht_getfriendip(const DHT *dht, const uint8_t *public_key, IP_Port *ip_port)
 
 /* returns number of nodes not in kill-timeout */
 static uint8_t do_ping_and_sendnode_requests(DHT *dht, uint64_t *lastgetnode, const uint8_t *public_key,
-        Client_data *list, uint32_t list_count, uint32_t *bootstrap_times, bool sortable)
+        Client_data *list, uint32_t list_count, uint32_t *bootstrap_times)
 {
     uint8_t not_kill = 0;
     const uint64_t temp_time = mono_time_get(dht->mono_time);
@@ -1700,8 +2382,6 @@ static uint8_t do_ping_and_sendnode_requests(DHT *dht, uint64_t *lastgetnode, co
     uint32_t num_nodes = 0;
     VLA(Client_data *, client_list, list_count * 2);
     VLA(IPPTsPng *, assoc_list, list_count * 2);
-    unsigned int sort = 0;
-    bool sort_ok = false;
 
     for (uint32_t i = 0; i < list_count; ++i) {
         /* If node is not dead. */
@@ -1713,7 +2393,6 @@ static uint8_t do_ping_and_sendnode_requests(DHT *dht, uint64_t *lastgetnode, co
             IPPTsPng *const assoc = assocs[j];
 
             if (!mono_time_is_timeout(dht->mono_time, assoc->timestamp, KILL_NODE_TIMEOUT)) {
-                sort = 0;
                 ++not_kill;
 
                 if (mono_time_is_timeout(dht->mono_time, assoc->last_pinged, PING_INTERVAL)) {
@@ -1727,21 +2406,10 @@ static uint8_t do_ping_and_sendnode_requests(DHT *dht, uint64_t *lastgetnode, co
                     assoc_list[num_nodes] = assoc;
                     ++num_nodes;
                 }
-            } else {
-                ++sort;
-
-                /* Timed out should be at beginning, if they are not, sort the list. */
-                if (sort > 1 && sort < (((j + 1) * 2) - 1)) {
-                    sort_ok = true;
-                }
             }
         }
     }
 
-    if (sortable && sort_ok) {
-        sort_client_list(list, dht->mono_time, list_count, public_key);
-    }
-
     if ((num_nodes != 0) && (mono_time_is_timeout(dht->mono_time, *lastgetnode, GET_NODE_INTERVAL)
                              || *bootstrap_times < MAX_BOOTSTRAP_TIMES)) {
         uint32_t rand_node = random_u32() % num_nodes;
@@ -1775,8 +2443,7 @@ static void do_dht_friends(DHT *dht)
         dht_friend->num_to_bootstrap = 0;
 
         do_ping_and_sendnode_requests(dht, &dht_friend->lastgetnode, dht_friend->public_key, dht_friend->client_list,
-                                      MAX_FRIEND_CLIENTS,
-                                      &dht_friend->bootstrap_times, 1);
+                                      MAX_FRIEND_CLIENTS, &dht_friend->bootstrap_times);
     }
 }
 
@@ -1792,8 +2459,8 @@ static void do_Close(DHT *dht)
     dht->num_to_bootstrap = 0;
 
     uint8_t not_killed = do_ping_and_sendnode_requests(
-                             dht, &dht->close_lastgetnodes, dht->self_public_key, dht->close_clientlist, LCLIENT_LIST, &dht->close_bootstrap_times,
-                             0);
+                             dht, &dht->close_lastgetnodes, dht->self_public_key, dht->close_clientlist, LCLIENT_LIST,
+                             &dht->close_bootstrap_times);
 
     if (not_killed != 0) {
         return;
@@ -1827,9 +2494,38 @@ void dht_getnodes(DHT *dht, const IP_Port *from_ipp, const uint8_t *from_id, con
     getnodes(dht, *from_ipp, from_id, which_id, nullptr);
 }
 
+uint64_t dht_bootstrap_lookup_next_run(const DHT *dht)
+{
+    const Bootstrap_Lookup *const lookup = &dht->bootstrap;
+
+    if (!lookup->active) {
+        return UINT64_MAX;
+    }
+
+    uint64_t next_run = lookup->start_time + BOOTSTRAP_LOOKUP_MAX_TIME * 1000;
+
+    for (uint32_t i = 0; i < lookup->num_nodes; ++i) {
+        if (lookup->nodes[i].state == BOOTSTRAP_NODE_ASKED) {
+            next_run = min_u64(next_run, lookup->nodes[i].sent_time + BOOTSTRAP_LOOKUP_TIMEOUT);
+        }
+    }
+
+    return next_run;
+}
+
 void dht_bootstrap(DHT *dht, IP_Port ip_port, const uint8_t *public_key)
 {
-    getnodes(dht, ip_port, public_key, dht->self_public_key, nullptr);
+    bootstrap_lookup_start(dht);
+    const uint32_t index = bootstrap_lookup_add(dht, public_key, ip_port);
+
+    if (index == UINT32_MAX || dht->bootstrap.nodes[index].state != BOOTSTRAP_NODE_NEW) {
+        getnodes(dht, ip_port, public_key, dht->self_public_key, nullptr);
+        return;
+    }
+
+    /* Nodes we are told to bootstrap from are asked right away, whatever the
+     * window says. */
+    bootstrap_lookup_ask(dht, &dht->bootstrap.nodes[index]);
 }
 int dht_bootstrap_from_address(DHT *dht, const char *address, uint8_t ipv6enabled,
                                uint16_t port, const uint8_t *public_key)
@@ -1867,20 +2563,20 @@ int dht_bootstrap_from_address(DHT *dht, const char *address, uint8_t ipv6enable
  */
 int route_packet(const DHT *dht, const uint8_t *public_key, const uint8_t *packet, uint16_t length)
 {
-    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
-        if (id_equal(public_key, dht->close_clientlist[i].public_key)) {
-            const Client_data *const client = &dht->close_clientlist[i];
-            const IPPTsPng *const assocs[] = { &client->assoc6, &client->assoc4, nullptr };
+    const uint32_t index = index_of_close_client(dht, public_key);
 
-            for (const IPPTsPng * const *it = assocs; *it; ++it) {
-                const IPPTsPng *const assoc = *it;
+    if (index == UINT32_MAX) {
+        return -1;
+    }
 
-                if (ip_isset(&assoc->ip_port.ip)) {
-                    return sendpacket(dht->net, assoc->ip_port, packet, length);
-                }
-            }
+    const Client_data *const client = &dht->close_clientlist[index];
+    const IPPTsPng *const assocs[] = { &client->assoc6, &client->assoc4, nullptr };
 
-            break;
+    for (const IPPTsPng * const *it = assocs; *it; ++it) {
+        const IPPTsPng *const assoc = *it;
+
+        if (ip_isset(&assoc->ip_port.ip)) {
+            return sendpacket(dht->net, assoc->ip_port, packet, length);
         }
     }
 
@@ -1970,7 +2666,7 @@ static int friend_iplist(const DHT *dht, IP_Port *ip_portlist, uint16_t friend_n
  */
 int route_tofriend(const DHT *dht, const uint8_t *friend_id, const uint8_t *packet, uint16_t length)
 {
-    const uint32_t num = index_of_friend_pk(dht->friends_list, dht->num_friends, friend_id);
+    const uint32_t num = index_of_friend_pk(dht, friend_id);
 
     if (num == UINT32_MAX) {
         return 0;
@@ -2018,7 +2714,7 @@ int route_tofriend(const DHT *dht, const uint8_t *friend_id, const uint8_t *pack
  */
 static int routeone_tofriend(DHT *dht, const uint8_t *friend_id, const uint8_t *packet, uint16_t length)
 {
-    const uint32_t num = index_of_friend_pk(dht->friends_list, dht->num_friends, friend_id);
+    const uint32_t num = index_of_friend_pk(dht, friend_id);
 
     if (num == UINT32_MAX) {
         return 0;
@@ -2106,7 +2802,7 @@ static int handle_NATping(void *object, IP_Port source, const uint8_t *source_pu
     uint64_t ping_id;
     memcpy(&ping_id, packet + 1, sizeof(uint64_t));
 
-    uint32_t friendnumber = index_of_friend_pk(dht->friends_list, dht->num_friends, source_pubkey);
+    uint32_t friendnumber = index_of_friend_pk(dht, source_pubkey);
 
     if (friendnumber == UINT32_MAX) {
         return 1;
@@ -2357,21 +3053,20 @@ static int send_hardening_getnode_res(const DHT *dht, const Node_format *sendto,
     return sendpacket(dht->net, sendto->ip_port, packet, len);
 }
 
-/* TODO(irungentoo): improve */
 static IPPTsPng *get_closelist_IPPTsPng(DHT *dht, const uint8_t *public_key, Family sa_family)
 {
-    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
-        if (!id_equal(dht->close_clientlist[i].public_key, public_key)) {
-            continue;
-        }
+    const uint32_t index = index_of_close_client(dht, public_key);
 
-        if (net_family_is_ipv4(sa_family)) {
-            return &dht->close_clientlist[i].assoc4;
-        }
+    if (index == UINT32_MAX) {
+        return nullptr;
+    }
 
-        if (net_family_is_ipv6(sa_family)) {
-            return &dht->close_clientlist[i].assoc6;
-        }
+    if (net_family_is_ipv4(sa_family)) {
+        return &dht->close_clientlist[index].assoc4;
+    }
+
+    if (net_family_is_ipv6(sa_family)) {
+        return &dht->close_clientlist[index].assoc6;
     }
 
     return nullptr;
@@ -2660,11 +3355,20 @@ static int cryptopacket_handle(void *object, IP_Port source, const uint8_t *pack
 
     // Check if request is for us.
     if (id_equal(packet + 1, dht->self_public_key)) {
-        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+        if (length <= CRYPTO_SIZE + CRYPTO_MAC_SIZE || length > MAX_CRYPTO_REQUEST_SIZE) {
+            return 1;
+        }
+
+        const uint8_t *const public_key = packet + 1 + CRYPTO_PUBLIC_KEY_SIZE;
+        uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+        if (!dht_get_shared_key_recv_or_park(dht, shared_key, public_key, source, packet, length)) {
+            return 1;
+        }
+
         uint8_t data[MAX_CRYPTO_REQUEST_SIZE];
         uint8_t number;
-        const int len = handle_request(dht->self_public_key, dht->self_secret_key, public_key,
-                                       data, &number, packet, length);
+        const int len = unpack_request(shared_key, data, &number, packet, length);
 
         if (len == -1 || len == 0) {
             return 1;
@@ -2708,6 +3412,15 @@ DHT *new_dht(const Logger *log, Mono_Time *mono_time, Networking_Core *net, bool
     dht->net = net;
 
     dht->hole_punching_enabled = holepunching_enabled;
+    pk_index_init(&dht->friends_index, &dht_friend_pk, dht);
+
+    dht->shared_keys_recv = shared_keys_new(DEFAULT_SHARED_KEYS_CAPACITY);
+    dht->shared_keys_sent = shared_keys_new(DEFAULT_SHARED_KEYS_CAPACITY);
+
+    if (dht->shared_keys_recv == nullptr || dht->shared_keys_sent == nullptr) {
+        kill_dht(dht);
+        return nullptr;
+    }
 
     dht->ping = ping_new(mono_time, dht);
 
@@ -2749,12 +3462,23 @@ DHT *new_dht(const Logger *log, Mono_Time *mono_time, Networking_Core *net, bool
 
 void do_dht(DHT *dht)
 {
+    /* The bootstrap lookup runs on every call, so that lost requests are
+     * replaced without waiting for the rest of the DHT's once per second
+     * work. */
+    if (dht->bootstrap.active) {
+        networking_batch_start(dht->net);
+        do_bootstrap_lookup(dht);
+        networking_batch_end(dht->net);
+    }
+
     if (dht->last_run == mono_time_get(dht->mono_time)) {
         return;
     }
 
+    networking_batch_start(dht->net);
+
     // Load friends/clients if first call to do_dht
-    if (dht->loaded_num_nodes) {
+    if (dht->loaded_num_nodes || (dht->node_cache != nullptr && !dht->node_cache_seeded)) {
         dht_connect_after_load(dht);
     }
 
@@ -2765,6 +3489,7 @@ void do_dht(DHT *dht)
 #if DHT_HARDENING
     do_hardening(dht);
 #endif
+    networking_batch_end(dht->net);
     dht->last_run = mono_time_get(dht->mono_time);
 }
 
@@ -2777,8 +3502,13 @@ void kill_dht(DHT *dht)
     ping_array_kill(dht->dht_ping_array);
     ping_array_kill(dht->dht_harden_ping_array);
     ping_kill(dht->ping);
+    kill_shared_key_pool(dht->shared_key_pool);
+    shared_keys_free(dht->shared_keys_recv);
+    shared_keys_free(dht->shared_keys_sent);
     free(dht->friends_list);
+    pk_index_free(&dht->friends_index);
     free(dht->loaded_nodes_list);
+    node_cache_close(dht->node_cache);
     free(dht);
 }
 
@@ -2881,6 +3611,41 @@ void dht_save(const DHT *dht, uint8_t *data)
 /* Bootstrap from this number of nodes every time dht_connect_after_load() is called */
 #define SAVE_BOOTSTAP_FREQUENCY 8
 
+/* Bootstrap from this number of the best nodes in the node cache at once. */
+#define NODE_CACHE_BOOTSTRAP_NODES 32
+
+bool dht_open_node_cache(DHT *dht, const char *path)
+{
+    Node_Cache *const cache = node_cache_open(dht->log, path, DEFAULT_NODE_CACHE_NODES);
+
+    if (cache == nullptr) {
+        return false;
+    }
+
+    node_cache_close(dht->node_cache);
+    dht->node_cache = cache;
+    dht->node_cache_seeded = false;
+    return true;
+}
+
+/* Send getnodes requests to the best nodes in the node cache all at once.
+ * The ones that are still around answer within a round trip and fill the
+ * close list.
+ */
+static void bootstrap_from_node_cache(DHT *dht)
+{
+    uint8_t public_keys[NODE_CACHE_BOOTSTRAP_NODES * CRYPTO_PUBLIC_KEY_SIZE];
+    IP_Port ip_ports[NODE_CACHE_BOOTSTRAP_NODES];
+    const uint32_t num = node_cache_best(dht->node_cache, public_keys, ip_ports, NODE_CACHE_BOOTSTRAP_NODES,
+                                         mono_time_get(dht->mono_time));
+
+    LOGGER_DEBUG(dht->log, "bootstrapping from %u cached nodes", num);
+
+    for (uint32_t i = 0; i < num; ++i) {
+        dht_bootstrap(dht, ip_ports[i], public_keys + i * CRYPTO_PUBLIC_KEY_SIZE);
+    }
+}
+
 /* Start sending packets after DHT loaded_friends_list and loaded_clients_list are set */
 int dht_connect_after_load(DHT *dht)
 {
@@ -2888,6 +3653,11 @@ int dht_connect_after_load(DHT *dht)
         return -1;
     }
 
+    if (dht->node_cache != nullptr && !dht->node_cache_seeded) {
+        dht->node_cache_seeded = true;
+        bootstrap_from_node_cache(dht);
+    }
+
     if (!dht->loaded_nodes_list) {
         return -1;
     }
@@ -14,9 +14,14 @@
 #include "mono_time.h"
 #include "network.h"
 #include "ping_array.h"
+#include "shared_key_pool.h"
 
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Encryption and signature keys definition */
 #define ENC_PUBLIC_KEY CRYPTO_PUBLIC_KEY_SIZE
 #define ENC_SECRET_KEY CRYPTO_SECRET_KEY_SIZE
@@ -190,6 +195,16 @@ int unpack_ip_port(IP_Port *ip_port, const uint8_t *data, uint16_t length, bool
  */
 int pack_nodes(uint8_t *data, uint16_t length, const Node_format *nodes, uint16_t number);
 
+/* Encrypt plain with shared_key and build a DHT packet of the given type sent
+ * by public_key in packet (must be plain_length + 1 + CRYPTO_PUBLIC_KEY_SIZE +
+ * CRYPTO_NONCE_SIZE + CRYPTO_MAC_SIZE big).
+ *
+ * return length of the packet on success.
+ * return -1 on failure.
+ */
+int dht_create_packet(const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE], const uint8_t *shared_key,
+                      const uint8_t type, const uint8_t *plain, size_t plain_length, uint8_t *packet);
+
 /* Unpack data of length into nodes of size max_num_nodes.
  * Put the length of the data processed in processed_data_len.
  * tcp_enabled sets if TCP nodes are expected (true) or not (false).
@@ -202,21 +217,34 @@ int unpack_nodes(Node_format *nodes, uint16_t max_num_nodes, uint16_t *processed
 
 
 /*----------------------------------------------------------------------------------*/
-/* struct to store some shared keys so we don't have to regenerate them for each request. */
-#define MAX_KEYS_PER_SLOT 4
-#define KEYS_TIMEOUT 600
-
-typedef struct Shared_Key {
-    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
-    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    uint32_t times_requested;
-    bool stored;
-    uint64_t time_last_requested;
-} Shared_Key;
-
-typedef struct Shared_Keys {
-    Shared_Key keys[256 * MAX_KEYS_PER_SLOT];
-} Shared_Keys;
+/* Cache of shared keys so we don't have to regenerate them for each request.
+ * Holds up to a fixed number of keys and evicts the least recently used one
+ * when full.
+ */
+#define DEFAULT_SHARED_KEYS_CAPACITY 1024
+
+typedef struct Shared_Keys Shared_Keys;
+
+/* return a new cache holding up to capacity keys, or NULL on failure. */
+Shared_Keys *shared_keys_new(uint32_t capacity);
+
+void shared_keys_free(Shared_Keys *shared_keys);
+
+/* Number of lookups that found their key in the cache, that had to compute it,
+ * and of keys dropped to make room for a new one.
+ */
+uint64_t shared_keys_hits(const Shared_Keys *shared_keys);
+uint64_t shared_keys_misses(const Shared_Keys *shared_keys);
+uint64_t shared_keys_evictions(const Shared_Keys *shared_keys);
+
+/* Copy the cached key for public_key into shared_key.
+ *
+ * return true if the key was in the cache.
+ */
+bool shared_keys_lookup(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *public_key);
+
+/* Add the key for public_key to the cache, replacing the one already there. */
+void shared_keys_insert(Shared_Keys *shared_keys, const uint8_t *public_key, const uint8_t *shared_key);
 
 /*----------------------------------------------------------------------------------*/
 
@@ -248,8 +276,8 @@ const uint8_t *dht_get_friend_public_key(const DHT *dht, uint32_t friend_num);
  * If shared key is already in shared_keys, copy it to shared_key.
  * else generate it into shared_key and copy it to shared_keys
  */
-void get_shared_key(const Mono_Time *mono_time, Shared_Keys *shared_keys, uint8_t *shared_key,
-                    const uint8_t *secret_key, const uint8_t *public_key);
+void get_shared_key(Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *secret_key,
+                    const uint8_t *public_key);
 
 /* Copy shared_key to encrypt/decrypt DHT packet from public_key into shared_key
  * for packets that we receive.
@@ -261,6 +289,49 @@ void dht_get_shared_key_recv(DHT *dht, uint8_t *shared_key, const uint8_t *publi
  */
 void dht_get_shared_key_sent(DHT *dht, uint8_t *shared_key, const uint8_t *public_key);
 
+/* Replace the caches of shared keys for received and sent packets by empty
+ * ones holding up to capacity keys each.
+ *
+ * return true on success.
+ */
+bool dht_set_shared_keys_capacity(DHT *dht, uint32_t capacity);
+
+/* The caches of shared keys for received and sent packets. */
+const Shared_Keys *dht_get_shared_keys_recv(const DHT *dht);
+const Shared_Keys *dht_get_shared_keys_sent(const DHT *dht);
+
+/* Compute the shared keys missing from the DHT's caches on num_threads threads
+ * instead of in the packet handlers. Packets waiting for their key are handled
+ * again by do_dht_shared_key_pool().
+ *
+ * return true on success.
+ */
+bool dht_start_shared_key_pool(DHT *dht, uint16_t num_threads);
+
+/* return the DHT's shared key pool, or NULL if it computes keys itself. */
+const Shared_Key_Pool *dht_get_shared_key_pool(const DHT *dht);
+
+/* Copy the shared key between the DHT's secret key and public_key from
+ * shared_keys into shared_key. If it is missing and the DHT has a shared key
+ * pool, park packet, the packet being handled, until the key is ready.
+ * Otherwise compute the key and add it to shared_keys.
+ *
+ * return true if shared_key holds the key.
+ * return false if the handler must give up on packet for now.
+ */
+bool dht_get_shared_key_or_park(DHT *dht, Shared_Keys *shared_keys, uint8_t *shared_key, const uint8_t *public_key,
+                                IP_Port source, const uint8_t *packet, uint16_t length);
+
+/* Same as dht_get_shared_key_or_park() with the cache for received packets. */
+bool dht_get_shared_key_recv_or_park(DHT *dht, uint8_t *shared_key, const uint8_t *public_key, IP_Port source,
+                                     const uint8_t *packet, uint16_t length);
+
+/* Drop the packets waiting for keys for shared_keys before it is freed. */
+void dht_forget_shared_keys(DHT *dht, const Shared_Keys *shared_keys);
+
+/* Handle the packets whose shared keys are ready. Call this after networking_poll(). */
+void do_dht_shared_key_pool(DHT *dht, void *userdata);
+
 void dht_getnodes(DHT *dht, const IP_Port *from_ipp, const uint8_t *from_id, const uint8_t *which_id);
 
 typedef void dht_ip_cb(void *object, int32_t number, IP_Port ip_port);
@@ -299,6 +370,24 @@ int dht_delfriend(DHT *dht, const uint8_t *public_key, uint16_t lock_count);
  */
 int dht_getfriendip(const DHT *dht, const uint8_t *public_key, IP_Port *ip_port);
 
+#define PK_DISTANCE_WORDS (CRYPTO_PUBLIC_KEY_SIZE / sizeof(uint64_t))
+
+/* XOR distance between two public keys, as big endian words so that it can be
+ * compared word by word.
+ */
+typedef struct Pk_Distance {
+    uint64_t words[PK_DISTANCE_WORDS];
+} Pk_Distance;
+
+/* Compute the distance between pk and pk1. */
+void pk_distance(Pk_Distance *distance, const uint8_t *pk, const uint8_t *pk1);
+
+/* return -1 if distance1 is smaller than distance2.
+ * return 0 if they are equal.
+ * return 1 if distance1 is larger.
+ */
+int pk_distance_cmp(const Pk_Distance *distance1, const Pk_Distance *distance2);
+
 /* Compares pk1 and pk2 with pk.
  *
  *  return 0 if both are same distance.
@@ -332,6 +421,23 @@ bool node_addable_to_close_list(DHT *dht, const uint8_t *public_key, IP_Port ip_
 int get_close_nodes(const DHT *dht, const uint8_t *public_key, Node_format *nodes_list, Family sa_family,
                     bool is_LAN, uint8_t want_good);
 
+/* Put up to max_num of the nodes get_close_nodes() picks from in nodes: every
+ * node of the close list and of the friends' client lists that hasn't timed
+ * out, with its most recently seen address.
+ *
+ * return the number of nodes.
+ */
+uint32_t dht_copy_close_candidates(const DHT *dht, Node_format *nodes, uint32_t max_num);
+
+/* Like get_close_nodes() with an unspecified family, but choosing from a list
+ * of candidates filled by dht_copy_close_candidates(). Doesn't touch the DHT,
+ * so it can be run on any thread.
+ *
+ * return the number of nodes put in nodes_list (must be MAX_SENT_NODES big).
+ */
+int get_close_nodes_from(const Node_format *candidates, uint32_t num_candidates, const uint8_t *public_key,
+                         Node_format *nodes_list, bool is_LAN);
+
 
 /* Put up to max_num nodes in nodes from the random friends.
  *
@@ -355,6 +461,13 @@ void do_dht(DHT *dht);
  *   to setup connections
  */
 void dht_bootstrap(DHT *dht, IP_Port ip_port, const uint8_t *public_key);
+
+/* return the time in ms at which a request of the lookup for our own key that
+ * dht_bootstrap() starts times out, so that do_dht() should run to replace
+ * it. UINT64_MAX if no lookup is running.
+ */
+uint64_t dht_bootstrap_lookup_next_run(const DHT *dht);
+
 /* Resolves address into an IP address. If successful, sends a "get nodes"
  *   request to the given node with ip, port and public_key to setup connections
  *
@@ -369,6 +482,13 @@ void dht_bootstrap(DHT *dht, IP_Port ip_port, const uint8_t *public_key);
 int dht_bootstrap_from_address(DHT *dht, const char *address, uint8_t ipv6enabled,
                                uint16_t port, const uint8_t *public_key);
 
+/* Keep a persistent cache of the nodes we see in the file at path, and
+ * bootstrap from the best of them in the next dht_connect_after_load().
+ *
+ * return false if the file can't be opened or memory mapped.
+ */
+bool dht_open_node_cache(DHT *dht, const char *path);
+
 /* Start sending packets after DHT loaded_friends_list and loaded_clients_list are set.
  *
  * returns 0 if successful
@@ -435,4 +555,8 @@ uint32_t addto_lists(DHT *dht, IP_Port ip_port, const uint8_t *public_key);
  */
 unsigned int ipport_self_copy(const DHT *dht, IP_Port *dest);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif
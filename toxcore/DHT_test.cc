@@ -0,0 +1,161 @@
+#include "DHT.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+
+#include "crypto_core.h"
+
+namespace {
+
+struct Shared_Keys_Deleter {
+  void operator()(Shared_Keys *shared_keys) { shared_keys_free(shared_keys); }
+};
+
+using Shared_Keys_Ptr = std::unique_ptr<Shared_Keys, Shared_Keys_Deleter>;
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+using SecretKey = std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE>;
+using SharedKey = std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE>;
+
+PublicKey random_public_key() {
+  PublicKey pk;
+  SecretKey sk;
+  crypto_new_keypair(pk.data(), sk.data());
+  return pk;
+}
+
+// Byte by byte version of id_closest.
+int reference_id_closest(PublicKey const &pk, PublicKey const &pk1, PublicKey const &pk2) {
+  for (size_t i = 0; i < pk.size(); ++i) {
+    uint8_t const distance1 = pk[i] ^ pk1[i];
+    uint8_t const distance2 = pk[i] ^ pk2[i];
+
+    if (distance1 != distance2) {
+      return distance1 < distance2 ? 1 : 2;
+    }
+  }
+
+  return 0;
+}
+
+TEST(IdClosest, MatchesByteByByteComparison) {
+  PublicKey const pk = random_public_key();
+
+  for (int i = 0; i < 10000; ++i) {
+    PublicKey pk1 = random_public_key();
+    PublicKey pk2 = random_public_key();
+
+    // Share a prefix so that later words decide as well.
+    size_t const prefix = i % pk.size();
+    std::copy(pk.begin(), pk.begin() + prefix, pk1.begin());
+    std::copy(pk.begin(), pk.begin() + prefix, pk2.begin());
+
+    if (i % 7 == 0) {
+      pk2 = pk1;
+    }
+
+    int const expected = reference_id_closest(pk, pk1, pk2);
+    EXPECT_EQ(id_closest(pk.data(), pk1.data(), pk2.data()), expected);
+
+    Pk_Distance distance1;
+    Pk_Distance distance2;
+    pk_distance(&distance1, pk.data(), pk1.data());
+    pk_distance(&distance2, pk.data(), pk2.data());
+    EXPECT_EQ(pk_distance_cmp(&distance1, &distance2), expected == 0 ? 0 : expected == 1 ? -1 : 1);
+  }
+}
+
+TEST(IdClosest, DistanceToSelfIsZero) {
+  PublicKey const pk = random_public_key();
+  Pk_Distance distance;
+  pk_distance(&distance, pk.data(), pk.data());
+
+  for (uint64_t const word : distance.words) {
+    EXPECT_EQ(word, 0);
+  }
+}
+
+TEST(SharedKeys, MinimumCapacityIsOne) {
+  EXPECT_EQ(shared_keys_new(0), nullptr);
+  EXPECT_NE(Shared_Keys_Ptr(shared_keys_new(1)), nullptr);
+}
+
+TEST(SharedKeys, CachedKeyMatchesComputedKey) {
+  Shared_Keys_Ptr const shared_keys(shared_keys_new(4));
+  PublicKey self_pk;
+  SecretKey self_sk;
+  crypto_new_keypair(self_pk.data(), self_sk.data());
+  PublicKey const pk = random_public_key();
+
+  SharedKey expected;
+  encrypt_precompute(pk.data(), self_sk.data(), expected.data());
+
+  SharedKey first;
+  get_shared_key(shared_keys.get(), first.data(), self_sk.data(), pk.data());
+  SharedKey second;
+  get_shared_key(shared_keys.get(), second.data(), self_sk.data(), pk.data());
+
+  EXPECT_EQ(first, expected);
+  EXPECT_EQ(second, expected);
+  EXPECT_EQ(shared_keys_misses(shared_keys.get()), 1);
+  EXPECT_EQ(shared_keys_hits(shared_keys.get()), 1);
+  EXPECT_EQ(shared_keys_evictions(shared_keys.get()), 0);
+}
+
+TEST(SharedKeys, EvictsLeastRecentlyUsedKey) {
+  Shared_Keys_Ptr const shared_keys(shared_keys_new(2));
+  PublicKey self_pk;
+  SecretKey self_sk;
+  crypto_new_keypair(self_pk.data(), self_sk.data());
+  PublicKey const pk1 = random_public_key();
+  PublicKey const pk2 = random_public_key();
+  PublicKey const pk3 = random_public_key();
+
+  SharedKey key;
+  get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk1.data());
+  get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk2.data());
+  // Use pk1 again, so pk2 is the least recently used key.
+  get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk1.data());
+  get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk3.data());
+  EXPECT_EQ(shared_keys_evictions(shared_keys.get()), 1);
+  EXPECT_EQ(shared_keys_hits(shared_keys.get()), 1);
+
+  get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk1.data());
+  EXPECT_EQ(shared_keys_hits(shared_keys.get()), 2);
+  get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk3.data());
+  EXPECT_EQ(shared_keys_hits(shared_keys.get()), 3);
+
+  get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk2.data());
+  EXPECT_EQ(shared_keys_misses(shared_keys.get()), 4);
+  EXPECT_EQ(shared_keys_evictions(shared_keys.get()), 2);
+}
+
+TEST(SharedKeys, HoldsCapacityKeys) {
+  constexpr uint32_t capacity = 100;
+  Shared_Keys_Ptr const shared_keys(shared_keys_new(capacity));
+  PublicKey self_pk;
+  SecretKey self_sk;
+  crypto_new_keypair(self_pk.data(), self_sk.data());
+
+  std::array<PublicKey, capacity> keys;
+
+  for (PublicKey &pk : keys) {
+    pk = random_public_key();
+  }
+
+  SharedKey key;
+
+  for (int round = 0; round < 2; ++round) {
+    for (PublicKey const &pk : keys) {
+      get_shared_key(shared_keys.get(), key.data(), self_sk.data(), pk.data());
+    }
+  }
+
+  EXPECT_EQ(shared_keys_misses(shared_keys.get()), capacity);
+  EXPECT_EQ(shared_keys_hits(shared_keys.get()), capacity);
+  EXPECT_EQ(shared_keys_evictions(shared_keys.get()), 0);
+}
+
+}  // namespace
@@ -30,6 +30,7 @@
 static int write_cryptpacket_id(const Messenger *m, int32_t friendnumber, uint8_t packet_id, const uint8_t *data,
                                 uint32_t length, uint8_t congestion_control);
 static void m_register_default_plugins(Messenger *m);
+static bool start_timers(Messenger *m);
 
 bool friend_is_valid(const Messenger *m, int32_t friendnumber)
 {
@@ -520,6 +521,25 @@ int m_get_friend_connectionstatus(const Messenger *m, int32_t friendnumber)
     return CONNECTION_NONE;
 }
 
+int m_get_friend_transport_stats(const Messenger *m, int32_t friendnumber, Crypto_Connection_Stats *stats)
+{
+    if (!friend_is_valid(m, friendnumber)) {
+        return -1;
+    }
+
+    if (m->friendlist[friendnumber].status != FRIEND_ONLINE) {
+        return 0;
+    }
+
+    int crypt_conn_id = friend_connection_crypt_connection_id(m->fr_c, m->friendlist[friendnumber].friendcon_id);
+
+    if (crypto_connection_stats(m->net_crypto, crypt_conn_id, stats) == -1) {
+        return 0;
+    }
+
+    return 1;
+}
+
 int m_friend_exists(const Messenger *m, int32_t friendnumber)
 {
     if (!friend_is_valid(m, friendnumber)) {
@@ -1988,6 +2008,7 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
     }
 
     m->mono_time = mono_time;
+    m->start_time = current_time_monotonic(mono_time);
 
     m->fr = friendreq_new();
 
@@ -2019,7 +2040,8 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
     } else {
         IP ip;
         ip_init(&ip, options->ipv6enabled);
-        m->net = new_networking_ex(m->log, ip, options->port_range[0], options->port_range[1], &net_err);
+        m->net = new_networking_ex(m->log, ip, options->port_range[0], options->port_range[1], options->io_uring,
+                                   &net_err);
     }
 
     if (m->net == nullptr) {
@@ -2034,6 +2056,8 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
         return nullptr;
     }
 
+    networking_set_poll_budget(m->net, options->receive_budget);
+
     m->dht = new_dht(m->log, m->mono_time, m->net, options->hole_punching_enabled);
 
     if (m->dht == nullptr) {
@@ -2044,8 +2068,29 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
         return nullptr;
     }
 
+    if ((options->shared_key_cache_capacity != 0
+            && !dht_set_shared_keys_capacity(m->dht, options->shared_key_cache_capacity))
+            || (options->shared_key_threads != 0 && !dht_start_shared_key_pool(m->dht, options->shared_key_threads))) {
+        kill_dht(m->dht);
+        kill_networking(m->net);
+        friendreq_kill(m->fr);
+        logger_kill(m->log);
+        free(m);
+        return nullptr;
+    }
+
+    if (options->node_cache_path != nullptr && !dht_open_node_cache(m->dht, options->node_cache_path)) {
+        LOGGER_WARNING(m->log, "could not open node cache %s, running without it", options->node_cache_path);
+    }
+
     m->net_crypto = new_net_crypto(m->log, m->mono_time, m->dht, &options->proxy_info);
 
+    if (m->net_crypto != nullptr && options->crypto_threads != 0
+            && !net_crypto_start_workers(m->net_crypto, options->crypto_threads)) {
+        kill_net_crypto(m->net_crypto);
+        m->net_crypto = nullptr;
+    }
+
     if (m->net_crypto == nullptr) {
         kill_dht(m->dht);
         kill_networking(m->net);
@@ -2055,6 +2100,9 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
         return nullptr;
     }
 
+    net_crypto_set_congestion_control(m->net_crypto, options->congestion_control);
+    net_crypto_set_send_pacing(m->net_crypto, options->send_pacing);
+
 #ifndef VANILLA_NACL
     m->group_announce = new_gca_list();
 
@@ -2107,8 +2155,8 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
     }
 
     if (options->tcp_server_port) {
-        m->tcp_server = new_TCP_server(m->log, options->ipv6enabled, 1, &options->tcp_server_port,
-                                       dht_get_self_secret_key(m->dht), m->onion);
+        m->tcp_server = new_TCP_server_ex(m->log, options->ipv6enabled, 1, &options->tcp_server_port,
+                                          dht_get_self_secret_key(m->dht), m->onion, options->io_uring);
 
         if (m->tcp_server == nullptr) {
             kill_friend_connections(m->fr_c);
@@ -2143,6 +2191,11 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
 
     m_register_default_plugins(m);
 
+    if (!start_timers(m)) {
+        kill_messenger(m);
+        return nullptr;
+    }
+
     if (error) {
         *error = MESSENGER_ERROR_NONE;
     }
@@ -2174,6 +2227,7 @@ void kill_messenger(Messenger *m)
     kill_net_crypto(m->net_crypto);
     kill_dht(m->dht);
     kill_networking(m->net);
+    timer_wheel_kill(m->timers);
 
     for (i = 0; i < m->numfriends; ++i) {
         clear_receipts(m, i);
@@ -2555,10 +2609,14 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
     return 0;
 }
 
-static void do_friends(Messenger *m, void *userdata)
+/* return true if a friend is being sent a file, so that do_friends() should
+ * run again soon to request the next chunks.
+ */
+static bool do_friends(Messenger *m, void *userdata)
 {
     uint32_t i;
     uint64_t temp_time = mono_time_get(m->mono_time);
+    bool sending_files = false;
 
     for (i = 0; i < m->numfriends; ++i) {
         if (m->friendlist[i].status == FRIEND_ADDED) {
@@ -2612,8 +2670,14 @@ static void do_friends(Messenger *m, void *userdata)
             do_reqchunk_filecb(m, i, userdata);
 
             m->friendlist[i].last_seen_time = (uint64_t) time(nullptr);
+
+            if (m->friendlist[i].num_sending_files != 0) {
+                sending_files = true;
+            }
         }
     }
+
+    return sending_files;
 }
 
 static void connection_status_callback(Messenger *m, void *userdata)
@@ -2621,6 +2685,11 @@ static void connection_status_callback(Messenger *m, void *userdata)
     unsigned int conn_status = onion_connection_status(m->onion_c);
 
     if (conn_status != m->last_connection_status) {
+        if (conn_status == 2 && m->time_to_udp == 0) {
+            m->time_to_udp = max_u64(current_time_monotonic(m->mono_time) - m->start_time, 1);
+            LOGGER_INFO(m->log, "UDP connection after %lu ms", (unsigned long)m->time_to_udp);
+        }
+
         if (m->core_connection_change) {
             (*m->core_connection_change)(m, conn_status, userdata);
         }
@@ -2637,6 +2706,27 @@ static void connection_status_callback(Messenger *m, void *userdata)
  * TODO(mannol): A/V */
 #define MIN_RUN_INTERVAL 50
 
+/* Maximum messenger run interval in ms. The once per second timers keep it
+ * from being longer anyway. */
+#define MAX_RUN_INTERVAL 1000
+
+#ifndef VANILLA_NACL
+static bool groups_connected(const Messenger *m)
+{
+    const GC_Session *c = m->group_handler;
+
+    for (uint32_t i = 0; i < c->num_chats; ++i) {
+        const GC_Chat *chat = &c->chats[i];
+
+        if (chat->connection_state != CS_NONE && chat->connection_state < CS_INVALID) {
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif  // VANILLA_NACL
+
 /* Return the time in milliseconds before do_messenger() should be called again
  * for optimal performance.
  *
@@ -2644,13 +2734,79 @@ static void connection_status_callback(Messenger *m, void *userdata)
  */
 uint32_t messenger_run_interval(const Messenger *m)
 {
-    uint32_t crypto_interval = crypto_run_interval(m->net_crypto);
+    const uint64_t now = current_time_monotonic(m->mono_time);
+    const uint64_t next_run = timer_wheel_next_deadline(m->timers);
+    uint64_t interval = next_run > now ? next_run - now : 0;
 
-    if (crypto_interval > MIN_RUN_INTERVAL) {
-        return MIN_RUN_INTERVAL;
+    bool busy = m->received_connection_packets;
+#ifndef VANILLA_NACL
+    /* Group chats read their own TCP connections and keep their own timers. */
+    busy = busy || groups_connected(m);
+#endif
+
+    if (busy) {
+        interval = min_u64(interval, MIN_RUN_INTERVAL);
     }
 
-    return crypto_interval;
+    return min_u64(interval, MAX_RUN_INTERVAL);
+}
+
+/* return the time of the next change of mono_time_get(). */
+static uint64_t next_second(const Messenger *m)
+{
+    return (mono_time_get_ms(m->mono_time) / 1000 + 1) * 1000;
+}
+
+static void run_dht(void *object, void *userdata)
+{
+    Messenger *m = (Messenger *)object;
+    do_dht(m->dht);
+
+    timer_wheel_schedule(m->timers, &m->dht_timer, min_u64(next_second(m), dht_bootstrap_lookup_next_run(m->dht)));
+}
+
+static void run_net_crypto(void *object, void *userdata)
+{
+    Messenger *m = (Messenger *)object;
+    do_net_crypto_connections(m->net_crypto, userdata);
+    timer_wheel_schedule(m->timers, &m->net_crypto_timer,
+                         mono_time_get_ms(m->mono_time) + crypto_run_interval(m->net_crypto));
+}
+
+static void run_onion(void *object, void *userdata)
+{
+    Messenger *m = (Messenger *)object;
+    do_onion_client(m->onion_c);
+    timer_wheel_schedule(m->timers, &m->onion_timer, next_second(m));
+}
+
+/* return the time in ms at which do_friend_connections() has work next. */
+static uint64_t friend_connections_next_run(const Messenger *m)
+{
+    const uint32_t interval = friend_connections_run_interval(m->fr_c);
+
+    if (interval == 0) {
+        return mono_time_get_ms(m->mono_time);
+    }
+
+    return next_second(m) + (interval - 1) * UINT64_C(1000);
+}
+
+static void run_friend_connections(void *object, void *userdata)
+{
+    Messenger *m = (Messenger *)object;
+    do_friend_connections(m->fr_c, userdata);
+    timer_wheel_schedule(m->timers, &m->friend_connections_timer, friend_connections_next_run(m));
+}
+
+static void run_friends(void *object, void *userdata)
+{
+    Messenger *m = (Messenger *)object;
+    /* File chunks are requested as fast as net_crypto sends packets. */
+    const uint64_t next_run = do_friends(m, userdata)
+                              ? mono_time_get_ms(m->mono_time) + min_u32(crypto_run_interval(m->net_crypto), MIN_RUN_INTERVAL)
+                              : next_second(m);
+    timer_wheel_schedule(m->timers, &m->friends_timer, next_run);
 }
 
 /* Attempts to create a DHT announcement for a group chat with our connection info. An
@@ -2730,9 +2886,94 @@ static void do_gc_onion_friends(const Messenger *m)
 }
 #endif  // VANILLA_NACL
 
+static void run_group_announces(void *object, void *userdata)
+{
+    Messenger *m = (Messenger *)object;
+#ifndef VANILLA_NACL
+    do_gca(m->mono_time, m->group_announce);
+    do_gc_onion_friends(m);
+#endif
+    timer_wheel_schedule(m->timers, &m->group_announce_timer, next_second(m));
+}
+
+/* Start the timers of new_messenger(), all due right away. */
+static bool start_timers(Messenger *m)
+{
+    const uint64_t now = mono_time_get_ms(m->mono_time);
+
+    m->timers = timer_wheel_new(now);
+
+    if (m->timers == nullptr) {
+        return false;
+    }
+
+    timer_init(&m->dht_timer, run_dht, m);
+    timer_init(&m->net_crypto_timer, run_net_crypto, m);
+    timer_init(&m->onion_timer, run_onion, m);
+    timer_init(&m->friend_connections_timer, run_friend_connections, m);
+    timer_init(&m->friends_timer, run_friends, m);
+    timer_init(&m->group_announce_timer, run_group_announces, m);
+
+    if (!m->options.udp_disabled) {
+        timer_wheel_schedule(m->timers, &m->dht_timer, now);
+    }
+
+    timer_wheel_schedule(m->timers, &m->net_crypto_timer, now);
+    timer_wheel_schedule(m->timers, &m->onion_timer, now);
+    timer_wheel_schedule(m->timers, &m->friend_connections_timer, now);
+    timer_wheel_schedule(m->timers, &m->friends_timer, now);
+    timer_wheel_schedule(m->timers, &m->group_announce_timer, now);
+    return true;
+}
+
+/* Run all scheduled timers now, whether their deadline has passed or not. */
+static void run_all_timers(Messenger *m, void *userdata)
+{
+    Timer *const timers[] = {
+        &m->dht_timer,
+        &m->net_crypto_timer,
+        &m->onion_timer,
+        &m->friend_connections_timer,
+        &m->friends_timer,
+        &m->group_announce_timer,
+    };
+
+    for (size_t i = 0; i < sizeof(timers) / sizeof(timers[0]); ++i) {
+        if (timer_is_scheduled(timers[i])) {
+            timer_wheel_cancel(m->timers, timers[i]);
+            timers[i]->callback(timers[i]->object, userdata);
+        }
+    }
+}
+
+/* Count the packets received since the last call.
+ *
+ * return true if there were any.
+ */
+static bool count_received_packets(Messenger *m)
+{
+    const uint64_t tcp_packets = tcp_connections_packets_received(nc_get_tcp_c(m->net_crypto));
+    const uint64_t connection_packets = tcp_packets
+                                        + networking_class_handled(m->net, NET_CLASS_CRYPTO_DATA)
+                                        + networking_class_handled(m->net, NET_CLASS_HANDSHAKE);
+    const uint64_t packets = connection_packets + networking_class_handled(m->net, NET_CLASS_DHT);
+
+    m->received_connection_packets = connection_packets != m->connection_packets_received;
+    m->connection_packets_received = connection_packets;
+
+    if (packets == m->packets_received) {
+        return false;
+    }
+
+    m->packets_received = packets;
+    return true;
+}
+
 /* The main loop that needs to be run at least 20 times per second. */
 void do_messenger(Messenger *m, void *userdata)
 {
+    networking_batch_start(m->net);
+
     // Add the TCP relays, but only if this is the first time calling do_messenger
     if (!m->has_added_relays) {
         m->has_added_relays = true;
@@ -2756,23 +2997,45 @@ void do_messenger(Messenger *m, void *userdata)
 
     if (!m->options.udp_disabled) {
         networking_poll(m->net, userdata);
-        do_dht(m->dht);
+        do_dht_shared_key_pool(m->dht, userdata);
     }
 
     if (m->tcp_server) {
         do_TCP_server(m->tcp_server, m->mono_time);
     }
 
-    do_net_crypto(m->net_crypto, userdata);
-    do_onion_client(m->onion_c);
-    do_friend_connections(m->fr_c, userdata);
-    do_friends(m, userdata);
+    do_net_crypto_tcp(m->net_crypto, userdata);
+
+    /* Whatever arrived may have left work for any of the timers, so they
+     * all run. Otherwise only the expired ones do.
+     */
+    if (count_received_packets(m)) {
+        run_all_timers(m, userdata);
+    } else {
+        timer_wheel_run(m->timers, mono_time_get_ms(m->mono_time), userdata);
+    }
+
 #ifndef VANILLA_NACL
     do_gc(m->group_handler, userdata);
-    do_gca(m->mono_time, m->group_announce);
-    do_gc_onion_friends(m);
 #endif
     connection_status_callback(m, userdata);
+    do_net_crypto_send(m->net_crypto);
+
+    /* Packets held back by send pacing go when net_crypto runs next. */
+    const uint64_t net_crypto_next_run = mono_time_get_ms(m->mono_time) + crypto_run_interval(m->net_crypto);
+
+    if (net_crypto_next_run < timer_deadline(&m->net_crypto_timer)) {
+        timer_wheel_schedule(m->timers, &m->net_crypto_timer, net_crypto_next_run);
+    }
+
+    /* Friend connections that went on or offline run again right away. */
+    const uint64_t friend_connections_next = friend_connections_next_run(m);
+
+    if (friend_connections_next < timer_deadline(&m->friend_connections_timer)) {
+        timer_wheel_schedule(m->timers, &m->friend_connections_timer, friend_connections_next);
+    }
+
+    networking_batch_end(m->net);
 
     if (mono_time_get(m->mono_time) > m->lastdump + DUMPING_CLIENTS_FRIENDS_EVERY_N_SECONDS) {
         m->lastdump = mono_time_get(m->mono_time);
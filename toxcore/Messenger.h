@@ -15,6 +15,7 @@
 #include "logger.h"
 #include "net_crypto.h"
 #include "state.h"
+#include "timer_wheel.h"
 
 #define MAX_NAME_LENGTH 128
 /* TODO(irungentoo): this must depend on other variable. */
@@ -66,6 +67,14 @@ typedef struct Messenger_Options {
 
     bool hole_punching_enabled;
     bool local_discovery_enabled;
+    bool io_uring;
+    uint32_t shared_key_cache_capacity;
+    uint16_t shared_key_threads;
+    const char *node_cache_path;
+    uint32_t receive_budget;
+    uint16_t crypto_threads;
+    Congestion_Control_Type congestion_control;
+    bool send_pacing;
 
     logger_cb *log_callback;
     void *log_context;
@@ -308,6 +317,28 @@ struct Messenger {
     m_self_connection_status_cb *core_connection_change;
     unsigned int last_connection_status;
 
+    /* Time in ms the Messenger was created at, and how long after that it
+     * first got a UDP connection, 0 until then. */
+    uint64_t start_time;
+    uint64_t time_to_udp;
+
+    /* Deadlines of the parts of do_messenger() that don't need to run on
+     * every iteration. */
+    Timer_Wheel *timers;
+    Timer dht_timer;
+    Timer net_crypto_timer;
+    Timer onion_timer;
+    Timer friend_connections_timer;
+    Timer friends_timer;
+    Timer group_announce_timer;
+
+    /* Packets received up to the last do_messenger(), to tell whether it
+     * received any. Connection packets are crypto handshakes and data and
+     * anything from a TCP relay. */
+    uint64_t packets_received;
+    uint64_t connection_packets_received;
+    bool received_connection_packets;
+
     Messenger_Options options;
 };
 
@@ -399,6 +430,14 @@ int m_delfriend(Messenger *m, int32_t friendnumber);
  */
 int m_get_friend_connectionstatus(const Messenger *m, int32_t friendnumber);
 
+/* Copies the transport statistics of the connection to the friend to stats.
+ *
+ *  return 1 if the friend is online and stats was set.
+ *  return 0 if the friend is not online.
+ *  return -1 on failure.
+ */
+int m_get_friend_transport_stats(const Messenger *m, int32_t friendnumber, Crypto_Connection_Stats *stats);
+
 /* Checks if there exists a friend with given friendnumber.
  *
  *  return 1 if friend exists.
@@ -774,13 +813,19 @@ Messenger *new_messenger(Mono_Time *mono_time, Messenger_Options *options, unsig
  */
 void kill_messenger(Messenger *m);
 
-/* The main loop that needs to be run at least 20 times per second. */
+/* The main loop. Run it again after messenger_run_interval() ms.
+ *
+ * The DHT, onion, friend and connection timers only run when their deadline
+ * has passed, or when packets arrived since the last call.
+ */
 void do_messenger(Messenger *m, void *userdata);
 
 /* Return the time in milliseconds before do_messenger() should be called again
  * for optimal performance.
  *
- * returns time (in ms) before the next do_messenger() needs to be run on success.
+ * returns time (in ms) until the next deadline, at most one second. It is at
+ * most 50 ms after connection packets arrived or while a group chat is
+ * connected, so that replies go out quickly.
  */
 uint32_t messenger_run_interval(const Messenger *m);
 
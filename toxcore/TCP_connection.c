@@ -46,6 +46,9 @@ struct TCP_Connections {
 
     bool onion_status;
     uint16_t onion_num_conns;
+
+    /* Number of packets received from all relays. */
+    uint64_t packets_received;
 };
 
 
@@ -270,6 +273,11 @@ static TCP_con *get_tcp_connection(const TCP_Connections *tcp_c, int tcp_connect
     return &tcp_c->tcp_connections[tcp_connections_number];
 }
 
+uint64_t tcp_connections_packets_received(const TCP_Connections *tcp_c)
+{
+    return tcp_c->packets_received;
+}
+
 /* Returns the number of connected TCP relays */
 uint32_t tcp_connected_relays_count(const TCP_Connections *tcp_c)
 {
@@ -954,6 +962,7 @@ static int tcp_response_callback(void *object, uint8_t connection_id, const uint
 {
     TCP_Client_Connection *tcp_client_con = (TCP_Client_Connection *)object;
     TCP_Connections *tcp_c = (TCP_Connections *)tcp_con_custom_object(tcp_client_con);
+    ++tcp_c->packets_received;
 
     unsigned int tcp_connections_number = tcp_con_custom_uint(tcp_client_con);
     TCP_con *tcp_con = get_tcp_connection(tcp_c, tcp_connections_number);
@@ -988,6 +997,7 @@ static int tcp_status_callback(void *object, uint32_t number, uint8_t connection
 {
     TCP_Client_Connection *tcp_client_con = (TCP_Client_Connection *)object;
     TCP_Connections *tcp_c = (TCP_Connections *)tcp_con_custom_object(tcp_client_con);
+    ++tcp_c->packets_received;
 
     unsigned int tcp_connections_number = tcp_con_custom_uint(tcp_client_con);
     TCP_con *tcp_con = get_tcp_connection(tcp_c, tcp_connections_number);
@@ -1033,6 +1043,7 @@ static int tcp_conn_data_callback(void *object, uint32_t number, uint8_t connect
 
     TCP_Client_Connection *tcp_client_con = (TCP_Client_Connection *)object;
     TCP_Connections *tcp_c = (TCP_Connections *)tcp_con_custom_object(tcp_client_con);
+    ++tcp_c->packets_received;
 
     unsigned int tcp_connections_number = tcp_con_custom_uint(tcp_client_con);
     TCP_con *tcp_con = get_tcp_connection(tcp_c, tcp_connections_number);
@@ -1080,6 +1091,8 @@ static int tcp_conn_oob_callback(void *object, const uint8_t *public_key, const
         return tcp_conn_data_callback(object, connections_number, 0, data, length, userdata);
     }
 
+    ++tcp_c->packets_received;
+
     if (tcp_c->tcp_oob_callback) {
         tcp_c->tcp_oob_callback(tcp_c->tcp_oob_callback_object, public_key, tcp_connections_number, data, length, userdata);
     }
@@ -1090,6 +1103,7 @@ static int tcp_conn_oob_callback(void *object, const uint8_t *public_key, const
 static int tcp_onion_callback(void *object, const uint8_t *data, uint16_t length, void *userdata)
 {
     TCP_Connections *tcp_c = (TCP_Connections *)object;
+    ++tcp_c->packets_received;
 
     if (tcp_c->tcp_onion_callback) {
         tcp_c->tcp_onion_callback(tcp_c->tcp_onion_callback_object, data, length, userdata);
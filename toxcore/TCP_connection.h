@@ -75,6 +75,9 @@ uint32_t tcp_connections_count(const TCP_Connections *tcp_c);
 /* Returns the number of connected TCP relays */
 uint32_t tcp_connected_relays_count(const TCP_Connections *tcp_c);
 
+/* Returns the number of packets received from the TCP relays so far. */
+uint64_t tcp_connections_packets_received(const TCP_Connections *tcp_c);
+
 /* Send a packet to the TCP connection.
  *
  * return -1 on failure.
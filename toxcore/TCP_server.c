@@ -19,11 +19,13 @@
 #endif
 
 #ifdef TCP_SERVER_USE_EPOLL
+#include <errno.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 #endif
 
 #include "mono_time.h"
+#include "net_uring.h"
 #include "util.h"
 
 #ifdef TCP_SERVER_USE_EPOLL
@@ -72,6 +74,8 @@ struct TCP_Server {
     int efd;
     uint64_t last_run_pinged;
 #endif
+    /* Non-NULL if sockets are watched through io_uring instead of epoll. */
+    Net_Uring *uring;
     Socket *socks_listening;
     unsigned int num_listening_socks;
 
@@ -525,11 +529,22 @@ static int write_packet_TCP_secure_connection(TCP_Secure_Connection *con, const
     return 1;
 }
 
+/* Close a socket that may be watched by the server's io_uring.
+ */
+static void kill_watched_sock(const TCP_Server *tcp_server, Socket sock)
+{
+    if (tcp_server->uring != nullptr) {
+        net_uring_cancel_fd(tcp_server->uring, sock.socket);
+    }
+
+    kill_sock(sock);
+}
+
 /* Kill a TCP_Secure_Connection
  */
-static void kill_TCP_secure_connection(TCP_Secure_Connection *con)
+static void kill_TCP_secure_connection(const TCP_Server *tcp_server, TCP_Secure_Connection *con)
 {
-    kill_sock(con->sock);
+    kill_watched_sock(tcp_server, con->sock);
     wipe_secure_connection(con);
 }
 
@@ -558,7 +573,7 @@ static int kill_accepted(TCP_Server *tcp_server, int index)
         return -1;
     }
 
-    kill_sock(sock);
+    kill_watched_sock(tcp_server, sock);
     return 0;
 }
 
@@ -978,7 +993,7 @@ static int confirm_TCP_connection(TCP_Server *tcp_server, const Mono_Time *mono_
     int index = add_accepted(tcp_server, mono_time, con);
 
     if (index == -1) {
-        kill_TCP_secure_connection(con);
+        kill_TCP_secure_connection(tcp_server, con);
         return -1;
     }
 
@@ -1016,7 +1031,7 @@ static int accept_connection(TCP_Server *tcp_server, Socket sock)
     TCP_Secure_Connection *conn = &tcp_server->incoming_connection_queue[index];
 
     if (conn->status != TCP_STATUS_NO_STATUS) {
-        kill_TCP_secure_connection(conn);
+        kill_TCP_secure_connection(tcp_server, conn);
     }
 
     conn->status = TCP_STATUS_CONNECTED;
@@ -1055,8 +1070,75 @@ static Socket new_listening_TCP_socket(Family family, uint16_t port)
     return sock;
 }
 
+#ifdef TCP_SERVER_USE_EPOLL
+/* Event data identifying a socket: its descriptor, what kind of socket it is
+ * and its index in the matching connection list.
+ */
+static uint64_t tcp_socket_data(Socket sock, int status, uint32_t index)
+{
+    return (uint32_t)sock.socket | ((uint64_t)status << 32) | ((uint64_t)index << 40);
+}
+
+/* Start accepting connections on a listening socket.
+ *
+ * return true on success.
+ */
+static bool tcp_watch_listening(TCP_Server *tcp_server, Socket sock)
+{
+    const uint64_t data = tcp_socket_data(sock, TCP_SOCKET_LISTENING, 0);
+
+    if (tcp_server->uring != nullptr) {
+        return net_uring_accept_multishot(tcp_server->uring, sock.socket, data);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = data;
+    return epoll_ctl(tcp_server->efd, EPOLL_CTL_ADD, sock.socket, &ev) != -1;
+}
+
+/* Start watching an accepted socket for incoming data.
+ *
+ * return true on success.
+ */
+static bool tcp_watch_socket(TCP_Server *tcp_server, Socket sock, uint64_t data)
+{
+    if (tcp_server->uring != nullptr) {
+        return net_uring_poll_multishot(tcp_server->uring, sock.socket, data);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    ev.data.u64 = data;
+    return epoll_ctl(tcp_server->efd, EPOLL_CTL_ADD, sock.socket, &ev) != -1;
+}
+
+/* Go back to epoll when the kernel turns out not to support the io_uring
+ * requests we need. Only the listening sockets are watched at that point.
+ */
+static void tcp_uring_fallback(TCP_Server *tcp_server)
+{
+    LOGGER_WARNING(tcp_server->logger, "io_uring accept failed, using epoll instead");
+    net_uring_kill(tcp_server->uring);
+    tcp_server->uring = nullptr;
+
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
+        if (!tcp_watch_listening(tcp_server, tcp_server->socks_listening[i])) {
+            LOGGER_ERROR(tcp_server->logger, "failed to watch listening socket %d",
+                         tcp_server->socks_listening[i].socket);
+        }
+    }
+}
+#endif
+
 TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
                            const uint8_t *secret_key, Onion *onion)
+{
+    return new_TCP_server_ex(logger, ipv6_enabled, num_sockets, ports, secret_key, onion, false);
+}
+
+TCP_Server *new_TCP_server_ex(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                              const uint8_t *secret_key, Onion *onion, bool use_io_uring)
 {
     if (num_sockets == 0 || ports == nullptr) {
         return nullptr;
@@ -1090,24 +1172,27 @@ TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t
         return nullptr;
     }
 
+    if (use_io_uring) {
+        temp->uring = net_uring_new(NET_URING_ENTRIES);
+
+        if (temp->uring == nullptr) {
+            LOGGER_WARNING(logger, "io_uring is not available, using epoll instead");
+        }
+    }
+
 #endif
 
     const Family family = ipv6_enabled ? net_family_ipv6 : net_family_ipv4;
 
     uint32_t i;
-#ifdef TCP_SERVER_USE_EPOLL
-    struct epoll_event ev;
-#endif
 
     for (i = 0; i < num_sockets; ++i) {
         Socket sock = new_listening_TCP_socket(family, ports[i]);
 
         if (sock_valid(sock)) {
 #ifdef TCP_SERVER_USE_EPOLL
-            ev.events = EPOLLIN | EPOLLET;
-            ev.data.u64 = sock.socket | ((uint64_t)TCP_SOCKET_LISTENING << 32);
 
-            if (epoll_ctl(temp->efd, EPOLL_CTL_ADD, sock.socket, &ev) == -1) {
+            if (!tcp_watch_listening(temp, sock)) {
                 continue;
             }
 
@@ -1119,11 +1204,20 @@ TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t
     }
 
     if (temp->num_listening_socks == 0) {
+        net_uring_kill(temp->uring);
         free(temp->socks_listening);
         free(temp);
         return nullptr;
     }
 
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (temp->uring != nullptr && !net_uring_submit(temp->uring)) {
+        tcp_uring_fallback(temp);
+    }
+
+#endif
+
     if (onion) {
         temp->onion = onion;
         set_callback_handle_recv_1(onion, &handle_onion_recv_1, temp);
@@ -1162,14 +1256,14 @@ static int do_incoming(TCP_Server *tcp_server, uint32_t i)
                                         tcp_server->secret_key);
 
     if (ret == -1) {
-        kill_TCP_secure_connection(&tcp_server->incoming_connection_queue[i]);
+        kill_TCP_secure_connection(tcp_server, &tcp_server->incoming_connection_queue[i]);
     } else if (ret == 1) {
         int index_new = tcp_server->unconfirmed_connection_queue_index % MAX_INCOMING_CONNECTIONS;
         TCP_Secure_Connection *conn_old = &tcp_server->incoming_connection_queue[i];
         TCP_Secure_Connection *conn_new = &tcp_server->unconfirmed_connection_queue[index_new];
 
         if (conn_new->status != TCP_STATUS_NO_STATUS) {
-            kill_TCP_secure_connection(conn_new);
+            kill_TCP_secure_connection(tcp_server, conn_new);
         }
 
         move_secure_connection(conn_new, conn_old);
@@ -1198,7 +1292,7 @@ static int do_unconfirmed(TCP_Server *tcp_server, const Mono_Time *mono_time, ui
     }
 
     if (len == -1) {
-        kill_TCP_secure_connection(conn);
+        kill_TCP_secure_connection(tcp_server, conn);
         return -1;
     }
 
@@ -1312,125 +1406,257 @@ static void do_TCP_confirmed(TCP_Server *tcp_server, const Mono_Time *mono_time)
 }
 
 #ifdef TCP_SERVER_USE_EPOLL
-static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time)
+/* Accept a connection and start watching its socket.
+ */
+static void tcp_accept_socket(TCP_Server *tcp_server, Socket sock)
 {
-#define MAX_EVENTS 16
-    struct epoll_event events[MAX_EVENTS];
-    const int nfds = epoll_wait(tcp_server->efd, events, MAX_EVENTS, 0);
-#undef MAX_EVENTS
+    const int index = accept_connection(tcp_server, sock);
 
-    for (int n = 0; n < nfds; ++n) {
-        const Socket sock = {(int)(events[n].data.u64 & 0xFFFFFFFF)};
-        const int status = (events[n].data.u64 >> 32) & 0xFF;
-        const int index = events[n].data.u64 >> 40;
+    if (index == -1) {
+        return;
+    }
 
-        if ((events[n].events & EPOLLERR) || (events[n].events & EPOLLHUP) || (events[n].events & EPOLLRDHUP)) {
-            switch (status) {
-                case TCP_SOCKET_LISTENING: {
-                    // should never happen
-                    break;
-                }
+    if (!tcp_watch_socket(tcp_server, sock, tcp_socket_data(sock, TCP_SOCKET_INCOMING, index))) {
+        kill_TCP_secure_connection(tcp_server, &tcp_server->incoming_connection_queue[index]);
+    }
+}
 
-                case TCP_SOCKET_INCOMING: {
-                    kill_TCP_secure_connection(&tcp_server->incoming_connection_queue[index]);
-                    break;
-                }
+/* return true if the connection an event refers to still owns the socket.
+ */
+static bool tcp_socket_owned(const TCP_Server *tcp_server, uint64_t data)
+{
+    const int sock = (int)(data & 0xFFFFFFFF);
+    const int status = (data >> 32) & 0xFF;
+    const uint32_t index = data >> 40;
 
-                case TCP_SOCKET_UNCONFIRMED: {
-                    kill_TCP_secure_connection(&tcp_server->unconfirmed_connection_queue[index]);
-                    break;
-                }
+    switch (status) {
+        case TCP_SOCKET_INCOMING:
+            return index < MAX_INCOMING_CONNECTIONS
+                   && tcp_server->incoming_connection_queue[index].status != TCP_STATUS_NO_STATUS
+                   && tcp_server->incoming_connection_queue[index].sock.socket == sock;
+
+        case TCP_SOCKET_UNCONFIRMED:
+            return index < MAX_INCOMING_CONNECTIONS
+                   && tcp_server->unconfirmed_connection_queue[index].status != TCP_STATUS_NO_STATUS
+                   && tcp_server->unconfirmed_connection_queue[index].sock.socket == sock;
+
+        case TCP_SOCKET_CONFIRMED:
+            return index < tcp_server->size_accepted_connections
+                   && tcp_server->accepted_connection_array[index].status != TCP_STATUS_NO_STATUS
+                   && tcp_server->accepted_connection_array[index].sock.socket == sock;
+    }
+
+    return true;
+}
+
+/* Kill the connection an event refers to.
+ */
+static void tcp_kill_socket_owner(TCP_Server *tcp_server, uint64_t data)
+{
+    const int status = (data >> 32) & 0xFF;
+    const int index = data >> 40;
+
+    switch (status) {
+        case TCP_SOCKET_LISTENING: {
+            // should never happen
+            break;
+        }
+
+        case TCP_SOCKET_INCOMING: {
+            kill_TCP_secure_connection(tcp_server, &tcp_server->incoming_connection_queue[index]);
+            break;
+        }
+
+        case TCP_SOCKET_UNCONFIRMED: {
+            kill_TCP_secure_connection(tcp_server, &tcp_server->unconfirmed_connection_queue[index]);
+            break;
+        }
+
+        case TCP_SOCKET_CONFIRMED: {
+            kill_accepted(tcp_server, index);
+            break;
+        }
+    }
+}
 
-                case TCP_SOCKET_CONFIRMED: {
-                    kill_accepted(tcp_server, index);
+/* Handle a readiness or hang-up event on a watched socket. When the
+ * connection moves to another list, data is updated to its new place.
+ *
+ * return true if the socket is still watched.
+ */
+static bool tcp_socket_event(TCP_Server *tcp_server, const Mono_Time *mono_time, uint64_t *data, bool hangup)
+{
+    const Socket sock = {(int)(*data & 0xFFFFFFFF)};
+    const int status = (*data >> 32) & 0xFF;
+    const int index = *data >> 40;
+
+    if (!tcp_socket_owned(tcp_server, *data)) {
+        // The connection was killed while the event was queued.
+        return false;
+    }
+
+    if (hangup) {
+        tcp_kill_socket_owner(tcp_server, *data);
+        return false;
+    }
+
+    switch (status) {
+        case TCP_SOCKET_LISTENING: {
+            // socket is from socks_listening, accept connection
+            while (1) {
+                Socket sock_new = net_accept(sock);
+
+                if (!sock_valid(sock_new)) {
                     break;
                 }
+
+                tcp_accept_socket(tcp_server, sock_new);
             }
 
+            break;
+        }
+
+        case TCP_SOCKET_INCOMING: {
+            const int index_new = do_incoming(tcp_server, index);
+
+            if (index_new != -1) {
+                *data = tcp_socket_data(sock, TCP_SOCKET_UNCONFIRMED, index_new);
+            }
+
+            break;
+        }
+
+        case TCP_SOCKET_UNCONFIRMED: {
+            const int index_new = do_unconfirmed(tcp_server, mono_time, index);
+
+            if (index_new != -1) {
+                *data = tcp_socket_data(sock, TCP_SOCKET_CONFIRMED, index_new);
+            }
+
+            break;
+        }
+
+        case TCP_SOCKET_CONFIRMED: {
+            do_confirmed_recv(tcp_server, index);
+            break;
+        }
+    }
+
+    return tcp_socket_owned(tcp_server, *data);
+}
+
+static bool tcp_epoll_process(TCP_Server *tcp_server, const Mono_Time *mono_time)
+{
+#define MAX_EVENTS 16
+    struct epoll_event events[MAX_EVENTS];
+    const int nfds = epoll_wait(tcp_server->efd, events, MAX_EVENTS, 0);
+#undef MAX_EVENTS
+
+    for (int n = 0; n < nfds; ++n) {
+        const bool hangup = (events[n].events & EPOLLERR) || (events[n].events & EPOLLHUP)
+                            || (events[n].events & EPOLLRDHUP);
+
+        if (!hangup && !(events[n].events & EPOLLIN)) {
             continue;
         }
 
+        const Socket sock = {(int)(events[n].data.u64 & 0xFFFFFFFF)};
+        uint64_t data = events[n].data.u64;
 
-        if (!(events[n].events & EPOLLIN)) {
+        if (!tcp_socket_event(tcp_server, mono_time, &data, hangup) || data == events[n].data.u64) {
             continue;
         }
 
-        switch (status) {
-            case TCP_SOCKET_LISTENING: {
-                // socket is from socks_listening, accept connection
-                while (1) {
-                    Socket sock_new = net_accept(sock);
+        events[n].events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+        events[n].data.u64 = data;
 
-                    if (!sock_valid(sock_new)) {
-                        break;
-                    }
+        if (epoll_ctl(tcp_server->efd, EPOLL_CTL_MOD, sock.socket, &events[n]) == -1) {
+            tcp_kill_socket_owner(tcp_server, data);
+        }
+    }
 
-                    int index_new = accept_connection(tcp_server, sock_new);
+    return nfds > 0;
+}
 
-                    if (index_new == -1) {
-                        continue;
-                    }
+static bool tcp_uring_process(TCP_Server *tcp_server, const Mono_Time *mono_time)
+{
+    Net_Uring *const ring = tcp_server->uring;
 
-                    struct epoll_event ev;
+    if (!net_uring_submit(ring)) {
+        return false;
+    }
 
-                    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    Net_Uring_Event event;
+    bool processed = false;
 
-                    ev.data.u64 = sock_new.socket | ((uint64_t)TCP_SOCKET_INCOMING << 32) | ((uint64_t)index_new << 40);
+    while (net_uring_next_event(ring, &event)) {
+        processed = true;
 
-                    if (epoll_ctl(tcp_server->efd, EPOLL_CTL_ADD, sock_new.socket, &ev) == -1) {
-                        kill_TCP_secure_connection(&tcp_server->incoming_connection_queue[index_new]);
-                        continue;
-                    }
-                }
+        const Socket sock = {(int)(event.user_data & 0xFFFFFFFF)};
+        const int status = (event.user_data >> 32) & 0xFF;
 
-                break;
+        if (status == TCP_SOCKET_LISTENING) {
+            if (event.res == -EINVAL || event.res == -EOPNOTSUPP) {
+                // Kernel too old for multishot accept.
+                tcp_uring_fallback(tcp_server);
+                return false;
             }
 
-            case TCP_SOCKET_INCOMING: {
-                const int index_new = do_incoming(tcp_server, index);
+            if (event.res >= 0) {
+                const Socket sock_new = {event.res};
+                tcp_accept_socket(tcp_server, sock_new);
+            }
 
-                if (index_new != -1) {
-                    events[n].events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-                    events[n].data.u64 = sock.socket | ((uint64_t)TCP_SOCKET_UNCONFIRMED << 32) | ((uint64_t)index_new << 40);
+            if (!event.more && !net_uring_accept_multishot(ring, sock.socket, event.user_data)) {
+                LOGGER_ERROR(tcp_server->logger, "failed to re-arm accept on socket %d", sock.socket);
+            }
 
-                    if (epoll_ctl(tcp_server->efd, EPOLL_CTL_MOD, sock.socket, &events[n]) == -1) {
-                        kill_TCP_secure_connection(&tcp_server->unconfirmed_connection_queue[index_new]);
-                        break;
-                    }
-                }
+            continue;
+        }
 
-                break;
-            }
+        if (event.res == -ECANCELED) {
+            // The socket was closed.
+            continue;
+        }
 
-            case TCP_SOCKET_UNCONFIRMED: {
-                const int index_new = do_unconfirmed(tcp_server, mono_time, index);
+        const bool hangup = net_uring_poll_hangup(event.res);
 
-                if (index_new != -1) {
-                    events[n].events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-                    events[n].data.u64 = sock.socket | ((uint64_t)TCP_SOCKET_CONFIRMED << 32) | ((uint64_t)index_new << 40);
+        if (!hangup && !net_uring_poll_readable(event.res) && event.more) {
+            continue;
+        }
 
-                    if (epoll_ctl(tcp_server->efd, EPOLL_CTL_MOD, sock.socket, &events[n]) == -1) {
-                        // remove from confirmed connections
-                        kill_accepted(tcp_server, index_new);
-                        break;
-                    }
-                }
+        uint64_t data = event.user_data;
 
-                break;
-            }
+        if (!tcp_socket_event(tcp_server, mono_time, &data, hangup)) {
+            continue;
+        }
 
-            case TCP_SOCKET_CONFIRMED: {
-                do_confirmed_recv(tcp_server, index);
-                break;
-            }
+        // Multishot polls stop on errors and when the completion queue overflows.
+        const bool watched = event.more
+                             ? data == event.user_data || net_uring_poll_update(ring, event.user_data, data)
+                             : net_uring_poll_multishot(ring, sock.socket, data);
+
+        if (!watched) {
+            tcp_kill_socket_owner(tcp_server, data);
         }
     }
 
-    return nfds > 0;
+    return processed;
 }
 
 static void do_TCP_epoll(TCP_Server *tcp_server, const Mono_Time *mono_time)
 {
+    if (tcp_server->uring != nullptr) {
+        while (tcp_server->uring != nullptr && tcp_uring_process(tcp_server, mono_time)) {
+            // Keep processing packets until there are no more completions.
+            continue;
+        }
+
+        if (tcp_server->uring != nullptr) {
+            return;
+        }
+    }
+
     while (tcp_epoll_process(tcp_server, mono_time)) {
         // Keep processing packets until there are no more FDs ready for reading.
         continue;
@@ -1455,9 +1681,11 @@ void do_TCP_server(TCP_Server *tcp_server, Mono_Time *mono_time)
 void kill_TCP_server(TCP_Server *tcp_server)
 {
     for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
-        kill_sock(tcp_server->socks_listening[i]);
+        kill_watched_sock(tcp_server, tcp_server->socks_listening[i]);
     }
 
+    net_uring_kill(tcp_server->uring);
+
     if (tcp_server->onion) {
         set_callback_handle_recv_1(tcp_server->onion, nullptr, nullptr);
     }
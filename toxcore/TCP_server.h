@@ -85,6 +85,13 @@ size_t tcp_server_listen_count(const TCP_Server *tcp_server);
 TCP_Server *new_TCP_server(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
                            const uint8_t *secret_key, Onion *onion);
 
+/* Create new TCP server instance. If use_io_uring is true and the build and the
+ * kernel support it, connections are accepted and watched through multishot
+ * io_uring requests instead of epoll.
+ */
+TCP_Server *new_TCP_server_ex(const Logger *logger, uint8_t ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                              const uint8_t *secret_key, Onion *onion, bool use_io_uring);
+
 /* Run the TCP_server
  */
 void do_TCP_server(TCP_Server *tcp_server, Mono_Time *mono_time);
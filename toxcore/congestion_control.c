@@ -0,0 +1,396 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Congestion controllers deciding how fast a crypto connection sends.
+ */
+#include "congestion_control.h"
+
+#include <string.h>
+
+#include "ccompat.h"
+
+/* If the send queue is SEND_QUEUE_RATIO times larger than the
+ * calculated link speed the packet send speed will be reduced
+ * by a value depending on this number.
+ */
+#define SEND_QUEUE_RATIO 2.0
+
+/* Rate factor of the delay controller while it looks for the bandwidth, the
+ * smallest that doubles the delivery rate every round.
+ */
+#define DELAY_STARTUP_GAIN 2.885
+
+/* The bandwidth is found when it grew by less than DELAY_FULL_GROWTH for
+ * DELAY_FULL_ROUNDS rounds.
+ */
+#define DELAY_FULL_GROWTH 1.25
+#define DELAY_FULL_ROUNDS 3
+
+/* Shortest round in ms. Each request packet acknowledges the packets that
+ * arrived since the previous one, so a round needs several of them for its
+ * delivery rate to be close to the rate at which packets arrived.
+ */
+#define DELAY_MIN_ROUND_LENGTH (CONGESTION_SAMPLE_INTERVAL * 4)
+
+/* Round trip times this many times the lowest mean the bottleneck queue is
+ * filling up, or has been for a while.
+ */
+#define DELAY_QUEUE_RTT_RATIO 1.25
+#define DELAY_FULL_QUEUE_RTT_RATIO 1.5
+
+/* Most the bandwidth shrinks by after a round with a full queue. */
+#define DELAY_FULL_QUEUE_BACKOFF 0.9
+
+/* Rate factors the delay controller cycles through once the bandwidth is
+ * found, one round each: probe for more, drain the queue that may have built
+ * up, then cruise.
+ */
+static const double delay_probe_gains[] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+
+#define NUM_DELAY_PROBE_GAINS (sizeof(delay_probe_gains) / sizeof(delay_probe_gains[0]))
+
+typedef struct Congestion_Controller {
+    const char *name;
+    void (*init)(Congestion_Control *cc);
+    void (*update)(Congestion_Control *cc, const Congestion_Sample *sample, double *send_rate,
+                   double *send_rate_requested);
+} Congestion_Controller;
+
+static void queue_init(Congestion_Control *cc)
+{
+    memset(&cc->state.queue, 0, sizeof(Queue_Congestion));
+}
+
+static void queue_update(Congestion_Control *cc, const Congestion_Sample *sample, double *send_rate,
+                         double *send_rate_requested)
+{
+    Queue_Congestion *const queue = &cc->state.queue;
+
+    unsigned int pos = queue->last_sendqueue_counter % CONGESTION_QUEUE_ARRAY_SIZE;
+    queue->last_sendqueue_size[pos] = sample->send_queue;
+
+    long signed int sum = 0;
+    sum = (long signed int)queue->last_sendqueue_size[pos] -
+          (long signed int)queue->last_sendqueue_size[(pos + 1) % CONGESTION_QUEUE_ARRAY_SIZE];
+
+    unsigned int n_p_pos = queue->last_sendqueue_counter % CONGESTION_LAST_SENT_ARRAY_SIZE;
+    queue->last_num_packets_sent[n_p_pos] = sample->packets_sent;
+    queue->last_num_packets_resent[n_p_pos] = sample->packets_resent;
+
+    queue->last_sendqueue_counter = (queue->last_sendqueue_counter + 1) %
+                                    (CONGESTION_QUEUE_ARRAY_SIZE * CONGESTION_LAST_SENT_ARRAY_SIZE);
+
+    if (sample->hold_rate) {
+        return;
+    }
+
+    long signed int total_sent = 0;
+    long signed int total_resent = 0;
+
+    // TODO(irungentoo): use real delay
+    unsigned int delay = (unsigned int)((sample->min_rtt / CONGESTION_SAMPLE_INTERVAL) + 0.5);
+    unsigned int packets_set_rem_array = (CONGESTION_LAST_SENT_ARRAY_SIZE - CONGESTION_QUEUE_ARRAY_SIZE);
+
+    if (delay > packets_set_rem_array) {
+        delay = packets_set_rem_array;
+    }
+
+    for (unsigned j = 0; j < CONGESTION_QUEUE_ARRAY_SIZE; ++j) {
+        unsigned int ind = (j + (packets_set_rem_array  - delay) + n_p_pos) % CONGESTION_LAST_SENT_ARRAY_SIZE;
+        total_sent += queue->last_num_packets_sent[ind];
+        total_resent += queue->last_num_packets_resent[ind];
+    }
+
+    if (sum > 0) {
+        total_sent -= sum;
+    } else {
+        if (total_resent > -sum) {
+            total_resent = -sum;
+        }
+    }
+
+    /* if queue is too big only allow resending packets. */
+    uint32_t npackets = sample->send_queue;
+    double min_speed = 1000.0 * (((double)(total_sent)) / ((double)(CONGESTION_QUEUE_ARRAY_SIZE) *
+                                 CONGESTION_SAMPLE_INTERVAL));
+
+    double min_speed_request = 1000.0 * (((double)(total_sent + total_resent)) / ((double)(
+            CONGESTION_QUEUE_ARRAY_SIZE) * CONGESTION_SAMPLE_INTERVAL));
+
+    if (min_speed < CONGESTION_MIN_RATE) {
+        min_speed = CONGESTION_MIN_RATE;
+    }
+
+    double send_array_ratio = (((double)npackets) / min_speed);
+
+    // TODO(irungentoo): Improve formula?
+    if (send_array_ratio > SEND_QUEUE_RATIO && CONGESTION_MIN_QUEUE_LENGTH < npackets) {
+        *send_rate = min_speed * (1.0 / (send_array_ratio / SEND_QUEUE_RATIO));
+    } else if (sample->last_congestion_event + CONGESTION_EVENT_TIMEOUT < sample->time) {
+        *send_rate = min_speed * 1.2;
+    } else {
+        *send_rate = min_speed * 0.9;
+    }
+
+    *send_rate_requested = min_speed_request * 1.2;
+
+    if (*send_rate < CONGESTION_MIN_RATE) {
+        *send_rate = CONGESTION_MIN_RATE;
+    }
+
+    if (*send_rate_requested < *send_rate) {
+        *send_rate_requested = *send_rate;
+    }
+}
+
+static void delay_init(Congestion_Control *cc)
+{
+    Delay_Congestion *const delay = &cc->state.delay;
+    memset(delay, 0, sizeof(Delay_Congestion));
+    delay->phase = DELAY_CONGESTION_STARTUP;
+
+    for (uint32_t i = 0; i < CONGESTION_BANDWIDTH_WINDOW; ++i) {
+        delay->delivery_rates[i] = 0;
+    }
+
+    delay->bandwidth = 0;
+    delay->full_bandwidth = 0;
+}
+
+/* Update the bandwidth, the highest delivery rate of the window. */
+static void delay_update_bandwidth(Delay_Congestion *delay)
+{
+    const uint32_t num_rates = delay->num_rounds < CONGESTION_BANDWIDTH_WINDOW
+                               ? delay->num_rounds : CONGESTION_BANDWIDTH_WINDOW;
+    delay->bandwidth = 0;
+
+    for (uint32_t i = 0; i < num_rates; ++i) {
+        if (delay->delivery_rates[i] > delay->bandwidth) {
+            delay->bandwidth = delay->delivery_rates[i];
+        }
+    }
+}
+
+/* Record the delivery rate of the round that just ended.
+ *
+ * return the delivery rate.
+ */
+static double delay_add_round(Delay_Congestion *delay, uint64_t round_length)
+{
+    /* A request packet only acknowledges the packets up to the last one it
+     * asks for again, so the packets after a lost one are all acknowledged
+     * at once when it arrives. Packets can't be delivered faster than they
+     * were sent, though.
+     */
+    const uint32_t delivered = delay->round_delivered < delay->round_sent
+                               ? delay->round_delivered : delay->round_sent;
+    const double delivery_rate = delivered * 1000.0 / round_length;
+
+    /* With nothing left to send, a lower delivery rate says nothing about the
+     * link.
+     */
+    if (delay->round_app_limited && delivery_rate < delay->bandwidth) {
+        return delivery_rate;
+    }
+
+    delay->delivery_rates[delay->num_rounds % CONGESTION_BANDWIDTH_WINDOW] = delivery_rate;
+    ++delay->num_rounds;
+    delay_update_bandwidth(delay);
+    return delivery_rate;
+}
+
+/* Move on to the next phase at the end of a round if it is time. */
+static void delay_next_round(Delay_Congestion *delay, uint64_t min_rtt, double delivery_rate)
+{
+    /* Only trust round trip times measured in this round. */
+    const bool queue_full = delay->round_min_rtt != 0
+                            && delay->round_min_rtt > min_rtt * DELAY_FULL_QUEUE_RTT_RATIO;
+
+    switch (delay->phase) {
+        case DELAY_CONGESTION_STARTUP: {
+            /* A round trip time grown by a late acknowledgement only means
+             * a full queue once the delivery rate stops growing too.
+             */
+            if (delay->bandwidth >= delay->full_bandwidth * DELAY_FULL_GROWTH) {
+                delay->full_bandwidth = delay->bandwidth;
+                delay->rounds_without_growth = 0;
+            } else if (queue_full || ++delay->rounds_without_growth >= DELAY_FULL_ROUNDS) {
+                delay->phase = DELAY_CONGESTION_DRAIN;
+                delay->rounds_without_growth = 0;
+            }
+
+            break;
+        }
+
+        case DELAY_CONGESTION_DRAIN: {
+            /* Drained once the round trip time is back near the lowest, or
+             * after as many rounds as the startup took to notice.
+             */
+            ++delay->rounds_without_growth;
+
+            if ((delay->rtt != 0 && delay->rtt <= min_rtt * DELAY_QUEUE_RTT_RATIO)
+                    || delay->rounds_without_growth >= DELAY_FULL_ROUNDS) {
+                delay->phase = DELAY_CONGESTION_PROBE;
+                delay->cycle_index = 2;
+            }
+
+            break;
+        }
+
+        case DELAY_CONGESTION_PROBE: {
+            delay->cycle_index = (delay->cycle_index + 1) % NUM_DELAY_PROBE_GAINS;
+
+            /* With a queue at the bottleneck, packets were delivered as fast
+             * as the link goes. Higher rates in the window were measured
+             * when acknowledgements were held back. Late acknowledgements of
+             * lost packets also look like a queue, so the bandwidth shrinks
+             * a little at a time.
+             */
+            if (queue_full && !delay->round_app_limited) {
+                double limit = delay->bandwidth * DELAY_FULL_QUEUE_BACKOFF;
+
+                if (delivery_rate > limit) {
+                    limit = delivery_rate;
+                }
+
+                for (uint32_t i = 0; i < CONGESTION_BANDWIDTH_WINDOW; ++i) {
+                    if (delay->delivery_rates[i] > limit) {
+                        delay->delivery_rates[i] = limit;
+                    }
+                }
+
+                delay_update_bandwidth(delay);
+            }
+
+            break;
+        }
+    }
+}
+
+static double delay_gain(const Delay_Congestion *delay, uint64_t min_rtt)
+{
+    switch (delay->phase) {
+        case DELAY_CONGESTION_STARTUP:
+            return DELAY_STARTUP_GAIN;
+
+        case DELAY_CONGESTION_DRAIN:
+            return 1.0 / DELAY_STARTUP_GAIN;
+
+        case DELAY_CONGESTION_PROBE:
+            break;
+    }
+
+    double gain = delay_probe_gains[delay->cycle_index];
+
+    if (delay->rtt == 0) {
+        return gain;
+    }
+
+    /* Don't probe into a queue that is filling up, and drain one that stays
+     * full.
+     */
+    if (delay->rtt > min_rtt * DELAY_FULL_QUEUE_RTT_RATIO) {
+        gain = delay_probe_gains[1];
+    } else if (delay->rtt > min_rtt * DELAY_QUEUE_RTT_RATIO && gain > 1.0) {
+        gain = 1.0;
+    }
+
+    return gain;
+}
+
+static void delay_update(Congestion_Control *cc, const Congestion_Sample *sample, double *send_rate,
+                         double *send_rate_requested)
+{
+    Delay_Congestion *const delay = &cc->state.delay;
+
+    if (sample->interval == 0) {
+        return;
+    }
+
+    if (delay->round_start == 0) {
+        delay->round_start = sample->time - sample->interval;
+    }
+
+    delay->round_sent += sample->packets_sent + sample->packets_resent;
+    delay->round_delivered += sample->packets_delivered;
+
+    if (sample->send_queue == 0) {
+        delay->round_app_limited = true;
+    }
+
+    if (sample->rtt != 0 && (delay->round_min_rtt == 0 || sample->rtt < delay->round_min_rtt)) {
+        delay->round_min_rtt = sample->rtt;
+    }
+
+    /* Acknowledgements come in bursts with the request packets, so the
+     * delivery rate is only measured over whole rounds.
+     */
+    const uint64_t min_round_length = sample->min_rtt > DELAY_MIN_ROUND_LENGTH
+                                      ? sample->min_rtt : DELAY_MIN_ROUND_LENGTH;
+    const uint64_t round_length = sample->time - delay->round_start;
+
+    if (round_length >= min_round_length) {
+        const double delivery_rate = delay_add_round(delay, round_length);
+
+        if (delay->round_min_rtt != 0) {
+            delay->rtt = delay->round_min_rtt;
+        }
+
+        delay->round_start = sample->time;
+        delay->round_sent = 0;
+        delay->round_delivered = 0;
+        delay_next_round(delay, sample->min_rtt, delivery_rate);
+        delay->round_app_limited = false;
+        delay->round_min_rtt = 0;
+    }
+
+    if (sample->hold_rate) {
+        return;
+    }
+
+    double rate = delay_gain(delay, sample->min_rtt) * delay->bandwidth;
+
+    /* Until the first packets are acknowledged, the bandwidth is unknown. */
+    if (delay->phase == DELAY_CONGESTION_STARTUP && rate < *send_rate) {
+        rate = *send_rate;
+    }
+
+    if (rate < CONGESTION_MIN_RATE) {
+        rate = CONGESTION_MIN_RATE;
+    }
+
+    *send_rate = rate;
+    *send_rate_requested = rate;
+}
+
+static const Congestion_Controller controllers[NUM_CONGESTION_CONTROL_TYPES] = {
+    {"queue", queue_init, queue_update},
+    {"delay", delay_init, delay_update},
+};
+
+void congestion_control_init(Congestion_Control *cc, Congestion_Control_Type type)
+{
+    if ((unsigned int)type >= NUM_CONGESTION_CONTROL_TYPES) {
+        type = CONGESTION_CONTROL_QUEUE;
+    }
+
+    cc->type = type;
+    controllers[type].init(cc);
+}
+
+void congestion_control_update(Congestion_Control *cc, const Congestion_Sample *sample, double *send_rate,
+                               double *send_rate_requested)
+{
+    controllers[cc->type].update(cc, sample, send_rate, send_rate_requested);
+}
+
+const char *congestion_control_name(Congestion_Control_Type type)
+{
+    if ((unsigned int)type >= NUM_CONGESTION_CONTROL_TYPES) {
+        return nullptr;
+    }
+
+    return controllers[type].name;
+}
@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Congestion controllers deciding how fast a crypto connection sends.
+ *
+ * Every CONGESTION_SAMPLE_INTERVAL ms, net_crypto gives the controller of an
+ * established connection a sample of what happened on it since the previous
+ * one, and the controller sets the rate at which new packets are sent and
+ * the rate at which packets the peer asked for again may be resent.
+ */
+#ifndef C_TOXCORE_TOXCORE_CONGESTION_CONTROL_H
+#define C_TOXCORE_TOXCORE_CONGESTION_CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Interval in ms between two samples. */
+#define CONGESTION_SAMPLE_INTERVAL 50
+
+/* Minimum send rate in packets per second. */
+#define CONGESTION_MIN_RATE 4.0
+
+/* Send queue length that the queue controller always allows. */
+#define CONGESTION_MIN_QUEUE_LENGTH 64
+
+/* Base current transfer speed on last CONGESTION_QUEUE_ARRAY_SIZE number of points taken
+ * at the dT defined by CONGESTION_SAMPLE_INTERVAL */
+#define CONGESTION_QUEUE_ARRAY_SIZE 12
+#define CONGESTION_LAST_SENT_ARRAY_SIZE (CONGESTION_QUEUE_ARRAY_SIZE * 2)
+
+/* Number of rounds the delay controller takes the highest delivery rate of. */
+#define CONGESTION_BANDWIDTH_WINDOW 10
+
+/* Timeout for increasing speed after congestion event (in ms). */
+#define CONGESTION_EVENT_TIMEOUT 1000
+
+typedef enum Congestion_Control_Type {
+    /* Follows the growth of the send queue, toxcore's original controller. */
+    CONGESTION_CONTROL_QUEUE,
+
+    /* Measures the bottleneck bandwidth from the delivery rate and sends at
+     * about that rate, probing for more now and then, like BBR. Slows down
+     * when the round trip time grows above the lowest seen.
+     */
+    CONGESTION_CONTROL_DELAY,
+} Congestion_Control_Type;
+
+#define NUM_CONGESTION_CONTROL_TYPES 2
+
+typedef struct Congestion_Sample {
+    uint64_t time;
+    /* Time in ms since the previous sample. */
+    uint64_t interval;
+
+    /* Packets sent for the first time and resent since the previous sample. */
+    uint32_t packets_sent;
+    uint32_t packets_resent;
+    /* Packets the peer acknowledged since the previous sample. */
+    uint32_t packets_delivered;
+
+    /* Packets in the send buffer, sent or not, acknowledged or not. */
+    uint32_t send_queue;
+
+    /* Lowest round trip time seen on the connection and the latest one, in
+     * ms. The latest is 0 if none was measured since the previous sample.
+     */
+    uint64_t min_rtt;
+    uint64_t rtt;
+
+    /* Last time the send budget of the connection ran out. */
+    uint64_t last_congestion_event;
+
+    /* The controller should keep the current rates, e.g. because the
+     * connection just switched from TCP to UDP.
+     */
+    bool hold_rate;
+} Congestion_Sample;
+
+typedef struct Queue_Congestion {
+    uint32_t last_sendqueue_size[CONGESTION_QUEUE_ARRAY_SIZE];
+    uint32_t last_sendqueue_counter;
+    long signed int last_num_packets_sent[CONGESTION_LAST_SENT_ARRAY_SIZE];
+    long signed int last_num_packets_resent[CONGESTION_LAST_SENT_ARRAY_SIZE];
+} Queue_Congestion;
+
+typedef enum Delay_Congestion_Phase {
+    DELAY_CONGESTION_STARTUP,
+    DELAY_CONGESTION_DRAIN,
+    DELAY_CONGESTION_PROBE,
+} Delay_Congestion_Phase;
+
+typedef struct Delay_Congestion {
+    Delay_Congestion_Phase phase;
+
+    /* Delivery rates of the latest rounds in packets per second. */
+    double delivery_rates[CONGESTION_BANDWIDTH_WINDOW];
+    uint32_t num_rounds;
+    double bandwidth;
+
+    /* Start of the current round, which lasts one lowest round trip time,
+     * the packets sent and delivered in it so far and whether the send queue
+     * ran empty.
+     */
+    uint64_t round_start;
+    uint32_t round_sent;
+    uint32_t round_delivered;
+    bool round_app_limited;
+    /* Lowest round trip time measured in the current round and in the last
+     * round that had one, 0 if none. The request packets acknowledge some
+     * packets late, which only ever makes the round trip time look longer.
+     */
+    uint64_t round_min_rtt;
+    uint64_t rtt;
+    /* Bandwidth at the last round in which it grew by a quarter, and the
+     * number of rounds since.
+     */
+    double full_bandwidth;
+    uint32_t rounds_without_growth;
+    /* Position in the cycle of rates when probing. */
+    uint32_t cycle_index;
+} Delay_Congestion;
+
+typedef struct Congestion_Control {
+    Congestion_Control_Type type;
+
+    union {
+        Queue_Congestion queue;
+        Delay_Congestion delay;
+    } state;
+} Congestion_Control;
+
+/* Set up cc as a new controller of the given type. */
+void congestion_control_init(Congestion_Control *cc, Congestion_Control_Type type);
+
+/* Update the send rates in packets per second after a sample: send_rate for
+ * new packets and send_rate_requested for packets the peer asked for again.
+ * Both are at least CONGESTION_MIN_RATE.
+ */
+void congestion_control_update(Congestion_Control *cc, const Congestion_Sample *sample, double *send_rate,
+                               double *send_rate_requested);
+
+/* Short name of the controller type, or NULL if there is no such type. */
+const char *congestion_control_name(Congestion_Control_Type type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_TOXCORE_TOXCORE_CONGESTION_CONTROL_H
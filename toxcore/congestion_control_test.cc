@@ -0,0 +1,103 @@
+#include "congestion_control.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+namespace {
+
+Congestion_Sample steady_sample(uint64_t time, uint32_t delivered, uint32_t send_queue, uint64_t rtt) {
+  Congestion_Sample sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.time = time;
+  sample.interval = CONGESTION_SAMPLE_INTERVAL;
+  sample.packets_sent = delivered;
+  sample.packets_delivered = delivered;
+  sample.send_queue = send_queue;
+  sample.min_rtt = 100;
+  sample.rtt = rtt;
+  return sample;
+}
+
+TEST(CongestionControl, UnknownTypesUseTheQueueController) {
+  Congestion_Control cc;
+  congestion_control_init(&cc, (Congestion_Control_Type)NUM_CONGESTION_CONTROL_TYPES);
+  EXPECT_EQ(cc.type, CONGESTION_CONTROL_QUEUE);
+  EXPECT_STREQ(congestion_control_name(CONGESTION_CONTROL_QUEUE), "queue");
+  EXPECT_STREQ(congestion_control_name(CONGESTION_CONTROL_DELAY), "delay");
+  EXPECT_EQ(congestion_control_name((Congestion_Control_Type)NUM_CONGESTION_CONTROL_TYPES), nullptr);
+}
+
+TEST(CongestionControl, QueueControllerSpeedsUpWithoutCongestion) {
+  Congestion_Control cc;
+  congestion_control_init(&cc, CONGESTION_CONTROL_QUEUE);
+  double send_rate = CONGESTION_MIN_RATE;
+  double send_rate_requested = CONGESTION_MIN_RATE;
+
+  for (uint64_t i = 1; i <= CONGESTION_LAST_SENT_ARRAY_SIZE; ++i) {
+    const Congestion_Sample sample = steady_sample(10000 + i * CONGESTION_SAMPLE_INTERVAL, 50, 10, 100);
+    congestion_control_update(&cc, &sample, &send_rate, &send_rate_requested);
+  }
+
+  // 50 packets every 50 ms, 20% more.
+  EXPECT_DOUBLE_EQ(send_rate, 1200.0);
+  EXPECT_GE(send_rate_requested, send_rate);
+}
+
+TEST(CongestionControl, HoldRateKeepsTheRates) {
+  for (uint32_t type = 0; type < NUM_CONGESTION_CONTROL_TYPES; ++type) {
+    Congestion_Control cc;
+    congestion_control_init(&cc, (Congestion_Control_Type)type);
+    double send_rate = 123.0;
+    double send_rate_requested = 456.0;
+
+    Congestion_Sample sample = steady_sample(10000, 50, 10, 100);
+    sample.hold_rate = true;
+    congestion_control_update(&cc, &sample, &send_rate, &send_rate_requested);
+
+    EXPECT_EQ(send_rate, 123.0);
+    EXPECT_EQ(send_rate_requested, 456.0);
+  }
+}
+
+TEST(CongestionControl, DelayControllerSendsAtTheBandwidth) {
+  Congestion_Control cc;
+  congestion_control_init(&cc, CONGESTION_CONTROL_DELAY);
+  double send_rate = CONGESTION_MIN_RATE;
+  double send_rate_requested = CONGESTION_MIN_RATE;
+
+  // A link delivering 1000 packets per second with a full send queue.
+  for (uint64_t i = 1; i <= 200; ++i) {
+    const Congestion_Sample sample = steady_sample(i * CONGESTION_SAMPLE_INTERVAL, 50, 1000, 100);
+    congestion_control_update(&cc, &sample, &send_rate, &send_rate_requested);
+    EXPECT_GE(send_rate, CONGESTION_MIN_RATE);
+  }
+
+  EXPECT_EQ(cc.state.delay.phase, DELAY_CONGESTION_PROBE);
+  EXPECT_GE(send_rate, 750.0);
+  EXPECT_LE(send_rate, 1250.0);
+  EXPECT_EQ(send_rate_requested, send_rate);
+}
+
+TEST(CongestionControl, DelayControllerDrainsAGrowingQueue) {
+  Congestion_Control cc;
+  congestion_control_init(&cc, CONGESTION_CONTROL_DELAY);
+  double send_rate = CONGESTION_MIN_RATE;
+  double send_rate_requested = CONGESTION_MIN_RATE;
+
+  for (uint64_t i = 1; i <= 200; ++i) {
+    const Congestion_Sample sample = steady_sample(i * CONGESTION_SAMPLE_INTERVAL, 50, 1000, 100);
+    congestion_control_update(&cc, &sample, &send_rate, &send_rate_requested);
+  }
+
+  // The round trip time tripled: the queue at the bottleneck keeps growing.
+  // The rate changes at the end of a round.
+  for (uint64_t i = 201; i <= 220; ++i) {
+    const Congestion_Sample sample = steady_sample(i * CONGESTION_SAMPLE_INTERVAL, 50, 1000, 300);
+    congestion_control_update(&cc, &sample, &send_rate, &send_rate_requested);
+  }
+
+  EXPECT_LT(send_rate, 1000.0);
+}
+
+}  // namespace
@@ -191,6 +191,13 @@ int32_t encrypt_data_symmetric(const uint8_t *secret_key, const uint8_t *nonce,
         return -1;
     }
 
+#ifndef VANILLA_NACL
+
+    if (crypto_box_easy_afternm(encrypted, plain, length, nonce, secret_key) != 0) {
+        return -1;
+    }
+
+#else
     const size_t size_temp_plain = length + crypto_box_ZEROBYTES;
     const size_t size_temp_encrypted = length + crypto_box_MACBYTES + crypto_box_BOXZEROBYTES;
 
@@ -219,6 +226,7 @@ int32_t encrypt_data_symmetric(const uint8_t *secret_key, const uint8_t *nonce,
 
     crypto_free(temp_plain, size_temp_plain);
     crypto_free(temp_encrypted, size_temp_encrypted);
+#endif
 
     return length + crypto_box_MACBYTES;
 }
@@ -230,6 +238,13 @@ int32_t decrypt_data_symmetric(const uint8_t *secret_key, const uint8_t *nonce,
         return -1;
     }
 
+#ifndef VANILLA_NACL
+
+    if (crypto_box_open_easy_afternm(plain, encrypted, length, nonce, secret_key) != 0) {
+        return -1;
+    }
+
+#else
     const size_t size_temp_plain = length + crypto_box_ZEROBYTES;
     const size_t size_temp_encrypted = length + crypto_box_BOXZEROBYTES;
 
@@ -257,7 +272,68 @@ int32_t decrypt_data_symmetric(const uint8_t *secret_key, const uint8_t *nonce,
 
     crypto_free(temp_plain, size_temp_plain);
     crypto_free(temp_encrypted, size_temp_encrypted);
+#endif
+
+    return length - crypto_box_MACBYTES;
+}
+
+int32_t encrypt_data_symmetric_in_place(const uint8_t *secret_key, const uint8_t *nonce, uint8_t *data, size_t length)
+{
+    if (length == 0 || !secret_key || !nonce || !data) {
+        return -1;
+    }
+
+#ifndef VANILLA_NACL
+
+    if (crypto_box_detached_afternm(data + crypto_box_MACBYTES, data, data + crypto_box_MACBYTES, length, nonce,
+                                    secret_key) != 0) {
+        return -1;
+    }
+
+    return length + crypto_box_MACBYTES;
+#else
+    /* NaCl needs zero padding in front of the plain text, so it can't work
+     * in place without the caller leaving crypto_box_ZEROBYTES of room.
+     */
+    uint8_t *plain = crypto_malloc(length);
+
+    if (plain == nullptr) {
+        return -1;
+    }
+
+    memcpy(plain, data + crypto_box_MACBYTES, length);
+    const int32_t ret = encrypt_data_symmetric(secret_key, nonce, plain, length, data);
+    crypto_free(plain, length);
+    return ret;
+#endif
+}
+
+int32_t decrypt_data_symmetric_in_place(const uint8_t *secret_key, const uint8_t *nonce, uint8_t *data, size_t length)
+{
+    if (length <= crypto_box_BOXZEROBYTES || !secret_key || !nonce || !data) {
+        return -1;
+    }
+
+#ifndef VANILLA_NACL
+
+    if (crypto_box_open_detached_afternm(data + crypto_box_MACBYTES, data + crypto_box_MACBYTES, data,
+                                         length - crypto_box_MACBYTES, nonce, secret_key) != 0) {
+        return -1;
+    }
+
     return length - crypto_box_MACBYTES;
+#else
+    uint8_t *encrypted = crypto_malloc(length);
+
+    if (encrypted == nullptr) {
+        return -1;
+    }
+
+    memcpy(encrypted, data, length);
+    const int32_t ret = decrypt_data_symmetric(secret_key, nonce, encrypted, length, data + crypto_box_MACBYTES);
+    crypto_free(encrypted, length);
+    return ret;
+#endif
 }
 
 int32_t encrypt_data(const uint8_t *public_key, const uint8_t *secret_key, const uint8_t *nonce,
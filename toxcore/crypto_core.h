@@ -246,6 +246,29 @@ int32_t encrypt_data_symmetric(const uint8_t *shared_key, const uint8_t *nonce,
 int32_t decrypt_data_symmetric(const uint8_t *shared_key, const uint8_t *nonce, const uint8_t *encrypted, size_t length,
                                uint8_t *plain);
 
+/**
+ * Encrypts the length bytes of plain text at data + CRYPTO_MAC_SIZE in place
+ * and puts the MAC in front of them, leaving data in the format
+ * encrypt_data_symmetric produces. Use this to encrypt a packet that was
+ * assembled where its cipher text goes, without a second buffer.
+ *
+ * @return -1 if there was a problem, length of encrypted data (length +
+ * CRYPTO_MAC_SIZE) if everything was fine.
+ */
+int32_t encrypt_data_symmetric_in_place(const uint8_t *shared_key, const uint8_t *nonce, uint8_t *data,
+                                        size_t length);
+
+/**
+ * Decrypts the length bytes of encrypted data in place. The plain text ends up
+ * at data + CRYPTO_MAC_SIZE.
+ * data is left unchanged if decryption fails.
+ *
+ * @return -1 if there was a problem (decryption failed), length of plain data
+ * if everything was fine.
+ */
+int32_t decrypt_data_symmetric_in_place(const uint8_t *shared_key, const uint8_t *nonce, uint8_t *data,
+                                        size_t length);
+
 /**
  * Increment the given nonce by 1 in big endian (rightmost byte incremented
  * first).
@@ -3,6 +3,8 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <vector>
 
 namespace {
@@ -89,4 +91,95 @@ TEST(CryptoCore, MemcmpTimingIsDataIndependent) {
       << "Time of the different data comparison: " << result.second << " clocks";
 }
 
+TEST(CryptoCore, InPlaceEncryptionMatchesSymmetricEncryption) {
+  uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+  new_symmetric_key(shared_key);
+  uint8_t nonce[CRYPTO_NONCE_SIZE];
+  random_nonce(nonce);
+
+  for (size_t length = 1; length <= 1400; length += 37) {
+    std::vector<uint8_t> plain(length);
+    random_bytes(plain.data(), length);
+
+    std::vector<uint8_t> encrypted(length + CRYPTO_MAC_SIZE);
+    ASSERT_EQ(encrypt_data_symmetric(shared_key, nonce, plain.data(), length, encrypted.data()),
+              length + CRYPTO_MAC_SIZE);
+
+    std::vector<uint8_t> data(CRYPTO_MAC_SIZE);
+    data.insert(data.end(), plain.begin(), plain.end());
+    ASSERT_EQ(encrypt_data_symmetric_in_place(shared_key, nonce, data.data(), length),
+              length + CRYPTO_MAC_SIZE);
+    EXPECT_EQ(data, encrypted) << "length " << length;
+
+    ASSERT_EQ(decrypt_data_symmetric_in_place(shared_key, nonce, data.data(), data.size()), length);
+    EXPECT_TRUE(std::equal(plain.begin(), plain.end(), data.begin() + CRYPTO_MAC_SIZE));
+
+    std::vector<uint8_t> decrypted(length);
+    ASSERT_EQ(decrypt_data_symmetric(shared_key, nonce, encrypted.data(), encrypted.size(),
+                                     decrypted.data()),
+              length);
+    EXPECT_EQ(decrypted, plain);
+
+    // A corrupted MAC is rejected.
+    encrypted[0] ^= 1;
+    EXPECT_EQ(decrypt_data_symmetric_in_place(shared_key, nonce, encrypted.data(), encrypted.size()),
+              -1);
+  }
+}
+
+/**
+ * Not a test, but a benchmark: prints the throughput of symmetric encryption
+ * and decryption of packets of the sizes toxcore sends, copying between
+ * buffers and in place.
+ */
+TEST(CryptoCore, SymmetricEncryptionThroughput) {
+  uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+  new_symmetric_key(shared_key);
+  uint8_t nonce[CRYPTO_NONCE_SIZE];
+  random_nonce(nonce);
+
+  // Bytes of plain text per size and operation.
+  size_t const total = 8 * 1024 * 1024;
+
+  for (size_t const length : {64, 128, 256, 512, 1024, 1400}) {
+    size_t const packets = total / length;
+    std::vector<uint8_t> plain(length);
+    std::vector<uint8_t> encrypted(length + CRYPTO_MAC_SIZE);
+    random_bytes(plain.data(), length);
+
+    auto const mib_per_second = [packets, length](std::chrono::steady_clock::time_point start) {
+      std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+      return packets * length / elapsed.count() / (1024 * 1024);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < packets; ++i) {
+      encrypt_data_symmetric(shared_key, nonce, plain.data(), length, encrypted.data());
+    }
+
+    double const encrypt_copy = mib_per_second(start);
+    start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < packets; ++i) {
+      ASSERT_EQ(decrypt_data_symmetric(shared_key, nonce, encrypted.data(), encrypted.size(),
+                                       plain.data()),
+                length);
+    }
+
+    double const decrypt_copy = mib_per_second(start);
+    start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < packets; ++i) {
+      encrypt_data_symmetric_in_place(shared_key, nonce, encrypted.data(), length);
+      decrypt_data_symmetric_in_place(shared_key, nonce, encrypted.data(), encrypted.size());
+    }
+
+    double const round_trip_in_place = mib_per_second(start);
+
+    std::printf("%4zu bytes: encrypt %7.1f MiB/s, decrypt %7.1f MiB/s, in place round trip %7.1f MiB/s\n",
+                length, encrypt_copy, decrypt_copy, round_trip_in_place);
+  }
+}
+
 }  // namespace
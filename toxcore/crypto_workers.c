@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Threads encrypting and decrypting batches of packets.
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "crypto_workers.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "ccompat.h"
+
+/* Batches smaller than this are run on the calling thread alone, waking the
+ * threads would take longer than the jobs.
+ */
+#define CRYPTO_WORKERS_MIN_BATCH 4
+
+struct Crypto_Workers {
+    const Logger *log;
+
+    pthread_t threads[MAX_CRYPTO_WORKER_THREADS];
+    uint16_t num_threads;
+
+    pthread_mutex_t lock;
+    /* Signalled when a batch starts and when the threads should stop. */
+    pthread_cond_t work_cond;
+    /* Signalled when the last job of a batch is done. */
+    pthread_cond_t done_cond;
+    bool running;
+
+    /* The batch being run, protected by the lock. */
+    Crypto_Job *jobs;
+    uint32_t num_jobs;
+    uint32_t next_job;
+    uint32_t jobs_done;
+
+    /* Only used by the thread calling crypto_workers_run(). */
+    uint64_t total_jobs;
+    uint64_t batches;
+};
+
+static void run_job(Crypto_Job *job)
+{
+    if (job->encrypt) {
+        job->result = encrypt_data_symmetric_in_place(job->shared_key, job->nonce, job->data, job->length);
+    } else {
+        job->result = decrypt_data_symmetric_in_place(job->shared_key, job->nonce, job->data, job->length);
+    }
+}
+
+/* Run jobs of the current batch until none are left to take. Must be called
+ * with the lock held, returns with it held.
+ */
+static void run_batch_jobs(Crypto_Workers *workers)
+{
+    while (workers->next_job < workers->num_jobs) {
+        Crypto_Job *const job = &workers->jobs[workers->next_job];
+        ++workers->next_job;
+        pthread_mutex_unlock(&workers->lock);
+
+        run_job(job);
+
+        pthread_mutex_lock(&workers->lock);
+        ++workers->jobs_done;
+
+        if (workers->jobs_done == workers->num_jobs) {
+            pthread_cond_signal(&workers->done_cond);
+        }
+    }
+}
+
+static void *crypto_worker_thread(void *arg)
+{
+    Crypto_Workers *const workers = (Crypto_Workers *)arg;
+
+    pthread_mutex_lock(&workers->lock);
+
+    while (true) {
+        while (workers->running && workers->next_job >= workers->num_jobs) {
+            pthread_cond_wait(&workers->work_cond, &workers->lock);
+        }
+
+        if (!workers->running) {
+            break;
+        }
+
+        run_batch_jobs(workers);
+    }
+
+    pthread_mutex_unlock(&workers->lock);
+    return nullptr;
+}
+
+Crypto_Workers *new_crypto_workers(const Logger *log, uint16_t num_threads)
+{
+    if (num_threads == 0 || num_threads > MAX_CRYPTO_WORKER_THREADS) {
+        return nullptr;
+    }
+
+    Crypto_Workers *const workers = (Crypto_Workers *)calloc(1, sizeof(Crypto_Workers));
+
+    if (workers == nullptr) {
+        return nullptr;
+    }
+
+    workers->log = log;
+    workers->running = true;
+
+    if (pthread_mutex_init(&workers->lock, nullptr) != 0) {
+        free(workers);
+        return nullptr;
+    }
+
+    if (pthread_cond_init(&workers->work_cond, nullptr) != 0) {
+        pthread_mutex_destroy(&workers->lock);
+        free(workers);
+        return nullptr;
+    }
+
+    if (pthread_cond_init(&workers->done_cond, nullptr) != 0) {
+        pthread_cond_destroy(&workers->work_cond);
+        pthread_mutex_destroy(&workers->lock);
+        free(workers);
+        return nullptr;
+    }
+
+    for (uint16_t i = 0; i < num_threads; ++i) {
+        if (pthread_create(&workers->threads[i], nullptr, crypto_worker_thread, workers) != 0) {
+            LOGGER_ERROR(log, "failed to start crypto worker thread %u", i);
+            kill_crypto_workers(workers);
+            return nullptr;
+        }
+
+        ++workers->num_threads;
+    }
+
+    return workers;
+}
+
+void kill_crypto_workers(Crypto_Workers *workers)
+{
+    if (workers == nullptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&workers->lock);
+    workers->running = false;
+    pthread_cond_broadcast(&workers->work_cond);
+    pthread_mutex_unlock(&workers->lock);
+
+    for (uint16_t i = 0; i < workers->num_threads; ++i) {
+        pthread_join(workers->threads[i], nullptr);
+    }
+
+    pthread_cond_destroy(&workers->done_cond);
+    pthread_cond_destroy(&workers->work_cond);
+    pthread_mutex_destroy(&workers->lock);
+    free(workers);
+}
+
+void crypto_workers_run(Crypto_Workers *workers, Crypto_Job *jobs, uint32_t num_jobs)
+{
+    workers->total_jobs += num_jobs;
+    ++workers->batches;
+
+    if (num_jobs < CRYPTO_WORKERS_MIN_BATCH) {
+        for (uint32_t i = 0; i < num_jobs; ++i) {
+            run_job(&jobs[i]);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&workers->lock);
+    workers->jobs = jobs;
+    workers->num_jobs = num_jobs;
+    workers->next_job = 0;
+    workers->jobs_done = 0;
+    pthread_cond_broadcast(&workers->work_cond);
+
+    run_batch_jobs(workers);
+
+    while (workers->jobs_done < workers->num_jobs) {
+        pthread_cond_wait(&workers->done_cond, &workers->lock);
+    }
+
+    workers->jobs = nullptr;
+    workers->num_jobs = 0;
+    workers->next_job = 0;
+    pthread_mutex_unlock(&workers->lock);
+}
+
+uint64_t crypto_workers_jobs(const Crypto_Workers *workers)
+{
+    return workers->total_jobs;
+}
+
+uint64_t crypto_workers_batches(const Crypto_Workers *workers)
+{
+    return workers->batches;
+}
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Threads encrypting and decrypting batches of packets.
+ *
+ * The caller fills an array of jobs, each with its own key and nonce, and
+ * crypto_workers_run() spreads them over the threads and the calling thread,
+ * returning once all are done. The jobs of a batch are independent, so the
+ * caller decides the order in which their results are used.
+ */
+#ifndef C_TOXCORE_TOXCORE_CRYPTO_WORKERS_H
+#define C_TOXCORE_TOXCORE_CRYPTO_WORKERS_H
+
+#include "crypto_core.h"
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of worker threads. */
+#define MAX_CRYPTO_WORKER_THREADS 64
+
+typedef struct Crypto_Workers Crypto_Workers;
+
+typedef struct Crypto_Job {
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    uint8_t nonce[CRYPTO_NONCE_SIZE];
+
+    /* Encrypt the length bytes at data + CRYPTO_MAC_SIZE with
+     * encrypt_data_symmetric_in_place() if true, decrypt the length bytes at
+     * data with decrypt_data_symmetric_in_place() if false.
+     */
+    bool encrypt;
+    uint8_t *data;
+    uint16_t length;
+
+    /* What the crypto function returned. */
+    int32_t result;
+} Crypto_Job;
+
+/* Start num_threads threads.
+ *
+ * return NULL on failure.
+ */
+Crypto_Workers *new_crypto_workers(const Logger *log, uint16_t num_threads);
+
+/* Stop the threads. Must not be called while crypto_workers_run() runs. */
+void kill_crypto_workers(Crypto_Workers *workers);
+
+/* Run all jobs, on the threads and the calling thread, and return once they
+ * are done. Only one thread may call this at a time.
+ */
+void crypto_workers_run(Crypto_Workers *workers, Crypto_Job *jobs, uint32_t num_jobs);
+
+/* Number of jobs run and batches run since the workers were started. */
+uint64_t crypto_workers_jobs(const Crypto_Workers *workers);
+uint64_t crypto_workers_batches(const Crypto_Workers *workers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_TOXCORE_TOXCORE_CRYPTO_WORKERS_H
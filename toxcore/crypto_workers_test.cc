@@ -0,0 +1,115 @@
+#include "crypto_workers.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace {
+
+using Packet = std::array<uint8_t, 1400>;
+
+struct Crypto_Workers_Deleter {
+  void operator()(Crypto_Workers *workers) { kill_crypto_workers(workers); }
+};
+
+using Crypto_Workers_Ptr = std::unique_ptr<Crypto_Workers, Crypto_Workers_Deleter>;
+
+std::vector<Packet> random_packets(size_t count) {
+  std::vector<Packet> packets(count);
+
+  for (Packet &packet : packets) {
+    random_bytes(packet.data(), packet.size());
+  }
+
+  return packets;
+}
+
+// Fills one job per packet, each with its own key and a nonce one above the
+// previous job's, as net_crypto does for the packets of a connection.
+std::vector<Crypto_Job> encrypt_jobs(std::vector<Packet> *packets, uint16_t length) {
+  std::vector<Crypto_Job> jobs(packets->size());
+  uint8_t nonce[CRYPTO_NONCE_SIZE];
+  random_nonce(nonce);
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    new_symmetric_key(jobs[i].shared_key);
+    std::copy(nonce, nonce + CRYPTO_NONCE_SIZE, jobs[i].nonce);
+    jobs[i].encrypt = true;
+    jobs[i].data = (*packets)[i].data();
+    jobs[i].length = length;
+    increment_nonce(nonce);
+  }
+
+  return jobs;
+}
+
+TEST(CryptoWorkers, RejectsInvalidThreadCounts) {
+  EXPECT_EQ(new_crypto_workers(nullptr, 0), nullptr);
+  EXPECT_EQ(new_crypto_workers(nullptr, MAX_CRYPTO_WORKER_THREADS + 1), nullptr);
+}
+
+TEST(CryptoWorkers, BatchMatchesSequentialEncryption) {
+  Crypto_Workers_Ptr workers(new_crypto_workers(nullptr, 4));
+  ASSERT_NE(workers, nullptr);
+
+  for (const size_t count : {1, 3, 4, 64, 200}) {
+    const uint16_t length = 1000;
+    std::vector<Packet> packets = random_packets(count);
+    const std::vector<Packet> plain = packets;
+    std::vector<Crypto_Job> jobs = encrypt_jobs(&packets, length);
+
+    crypto_workers_run(workers.get(), jobs.data(), jobs.size());
+
+    for (size_t i = 0; i < count; ++i) {
+      ASSERT_EQ(jobs[i].result, length + CRYPTO_MAC_SIZE);
+
+      std::array<uint8_t, length + CRYPTO_MAC_SIZE> expected;
+      ASSERT_EQ(encrypt_data_symmetric(jobs[i].shared_key, jobs[i].nonce, plain[i].data() + CRYPTO_MAC_SIZE,
+                                       length, expected.data()),
+                length + CRYPTO_MAC_SIZE);
+      EXPECT_TRUE(std::equal(expected.begin(), expected.end(), packets[i].begin())) << "packet " << i;
+    }
+  }
+
+  EXPECT_EQ(crypto_workers_batches(workers.get()), 5);
+  EXPECT_EQ(crypto_workers_jobs(workers.get()), 1 + 3 + 4 + 64 + 200);
+}
+
+TEST(CryptoWorkers, DecryptsWhatWasEncrypted) {
+  Crypto_Workers_Ptr workers(new_crypto_workers(nullptr, 2));
+  ASSERT_NE(workers, nullptr);
+
+  const uint16_t length = 500;
+  std::vector<Packet> packets = random_packets(64);
+  const std::vector<Packet> plain = packets;
+  std::vector<Crypto_Job> jobs = encrypt_jobs(&packets, length);
+  crypto_workers_run(workers.get(), jobs.data(), jobs.size());
+
+  for (Crypto_Job &job : jobs) {
+    job.encrypt = false;
+    job.length = length + CRYPTO_MAC_SIZE;
+  }
+
+  // A packet that was tampered with fails alone and stays as it was.
+  packets[10][CRYPTO_MAC_SIZE] ^= 1;
+  const Packet tampered = packets[10];
+
+  crypto_workers_run(workers.get(), jobs.data(), jobs.size());
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (i == 10) {
+      EXPECT_EQ(jobs[i].result, -1);
+      EXPECT_EQ(packets[i], tampered);
+      continue;
+    }
+
+    ASSERT_EQ(jobs[i].result, length) << "packet " << i;
+    EXPECT_TRUE(std::equal(plain[i].begin() + CRYPTO_MAC_SIZE, plain[i].begin() + CRYPTO_MAC_SIZE + length,
+                           packets[i].begin() + CRYPTO_MAC_SIZE))
+        << "packet " << i;
+  }
+}
+
+}  // namespace
@@ -0,0 +1,523 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Worker threads that answer stateless DHT requests on SO_REUSEPORT sockets.
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "dht_workers.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LAN_discovery.h"
+#include "ccompat.h"
+#include "mono_time.h"
+#include "network.h"
+#include "ping.h"
+#include "util.h"
+
+/* Packets a worker can queue for the DHT thread between two do_dht_workers() calls. */
+#define DHT_WORKER_QUEUE_SIZE 256
+
+/* How long a worker blocks waiting for packets before checking if it should stop. */
+#define DHT_WORKER_WAIT_MS 50
+
+/* Seconds between two copies of the close list published to the workers. */
+#define DHT_WORKERS_PUBLISH_INTERVAL 1
+
+#define GETNODES_SIZE (1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t) + CRYPTO_MAC_SIZE)
+#define GETNODES_PLAIN_SIZE (CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t))
+
+typedef struct Worker_Packet {
+    IP_Port source;
+    /* If true, data holds the public key of a node that sent a request. */
+    bool node_seen;
+    uint16_t length;
+    uint8_t data[MAX_UDP_PACKET_SIZE];
+} Worker_Packet;
+
+typedef struct Worker_Queue {
+    Worker_Packet packets[DHT_WORKER_QUEUE_SIZE];
+    uint16_t size;
+} Worker_Queue;
+
+typedef struct DHT_Worker {
+    DHT_Workers *workers;
+    pthread_t thread;
+
+    Networking_Core *net;
+    Shared_Keys *shared_keys;
+
+    /* The worker's copy of the published close list. */
+    Node_format *nodes;
+    uint32_t num_nodes;
+    uint32_t nodes_capacity;
+    uint64_t nodes_version;
+
+    /* protect everything below from concurrent access */
+    pthread_mutex_t lock;
+    bool running;
+    /* The worker fills one queue while the DHT thread empties the other. */
+    Worker_Queue queues[2];
+    Worker_Queue *incoming;
+    uint64_t answered;
+    uint64_t forwarded;
+    uint64_t dropped;
+} DHT_Worker;
+
+struct DHT_Workers {
+    const Logger *log;
+    const Mono_Time *mono_time;
+    DHT *dht;
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+
+    /* The close list as last published, read by every worker. */
+    pthread_rwlock_t nodes_lock;
+    Node_format *nodes;
+    uint32_t num_nodes;
+    uint64_t nodes_version;
+    uint64_t last_publish;
+
+    DHT_Worker *worker_list;
+    uint16_t num_workers;
+};
+
+/* Queue a packet, or with node_seen set a node that sent a request, for the DHT thread. */
+static void worker_queue_push(DHT_Worker *worker, IP_Port source, const uint8_t *data, uint16_t length,
+                              bool node_seen)
+{
+    pthread_mutex_lock(&worker->lock);
+
+    if (node_seen) {
+        ++worker->answered;
+    }
+
+    Worker_Queue *const queue = worker->incoming;
+
+    if (queue->size == DHT_WORKER_QUEUE_SIZE) {
+        if (!node_seen) {
+            ++worker->dropped;
+        }
+
+        pthread_mutex_unlock(&worker->lock);
+        return;
+    }
+
+    Worker_Packet *const packet = &queue->packets[queue->size];
+    packet->source = source;
+    packet->node_seen = node_seen;
+    packet->length = length;
+    memcpy(packet->data, data, length);
+    ++queue->size;
+
+    if (!node_seen) {
+        ++worker->forwarded;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static int handle_worker_forward(void *object, IP_Port source, const uint8_t *packet, uint16_t length,
+                                 void *userdata)
+{
+    DHT_Worker *const worker = (DHT_Worker *)object;
+    worker_queue_push(worker, source, packet, length, false);
+    return 0;
+}
+
+static int handle_worker_getnodes(void *object, IP_Port source, const uint8_t *packet, uint16_t length,
+                                  void *userdata)
+{
+    DHT_Worker *const worker = (DHT_Worker *)object;
+    const DHT_Workers *const workers = worker->workers;
+
+    if (length != GETNODES_SIZE) {
+        return 1;
+    }
+
+    /* Check if packet is from ourself. */
+    if (id_equal(packet + 1, workers->self_public_key)) {
+        return 1;
+    }
+
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    get_shared_key(worker->shared_keys, shared_key, workers->self_secret_key, packet + 1);
+
+    uint8_t plain[GETNODES_PLAIN_SIZE];
+    const int len = decrypt_data_symmetric(
+                        shared_key,
+                        packet + 1 + CRYPTO_PUBLIC_KEY_SIZE,
+                        packet + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE,
+                        GETNODES_PLAIN_SIZE + CRYPTO_MAC_SIZE,
+                        plain);
+
+    if (len != GETNODES_PLAIN_SIZE) {
+        return 1;
+    }
+
+    Node_format nodes_list[MAX_SENT_NODES];
+    const int num_nodes = get_close_nodes_from(worker->nodes, worker->num_nodes, plain, nodes_list,
+                          ip_is_lan(source.ip));
+
+    uint8_t response_plain[1 + sizeof(Node_format) * MAX_SENT_NODES + sizeof(uint64_t)];
+    int nodes_length = 0;
+
+    if (num_nodes > 0) {
+        nodes_length = pack_nodes(response_plain + 1, sizeof(Node_format) * MAX_SENT_NODES, nodes_list, num_nodes);
+
+        if (nodes_length <= 0) {
+            return 1;
+        }
+    }
+
+    response_plain[0] = num_nodes;
+    memcpy(response_plain + 1 + nodes_length, plain + CRYPTO_PUBLIC_KEY_SIZE, sizeof(uint64_t));
+
+    const uint16_t response_plain_length = 1 + nodes_length + sizeof(uint64_t);
+    uint8_t response[sizeof(response_plain) + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + CRYPTO_MAC_SIZE];
+
+    const int response_length = dht_create_packet(workers->self_public_key, shared_key, NET_PACKET_SEND_NODES_IPV6,
+                                response_plain, response_plain_length, response);
+
+    if (response_length == -1) {
+        return 1;
+    }
+
+    sendpacket_batch(worker->net, source, response, response_length);
+    worker_queue_push(worker, source, packet + 1, CRYPTO_PUBLIC_KEY_SIZE, true);
+
+    return 0;
+}
+
+static int handle_worker_ping_request(void *object, IP_Port source, const uint8_t *packet, uint16_t length,
+                                      void *userdata)
+{
+    DHT_Worker *const worker = (DHT_Worker *)object;
+    const DHT_Workers *const workers = worker->workers;
+
+    if (length != DHT_PING_SIZE) {
+        return 1;
+    }
+
+    if (id_equal(packet + 1, workers->self_public_key)) {
+        return 1;
+    }
+
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    get_shared_key(worker->shared_keys, shared_key, workers->self_secret_key, packet + 1);
+
+    uint8_t ping_plain[PING_PLAIN_SIZE];
+    const int len = decrypt_data_symmetric(shared_key,
+                                           packet + 1 + CRYPTO_PUBLIC_KEY_SIZE,
+                                           packet + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE,
+                                           PING_PLAIN_SIZE + CRYPTO_MAC_SIZE,
+                                           ping_plain);
+
+    if (len != sizeof(ping_plain) || ping_plain[0] != NET_PACKET_PING_REQUEST) {
+        return 1;
+    }
+
+    /* The response echoes the ping id. */
+    ping_plain[0] = NET_PACKET_PING_RESPONSE;
+
+    uint8_t response[DHT_PING_SIZE];
+    const int response_length = dht_create_packet(workers->self_public_key, shared_key, NET_PACKET_PING_RESPONSE,
+                                ping_plain, sizeof(ping_plain), response);
+
+    if (response_length != sizeof(response)) {
+        return 1;
+    }
+
+    sendpacket_batch(worker->net, source, response, response_length);
+    worker_queue_push(worker, source, packet + 1, CRYPTO_PUBLIC_KEY_SIZE, true);
+
+    return 0;
+}
+
+/* Copy the close list if the DHT thread published a new one. */
+static void worker_refresh_nodes(DHT_Worker *worker)
+{
+    DHT_Workers *const workers = worker->workers;
+
+    pthread_rwlock_rdlock(&workers->nodes_lock);
+
+    if (workers->nodes_version != worker->nodes_version) {
+        if (workers->num_nodes > worker->nodes_capacity) {
+            Node_format *const nodes = (Node_format *)realloc(worker->nodes, workers->num_nodes * sizeof(Node_format));
+
+            if (nodes == nullptr) {
+                pthread_rwlock_unlock(&workers->nodes_lock);
+                return;
+            }
+
+            worker->nodes = nodes;
+            worker->nodes_capacity = workers->num_nodes;
+        }
+
+        if (workers->num_nodes > 0) {
+            memcpy(worker->nodes, workers->nodes, workers->num_nodes * sizeof(Node_format));
+        }
+
+        worker->num_nodes = workers->num_nodes;
+        worker->nodes_version = workers->nodes_version;
+    }
+
+    pthread_rwlock_unlock(&workers->nodes_lock);
+}
+
+static bool worker_running(DHT_Worker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    const bool running = worker->running;
+    pthread_mutex_unlock(&worker->lock);
+    return running;
+}
+
+static void *dht_worker_thread(void *arg)
+{
+    DHT_Worker *const worker = (DHT_Worker *)arg;
+
+    while (worker_running(worker)) {
+        networking_wait(worker->net, DHT_WORKER_WAIT_MS);
+        worker_refresh_nodes(worker);
+        networking_poll(worker->net, nullptr);
+    }
+
+    return nullptr;
+}
+
+/* Copy the close list for the workers. */
+static void publish_nodes(DHT_Workers *workers)
+{
+    const uint32_t max_num = LCLIENT_LIST + dht_get_num_friends(workers->dht) * MAX_FRIEND_CLIENTS;
+    Node_format *const nodes = (Node_format *)malloc(max_num * sizeof(Node_format));
+
+    if (nodes == nullptr) {
+        return;
+    }
+
+    const uint32_t num_nodes = dht_copy_close_candidates(workers->dht, nodes, max_num);
+
+    pthread_rwlock_wrlock(&workers->nodes_lock);
+    Node_format *const old_nodes = workers->nodes;
+    workers->nodes = nodes;
+    workers->num_nodes = num_nodes;
+    ++workers->nodes_version;
+    pthread_rwlock_unlock(&workers->nodes_lock);
+
+    free(old_nodes);
+}
+
+static void handle_worker_queue(DHT_Workers *workers, DHT_Worker *worker, void *userdata)
+{
+    pthread_mutex_lock(&worker->lock);
+    Worker_Queue *const queue = worker->incoming;
+    worker->incoming = queue == &worker->queues[0] ? &worker->queues[1] : &worker->queues[0];
+    pthread_mutex_unlock(&worker->lock);
+
+    Networking_Core *const net = dht_get_net(workers->dht);
+
+    for (uint16_t i = 0; i < queue->size; ++i) {
+        const Worker_Packet *const packet = &queue->packets[i];
+
+        if (packet->node_seen) {
+            ping_add(dht_get_ping(workers->dht), packet->data, packet->source);
+        } else {
+            networking_handle_packet(net, packet->source, packet->data, packet->length, userdata);
+        }
+    }
+
+    queue->size = 0;
+}
+
+void do_dht_workers(DHT_Workers *workers, void *userdata)
+{
+    if (mono_time_is_timeout(workers->mono_time, workers->last_publish, DHT_WORKERS_PUBLISH_INTERVAL)) {
+        publish_nodes(workers);
+        workers->last_publish = mono_time_get(workers->mono_time);
+    }
+
+    Networking_Core *const net = dht_get_net(workers->dht);
+    networking_batch_start(net);
+
+    for (uint16_t i = 0; i < workers->num_workers; ++i) {
+        handle_worker_queue(workers, &workers->worker_list[i], userdata);
+    }
+
+    networking_batch_end(net);
+}
+
+static bool start_worker(DHT_Workers *workers, DHT_Worker *worker, IP ip, uint16_t port)
+{
+    worker->workers = workers;
+    worker->incoming = &worker->queues[0];
+    worker->running = true;
+
+    worker->shared_keys = shared_keys_new(DEFAULT_SHARED_KEYS_CAPACITY);
+
+    if (worker->shared_keys == nullptr) {
+        return false;
+    }
+
+    worker->net = new_networking_reuseport(workers->log, ip, port);
+
+    if (worker->net == nullptr) {
+        shared_keys_free(worker->shared_keys);
+        return false;
+    }
+
+    for (uint16_t i = 0; i < 256; ++i) {
+        networking_registerhandler(worker->net, i, &handle_worker_forward, worker);
+    }
+
+    networking_registerhandler(worker->net, NET_PACKET_GET_NODES, &handle_worker_getnodes, worker);
+    networking_registerhandler(worker->net, NET_PACKET_PING_REQUEST, &handle_worker_ping_request, worker);
+    /* Same limits as packets arriving on the main socket. */
+    networking_set_rate_limit(worker->net, networking_get_rate_limit(dht_get_net(workers->dht)));
+
+    if (pthread_mutex_init(&worker->lock, nullptr) != 0) {
+        kill_networking(worker->net);
+        shared_keys_free(worker->shared_keys);
+        return false;
+    }
+
+    if (pthread_create(&worker->thread, nullptr, dht_worker_thread, worker) != 0) {
+        pthread_mutex_destroy(&worker->lock);
+        kill_networking(worker->net);
+        shared_keys_free(worker->shared_keys);
+        return false;
+    }
+
+    return true;
+}
+
+static void stop_worker(DHT_Worker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->running = false;
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_join(worker->thread, nullptr);
+
+    pthread_mutex_destroy(&worker->lock);
+    kill_networking(worker->net);
+    shared_keys_free(worker->shared_keys);
+    free(worker->nodes);
+}
+
+DHT_Workers *new_dht_workers(const Logger *log, const Mono_Time *mono_time, DHT *dht, uint16_t num_workers)
+{
+    if (num_workers == 0 || num_workers > MAX_DHT_WORKERS) {
+        return nullptr;
+    }
+
+    DHT_Workers *const workers = (DHT_Workers *)calloc(1, sizeof(DHT_Workers));
+
+    if (workers == nullptr) {
+        return nullptr;
+    }
+
+    workers->worker_list = (DHT_Worker *)calloc(num_workers, sizeof(DHT_Worker));
+
+    if (workers->worker_list == nullptr) {
+        free(workers);
+        return nullptr;
+    }
+
+    if (pthread_rwlock_init(&workers->nodes_lock, nullptr) != 0) {
+        free(workers->worker_list);
+        free(workers);
+        return nullptr;
+    }
+
+    workers->log = log;
+    workers->mono_time = mono_time;
+    workers->dht = dht;
+    memcpy(workers->self_public_key, dht_get_self_public_key(dht), CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(workers->self_secret_key, dht_get_self_secret_key(dht), CRYPTO_SECRET_KEY_SIZE);
+
+    publish_nodes(workers);
+    workers->last_publish = mono_time_get(mono_time);
+
+    const Networking_Core *const net = dht_get_net(dht);
+    IP ip;
+    ip_init(&ip, net_family_is_ipv6(net_family(net)));
+
+    for (uint16_t i = 0; i < num_workers; ++i) {
+        if (!start_worker(workers, &workers->worker_list[i], ip, net_ntohs(net_port(net)))) {
+            LOGGER_ERROR(log, "failed to start DHT worker %u", i);
+            kill_dht_workers(workers);
+            return nullptr;
+        }
+
+        ++workers->num_workers;
+    }
+
+    return workers;
+}
+
+void kill_dht_workers(DHT_Workers *workers)
+{
+    if (workers == nullptr) {
+        return;
+    }
+
+    for (uint16_t i = 0; i < workers->num_workers; ++i) {
+        stop_worker(&workers->worker_list[i]);
+    }
+
+    pthread_rwlock_destroy(&workers->nodes_lock);
+    crypto_memzero(workers->self_secret_key, sizeof(workers->self_secret_key));
+    free(workers->nodes);
+    free(workers->worker_list);
+    free(workers);
+}
+
+uint64_t dht_workers_answered(const DHT_Workers *workers)
+{
+    uint64_t answered = 0;
+
+    for (uint16_t i = 0; i < workers->num_workers; ++i) {
+        DHT_Worker *const worker = &workers->worker_list[i];
+        pthread_mutex_lock(&worker->lock);
+        answered += worker->answered;
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    return answered;
+}
+
+uint64_t dht_workers_forwarded(const DHT_Workers *workers)
+{
+    uint64_t forwarded = 0;
+
+    for (uint16_t i = 0; i < workers->num_workers; ++i) {
+        DHT_Worker *const worker = &workers->worker_list[i];
+        pthread_mutex_lock(&worker->lock);
+        forwarded += worker->forwarded;
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    return forwarded;
+}
+
+uint64_t dht_workers_dropped(const DHT_Workers *workers)
+{
+    uint64_t dropped = 0;
+
+    for (uint16_t i = 0; i < workers->num_workers; ++i) {
+        DHT_Worker *const worker = &workers->worker_list[i];
+        pthread_mutex_lock(&worker->lock);
+        dropped += worker->dropped;
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    return dropped;
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Worker threads that answer stateless DHT requests on SO_REUSEPORT sockets.
+ *
+ * Each worker owns a socket bound to the DHT's port, so the kernel spreads
+ * incoming packets between the DHT's own socket and the workers. A worker
+ * answers getnodes and ping requests itself, from its own shared key cache and
+ * a copy of the close list that the DHT thread publishes every second. All
+ * other packets, and the nodes seen in requests, are queued for the DHT
+ * thread, which handles them in do_dht_workers().
+ */
+#ifndef C_TOXCORE_TOXCORE_DHT_WORKERS_H
+#define C_TOXCORE_TOXCORE_DHT_WORKERS_H
+
+#include "DHT.h"
+#include "logger.h"
+#include "mono_time.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of worker threads. */
+#define MAX_DHT_WORKERS 64
+
+typedef struct DHT_Workers DHT_Workers;
+
+/* Start num_workers threads answering requests for dht.
+ *
+ * The DHT's socket must have been created by new_networking_reuseport() on
+ * the unspecified address of its family, which the workers bind to as well,
+ * and the DHT's keys must not change after this. The workers share the rate
+ * limit of the DHT's socket, so it has to be set before this.
+ *
+ * return NULL on failure.
+ */
+DHT_Workers *new_dht_workers(const Logger *log, const Mono_Time *mono_time, DHT *dht, uint16_t num_workers);
+
+/* Publish the close list to the workers and handle the packets they queued.
+ * Call this from the thread running do_dht(), as often as networking_poll().
+ */
+void do_dht_workers(DHT_Workers *workers, void *userdata);
+
+/* Stop the worker threads and close their sockets. */
+void kill_dht_workers(DHT_Workers *workers);
+
+/* Number of requests answered by the workers, packets they handed to the DHT
+ * thread, and packets they dropped because the DHT thread fell behind.
+ */
+uint64_t dht_workers_answered(const DHT_Workers *workers);
+uint64_t dht_workers_forwarded(const DHT_Workers *workers);
+uint64_t dht_workers_dropped(const DHT_Workers *workers);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_TOXCORE_TOXCORE_DHT_WORKERS_H
@@ -65,7 +65,15 @@ struct Friend_Connections {
     Onion_Client *onion_c;
 
     Friend_Conn *conns;
+    /* Same length as conns: the time in seconds before which
+     * do_friend_connections() has nothing to do for each connection, 0 to
+     * look at it on the next run. Kept apart so that the run passes over
+     * connections with nothing to do without loading them.
+     */
+    uint64_t *next_runs;
     uint32_t num_cons;
+    /* Earliest time in seconds do_friend_connections() has work. */
+    uint64_t next_run;
 
     fr_request_cb *fr_request_callback;
     void *fr_request_object;
@@ -114,11 +122,21 @@ static bool friendconn_id_valid(const Friend_Connections *fr_c, int friendcon_id
 static bool realloc_friendconns(Friend_Connections *fr_c, uint32_t num)
 {
     if (num == 0) {
+        free(fr_c->next_runs);
+        fr_c->next_runs = nullptr;
         free(fr_c->conns);
         fr_c->conns = nullptr;
         return true;
     }
 
+    uint64_t *new_next_runs = (uint64_t *)realloc(fr_c->next_runs, num * sizeof(uint64_t));
+
+    if (new_next_runs == nullptr) {
+        return false;
+    }
+
+    fr_c->next_runs = new_next_runs;
+
     Friend_Conn *newgroup_cons = (Friend_Conn *)realloc(fr_c->conns, num * sizeof(Friend_Conn));
 
     if (newgroup_cons == nullptr) {
@@ -129,6 +147,13 @@ static bool realloc_friendconns(Friend_Connections *fr_c, uint32_t num)
     return true;
 }
 
+/* Have do_friend_connections() look at the connection on its next run. */
+static void run_friend_conn(Friend_Connections *fr_c, int friendcon_id)
+{
+    fr_c->next_runs[friendcon_id] = 0;
+    fr_c->next_run = 0;
+}
+
 /* Create a new empty friend connection.
  *
  * return -1 on failure.
@@ -138,6 +163,7 @@ static int create_friend_conn(Friend_Connections *fr_c)
 {
     for (uint32_t i = 0; i < fr_c->num_cons; ++i) {
         if (fr_c->conns[i].status == FRIENDCONN_STATUS_NONE) {
+            run_friend_conn(fr_c, i);
             return i;
         }
     }
@@ -149,6 +175,7 @@ static int create_friend_conn(Friend_Connections *fr_c)
     const int id = fr_c->num_cons;
     ++fr_c->num_cons;
     memset(&fr_c->conns[id], 0, sizeof(Friend_Conn));
+    run_friend_conn(fr_c, id);
 
     return id;
 }
@@ -339,6 +366,7 @@ static void dht_ip_callback(void *object, int32_t number, IP_Port ip_port)
     set_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id, ip_port, 1);
     friend_con->dht_ip_port = ip_port;
     friend_con->dht_ip_port_lastrecv = mono_time_get(fr_c->mono_time);
+    run_friend_conn(fr_c, number);
 
     if (friend_con->hosting_tcp_relay) {
         friend_add_tcp_relay(fr_c, number, ip_port, friend_con->dht_temp_pk);
@@ -355,6 +383,7 @@ static void change_dht_pk(Friend_Connections *fr_c, int friendcon_id, const uint
     }
 
     friend_con->dht_pk_lastrecv = mono_time_get(fr_c->mono_time);
+    run_friend_conn(fr_c, friendcon_id);
 
     if (friend_con->dht_lock) {
         if (dht_delfriend(fr_c->dht, friend_con->dht_temp_pk, friend_con->dht_lock) != 0) {
@@ -379,6 +408,7 @@ static int handle_status(void *object, int number, uint8_t status, void *userdat
     }
 
     bool status_changed = 0;
+    run_friend_conn(fr_c, number);
 
     if (status) {  /* Went online. */
         status_changed = 1;
@@ -560,6 +590,7 @@ static int handle_new_connections(void *object, New_Connection *n_c)
     } else {
         friend_con->dht_ip_port = n_c->source;
         friend_con->dht_ip_port_lastrecv = mono_time_get(fr_c->mono_time);
+        run_friend_conn(fr_c, friendcon_id);
     }
 
     if (public_key_cmp(friend_con->dht_temp_pk, n_c->dht_public_key) != 0) {
@@ -911,12 +942,61 @@ static void lan_discovery(Friend_Connections *fr_c)
     }
 }
 
+/* return the time in seconds at which do_friend_connections() has something to
+ * do for the connection next, given that it just ran at temp_time.
+ */
+static uint64_t friend_conn_next_run(const Friend_Conn *friend_con, uint64_t temp_time)
+{
+    uint64_t next_run = UINT64_MAX;
+
+    if (friend_con->status == FRIENDCONN_STATUS_CONNECTING) {
+        if (friend_con->dht_lock) {
+            next_run = min_u64(next_run, friend_con->dht_pk_lastrecv + FRIEND_DHT_TIMEOUT + 1);
+
+            if (friend_con->crypt_connection_id == -1) {
+                /* Creating the connection failed, try again. */
+                next_run = temp_time + 1;
+            }
+        }
+
+        if (!net_family_is_unspec(friend_con->dht_ip_port.ip.family)) {
+            next_run = min_u64(next_run, friend_con->dht_ip_port_lastrecv + FRIEND_DHT_TIMEOUT + 1);
+        }
+    } else if (friend_con->status == FRIENDCONN_STATUS_CONNECTED) {
+        next_run = min_u64(next_run, friend_con->ping_lastsent + FRIEND_PING_INTERVAL + 1);
+        next_run = min_u64(next_run, friend_con->share_relays_lastsent + SHARE_RELAYS_INTERVAL + 1);
+        next_run = min_u64(next_run, friend_con->ping_lastrecv + FRIEND_CONNECTION_TIMEOUT + 1);
+    }
+
+    /* Sending failed, try again on the next run. */
+    return max_u64(next_run, temp_time + 1);
+}
+
+uint32_t friend_connections_run_interval(const Friend_Connections *fr_c)
+{
+    const uint64_t temp_time = mono_time_get(fr_c->mono_time);
+
+    if (fr_c->next_run <= temp_time) {
+        return 0;
+    }
+
+    return min_u64(fr_c->next_run - temp_time, UINT32_MAX);
+}
+
 /* main friend_connections loop. */
 void do_friend_connections(Friend_Connections *fr_c, void *userdata)
 {
     const uint64_t temp_time = mono_time_get(fr_c->mono_time);
+    uint64_t next_run = UINT64_MAX;
+    /* Set to 0 if something happens to a connection while the loop runs. */
+    fr_c->next_run = UINT64_MAX;
 
     for (uint32_t i = 0; i < fr_c->num_cons; ++i) {
+        if (temp_time < fr_c->next_runs[i]) {
+            next_run = min_u64(next_run, fr_c->next_runs[i]);
+            continue;
+        }
+
         Friend_Conn *const friend_con = get_conn(fr_c, i);
 
         if (friend_con) {
@@ -956,11 +1036,21 @@ void do_friend_connections(Friend_Connections *fr_c, void *userdata)
                 }
             }
         }
+
+        /* The status callbacks may have killed connections. */
+        if (i < fr_c->num_cons) {
+            const Friend_Conn *const con = get_conn(fr_c, i);
+            fr_c->next_runs[i] = con != nullptr ? friend_conn_next_run(con, temp_time) : UINT64_MAX;
+            next_run = min_u64(next_run, fr_c->next_runs[i]);
+        }
     }
 
     if (fr_c->local_discovery_enabled) {
         lan_discovery(fr_c);
+        next_run = min_u64(next_run, fr_c->last_lan_discovery + LAN_DISCOVERY_INTERVAL + 1);
     }
+
+    fr_c->next_run = min_u64(fr_c->next_run, next_run);
 }
 
 /* Free everything related with friend_connections. */
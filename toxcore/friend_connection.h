@@ -152,6 +152,13 @@ void set_friend_request_callback(Friend_Connections *fr_c, fr_request_cb *fr_req
 Friend_Connections *new_friend_connections(const Logger *logger, const Mono_Time *mono_time, Onion_Client *onion_c,
         bool local_discovery_enabled);
 
+/* return the time in seconds before do_friend_connections() should be called
+ * again: until the next ping, timeout or connection retry of any friend
+ * connection, or LAN discovery packet. 0 if something happened to a friend
+ * connection since it last ran.
+ */
+uint32_t friend_connections_run_interval(const Friend_Connections *fr_c);
+
 /* main friend_connections loop. */
 void do_friend_connections(Friend_Connections *fr_c, void *userdata);
 
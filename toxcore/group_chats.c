@@ -847,20 +847,22 @@ static int wrap_group_packet(const Logger *logger, const uint8_t *self_pk, const
                              uint32_t chat_id_hash, uint8_t packet_id)
 {
     uint16_t padding_len = gc_packet_padding_length(length);
+    const uint32_t enc_offset = sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY + CRYPTO_NONCE_SIZE;
+    const uint32_t enc_header_len = packet_id == NET_PACKET_GC_LOSSLESS
+                                    ? sizeof(uint8_t) + GC_MESSAGE_ID_BYTES
+                                    : sizeof(uint8_t);
 
-    if (length + padding_len + CRYPTO_MAC_SIZE + 1 + HASH_ID_BYTES + ENC_PUBLIC_KEY + CRYPTO_NONCE_SIZE > packet_size) {
+    if (enc_offset + CRYPTO_MAC_SIZE + padding_len + enc_header_len + length > packet_size) {
         return -1;
     }
 
-    uint8_t plain[MAX_GC_PACKET_SIZE];
+    /* The plain text is assembled where the cipher text goes and encrypted in place. */
+    uint8_t *plain = packet + enc_offset + CRYPTO_MAC_SIZE;
     memset(plain, 0, padding_len);
-
-    uint32_t enc_header_len = sizeof(uint8_t);
     plain[padding_len] = packet_type;
 
     if (packet_id == NET_PACKET_GC_LOSSLESS) {
         net_pack_u64(plain + padding_len + sizeof(uint8_t), message_id);
-        enc_header_len += GC_MESSAGE_ID_BYTES;
     }
 
     memcpy(plain + padding_len + enc_header_len, data, length);
@@ -869,19 +871,11 @@ static int wrap_group_packet(const Logger *logger, const uint8_t *self_pk, const
     random_nonce(nonce);
 
     uint16_t plain_len = padding_len + enc_header_len + length;
-    size_t encrypt_buf_size = plain_len + CRYPTO_MAC_SIZE;
-
-    uint8_t *encrypt = (uint8_t *)malloc(encrypt_buf_size);
-
-    if (encrypt == nullptr) {
-        return -1;
-    }
 
-    int enc_len = encrypt_data_symmetric(shared_key, nonce, plain, plain_len, encrypt);
+    int enc_len = encrypt_data_symmetric_in_place(shared_key, nonce, packet + enc_offset, plain_len);
 
-    if (enc_len != encrypt_buf_size) {
+    if (enc_len != plain_len + CRYPTO_MAC_SIZE) {
         LOGGER_ERROR(logger, "encryption failed. packet type: %d, enc_len: %d", packet_type, enc_len);
-        free(encrypt);
         return -1;
     }
 
@@ -889,11 +883,8 @@ static int wrap_group_packet(const Logger *logger, const uint8_t *self_pk, const
     net_pack_u32(packet + sizeof(uint8_t), chat_id_hash);
     memcpy(packet + sizeof(uint8_t) + HASH_ID_BYTES, self_pk, ENC_PUBLIC_KEY);
     memcpy(packet + sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY, nonce, CRYPTO_NONCE_SIZE);
-    memcpy(packet + sizeof(uint8_t) + HASH_ID_BYTES + ENC_PUBLIC_KEY + CRYPTO_NONCE_SIZE, encrypt, enc_len);
-
-    free(encrypt);
 
-    return 1 + HASH_ID_BYTES + ENC_PUBLIC_KEY + CRYPTO_NONCE_SIZE + enc_len;
+    return enc_offset + enc_len;
 }
 
 /* Sends a lossy packet to peer_number in chat instance.
@@ -1792,6 +1783,25 @@ uint8_t gc_get_role(const GC_Chat *chat, uint32_t peer_id)
     return chat->group[peer_number].role;
 }
 
+/* Copies the transport statistics of the connection to peer_id to stats.
+ *
+ * Returns 0 on success.
+ * Returns -1 if the peer_id is invalid.
+ */
+int gc_get_peer_transport_stats(const GC_Chat *chat, uint32_t peer_id, GC_Connection_Stats *stats)
+{
+    int peer_number = get_peer_number_of_peer_id(chat, peer_id);
+    const GC_Connection *gconn = gcc_get_connection(chat, peer_number);
+
+    if (gconn == nullptr) {
+        return -1;
+    }
+
+    gcc_get_transport_stats(chat->mono_time, gconn, stats);
+
+    return 0;
+}
+
 /* Copies the chat_id to dest. If dest is null this function has no effect. */
 void gc_get_chat_id(const GC_Chat *chat, uint8_t *dest)
 {
@@ -3985,7 +3995,7 @@ static int handle_gc_message_ack(const GC_Chat *chat, GC_Connection *gconn, cons
     }
 
     if (read_id > 0) {
-        return gcc_handle_ack(gconn, read_id);
+        return gcc_handle_ack(chat->mono_time, gconn, read_id);
     }
 
     uint64_t tm = mono_time_get(chat->mono_time);
@@ -3997,6 +4007,7 @@ static int handle_gc_message_ack(const GC_Chat *chat, GC_Connection *gconn, cons
 
         if (ret == 0) {
             gconn->send_array[idx].last_send_try = tm;
+            gcc_packet_resent(gconn, request_id);
             LOGGER_ERROR(chat->logger, "Re-sent requested packet %lu", request_id);
         }
 
@@ -4994,6 +5005,33 @@ static int handle_gc_udp_packet(void *object, IP_Port ipp, const uint8_t *packet
     return ret;
 }
 
+/* Source check of lossless and lossy group packets for the receive budget.
+ *
+ * return true if the packet comes from the address of a peer we've handshaked
+ * with.
+ */
+static bool gc_data_from_peer(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length)
+{
+    if (length < 1 + HASH_ID_BYTES + ENC_PUBLIC_KEY) {
+        return false;
+    }
+
+    uint32_t chat_id_hash;
+    net_unpack_u32(packet + 1, &chat_id_hash);
+
+    const Messenger *m = (const Messenger *)object;
+    const GC_Chat *chat = get_chat_by_hash(m->group_handler, chat_id_hash);
+
+    if (chat == nullptr) {
+        return false;
+    }
+
+    const int peer_number = get_peernum_of_enc_pk(chat, packet + 1 + HASH_ID_BYTES, false);
+    const GC_Connection *gconn = gcc_get_connection(chat, peer_number);
+
+    return gconn != nullptr && gconn->handshaked && ipport_equal(&gconn->addr.ip_port, source);
+}
+
 void gc_callback_message(Messenger *m, gc_message_cb *function, void *userdata)
 {
     GC_Session *c = m->group_handler;
@@ -5332,6 +5370,7 @@ static void do_peer_connections(Messenger *m, int group_number)
         }
 
         gcc_resend_packets(m, chat, i);
+        gcc_update_transport_stats(chat->mono_time, gconn);
 
         if (chat->new_tcp_relay || (gconn->tcp_relays_count == 0 &&
                                     mono_time_is_timeout(chat->mono_time, gconn->last_sent_tcp_relays_time, GC_TCP_RELAY_SEND_INTERVAL))) {
@@ -6459,6 +6498,8 @@ GC_Session *new_dht_groupchats(Messenger *m)
     networking_registerhandler(m->net, NET_PACKET_GC_LOSSLESS, &handle_gc_udp_packet, m);
     networking_registerhandler(m->net, NET_PACKET_GC_LOSSY, &handle_gc_udp_packet, m);
     networking_registerhandler(m->net, NET_PACKET_GC_HANDSHAKE, &handle_gc_udp_packet, m);
+    networking_register_source_check(m->net, NET_PACKET_GC_LOSSLESS, &gc_data_from_peer, m);
+    networking_register_source_check(m->net, NET_PACKET_GC_LOSSY, &gc_data_from_peer, m);
 
     return c;
 }
@@ -6544,6 +6585,8 @@ void kill_dht_groupchats(GC_Session *c)
     networking_registerhandler(c->messenger->net, NET_PACKET_GC_LOSSY, nullptr, nullptr);
     networking_registerhandler(c->messenger->net, NET_PACKET_GC_LOSSLESS, nullptr, nullptr);
     networking_registerhandler(c->messenger->net, NET_PACKET_GC_HANDSHAKE, nullptr, nullptr);
+    networking_register_source_check(c->messenger->net, NET_PACKET_GC_LOSSY, nullptr, nullptr);
+    networking_register_source_check(c->messenger->net, NET_PACKET_GC_LOSSLESS, nullptr, nullptr);
 
     free(c->chats);
     free(c);
@@ -224,6 +224,7 @@ typedef struct GC_TopicInfo {
 
 typedef struct GC_Connection GC_Connection;
 typedef struct GC_Exit_Info GC_Exit_Info;
+typedef struct GC_Connection_Stats GC_Connection_Stats;
 
 #define GROUP_SAVE_MAX_PEERS MAX_GC_PEER_ADDRS
 #define GROUP_SAVE_MAX_MODERATORS 128  // must be <= MAX_GC_MODERATORS (temporary fix to prevent save format breakage)
@@ -544,6 +545,13 @@ uint8_t gc_get_status(const GC_Chat *chat, uint32_t peer_id);
  */
 uint8_t gc_get_role(const GC_Chat *chat, uint32_t peer_id);
 
+/* Copies the transport statistics of the connection to peer_id to stats.
+ *
+ * Returns 0 on success.
+ * Returns -1 if the peer_id is invalid.
+ */
+int gc_get_peer_transport_stats(const GC_Chat *chat, uint32_t peer_id, GC_Connection_Stats *stats);
+
 /* Sets the role of peer_id. role must be one of: GR_MODERATOR, GR_USER, GR_OBSERVER
  *
  * Returns 0 on success.
@@ -28,6 +28,12 @@
 /* The time before the direct UDP connection is considered dead */
 #define GCC_UDP_DIRECT_TIMEOUT (GC_PING_TIMEOUT + 4)
 
+/* The interval in ms over which packet rates are measured */
+#define GCC_RATES_INTERVAL 1000
+
+/* Weight of the newest sample in the averages of the transport statistics is 1 / GCC_STATS_AVERAGE_WEIGHT */
+#define GCC_STATS_AVERAGE_WEIGHT 4
+
 
 /* Returns group connection object for peer_number.
  * Returns NULL if peer_number is invalid.
@@ -140,6 +146,12 @@ int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_C
         return -1;
     }
 
+    if (gconn->rtt_probe_time == 0) {
+        gconn->rtt_probe_message_id = gconn->send_message_id;
+        gconn->rtt_probe_time = mono_time_get_ms(mono_time);
+    }
+
+    ++gconn->packets_sent;
     ++gconn->send_message_id;
 
     return 0;
@@ -150,7 +162,7 @@ int gcc_add_to_send_array(const Logger *logger, const Mono_Time *mono_time, GC_C
  * Returns 0 if success.
  * Returns -1 on failure.
  */
-int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
+int gcc_handle_ack(const Mono_Time *mono_time, GC_Connection *gconn, uint64_t message_id)
 {
     uint16_t idx = gcc_get_array_index(message_id);
     GC_Message_Array_Entry *array_entry = &gconn->send_array[idx];
@@ -163,6 +175,18 @@ int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
         return -1;
     }
 
+    if (gconn->rtt_probe_time != 0 && gconn->rtt_probe_message_id == message_id) {
+        const uint64_t rtt = mono_time_get_ms(mono_time) - gconn->rtt_probe_time;
+
+        if (gconn->rtt == 0) {
+            gconn->rtt = rtt;
+        } else {
+            gconn->rtt = (gconn->rtt * (GCC_STATS_AVERAGE_WEIGHT - 1) + rtt) / GCC_STATS_AVERAGE_WEIGHT;
+        }
+
+        gconn->rtt_probe_time = 0;
+    }
+
     clear_array_entry(array_entry);
 
     /* Put send_array_start in proper position */
@@ -178,6 +202,51 @@ int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id)
     return 0;
 }
 
+/* Counts a resend of the send_array item with message_id. */
+void gcc_packet_resent(GC_Connection *gconn, uint64_t message_id)
+{
+    ++gconn->packets_resent;
+
+    /* the ack may be for either copy so it doesn't tell the round trip time */
+    if (gconn->rtt_probe_message_id == message_id) {
+        gconn->rtt_probe_time = 0;
+    }
+}
+
+/* Updates the packet rates of gconn once per second. */
+void gcc_update_transport_stats(const Mono_Time *mono_time, GC_Connection *gconn)
+{
+    const uint64_t tm = mono_time_get_ms(mono_time);
+
+    if (gconn->rates_time == 0) {
+        gconn->rates_time = tm;
+        return;
+    }
+
+    if (tm - gconn->rates_time < GCC_RATES_INTERVAL) {
+        return;
+    }
+
+    const double interval = (tm - gconn->rates_time) / 1000.0;
+    gconn->send_rate += (gconn->packets_sent / interval - gconn->send_rate) / GCC_STATS_AVERAGE_WEIGHT;
+    gconn->recv_rate += (gconn->packets_received / interval - gconn->recv_rate) / GCC_STATS_AVERAGE_WEIGHT;
+    gconn->packets_sent = 0;
+    gconn->packets_received = 0;
+    gconn->rates_time = tm;
+}
+
+/* Copies the transport statistics of gconn to stats. */
+void gcc_get_transport_stats(const Mono_Time *mono_time, const GC_Connection *gconn, GC_Connection_Stats *stats)
+{
+    stats->rtt = gconn->rtt;
+    stats->send_rate = gconn->send_rate;
+    stats->recv_rate = gconn->recv_rate;
+    stats->packets_resent = gconn->packets_resent;
+    stats->send_queue = (uint16_t)(gconn->send_message_id - gconn->send_array_start) % GCC_BUFFER_SIZE;
+    stats->handshaked = gconn->handshaked && !gconn->pending_delete;
+    stats->direct_connected = gcc_connection_is_direct(mono_time, gconn);
+}
+
 /*
  * Returns true if the ip_port is set for gconn.
  */
@@ -294,6 +363,8 @@ int gcc_handle_received_message(const GC_Chat *chat, uint32_t peer_number, const
             return -1;
         }
 
+        ++gconn->packets_received;
+
         return 1;
     }
 
@@ -301,6 +372,7 @@ int gcc_handle_received_message(const GC_Chat *chat, uint32_t peer_number, const
         gconn->last_received_direct_time = mono_time_get(chat->mono_time);
     }
 
+    ++gconn->packets_received;
     ++gconn->received_message_id;
 
     return 2;
@@ -394,6 +466,7 @@ void gcc_resend_packets(Messenger *m, const GC_Chat *chat, uint32_t peer_number)
         /* if this occurrs less than once per second this won't be reliable */
         if (delta > 1 && is_power_of_2(delta)) {
             gcc_send_group_packet(chat, gconn, array_entry->data, array_entry->data_length);
+            gcc_packet_resent(gconn, array_entry->message_id);
             continue;
         }
 
@@ -69,6 +69,27 @@ struct GC_Connection {
 
     bool    pending_delete;  /* true if this peer has been marked for deletion */
     GC_Exit_Info exit_info;
+
+    /* Transport statistics, see gcc_get_transport_stats() */
+    uint64_t    rtt_probe_message_id;  /* message_id of the message timed for the round trip time */
+    uint64_t    rtt_probe_time;  /* when it was sent in ms, 0 if no message is timed */
+    uint64_t    rtt;  /* average round trip time in ms, 0 if not measured yet */
+    uint64_t    rates_time;  /* start of the current packet rate interval in ms */
+    uint32_t    packets_sent;  /* lossless packets sent in the current interval */
+    uint32_t    packets_received;  /* lossless packets received in the current interval */
+    double      send_rate;
+    double      recv_rate;
+    uint64_t    packets_resent;
+};
+
+struct GC_Connection_Stats {
+    uint64_t rtt;            /* average round trip time in ms, 0 if not measured yet */
+    double send_rate;        /* average lossless packets sent per second */
+    double recv_rate;        /* average lossless packets received per second */
+    uint64_t packets_resent; /* since the peer joined */
+    uint32_t send_queue;     /* lossless packets not acknowledged yet */
+    bool handshaked;
+    bool direct_connected;
 };
 
 /* Return connection object for peer_number.
@@ -106,7 +127,16 @@ uint16_t gcc_get_array_index(uint64_t message_id);
  * Return 0 if success.
  * Return -1 on failure.
  */
-int gcc_handle_ack(GC_Connection *gconn, uint64_t message_id);
+int gcc_handle_ack(const Mono_Time *mono_time, GC_Connection *gconn, uint64_t message_id);
+
+/* Counts a resend of the send_array item with message_id. */
+void gcc_packet_resent(GC_Connection *gconn, uint64_t message_id);
+
+/* Updates the packet rates of gconn once per second. */
+void gcc_update_transport_stats(const Mono_Time *mono_time, GC_Connection *gconn);
+
+/* Copies the transport statistics of gconn to stats. */
+void gcc_get_transport_stats(const Mono_Time *mono_time, const GC_Connection *gconn, GC_Connection_Stats *stats);
 
 /*
  * Sets the send_message_id and send_array_start for gconn to id. This is used for the
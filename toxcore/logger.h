@@ -13,6 +13,10 @@
 
 #include "ccompat.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifndef MIN_LOGGER_LEVEL
 #define MIN_LOGGER_LEVEL LOGGER_LEVEL_INFO
 #endif
@@ -90,4 +94,8 @@ void logger_write(
         } \
     } while(0)
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif // C_TOXCORE_TOXCORE_LOGGER_H
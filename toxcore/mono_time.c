@@ -29,9 +29,20 @@
 
 #include "ccompat.h"
 
+/* Where the compiler has lock-free 64 bit atomics, the time is published with
+ * a release store and read with acquire loads, so that the many readers of
+ * mono_time_get() never wait for each other or for mono_time_update().
+ */
+#if defined(__GCC_ATOMIC_LLONG_LOCK_FREE) && __GCC_ATOMIC_LLONG_LOCK_FREE == 2
+#define MONO_TIME_ATOMIC
+#endif
+
 /* don't call into system billions of times for no reason */
 struct Mono_Time {
-    uint64_t time;
+    /* Monotonic time in milliseconds at the last update. mono_time_get() is
+     * derived from it, so both always change together.
+     */
+    uint64_t time_ms;
     uint64_t base_time;
 #ifdef OS_WIN32
     /* protect `last_clock_update` and `last_clock_mono` from concurrent access */
@@ -40,13 +51,39 @@ struct Mono_Time {
     bool last_clock_update;
 #endif
 
-    /* protect `time` from concurrent access */
+#ifndef MONO_TIME_ATOMIC
+    /* protect `time_ms` from concurrent access */
     pthread_rwlock_t *time_update_lock;
+#endif
 
     mono_time_current_time_cb *current_time_callback;
     void *user_data;
 };
 
+static uint64_t load_time_ms(const Mono_Time *mono_time)
+{
+#ifdef MONO_TIME_ATOMIC
+    return __atomic_load_n(&mono_time->time_ms, __ATOMIC_ACQUIRE);
+#else
+    uint64_t time_ms = 0;
+    pthread_rwlock_rdlock(mono_time->time_update_lock);
+    time_ms = mono_time->time_ms;
+    pthread_rwlock_unlock(mono_time->time_update_lock);
+    return time_ms;
+#endif
+}
+
+static void store_time_ms(Mono_Time *mono_time, uint64_t time_ms)
+{
+#ifdef MONO_TIME_ATOMIC
+    __atomic_store_n(&mono_time->time_ms, time_ms, __ATOMIC_RELEASE);
+#else
+    pthread_rwlock_wrlock(mono_time->time_update_lock);
+    mono_time->time_ms = time_ms;
+    pthread_rwlock_unlock(mono_time->time_update_lock);
+#endif
+}
+
 static uint64_t current_time_monotonic_default(Mono_Time *mono_time, void *user_data)
 {
     uint64_t time = 0;
@@ -60,7 +97,7 @@ static uint64_t current_time_monotonic_default(Mono_Time *mono_time, void *user_
     uint32_t ticks = GetTickCount();
 
     /* the higher 32 bits count the number of wrap arounds */
-    uint64_t old_ovf = mono_time->time & ~((uint64_t)UINT32_MAX);
+    uint64_t old_ovf = load_time_ms(mono_time) & ~((uint64_t)UINT32_MAX);
 
     /* Check if time has decreased because of 32 bit wrap from GetTickCount() */
     if (ticks < mono_time->last_clock_mono) {
@@ -103,6 +140,7 @@ Mono_Time *mono_time_new(void)
         return nullptr;
     }
 
+#ifndef MONO_TIME_ATOMIC
     mono_time->time_update_lock = (pthread_rwlock_t *)malloc(sizeof(pthread_rwlock_t));
 
     if (mono_time->time_update_lock == nullptr) {
@@ -116,6 +154,8 @@ Mono_Time *mono_time_new(void)
         return nullptr;
     }
 
+#endif
+
     mono_time->current_time_callback = current_time_monotonic_default;
     mono_time->user_data = nullptr;
 
@@ -125,14 +165,17 @@ Mono_Time *mono_time_new(void)
     mono_time->last_clock_update = false;
 
     if (pthread_mutex_init(&mono_time->last_clock_lock, nullptr) < 0) {
+#ifndef MONO_TIME_ATOMIC
+        pthread_rwlock_destroy(mono_time->time_update_lock);
         free(mono_time->time_update_lock);
+#endif
         free(mono_time);
         return nullptr;
     }
 
 #endif
 
-    mono_time->time = 0;
+    mono_time->time_ms = 0;
     mono_time->base_time = (uint64_t)time(nullptr) - (current_time_monotonic(mono_time) / 1000ULL);
 
     mono_time_update(mono_time);
@@ -145,37 +188,37 @@ void mono_time_free(Mono_Time *mono_time)
 #ifdef OS_WIN32
     pthread_mutex_destroy(&mono_time->last_clock_lock);
 #endif
+#ifndef MONO_TIME_ATOMIC
     pthread_rwlock_destroy(mono_time->time_update_lock);
     free(mono_time->time_update_lock);
+#endif
     free(mono_time);
 }
 
 void mono_time_update(Mono_Time *mono_time)
 {
-    uint64_t time = 0;
+    uint64_t time_ms = 0;
 #ifdef OS_WIN32
     /* we actually want to update the overflow state of mono_time here */
     pthread_mutex_lock(&mono_time->last_clock_lock);
     mono_time->last_clock_update = true;
 #endif
-    time = mono_time->current_time_callback(mono_time, mono_time->user_data) / 1000ULL;
-    time += mono_time->base_time;
+    time_ms = mono_time->current_time_callback(mono_time, mono_time->user_data);
 #ifdef OS_WIN32
     pthread_mutex_unlock(&mono_time->last_clock_lock);
 #endif
 
-    pthread_rwlock_wrlock(mono_time->time_update_lock);
-    mono_time->time = time;
-    pthread_rwlock_unlock(mono_time->time_update_lock);
+    store_time_ms(mono_time, time_ms);
 }
 
 uint64_t mono_time_get(const Mono_Time *mono_time)
 {
-    uint64_t time = 0;
-    pthread_rwlock_rdlock(mono_time->time_update_lock);
-    time = mono_time->time;
-    pthread_rwlock_unlock(mono_time->time_update_lock);
-    return time;
+    return load_time_ms(mono_time) / 1000ULL + mono_time->base_time;
+}
+
+uint64_t mono_time_get_ms(const Mono_Time *mono_time)
+{
+    return load_time_ms(mono_time);
 }
 
 bool mono_time_is_timeout(const Mono_Time *mono_time, uint64_t timestamp, uint64_t timeout)
@@ -210,3 +253,22 @@ uint64_t current_time_monotonic(Mono_Time *mono_time)
 #endif
     return time;
 }
+
+uint64_t current_time_monotonic_coarse(Mono_Time *mono_time)
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+
+    /* Same clock as CLOCK_MONOTONIC, read from the last tick without asking
+     * the hardware.
+     */
+    if (mono_time->current_time_callback == current_time_monotonic_default) {
+        struct timespec clock_mono;
+
+        if (clock_gettime(CLOCK_MONOTONIC_COARSE, &clock_mono) == 0) {
+            return 1000ULL * clock_mono.tv_sec + (clock_mono.tv_nsec / 1000000ULL);
+        }
+    }
+
+#endif
+    return current_time_monotonic(mono_time);
+}
@@ -57,9 +57,19 @@ void mono_time_update(Mono_Time *mono_time);
 
 /**
  * Return unix time since epoch in seconds.
+ *
+ * Any thread may call this and mono_time_get_ms while another one calls
+ * mono_time_update. Where 64 bit atomics are lock-free, they never block.
  */
 uint64_t mono_time_get(const Mono_Time *mono_time);
 
+/**
+ * Return the monotonic time in milliseconds at the last mono_time_update.
+ *
+ * mono_time_get changes exactly when this crosses a multiple of 1000.
+ */
+uint64_t mono_time_get_ms(const Mono_Time *mono_time);
+
 /**
  * Return true iff timestamp is at least timeout seconds in the past.
  */
@@ -71,6 +81,13 @@ bool mono_time_is_timeout(const Mono_Time *mono_time, uint64_t timestamp, uint64
  */
 uint64_t current_time_monotonic(Mono_Time *mono_time);
 
+/**
+ * Like current_time_monotonic, but cheaper and only as precise as the system
+ * tick, so it may lag behind current_time_monotonic by a few milliseconds.
+ * For callers on hot paths that only measure intervals of many milliseconds.
+ */
+uint64_t current_time_monotonic_coarse(Mono_Time *mono_time);
+
 typedef uint64_t mono_time_current_time_cb(Mono_Time *mono_time, void *user_data);
 
 /* Override implementation of current_time_monotonic() (for tests).
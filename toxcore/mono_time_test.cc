@@ -2,6 +2,9 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 namespace {
 
 TEST(MonoTime, UnixTimeIncreasesOverTime) {
@@ -61,4 +64,90 @@ TEST(MonoTime, CustomTime) {
   mono_time_free(mono_time);
 }
 
+TEST(MonoTime, MillisecondsMatchSeconds) {
+  Mono_Time *mono_time = mono_time_new();
+
+  uint64_t test_time = 5999;
+
+  mono_time_set_current_time_callback(mono_time, test_current_time_callback, &test_time);
+  mono_time_update(mono_time);
+
+  uint64_t const start = mono_time_get(mono_time);
+  EXPECT_EQ(mono_time_get_ms(mono_time), 5999);
+
+  test_time = 6000;
+  EXPECT_EQ(mono_time_get_ms(mono_time), 5999);
+
+  mono_time_update(mono_time);
+  EXPECT_EQ(mono_time_get_ms(mono_time), 6000);
+  EXPECT_EQ(mono_time_get(mono_time), start + 1);
+
+  mono_time_free(mono_time);
+}
+
+TEST(MonoTime, CoarseTimeFollowsCustomTime) {
+  Mono_Time *mono_time = mono_time_new();
+
+  uint64_t test_time = 123456;
+
+  mono_time_set_current_time_callback(mono_time, test_current_time_callback, &test_time);
+  EXPECT_EQ(current_time_monotonic_coarse(mono_time), test_time);
+
+  mono_time_set_current_time_callback(mono_time, nullptr, nullptr);
+
+  uint64_t const before = current_time_monotonic(mono_time);
+  uint64_t const coarse = current_time_monotonic_coarse(mono_time);
+  uint64_t const after = current_time_monotonic(mono_time);
+
+  // The coarse clock lags by at most a tick, which is well under 100 ms.
+  EXPECT_LE(coarse, after);
+  EXPECT_GE(coarse + 100, before);
+
+  mono_time_free(mono_time);
+}
+
+TEST(MonoTime, ConcurrentReadersSeeIncreasingTime) {
+  Mono_Time *mono_time = mono_time_new();
+
+  uint64_t test_time = 1000;
+
+  mono_time_set_current_time_callback(mono_time, test_current_time_callback, &test_time);
+  mono_time_update(mono_time);
+
+  std::vector<std::thread> readers;
+  std::vector<int> increasing(4, 1);
+
+  for (size_t i = 0; i < increasing.size(); ++i) {
+    readers.emplace_back([mono_time, &increasing, i]() {
+      uint64_t last_ms = mono_time_get_ms(mono_time);
+      bool ok = true;
+
+      while (last_ms < 100000) {
+        const uint64_t time = mono_time_get(mono_time);
+        const uint64_t time_ms = mono_time_get_ms(mono_time);
+        ok = ok && time_ms >= last_ms && mono_time_get(mono_time) >= time;
+        last_ms = time_ms;
+      }
+
+      increasing[i] = ok ? 1 : 0;
+    });
+  }
+
+  // Only this thread writes test_time, and only mono_time_update reads it.
+  while (test_time < 100000) {
+    test_time += 7;
+    mono_time_update(mono_time);
+  }
+
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+
+  for (size_t i = 0; i < increasing.size(); ++i) {
+    EXPECT_TRUE(increasing[i]) << "reader " << i;
+  }
+
+  mono_time_free(mono_time);
+}
+
 }  // namespace
@@ -15,23 +15,59 @@
 #include "net_crypto.h"
 
 #include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "crypto_workers.h"
 #include "mono_time.h"
+#include "packets_array.h"
+#include "request_ranges.h"
+#include "slab_allocator.h"
 #include "util.h"
 
-typedef struct Packet_Data {
+/* Weight of the newest sample in the averages of crypto_connection_stats is
+ * 1 / STATS_AVERAGE_WEIGHT.
+ */
+#define STATS_AVERAGE_WEIGHT 8
+
+/* Peers that don't know range requests drop them, so until the peer sends one
+ * each of the first CRYPTO_REQUEST_RANGES_PROBES request packets goes out in
+ * both formats.
+ */
+#define CRYPTO_REQUEST_RANGES_PROBES 8
+
+/* With send pacing, packets go CRYPTO_PACING_GAIN times as fast as the send
+ * rate, so the pacer doesn't hold back the packets the send rate allows, and
+ * at least fast enough to send CRYPTO_MIN_QUEUE_LENGTH packets in one
+ * congestion control sample.
+ */
+#define CRYPTO_PACING_GAIN 1.25
+#define CRYPTO_PACING_MIN_RATE (CRYPTO_MIN_QUEUE_LENGTH * 1000.0 / CONGESTION_SAMPLE_INTERVAL)
+/* A paced connection keeps at most CRYPTO_PACING_MAX_CREDIT ms of send credit
+ * (or one packet interval if that is longer), enough to keep up when the main
+ * loop runs late, but not enough to burst after being idle.
+ */
+#define CRYPTO_PACING_MAX_CREDIT 50.0
+
+struct Packet_Data {
     uint64_t sent_time;
     uint16_t length;
+    /* The peer asked for the packet again, so an acknowledgement may be for
+     * either copy and doesn't tell the round trip time.
+     */
+    bool resent;
     uint8_t data[MAX_CRYPTO_DATA_SIZE];
-} Packet_Data;
+};
+
+/* Bytes of a Packet_Data holding length bytes of data. */
+#define PACKET_DATA_SIZE(length) (offsetof(Packet_Data, data) + (length))
 
-typedef struct Packets_Array {
-    Packet_Data *buffer[CRYPTO_PACKET_BUFFER_SIZE];
-    uint32_t  buffer_start;
-    uint32_t  buffer_end; /* packet numbers in array: `{buffer_start, buffer_end)` */
-} Packets_Array;
+/* Packets are mostly either short messages or file chunks filling the whole
+ * packet, Packet_Data blocks come in sizes for both and one in between.
+ */
+#define PACKET_SLAB_SMALL_DATA 112
+#define PACKET_SLAB_MEDIUM_DATA 496
 
 typedef enum Crypto_Conn_State {
     CRYPTO_CONN_FREE = 0,            /* the connection slot is free. This value is 0 so it is valid after
@@ -53,14 +89,11 @@ typedef struct Crypto_Connection {
     uint8_t sessionsecret_key[CRYPTO_SECRET_KEY_SIZE]; /* Our private key for this session. */
     uint8_t peersessionpublic_key[CRYPTO_PUBLIC_KEY_SIZE]; /* The public key of the peer. */
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE]; /* The precomputed shared key from encrypt_precompute. */
-    Crypto_Conn_State status; /* See Crypto_Conn_State documentation */
     uint64_t cookie_request_number; /* number used in the cookie request packets for this connection */
     uint8_t dht_public_key[CRYPTO_PUBLIC_KEY_SIZE]; /* The dht public key of the peer */
 
     uint8_t *temp_packet; /* Where the cookie request/handshake packet is stored while it is being sent. */
     uint16_t temp_packet_length;
-    uint64_t temp_packet_sent_time; /* The time at which the last temp_packet was sent in ms. */
-    uint32_t temp_packet_num_sent;
 
     IP_Port ip_portv4; /* The ip and port to contact this guy directly.*/
     IP_Port ip_portv6;
@@ -69,8 +102,9 @@ typedef struct Crypto_Connection {
 
     uint64_t last_tcp_sent; /* Time the last TCP packet was sent. */
 
-    Packets_Array send_array;
-    Packets_Array recv_array;
+    /* Allocated when the peer's handshake arrives, null before. */
+    Packets_Array *send_array;
+    Packets_Array *recv_array;
 
     connection_status_cb *connection_status_callback;
     void *connection_status_callback_object;
@@ -85,6 +119,9 @@ typedef struct Crypto_Connection {
     int connection_lossy_data_callback_id;
 
     uint64_t last_request_packet_sent;
+    /* The peer sent a range request, so it understands them. */
+    bool request_ranges;
+    uint8_t request_ranges_probes;
     uint64_t direct_send_attempt_time;
 
     uint32_t packet_counter;
@@ -101,20 +138,41 @@ typedef struct Crypto_Connection {
     uint64_t last_packets_left_requested_set;
     double last_packets_left_requested_rem;
 
-    uint32_t last_sendqueue_size[CONGESTION_QUEUE_ARRAY_SIZE];
-    uint32_t last_sendqueue_counter;
-    long signed int last_num_packets_sent[CONGESTION_LAST_SENT_ARRAY_SIZE];
-    long signed int last_num_packets_resent[CONGESTION_LAST_SENT_ARRAY_SIZE];
+    Congestion_Control congestion;
     uint32_t packets_sent;
     uint32_t packets_resent;
+    uint32_t packets_delivered;
     uint64_t last_congestion_event;
+    /* Lowest round trip time and the latest one since the last congestion
+     * control sample, 0 if none.
+     */
     uint64_t rtt_time;
+    uint64_t last_rtt_time;
+
+    /* Averages for crypto_connection_stats. */
+    uint64_t smoothed_rtt_time;
+    double packet_send_rate_average;
+    double packet_recv_rate_average;
+    uint64_t total_packets_resent;
 
     /* TCP_connection connection_number */
     unsigned int connection_number_tcp;
 
     uint8_t maximum_speed_reached;
 
+    /* With crypto workers or send pacing, the packets from new_packets_start
+     * to the end of send_array were queued by write_cryptpacket() and wait for
+     * do_net_crypto_send() to send them.
+     */
+    bool has_new_packets;
+    uint32_t new_packets_start;
+
+    /* With send pacing, the time in ms at which the next packet may go, and
+     * whether packets the peer asked for again wait for it.
+     */
+    double next_send_time;
+    bool pacing_held_back;
+
     /* Must be a pointer, because the struct is moved in memory */
     pthread_mutex_t *mutex;
 
@@ -123,6 +181,47 @@ typedef struct Crypto_Connection {
     uint32_t dht_pk_callback_number;
 } Crypto_Connection;
 
+/* The part of a connection that the scans over all connections in
+ * send_crypto_packets() and kill_timedout() read on every run. These live in
+ * an array of their own indexed like the connections, so the scans pass over
+ * connections with nothing to do without loading the rest of them.
+ */
+typedef struct Crypto_Conn_Schedule {
+    Crypto_Conn_State status; /* See Crypto_Conn_State documentation */
+    uint32_t temp_packet_num_sent;
+    uint64_t temp_packet_sent_time; /* The time at which the last temp_packet was sent in ms. */
+    /* The time in ms before which send_crypto_packets() has nothing to do for
+     * the connection, 0 to look at it on the next run.
+     */
+    uint64_t next_run;
+    /* What the connection adds to the sleep time when send_crypto_packets()
+     * passes over it: its send rate if it counts towards the total, else 0,
+     * and its interval between request packets, 0 if it has none.
+     */
+    double send_rate;
+    uint32_t request_packet_interval;
+} Crypto_Conn_Schedule;
+
+/* Number of data packets encrypted or decrypted in one crypto_workers_run(). */
+#define CRYPTO_BATCH_SIZE 64
+
+typedef struct Crypto_Batch_Packet {
+    int crypt_connection_id;
+    /* Number of a packet being sent in the send array. */
+    uint32_t packet_num;
+    /* Where a received packet came from if it came over UDP. */
+    bool udp;
+    IP_Port source;
+    uint16_t length;
+    uint8_t packet[MAX_CRYPTO_PACKET_SIZE];
+} Crypto_Batch_Packet;
+
+typedef struct Crypto_Batch {
+    Crypto_Job jobs[CRYPTO_BATCH_SIZE];
+    Crypto_Batch_Packet packets[CRYPTO_BATCH_SIZE];
+    uint32_t length;
+} Crypto_Batch;
+
 struct Net_Crypto {
     const Logger *log;
     Mono_Time *mono_time;
@@ -131,6 +230,7 @@ struct Net_Crypto {
     TCP_Connections *tcp_c;
 
     Crypto_Connection *crypto_connections;
+    Crypto_Conn_Schedule *schedule; /* Same length as crypto_connections. */
     pthread_mutex_t tcp_mutex;
 
     pthread_mutex_t connections_mutex;
@@ -138,6 +238,9 @@ struct Net_Crypto {
 
     uint32_t crypto_connections_length; /* Length of connections array. */
 
+    /* Connection ids keyed by real public key. */
+    Pk_Index connections_index;
+
     /* Our public and secret keys. */
     uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
@@ -152,6 +255,28 @@ struct Net_Crypto {
     uint32_t current_sleep_time;
 
     BS_List ip_port_list;
+
+    /* Threads encrypting and decrypting data packets, null if not started. */
+    Crypto_Workers *workers;
+    Crypto_Batch *send_batch;
+    /* Received data packets waiting to be decrypted, in the order they came. */
+    Crypto_Batch *recv_batch;
+
+    /* Packet_Data of the send and receive arrays of all connections. */
+    Slab_Allocator *packet_slab;
+
+    /* Congestion controller of new connections. */
+    Congestion_Control_Type congestion_control_type;
+
+    /* Spread the packets of each connection evenly over time instead of
+     * sending them in bursts.
+     */
+    bool send_pacing;
+
+    /* The thread running do_net_crypto(), the only one resizing the packet
+     * arrays.
+     */
+    pthread_t thread;
 };
 
 const uint8_t *nc_get_self_public_key(const Net_Crypto *c)
@@ -184,7 +309,7 @@ static bool crypt_connection_id_is_valid(const Net_Crypto *c, int crypt_connecti
         return false;
     }
 
-    const Crypto_Conn_State status = c->crypto_connections[crypt_connection_id].status;
+    const Crypto_Conn_State status = c->schedule[crypt_connection_id].status;
 
     if (status == CRYPTO_CONN_NO_CONNECTION || status == CRYPTO_CONN_FREE) {
         return false;
@@ -562,6 +687,22 @@ static Crypto_Connection *get_crypto_connection(const Net_Crypto *c, int crypt_c
     return &c->crypto_connections[crypt_connection_id];
 }
 
+/* return the scheduler state of a connection get_crypto_connection() found. */
+static Crypto_Conn_Schedule *get_schedule(const Net_Crypto *c, int crypt_connection_id)
+{
+    return &c->schedule[crypt_connection_id];
+}
+
+/* Move a connection to status and have send_crypto_packets() look at it on its
+ * next run.
+ */
+static void set_connection_status(const Net_Crypto *c, int crypt_connection_id, Crypto_Conn_State status)
+{
+    Crypto_Conn_Schedule *sched = get_schedule(c, crypt_connection_id);
+    sched->status = status;
+    sched->next_run = 0;
+}
+
 
 /* Associate an ip_port to a connection.
  *
@@ -685,7 +826,7 @@ static int send_packet_to(Net_Crypto *c, int crypt_connection_id, const uint8_t
         crypto_connection_status(c, crypt_connection_id, &direct_connected, nullptr);
 
         if (direct_connected) {
-            if ((uint32_t)sendpacket(dht_get_net(c->dht), ip_port, data, length) == length) {
+            if ((uint32_t)sendpacket_batch(dht_get_net(c->dht), ip_port, data, length) == length) {
                 pthread_mutex_unlock(conn->mutex);
                 return 0;
             }
@@ -729,12 +870,68 @@ static int send_packet_to(Net_Crypto *c, int crypt_connection_id, const uint8_t
 /** START: Array Related functions */
 
 
-/* Return number of packets in array
- * Note that holes are counted too.
+/* Allocate the send and receive arrays of a connection whose handshake is
+ * done. Connections that never get that far don't pay for them.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int alloc_packets_arrays(Crypto_Connection *conn)
+{
+    if (conn->send_array == nullptr) {
+        conn->send_array = new_packets_array();
+    }
+
+    if (conn->recv_array == nullptr) {
+        conn->recv_array = new_packets_array();
+    }
+
+    if (conn->send_array == nullptr || conn->recv_array == nullptr) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* return true if called on the thread running do_net_crypto(). */
+static bool on_net_crypto_thread(const Net_Crypto *c)
+{
+    return pthread_equal(pthread_self(), c->thread) != 0;
+}
+
+/* Grow the send array of an established connection sending in bulk so that
+ * the packets the send rate allows before the next run fit in it, with
+ * PACKETS_ARRAY_MIN_SIZE slots to spare for packets sent from other threads.
+ * Connections with fewer packets queued than that keep the room the smallest
+ * array has, so idle connections don't hold on to bigger arrays.
+ *
+ * write_cryptpacket() may add packets from other threads, while the thread
+ * running do_net_crypto() reads the array without locking it. So only that
+ * thread resizes arrays, here, in shrink_packets_array() and when it adds
+ * packets itself, and it holds the connection's mutex while doing so, as does
+ * every other thread touching the array.
  */
-static uint32_t num_packets_array(const Packets_Array *array)
+static void reserve_send_array(Crypto_Connection *conn)
 {
-    return array->buffer_end - array->buffer_start;
+    Packets_Array *const array = conn->send_array;
+    const uint32_t queued = num_packets_array(array);
+
+    if (queued < PACKETS_ARRAY_MIN_SIZE) {
+        return;
+    }
+
+    const uint32_t num = min_u32(queued + min_u32(conn->packets_left, CRYPTO_PACKET_BUFFER_SIZE)
+                                 + PACKETS_ARRAY_MIN_SIZE, CRYPTO_PACKET_BUFFER_SIZE);
+
+    if (num <= array->size) {
+        /* Keeps shrink_packets_array() from taking back the room. */
+        array->peak = max_u32(array->peak, num);
+        return;
+    }
+
+    pthread_mutex_lock(conn->mutex);
+    reserve_packets_array(array, num);
+    pthread_mutex_unlock(conn->mutex);
 }
 
 /* Add data with packet number to array.
@@ -742,25 +939,31 @@ static uint32_t num_packets_array(const Packets_Array *array)
  * return -1 on failure.
  * return 0 on success.
  */
-static int add_data_to_buffer(const Logger *log, Packets_Array *array, uint32_t number, const Packet_Data *data)
+static int add_data_to_buffer(const Logger *log, Slab_Allocator *slab, Packets_Array *array, uint32_t number,
+                              const Packet_Data *data)
 {
     if (number - array->buffer_start >= CRYPTO_PACKET_BUFFER_SIZE) {
         return -1;
     }
 
-    uint32_t num = number % CRYPTO_PACKET_BUFFER_SIZE;
+    if (number - array->buffer_start >= num_packets_array(array)
+            && reserve_packets_array(array, number - array->buffer_start + 1) != 0) {
+        return -1;
+    }
+
+    uint32_t num = packets_array_slot(array, number);
 
     if (array->buffer[num]) {
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)malloc(sizeof(Packet_Data));
+    Packet_Data *new_d = (Packet_Data *)slab_alloc(slab, PACKET_DATA_SIZE(data->length));
 
     if (new_d == nullptr) {
         return -1;
     }
 
-    memcpy(new_d, data, sizeof(Packet_Data));
+    memcpy(new_d, data, PACKET_DATA_SIZE(data->length));
     array->buffer[num] = new_d;
 
     if (number - array->buffer_start >= num_packets_array(array)) {
@@ -784,7 +987,7 @@ static int get_data_pointer(const Logger *log, const Packets_Array *array, Packe
         return -1;
     }
 
-    uint32_t num = number % CRYPTO_PACKET_BUFFER_SIZE;
+    uint32_t num = packets_array_slot(array, number);
 
     if (!array->buffer[num]) {
         return 0;
@@ -794,28 +997,34 @@ static int get_data_pointer(const Logger *log, const Packets_Array *array, Packe
     return 1;
 }
 
-/* Add data to end of array.
+/* Add data to end of array. Only grows the array if may_grow is true, on
+ * other threads reserve_send_array() keeps room in it.
  *
  * return -1 on failure.
  * return packet number on success.
  */
-static int64_t add_data_end_of_buffer(const Logger *log, Packets_Array *array, const Packet_Data *data)
+static int64_t add_data_end_of_buffer(const Logger *log, Slab_Allocator *slab, Packets_Array *array,
+                                      const Packet_Data *data, bool may_grow)
 {
-    const uint32_t num_spots = num_packets_array(array);
+    const uint32_t num = num_packets_array(array);
+
+    if (num >= CRYPTO_PACKET_BUFFER_SIZE || (num >= array->size && !may_grow)) {
+        return -1;
+    }
 
-    if (num_spots >= CRYPTO_PACKET_BUFFER_SIZE) {
+    if (num >= array->size && reserve_packets_array(array, num + 1) != 0) {
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)malloc(sizeof(Packet_Data));
+    Packet_Data *new_d = (Packet_Data *)slab_alloc(slab, PACKET_DATA_SIZE(data->length));
 
     if (new_d == nullptr) {
         return -1;
     }
 
-    memcpy(new_d, data, sizeof(Packet_Data));
+    memcpy(new_d, data, PACKET_DATA_SIZE(data->length));
     uint32_t id = array->buffer_end;
-    array->buffer[id % CRYPTO_PACKET_BUFFER_SIZE] = new_d;
+    array->buffer[packets_array_slot(array, id)] = new_d;
     ++array->buffer_end;
     return id;
 }
@@ -825,32 +1034,36 @@ static int64_t add_data_end_of_buffer(const Logger *log, Packets_Array *array, c
  * return -1 on failure.
  * return packet number on success.
  */
-static int64_t read_data_beg_buffer(const Logger *log, Packets_Array *array, Packet_Data *data)
+static int64_t read_data_beg_buffer(const Logger *log, Slab_Allocator *slab, Packets_Array *array, Packet_Data *data)
 {
     if (array->buffer_end == array->buffer_start) {
         return -1;
     }
 
-    const uint32_t num = array->buffer_start % CRYPTO_PACKET_BUFFER_SIZE;
+    const uint32_t num = packets_array_slot(array, array->buffer_start);
 
     if (!array->buffer[num]) {
         return -1;
     }
 
-    memcpy(data, array->buffer[num], sizeof(Packet_Data));
+    memcpy(data, array->buffer[num], PACKET_DATA_SIZE(array->buffer[num]->length));
     uint32_t id = array->buffer_start;
     ++array->buffer_start;
-    free(array->buffer[num]);
+    slab_free(slab, array->buffer[num]);
     array->buffer[num] = nullptr;
     return id;
 }
 
 /* Delete all packets in array before number (but not number)
+ * With precise_rtt, set latest_send_time to the latest time one of them that
+ * was only sent once was sent, if later. Otherwise set it to the time the
+ * first one was last sent.
  *
  * return -1 on failure.
- * return 0 on success
+ * return number of packets deleted on success.
  */
-static int clear_buffer_until(const Logger *log, Packets_Array *array, uint32_t number)
+static int clear_buffer_until(const Logger *log, Slab_Allocator *slab, Packets_Array *array, uint32_t number,
+                              uint64_t *latest_send_time, bool precise_rtt)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -859,29 +1072,39 @@ static int clear_buffer_until(const Logger *log, Packets_Array *array, uint32_t
     }
 
     uint32_t i;
+    int deleted = 0;
 
     for (i = array->buffer_start; i != number; ++i) {
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        uint32_t num = packets_array_slot(array, i);
 
         if (array->buffer[num]) {
-            free(array->buffer[num]);
+            if (precise_rtt) {
+                if (!array->buffer[num]->resent && *latest_send_time < array->buffer[num]->sent_time) {
+                    *latest_send_time = array->buffer[num]->sent_time;
+                }
+            } else if (i == array->buffer_start) {
+                *latest_send_time = array->buffer[num]->sent_time;
+            }
+
+            slab_free(slab, array->buffer[num]);
             array->buffer[num] = nullptr;
+            ++deleted;
         }
     }
 
     array->buffer_start = i;
-    return 0;
+    return deleted;
 }
 
-static int clear_buffer(Packets_Array *array)
+static int clear_buffer(Slab_Allocator *slab, Packets_Array *array)
 {
     uint32_t i;
 
     for (i = array->buffer_start; i != array->buffer_end; ++i) {
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        uint32_t num = packets_array_slot(array, i);
 
         if (array->buffer[num]) {
-            free(array->buffer[num]);
+            slab_free(slab, array->buffer[num]);
             array->buffer[num] = nullptr;
         }
     }
@@ -905,6 +1128,10 @@ static int set_buffer_end(const Logger *log, Packets_Array *array, uint32_t numb
         return -1;
     }
 
+    if (reserve_packets_array(array, number - array->buffer_start) != 0) {
+        return -1;
+    }
+
     array->buffer_end = number;
     return 0;
 }
@@ -936,7 +1163,7 @@ static int generate_request_packet(const Logger *log, uint8_t *data, uint16_t le
     uint32_t n = 1;
 
     for (uint32_t i = recv_array->buffer_start; i != recv_array->buffer_end; ++i) {
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        uint32_t num = packets_array_slot(recv_array, i);
 
         if (!recv_array->buffer[num]) {
             data[cur_len] = n;
@@ -963,13 +1190,16 @@ static int generate_request_packet(const Logger *log, uint8_t *data, uint16_t le
 }
 
 /* Handle a request data packet.
- * Remove all the packets the other received from the array.
+ * Remove all the packets the other received from the array and add their
+ * number to delivered. Set latest_send_time to the latest time one of them
+ * that was only sent once was sent, if later.
  *
  * return -1 on failure.
  * return number of requested packets on success.
  */
-static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packets_Array *send_array,
-                                 const uint8_t *data, uint16_t length, uint64_t *latest_send_time, uint64_t rtt_time)
+static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Slab_Allocator *slab,
+                                 Packets_Array *send_array, const uint8_t *data, uint16_t length, uint64_t *latest_send_time, uint64_t rtt_time,
+                                 uint32_t *delivered)
 {
     if (length == 0) {
         return -1;
@@ -990,14 +1220,14 @@ static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packet
     uint32_t requested = 0;
 
     const uint64_t temp_time = current_time_monotonic(mono_time);
-    uint64_t l_sent_time = -1;
+    uint64_t l_sent_time = 0;
 
     for (uint32_t i = send_array->buffer_start; i != send_array->buffer_end; ++i) {
         if (length == 0) {
             break;
         }
 
-        uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        uint32_t num = packets_array_slot(send_array, i);
 
         if (n == data[0]) {
             if (send_array->buffer[num]) {
@@ -1005,6 +1235,7 @@ static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packet
 
                 if ((sent_time + rtt_time) < temp_time) {
                     send_array->buffer[num]->sent_time = 0;
+                    send_array->buffer[num]->resent = true;
                 }
             }
 
@@ -1016,12 +1247,13 @@ static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packet
             if (send_array->buffer[num]) {
                 uint64_t sent_time = send_array->buffer[num]->sent_time;
 
-                if (l_sent_time < sent_time) {
+                if (!send_array->buffer[num]->resent && l_sent_time < sent_time) {
                     l_sent_time = sent_time;
                 }
 
-                free(send_array->buffer[num]);
+                slab_free(slab, send_array->buffer[num]);
                 send_array->buffer[num] = nullptr;
+                ++*delivered;
             }
         }
 
@@ -1046,18 +1278,153 @@ static int handle_request_packet(Mono_Time *mono_time, const Logger *log, Packet
     return requested;
 }
 
+/* Create a range request packet from recv_array into data of length.
+ *
+ * return -1 on failure.
+ * return length of packet on success.
+ */
+static int generate_request_ranges_packet(uint8_t *data, uint16_t length, const Packets_Array *recv_array)
+{
+    if (length == 0) {
+        return -1;
+    }
+
+    data[0] = PACKET_ID_REQUEST_RANGES;
+
+    uint16_t cur_len = 1;
+    uint32_t received = 0;
+    uint32_t missing = 0;
+
+    for (uint32_t i = recv_array->buffer_start; i != recv_array->buffer_end; ++i) {
+        uint32_t num = packets_array_slot(recv_array, i);
+
+        if (!recv_array->buffer[num]) {
+            ++missing;
+            continue;
+        }
+
+        if (missing != 0) {
+            const uint16_t new_len = request_range_write(data, cur_len, length, received, missing);
+
+            if (new_len == 0) {
+                return cur_len;
+            }
+
+            cur_len = new_len;
+            received = 0;
+            missing = 0;
+        }
+
+        ++received;
+    }
+
+    if (received != 0 || missing != 0) {
+        const uint16_t new_len = request_range_write(data, cur_len, length, received, missing);
+
+        if (new_len != 0) {
+            cur_len = new_len;
+        }
+    }
+
+    return cur_len;
+}
+
+/* Handle a range request data packet.
+ * Remove all the packets the other received from the array and add their
+ * number to delivered. Set latest_send_time to the latest time one of them
+ * that was only sent once was sent, if later.
+ *
+ * return -1 on failure.
+ * return number of requested packets on success.
+ */
+static int handle_request_ranges_packet(Mono_Time *mono_time, Slab_Allocator *slab, Packets_Array *send_array,
+                                        const uint8_t *data, uint16_t length, uint64_t *latest_send_time, uint64_t rtt_time,
+                                        uint32_t *delivered)
+{
+    if (length == 0) {
+        return -1;
+    }
+
+    if (data[0] != PACKET_ID_REQUEST_RANGES) {
+        return -1;
+    }
+
+    uint16_t offset = 1;
+    uint32_t requested = 0;
+
+    const uint64_t temp_time = current_time_monotonic(mono_time);
+    uint64_t l_sent_time = 0;
+    uint32_t i = send_array->buffer_start;
+
+    while (offset < length && i != send_array->buffer_end) {
+        uint32_t received;
+        uint32_t missing;
+
+        if (!request_range_read(data, length, &offset, &received, &missing)) {
+            return -1;
+        }
+
+        received = min_u32(received, send_array->buffer_end - i);
+
+        for (uint32_t end = i + received; i != end; ++i) {
+            uint32_t num = packets_array_slot(send_array, i);
+
+            if (send_array->buffer[num]) {
+                uint64_t sent_time = send_array->buffer[num]->sent_time;
+
+                if (!send_array->buffer[num]->resent && l_sent_time < sent_time) {
+                    l_sent_time = sent_time;
+                }
+
+                slab_free(slab, send_array->buffer[num]);
+                send_array->buffer[num] = nullptr;
+                ++*delivered;
+            }
+        }
+
+        missing = min_u32(missing, send_array->buffer_end - i);
+        requested += missing;
+
+        for (uint32_t end = i + missing; i != end; ++i) {
+            uint32_t num = packets_array_slot(send_array, i);
+
+            if (send_array->buffer[num]) {
+                uint64_t sent_time = send_array->buffer[num]->sent_time;
+
+                if ((sent_time + rtt_time) < temp_time) {
+                    send_array->buffer[num]->sent_time = 0;
+                    send_array->buffer[num]->resent = true;
+                }
+            }
+        }
+    }
+
+    if (*latest_send_time < l_sent_time) {
+        *latest_send_time = l_sent_time;
+    }
+
+    return requested;
+}
+
 /** END: Array Related functions */
 
 #define MAX_DATA_DATA_PACKET_SIZE (MAX_CRYPTO_PACKET_SIZE - (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE))
 
-/* Creates and sends a data packet to the peer using the fastest route.
+/* Offset of the plain text in a data packet while it's being assembled: the
+ * packet id, the last bytes of the nonce and the MAC come before it.
+ */
+#define DATA_PACKET_PLAIN_OFFSET (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE)
+
+/* Encrypts the length bytes of data at packet + DATA_PACKET_PLAIN_OFFSET in
+ * place and sends the resulting data packet to the peer using the fastest
+ * route.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int send_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length)
+static int send_data_packet(Net_Crypto *c, int crypt_connection_id, uint8_t *packet, uint16_t length)
 {
-    const uint16_t max_length = MAX_CRYPTO_PACKET_SIZE - (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE);
+    const uint16_t max_length = MAX_CRYPTO_PACKET_SIZE - DATA_PACKET_PLAIN_OFFSET;
 
     if (length == 0 || length > max_length) {
         return -1;
@@ -1069,13 +1436,15 @@ static int send_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_
         return -1;
     }
 
+    const uint16_t packet_length = DATA_PACKET_PLAIN_OFFSET + length;
+
     pthread_mutex_lock(conn->mutex);
-    VLA(uint8_t, packet, 1 + sizeof(uint16_t) + length + CRYPTO_MAC_SIZE);
     packet[0] = NET_PACKET_CRYPTO_DATA;
     memcpy(packet + 1, conn->sent_nonce + (CRYPTO_NONCE_SIZE - sizeof(uint16_t)), sizeof(uint16_t));
-    const int len = encrypt_data_symmetric(conn->shared_key, conn->sent_nonce, data, length, packet + 1 + sizeof(uint16_t));
+    const int len = encrypt_data_symmetric_in_place(conn->shared_key, conn->sent_nonce, packet + 1 + sizeof(uint16_t),
+                    length);
 
-    if (len + 1 + sizeof(uint16_t) != SIZEOF_VLA(packet)) {
+    if (len + 1 + sizeof(uint16_t) != packet_length) {
         pthread_mutex_unlock(conn->mutex);
         return -1;
     }
@@ -1083,7 +1452,28 @@ static int send_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_
     increment_nonce(conn->sent_nonce);
     pthread_mutex_unlock(conn->mutex);
 
-    return send_packet_to(c, crypt_connection_id, packet, SIZEOF_VLA(packet));
+    return send_packet_to(c, crypt_connection_id, packet, packet_length);
+}
+
+/* Writes the plain text of a data packet with buffer_start and num at
+ * packet + DATA_PACKET_PLAIN_OFFSET. packet must be MAX_CRYPTO_PACKET_SIZE
+ * big and length at most MAX_CRYPTO_DATA_SIZE.
+ *
+ * return length of the plain text.
+ */
+static uint16_t write_data_packet_plain(uint8_t *packet, uint32_t buffer_start, uint32_t num, const uint8_t *data,
+                                        uint16_t length)
+{
+    num = net_htonl(num);
+    buffer_start = net_htonl(buffer_start);
+    const uint16_t padding_length = (MAX_CRYPTO_DATA_SIZE - length) % CRYPTO_MAX_PADDING;
+    uint8_t *plain = packet + DATA_PACKET_PLAIN_OFFSET;
+    memcpy(plain, &buffer_start, sizeof(uint32_t));
+    memcpy(plain + sizeof(uint32_t), &num, sizeof(uint32_t));
+    memset(plain + (sizeof(uint32_t) * 2), PACKET_ID_PADDING, padding_length);
+    memcpy(plain + (sizeof(uint32_t) * 2) + padding_length, data, length);
+
+    return (sizeof(uint32_t) * 2) + padding_length + length;
 }
 
 /* Creates and sends a data packet with buffer_start and num to the peer using the fastest route.
@@ -1098,96 +1488,335 @@ static int send_data_packet_helper(Net_Crypto *c, int crypt_connection_id, uint3
         return -1;
     }
 
-    num = net_htonl(num);
-    buffer_start = net_htonl(buffer_start);
-    uint16_t padding_length = (MAX_CRYPTO_DATA_SIZE - length) % CRYPTO_MAX_PADDING;
-    VLA(uint8_t, packet, sizeof(uint32_t) + sizeof(uint32_t) + padding_length + length);
-    memcpy(packet, &buffer_start, sizeof(uint32_t));
-    memcpy(packet + sizeof(uint32_t), &num, sizeof(uint32_t));
-    memset(packet + (sizeof(uint32_t) * 2), PACKET_ID_PADDING, padding_length);
-    memcpy(packet + (sizeof(uint32_t) * 2) + padding_length, data, length);
+    uint8_t packet[MAX_CRYPTO_PACKET_SIZE];
+    const uint16_t plain_length = write_data_packet_plain(packet, buffer_start, num, data, length);
 
-    return send_data_packet(c, crypt_connection_id, packet, SIZEOF_VLA(packet));
+    return send_data_packet(c, crypt_connection_id, packet, plain_length);
 }
 
-static int reset_max_speed_reached(Net_Crypto *c, int crypt_connection_id)
+/* Encrypts the packets of the send batch on the crypto workers and sends them
+ * in order. Each gets its own nonce, reserved from the connection's nonce in
+ * one step, so the peer sees the same nonces as if they were sent one by one.
+ *
+ * return number of packets sent.
+ */
+static uint32_t send_data_packet_batch(Net_Crypto *c, int crypt_connection_id, uint64_t sent_time)
 {
+    Crypto_Batch *batch = c->send_batch;
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
-    if (conn == nullptr) {
-        return -1;
+    if (conn == nullptr || batch->length == 0) {
+        return 0;
     }
 
-    /* If last packet send failed, try to send packet again.
-     * If sending it fails we won't be able to send the new packet. */
-    if (conn->maximum_speed_reached) {
-        Packet_Data *dt = nullptr;
-        const uint32_t packet_num = conn->send_array.buffer_end - 1;
-        const int ret = get_data_pointer(c->log, &conn->send_array, &dt, packet_num);
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    uint8_t nonce[CRYPTO_NONCE_SIZE];
+    pthread_mutex_lock(conn->mutex);
+    memcpy(shared_key, conn->shared_key, CRYPTO_SHARED_KEY_SIZE);
+    memcpy(nonce, conn->sent_nonce, CRYPTO_NONCE_SIZE);
+    increment_nonce_number(conn->sent_nonce, batch->length);
+    pthread_mutex_unlock(conn->mutex);
 
-        if (ret == 1 && dt->sent_time == 0) {
-            if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num,
-                                        dt->data, dt->length) != 0) {
-                return -1;
-            }
+    for (uint32_t i = 0; i < batch->length; ++i) {
+        Crypto_Job *job = &batch->jobs[i];
+        uint8_t *packet = batch->packets[i].packet;
+        packet[0] = NET_PACKET_CRYPTO_DATA;
+        memcpy(packet + 1, nonce + (CRYPTO_NONCE_SIZE - sizeof(uint16_t)), sizeof(uint16_t));
+        memcpy(job->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+        memcpy(job->nonce, nonce, CRYPTO_NONCE_SIZE);
+        job->encrypt = true;
+        job->data = packet + 1 + sizeof(uint16_t);
+        increment_nonce(nonce);
+    }
 
-            dt->sent_time = current_time_monotonic(c->mono_time);
+    crypto_workers_run(c->workers, batch->jobs, batch->length);
+
+    uint32_t num_sent = 0;
+
+    for (uint32_t i = 0; i < batch->length; ++i) {
+        const Crypto_Job *job = &batch->jobs[i];
+        const Crypto_Batch_Packet *entry = &batch->packets[i];
+
+        if (job->result != job->length + CRYPTO_MAC_SIZE
+                || send_packet_to(c, crypt_connection_id, entry->packet, DATA_PACKET_PLAIN_OFFSET + job->length) != 0) {
+            continue;
         }
 
-        conn->maximum_speed_reached = 0;
+        Packet_Data *dt = nullptr;
+
+        if (get_data_pointer(c->log, conn->send_array, &dt, entry->packet_num) == 1) {
+            dt->sent_time = sent_time;
+        }
+
+        ++num_sent;
     }
 
-    return 0;
+    batch->length = 0;
+    crypto_memzero(shared_key, sizeof(shared_key));
+    return num_sent;
 }
 
-/*  return -1 if data could not be put in packet queue.
- *  return positive packet number if data was put into the queue.
+/* Sends up to max_num of the unsent packets at positions start to end - 1 in
+ * the send array, in batches encrypted on the crypto workers.
+ * send_failed is set to true if a packet could not be sent.
+ *
+ * return -1 on failure.
+ * return number of packets sent on success.
  */
-static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length,
-                                    uint8_t congestion_control)
+static int send_unsent_packets(Net_Crypto *c, int crypt_connection_id, uint32_t start, uint32_t end,
+                               uint32_t max_num, bool *send_failed)
 {
-    if (length == 0 || length > MAX_CRYPTO_DATA_SIZE) {
-        return -1;
-    }
-
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == nullptr) {
         return -1;
     }
 
-    /* If last packet send failed, try to send packet again.
-     * If sending it fails we won't be able to send the new packet. */
-    reset_max_speed_reached(c, crypt_connection_id);
+    Crypto_Batch *batch = c->send_batch;
+    const uint64_t temp_time = current_time_monotonic(c->mono_time);
+    uint32_t num_sent = 0;
+    uint32_t i = start;
 
-    if (conn->maximum_speed_reached && congestion_control) {
-        return -1;
-    }
+    while (i < end && num_sent < max_num) {
+        while (i < end && batch->length < CRYPTO_BATCH_SIZE && batch->length < max_num - num_sent) {
+            Packet_Data *dt;
+            const uint32_t packet_num = i + conn->send_array->buffer_start;
+            const int ret = get_data_pointer(c->log, conn->send_array, &dt, packet_num);
+            ++i;
 
-    Packet_Data dt;
-    dt.sent_time = 0;
-    dt.length = length;
-    memcpy(dt.data, data, length);
-    pthread_mutex_lock(conn->mutex);
-    int64_t packet_num = add_data_end_of_buffer(c->log, &conn->send_array, &dt);
-    pthread_mutex_unlock(conn->mutex);
+            if (ret == -1) {
+                batch->length = 0;
+                return -1;
+            }
 
-    if (packet_num == -1) {
-        return -1;
-    }
+            if (ret == 0 || dt->sent_time) {
+                continue;
+            }
 
-    if (!congestion_control && conn->maximum_speed_reached) {
-        return packet_num;
-    }
+            Crypto_Batch_Packet *entry = &batch->packets[batch->length];
+            entry->packet_num = packet_num;
+            batch->jobs[batch->length].length = write_data_packet_plain(entry->packet, conn->recv_array->buffer_start,
+                                                packet_num, dt->data, dt->length);
+            ++batch->length;
+        }
 
-    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, data, length) == 0) {
-        Packet_Data *dt1 = nullptr;
+        const uint32_t batch_length = batch->length;
+        const uint32_t batch_sent = send_data_packet_batch(c, crypt_connection_id, temp_time);
 
-        if (get_data_pointer(c->log, &conn->send_array, &dt1, packet_num) == 1) {
-            dt1->sent_time = current_time_monotonic(c->mono_time);
+        if (batch_sent != batch_length) {
+            *send_failed = true;
         }
-    } else {
-        conn->maximum_speed_reached = 1;
+
+        num_sent += batch_sent;
+    }
+
+    return num_sent;
+}
+
+/* Sends up to max_num of the unsent packets at positions start to end - 1 in
+ * the send array one at a time.
+ * send_failed is set to true if a packet could not be sent.
+ *
+ * return -1 on failure.
+ * return number of packets sent on success.
+ */
+static int send_unsent_packets_serial(Net_Crypto *c, int crypt_connection_id, uint32_t start, uint32_t end,
+                                      uint32_t max_num, bool *send_failed)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
+    const uint64_t temp_time = current_time_monotonic(c->mono_time);
+    uint32_t num_sent = 0;
+
+    for (uint32_t i = start; i < end && num_sent < max_num; ++i) {
+        Packet_Data *dt;
+        const uint32_t packet_num = i + conn->send_array->buffer_start;
+        const int ret = get_data_pointer(c->log, conn->send_array, &dt, packet_num);
+
+        if (ret == -1) {
+            return -1;
+        }
+
+        if (ret == 0 || dt->sent_time) {
+            continue;
+        }
+
+        if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array->buffer_start, packet_num, dt->data,
+                                    dt->length) == 0) {
+            dt->sent_time = temp_time;
+            ++num_sent;
+        } else {
+            *send_failed = true;
+        }
+    }
+
+    return num_sent;
+}
+
+/* return the packets per second send pacing sends the packets of the
+ * connection at.
+ */
+static double pacing_rate(const Crypto_Connection *conn)
+{
+    const double rate = conn->packet_send_rate_requested * CRYPTO_PACING_GAIN;
+    return rate > CRYPTO_PACING_MIN_RATE ? rate : CRYPTO_PACING_MIN_RATE;
+}
+
+/* Drop the send credit the connection built up beyond
+ * CRYPTO_PACING_MAX_CREDIT, so that a connection that was idle doesn't burst
+ * when it sends again.
+ */
+static void limit_pacing_credit(Crypto_Connection *conn, uint64_t temp_time)
+{
+    const double interval = 1000.0 / pacing_rate(conn);
+    const double earliest = temp_time - (interval > CRYPTO_PACING_MAX_CREDIT ? interval : CRYPTO_PACING_MAX_CREDIT);
+
+    if (conn->next_send_time < earliest) {
+        conn->next_send_time = earliest;
+    }
+}
+
+/* return the number of packets send pacing lets the connection send at
+ * temp_time, UINT32_MAX without send pacing.
+ */
+static uint32_t paced_packets(const Net_Crypto *c, Crypto_Connection *conn, uint64_t temp_time)
+{
+    if (!c->send_pacing) {
+        return UINT32_MAX;
+    }
+
+    limit_pacing_credit(conn, temp_time);
+
+    if (conn->next_send_time > temp_time) {
+        return 0;
+    }
+
+    return (uint32_t)((temp_time - conn->next_send_time) * pacing_rate(conn) / 1000.0) + 1;
+}
+
+/* Move the next send time of the connection past the num_sent packets it just
+ * sent. A connection that sent all it had keeps no credit for the time it
+ * was idle.
+ */
+static void pace_sent_packets(const Net_Crypto *c, Crypto_Connection *conn, uint64_t temp_time, uint32_t num_sent,
+                              bool idle)
+{
+    if (!c->send_pacing) {
+        return;
+    }
+
+    if (idle && conn->next_send_time < temp_time) {
+        conn->next_send_time = temp_time;
+    }
+
+    limit_pacing_credit(conn, temp_time);
+    conn->next_send_time += num_sent * 1000.0 / pacing_rate(conn);
+}
+
+static int reset_max_speed_reached(Net_Crypto *c, int crypt_connection_id)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
+    /* If last packet send failed, try to send packet again.
+     * If sending it fails we won't be able to send the new packet. */
+    if (conn->maximum_speed_reached) {
+        Packet_Data *dt = nullptr;
+        const uint32_t packet_num = conn->send_array->buffer_end - 1;
+        const int ret = get_data_pointer(c->log, conn->send_array, &dt, packet_num);
+
+        if (ret == 1 && dt->sent_time == 0) {
+            if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array->buffer_start, packet_num,
+                                        dt->data, dt->length) != 0) {
+                return -1;
+            }
+
+            dt->sent_time = current_time_monotonic(c->mono_time);
+        }
+
+        conn->maximum_speed_reached = 0;
+    }
+
+    return 0;
+}
+
+/*  return -1 if data could not be put in packet queue.
+ *  return positive packet number if data was put into the queue.
+ */
+static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length,
+                                    uint8_t congestion_control)
+{
+    if (length == 0 || length > MAX_CRYPTO_DATA_SIZE) {
+        return -1;
+    }
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
+    /* If last packet send failed, try to send packet again.
+     * If sending it fails we won't be able to send the new packet. */
+    reset_max_speed_reached(c, crypt_connection_id);
+
+    if (conn->maximum_speed_reached && congestion_control) {
+        return -1;
+    }
+
+    Packet_Data dt;
+    dt.sent_time = 0;
+    dt.length = length;
+    dt.resent = false;
+    memcpy(dt.data, data, length);
+    pthread_mutex_lock(conn->mutex);
+    int64_t packet_num = add_data_end_of_buffer(c->log, c->packet_slab, conn->send_array, &dt, on_net_crypto_thread(c));
+    pthread_mutex_unlock(conn->mutex);
+
+    if (packet_num == -1) {
+        return -1;
+    }
+
+    if (!congestion_control && conn->maximum_speed_reached) {
+        return packet_num;
+    }
+
+    const uint64_t temp_time = current_time_monotonic(c->mono_time);
+
+    /* Sent with the other new packets by do_net_crypto_send(), or when send
+     * pacing lets it go.
+     */
+    if (c->workers != nullptr || conn->has_new_packets || paced_packets(c, conn, temp_time) == 0) {
+        if (!conn->has_new_packets) {
+            conn->has_new_packets = true;
+            conn->new_packets_start = packet_num;
+        }
+
+        return packet_num;
+    }
+
+    if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array->buffer_start, packet_num, data, length) == 0) {
+        Packet_Data *dt1 = nullptr;
+
+        /* The packet may be acknowledged and freed in the meantime. */
+        pthread_mutex_lock(conn->mutex);
+
+        if (get_data_pointer(c->log, conn->send_array, &dt1, packet_num) == 1) {
+            dt1->sent_time = temp_time;
+        }
+
+        pthread_mutex_unlock(conn->mutex);
+
+        pace_sent_packets(c, conn, temp_time, 1, true);
+    } else {
+        conn->maximum_speed_reached = 1;
         LOGGER_DEBUG(c->log, "send_data_packet failed");
     }
 
@@ -1206,6 +1835,22 @@ static uint16_t get_nonce_uint16(const uint8_t *nonce)
 
 #define DATA_NUM_THRESHOLD 21845
 
+/* Put the nonce the data packet was encrypted with in nonce, from the
+ * connection's receive nonce and the nonce bytes in the packet.
+ *
+ * return how far ahead of the receive nonce it is.
+ */
+static uint16_t data_packet_nonce(const Crypto_Connection *conn, const uint8_t *packet, uint8_t *nonce)
+{
+    memcpy(nonce, conn->recv_nonce, CRYPTO_NONCE_SIZE);
+    const uint16_t num_cur_nonce = get_nonce_uint16(nonce);
+    uint16_t num;
+    net_unpack_u16(packet + 1, &num);
+    const uint16_t diff = num - num_cur_nonce;
+    increment_nonce_number(nonce, diff);
+    return diff;
+}
+
 /* Handle a data packet.
  * Decrypt packet of length and put it into data.
  * data must be at least MAX_DATA_DATA_PACKET_SIZE big.
@@ -1229,12 +1874,7 @@ static int handle_data_packet(const Net_Crypto *c, int crypt_connection_id, uint
     }
 
     uint8_t nonce[CRYPTO_NONCE_SIZE];
-    memcpy(nonce, conn->recv_nonce, CRYPTO_NONCE_SIZE);
-    uint16_t num_cur_nonce = get_nonce_uint16(nonce);
-    uint16_t num;
-    net_unpack_u16(packet + 1, &num);
-    uint16_t diff = num - num_cur_nonce;
-    increment_nonce_number(nonce, diff);
+    const uint16_t diff = data_packet_nonce(conn, packet, nonce);
     int len = decrypt_data_symmetric(conn->shared_key, nonce, packet + 1 + sizeof(uint16_t),
                                      length - (1 + sizeof(uint16_t)), data);
 
@@ -1263,16 +1903,116 @@ static int send_request_packet(Net_Crypto *c, int crypt_connection_id)
     }
 
     uint8_t data[MAX_CRYPTO_DATA_SIZE];
-    int len = generate_request_packet(c->log, data, sizeof(data), &conn->recv_array);
+    int len;
+
+    if (!conn->request_ranges) {
+        len = generate_request_packet(c->log, data, sizeof(data), conn->recv_array);
+
+        if (len == -1) {
+            return -1;
+        }
+
+        if (conn->request_ranges_probes >= CRYPTO_REQUEST_RANGES_PROBES) {
+            return send_data_packet_helper(c, crypt_connection_id, conn->recv_array->buffer_start, conn->send_array->buffer_end,
+                                           data, len);
+        }
+
+        if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array->buffer_start, conn->send_array->buffer_end, data,
+                                    len) != 0) {
+            return -1;
+        }
+
+        ++conn->request_ranges_probes;
+    }
+
+    len = generate_request_ranges_packet(data, sizeof(data), conn->recv_array);
 
     if (len == -1) {
         return -1;
     }
 
-    return send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, conn->send_array.buffer_end, data,
+    return send_data_packet_helper(c, crypt_connection_id, conn->recv_array->buffer_start, conn->send_array->buffer_end, data,
                                    len);
 }
 
+/* return the position in the send array of the first packet waiting for
+ * do_net_crypto_send(), the size of the array if none is waiting.
+ */
+static uint32_t first_new_packet_index(const Crypto_Connection *conn)
+{
+    const uint32_t array_size = num_packets_array(conn->send_array);
+
+    if (!conn->has_new_packets) {
+        return array_size;
+    }
+
+    const uint32_t num = conn->new_packets_start - conn->send_array->buffer_start;
+
+    /* The peer acknowledged packets that were never sent. */
+    if (num > array_size) {
+        return 0;
+    }
+
+    return num;
+}
+
+/* Sends the packets queued since the last call in batches on the crypto
+ * workers.
+ */
+static void send_new_packets(Net_Crypto *c, int crypt_connection_id)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr || !conn->has_new_packets) {
+        return;
+    }
+
+    const uint64_t temp_time = current_time_monotonic(c->mono_time);
+    const uint32_t max_num = paced_packets(c, conn, temp_time);
+
+    if (max_num == 0) {
+        return;
+    }
+
+    const uint32_t start = first_new_packet_index(conn);
+    const uint32_t end = num_packets_array(conn->send_array);
+    bool send_failed = false;
+    int num_sent;
+
+    if (c->workers != nullptr) {
+        num_sent = send_unsent_packets(c, crypt_connection_id, start, end, max_num, &send_failed);
+    } else {
+        num_sent = send_unsent_packets_serial(c, crypt_connection_id, start, end, max_num, &send_failed);
+    }
+
+    conn->has_new_packets = false;
+
+    if (num_sent == -1) {
+        return;
+    }
+
+    pace_sent_packets(c, conn, temp_time, num_sent, (uint32_t)num_sent < max_num);
+
+    /* The rest waits for the pacer. */
+    if ((uint32_t)num_sent == max_num) {
+        for (uint32_t i = start; i < end; ++i) {
+            Packet_Data *dt;
+            const uint32_t packet_num = i + conn->send_array->buffer_start;
+
+            if (get_data_pointer(c->log, conn->send_array, &dt, packet_num) == 1 && dt->sent_time == 0) {
+                conn->has_new_packets = true;
+                conn->new_packets_start = packet_num;
+                break;
+            }
+        }
+    }
+
+    if (send_failed) {
+        conn->maximum_speed_reached = 1;
+        LOGGER_DEBUG(c->log, "send_data_packet failed");
+    }
+}
+
 /* Send up to max num previously requested data packets.
  *
  * return -1 on failure.
@@ -1290,39 +2030,13 @@ static int send_requested_packets(Net_Crypto *c, int crypt_connection_id, uint32
         return -1;
     }
 
-    const uint64_t temp_time = current_time_monotonic(c->mono_time);
-    const uint32_t array_size = num_packets_array(&conn->send_array);
-    uint32_t num_sent = 0;
-
-    for (uint32_t i = 0; i < array_size; ++i) {
-        Packet_Data *dt;
-        const uint32_t packet_num = i + conn->send_array.buffer_start;
-        const int ret = get_data_pointer(c->log, &conn->send_array, &dt, packet_num);
-
-        if (ret == -1) {
-            return -1;
-        }
-
-        if (ret == 0) {
-            continue;
-        }
-
-        if (dt->sent_time) {
-            continue;
-        }
-
-        if (send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, packet_num, dt->data,
-                                    dt->length) == 0) {
-            dt->sent_time = temp_time;
-            ++num_sent;
-        }
+    bool send_failed = false;
 
-        if (num_sent >= max_num) {
-            break;
-        }
+    if (c->workers != nullptr) {
+        return send_unsent_packets(c, crypt_connection_id, 0, first_new_packet_index(conn), max_num, &send_failed);
     }
 
-    return num_sent;
+    return send_unsent_packets_serial(c, crypt_connection_id, 0, first_new_packet_index(conn), max_num, &send_failed);
 }
 
 
@@ -1356,8 +2070,11 @@ static int new_temp_packet(const Net_Crypto *c, int crypt_connection_id, const u
     memcpy(temp_packet, packet, length);
     conn->temp_packet = temp_packet;
     conn->temp_packet_length = length;
-    conn->temp_packet_sent_time = 0;
-    conn->temp_packet_num_sent = 0;
+
+    Crypto_Conn_Schedule *sched = get_schedule(c, crypt_connection_id);
+    sched->temp_packet_sent_time = 0;
+    sched->temp_packet_num_sent = 0;
+    sched->next_run = 0;
     return 0;
 }
 
@@ -1380,8 +2097,10 @@ static int clear_temp_packet(const Net_Crypto *c, int crypt_connection_id)
 
     conn->temp_packet = nullptr;
     conn->temp_packet_length = 0;
-    conn->temp_packet_sent_time = 0;
-    conn->temp_packet_num_sent = 0;
+
+    Crypto_Conn_Schedule *sched = get_schedule(c, crypt_connection_id);
+    sched->temp_packet_sent_time = 0;
+    sched->temp_packet_num_sent = 0;
     return 0;
 }
 
@@ -1407,8 +2126,9 @@ static int send_temp_packet(Net_Crypto *c, int crypt_connection_id)
         return -1;
     }
 
-    conn->temp_packet_sent_time = current_time_monotonic(c->mono_time);
-    ++conn->temp_packet_num_sent;
+    Crypto_Conn_Schedule *sched = get_schedule(c, crypt_connection_id);
+    sched->temp_packet_sent_time = current_time_monotonic(c->mono_time);
+    ++sched->temp_packet_num_sent;
     return 0;
 }
 
@@ -1456,7 +2176,7 @@ static int send_kill_packet(Net_Crypto *c, int crypt_connection_id)
     }
 
     uint8_t kill_packet = PACKET_ID_KILL;
-    return send_data_packet_helper(c, crypt_connection_id, conn->recv_array.buffer_start, conn->send_array.buffer_end,
+    return send_data_packet_helper(c, crypt_connection_id, conn->recv_array->buffer_start, conn->send_array->buffer_end,
                                    &kill_packet, sizeof(kill_packet));
 }
 
@@ -1487,15 +2207,15 @@ static void connection_kill(Net_Crypto *c, int crypt_connection_id, void *userda
     pthread_mutex_unlock(&c->connections_mutex);
 }
 
-/* Handle a received data packet.
+/* Handle the decrypted contents of a data packet.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length,
-                                   bool udp, void *userdata)
+static int handle_decrypted_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t len,
+                                        bool udp, void *userdata)
 {
-    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE) {
+    if (len <= sizeof(uint32_t) * 2) {
         return -1;
     }
 
@@ -1505,12 +2225,10 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
         return -1;
     }
 
-    uint8_t data[MAX_DATA_DATA_PACKET_SIZE];
-    int len = handle_data_packet(c, crypt_connection_id, data, packet, length);
-
-    if (len <= (int)(sizeof(uint32_t) * 2)) {
-        return -1;
-    }
+    /* Acknowledgements, requests and data change what send_crypto_packets()
+     * has to do for the connection.
+     */
+    get_schedule(c, crypt_connection_id)->next_run = 0;
 
     uint32_t buffer_start;
     uint32_t num;
@@ -1521,19 +2239,30 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
 
     uint64_t rtt_calc_time = 0;
 
-    if (buffer_start != conn->send_array.buffer_start) {
-        Packet_Data *packet_time;
+    /* The delay controller needs a round trip time sample on every
+     * acknowledgement: from the newest packet acknowledged, through request
+     * packets too, and never from a packet that was resent, since the
+     * acknowledgement may be for either copy (Karn's algorithm). The queue
+     * controller was tuned on the samples of the oldest packet acknowledged
+     * through the header, and keeps them.
+     */
+    const bool precise_rtt = conn->congestion.type == CONGESTION_CONTROL_DELAY;
 
-        if (get_data_pointer(c->log, &conn->send_array, &packet_time, conn->send_array.buffer_start) == 1) {
-            rtt_calc_time = packet_time->sent_time;
-        }
+    if (buffer_start != conn->send_array->buffer_start) {
+        /* Freed packets may be in use by send_lossless_packet() on another thread. */
+        pthread_mutex_lock(conn->mutex);
+        const int delivered = clear_buffer_until(c->log, c->packet_slab, conn->send_array, buffer_start,
+                                                 &rtt_calc_time, precise_rtt);
+        pthread_mutex_unlock(conn->mutex);
 
-        if (clear_buffer_until(c->log, &conn->send_array, buffer_start) != 0) {
+        if (delivered == -1) {
             return -1;
         }
+
+        conn->packets_delivered += delivered;
     }
 
-    uint8_t *real_data = data + (sizeof(uint32_t) * 2);
+    const uint8_t *real_data = data + (sizeof(uint32_t) * 2);
     uint16_t real_length = len - (sizeof(uint32_t) * 2);
 
     while (real_data[0] == PACKET_ID_PADDING) { /* Remove Padding */
@@ -1550,9 +2279,9 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
         return 0;
     }
 
-    if (conn->status == CRYPTO_CONN_NOT_CONFIRMED) {
+    if (get_schedule(c, crypt_connection_id)->status == CRYPTO_CONN_NOT_CONFIRMED) {
         clear_temp_packet(c, crypt_connection_id);
-        conn->status = CRYPTO_CONN_ESTABLISHED;
+        set_connection_status(c, crypt_connection_id, CRYPTO_CONN_ESTABLISHED);
 
         if (conn->connection_status_callback) {
             conn->connection_status_callback(conn->connection_status_callback_object, conn->connection_status_callback_id, 1,
@@ -1560,7 +2289,7 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
         }
     }
 
-    if (real_data[0] == PACKET_ID_REQUEST) {
+    if (real_data[0] == PACKET_ID_REQUEST || real_data[0] == PACKET_ID_REQUEST_RANGES) {
         uint64_t rtt_time;
 
         if (udp) {
@@ -1569,26 +2298,43 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
             rtt_time = DEFAULT_TCP_PING_CONNECTION;
         }
 
-        int requested = handle_request_packet(c->mono_time, c->log, &conn->send_array, real_data, real_length, &rtt_calc_time,
-                                              rtt_time);
+        int requested;
+
+        pthread_mutex_lock(conn->mutex);
+
+        if (real_data[0] == PACKET_ID_REQUEST) {
+            requested = handle_request_packet(c->mono_time, c->log, c->packet_slab, conn->send_array, real_data, real_length,
+                                              &rtt_calc_time, rtt_time, &conn->packets_delivered);
+        } else {
+            requested = handle_request_ranges_packet(c->mono_time, c->packet_slab, conn->send_array, real_data, real_length,
+                                                     &rtt_calc_time, rtt_time, &conn->packets_delivered);
+            conn->request_ranges = true;
+        }
+
+        pthread_mutex_unlock(conn->mutex);
 
         if (requested == -1) {
             return -1;
         }
 
-        set_buffer_end(c->log, &conn->recv_array, num);
+        if (!precise_rtt) {
+            /* Request packets never gave the queue controller a sample. */
+            rtt_calc_time = 0;
+        }
+
+        set_buffer_end(c->log, conn->recv_array, num);
     } else if (real_data[0] >= PACKET_ID_RANGE_LOSSLESS_START && real_data[0] <= PACKET_ID_RANGE_LOSSLESS_END) {
         Packet_Data dt = {0};
         dt.length = real_length;
         memcpy(dt.data, real_data, real_length);
 
-        if (add_data_to_buffer(c->log, &conn->recv_array, num, &dt) != 0) {
+        if (add_data_to_buffer(c->log, c->packet_slab, conn->recv_array, num, &dt) != 0) {
             return -1;
         }
 
         while (1) {
             pthread_mutex_lock(conn->mutex);
-            int ret = read_data_beg_buffer(c->log, &conn->recv_array, &dt);
+            int ret = read_data_beg_buffer(c->log, c->packet_slab, conn->recv_array, &dt);
             pthread_mutex_unlock(conn->mutex);
 
             if (ret == -1) {
@@ -1612,7 +2358,7 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
         ++conn->packet_counter;
     } else if (real_data[0] >= PACKET_ID_RANGE_LOSSY_START && real_data[0] <= PACKET_ID_RANGE_LOSSY_END) {
 
-        set_buffer_end(c->log, &conn->recv_array, num);
+        set_buffer_end(c->log, conn->recv_array, num);
 
         if (conn->connection_lossy_data_callback) {
             conn->connection_lossy_data_callback(conn->connection_lossy_data_callback_object,
@@ -1625,6 +2371,15 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
     if (rtt_calc_time != 0) {
         uint64_t rtt_time = current_time_monotonic(c->mono_time) - rtt_calc_time;
 
+        conn->last_rtt_time = rtt_time;
+
+        if (conn->smoothed_rtt_time == 0) {
+            conn->smoothed_rtt_time = rtt_time;
+        } else {
+            conn->smoothed_rtt_time = (conn->smoothed_rtt_time * (STATS_AVERAGE_WEIGHT - 1) + rtt_time)
+                                      / STATS_AVERAGE_WEIGHT;
+        }
+
         if (rtt_time < conn->rtt_time) {
             conn->rtt_time = rtt_time;
         }
@@ -1633,6 +2388,34 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
     return 0;
 }
 
+/* Handle a received data packet.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length,
+                                   bool udp, void *userdata)
+{
+    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE) {
+        return -1;
+    }
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
+    uint8_t data[MAX_DATA_DATA_PACKET_SIZE];
+    const int len = handle_data_packet(c, crypt_connection_id, data, packet, length);
+
+    if (len == -1) {
+        return -1;
+    }
+
+    return handle_decrypted_data_packet(c, crypt_connection_id, data, len, udp, userdata);
+}
+
 /* Handle a packet that was received for the connection.
  *
  * return -1 on failure.
@@ -1651,9 +2434,11 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
         return -1;
     }
 
+    const Crypto_Conn_State status = get_schedule(c, crypt_connection_id)->status;
+
     switch (packet[0]) {
         case NET_PACKET_COOKIE_RESPONSE: {
-            if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING) {
+            if (status != CRYPTO_CONN_COOKIE_REQUESTING) {
                 return -1;
             }
 
@@ -1672,14 +2457,14 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
                 return -1;
             }
 
-            conn->status = CRYPTO_CONN_HANDSHAKE_SENT;
+            set_connection_status(c, crypt_connection_id, CRYPTO_CONN_HANDSHAKE_SENT);
             return 0;
         }
 
         case NET_PACKET_CRYPTO_HS: {
-            if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING
-                    && conn->status != CRYPTO_CONN_HANDSHAKE_SENT
-                    && conn->status != CRYPTO_CONN_NOT_CONFIRMED) {
+            if (status != CRYPTO_CONN_COOKIE_REQUESTING
+                    && status != CRYPTO_CONN_HANDSHAKE_SENT
+                    && status != CRYPTO_CONN_NOT_CONFIRMED) {
                 return -1;
             }
 
@@ -1695,37 +2480,189 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
             if (public_key_cmp(dht_public_key, conn->dht_public_key) == 0) {
                 encrypt_precompute(conn->peersessionpublic_key, conn->sessionsecret_key, conn->shared_key);
 
-                if (conn->status == CRYPTO_CONN_COOKIE_REQUESTING) {
+                if (status == CRYPTO_CONN_COOKIE_REQUESTING) {
                     if (create_send_handshake(c, crypt_connection_id, cookie, dht_public_key) != 0) {
                         return -1;
                     }
                 }
 
-                conn->status = CRYPTO_CONN_NOT_CONFIRMED;
+                if (alloc_packets_arrays(conn) != 0) {
+                    return -1;
+                }
+
+                set_connection_status(c, crypt_connection_id, CRYPTO_CONN_NOT_CONFIRMED);
             } else {
                 if (conn->dht_pk_callback) {
                     conn->dht_pk_callback(conn->dht_pk_callback_object, conn->dht_pk_callback_number, dht_public_key, userdata);
                 }
             }
 
-            return 0;
+            return 0;
+        }
+
+        case NET_PACKET_CRYPTO_DATA: {
+            if (status != CRYPTO_CONN_NOT_CONFIRMED && status != CRYPTO_CONN_ESTABLISHED) {
+                return -1;
+            }
+
+            return handle_data_packet_core(c, crypt_connection_id, packet, length, udp, userdata);
+        }
+
+        default: {
+            return -1;
+        }
+    }
+}
+
+/* Set the time at which a direct packet from source was last received for the
+ * connection to now.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int set_direct_lastrecv_time(Net_Crypto *c, int crypt_connection_id, const IP_Port *source)
+{
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
+    pthread_mutex_lock(conn->mutex);
+
+    if (net_family_is_ipv4(source->ip.family)) {
+        conn->direct_lastrecv_timev4 = mono_time_get(c->mono_time);
+    } else {
+        conn->direct_lastrecv_timev6 = mono_time_get(c->mono_time);
+    }
+
+    pthread_mutex_unlock(conn->mutex);
+    return 0;
+}
+
+/* Decrypt the queued data packets on the crypto workers, then handle them in
+ * the order they were received.
+ */
+static void handle_received_data_packets(Net_Crypto *c, void *userdata)
+{
+    Crypto_Batch *batch = c->recv_batch;
+
+    if (batch == nullptr || batch->length == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < batch->length; ++i) {
+        Crypto_Job *job = &batch->jobs[i];
+        Crypto_Batch_Packet *entry = &batch->packets[i];
+        const Crypto_Connection *conn = get_crypto_connection(c, entry->crypt_connection_id);
+
+        job->encrypt = false;
+        job->data = entry->packet + 1 + sizeof(uint16_t);
+        job->length = entry->length - (1 + sizeof(uint16_t));
+
+        if (conn == nullptr) {
+            /* Fails right away, the packet is dropped below. */
+            job->length = 0;
+            continue;
+        }
+
+        memcpy(job->shared_key, conn->shared_key, CRYPTO_SHARED_KEY_SIZE);
+        data_packet_nonce(conn, entry->packet, job->nonce);
+    }
+
+    crypto_workers_run(c->workers, batch->jobs, batch->length);
+
+    for (uint32_t i = 0; i < batch->length; ++i) {
+        Crypto_Job *job = &batch->jobs[i];
+        const Crypto_Batch_Packet *entry = &batch->packets[i];
+        Crypto_Connection *conn = get_crypto_connection(c, entry->crypt_connection_id);
+
+        if (conn == nullptr) {
+            continue;
+        }
+
+        const Crypto_Conn_State status = get_schedule(c, entry->crypt_connection_id)->status;
+
+        if (status != CRYPTO_CONN_NOT_CONFIRMED && status != CRYPTO_CONN_ESTABLISHED) {
+            continue;
+        }
+
+        /* An earlier packet of the batch may have moved the receive nonce or
+         * the connection may have been replaced. The packet must then decrypt
+         * with what handle_data_packet() would use now.
+         */
+        uint8_t nonce[CRYPTO_NONCE_SIZE];
+        const uint16_t diff = data_packet_nonce(conn, entry->packet, nonce);
+
+        if (crypto_memcmp(nonce, job->nonce, CRYPTO_NONCE_SIZE) != 0
+                || crypto_memcmp(conn->shared_key, job->shared_key, CRYPTO_SHARED_KEY_SIZE) != 0) {
+            if (job->result != -1) {
+                continue;
+            }
+
+            job->result = decrypt_data_symmetric_in_place(conn->shared_key, nonce, job->data, job->length);
+        }
+
+        if (job->result != job->length - CRYPTO_MAC_SIZE) {
+            continue;
         }
 
-        case NET_PACKET_CRYPTO_DATA: {
-            if (conn->status != CRYPTO_CONN_NOT_CONFIRMED && conn->status != CRYPTO_CONN_ESTABLISHED) {
-                return -1;
-            }
+        if (diff > DATA_NUM_THRESHOLD * 2) {
+            increment_nonce_number(conn->recv_nonce, DATA_NUM_THRESHOLD);
+        }
 
-            return handle_data_packet_core(c, crypt_connection_id, packet, length, udp, userdata);
+        if (handle_decrypted_data_packet(c, entry->crypt_connection_id, job->data + CRYPTO_MAC_SIZE, job->result,
+                                         entry->udp, userdata) != 0) {
+            continue;
         }
 
-        default: {
-            return -1;
+        if (entry->udp) {
+            set_direct_lastrecv_time(c, entry->crypt_connection_id, &entry->source);
         }
     }
+
+    batch->length = 0;
+}
+
+/* Queue a received data packet to be decrypted in a batch with the packets
+ * that arrive with it. source is where a UDP packet came from, null for TCP.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int queue_received_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *packet,
+                                      uint16_t length, const IP_Port *source, void *userdata)
+{
+    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE) {
+        return -1;
+    }
+
+    Crypto_Batch *batch = c->recv_batch;
+
+    if (batch->length == CRYPTO_BATCH_SIZE) {
+        handle_received_data_packets(c, userdata);
+    }
+
+    Crypto_Batch_Packet *entry = &batch->packets[batch->length];
+    entry->crypt_connection_id = crypt_connection_id;
+    entry->udp = source != nullptr;
+
+    if (source != nullptr) {
+        entry->source = *source;
+    }
+
+    entry->length = length;
+    memcpy(entry->packet, packet, length);
+    ++batch->length;
+    return 0;
 }
 
 /* Set the size of the friend list to numfriends.
+ *
+ * The schedule array is only resized once the connections array was, so on
+ * failure both still hold at least the smaller of the old and the new number
+ * of connections. Callers shrinking the arrays set crypto_connections_length
+ * first, callers growing them only after this succeeded.
  *
  *  return -1 if realloc fails.
  *  return 0 if it succeeds.
@@ -1733,6 +2670,8 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
 static int realloc_cryptoconnection(Net_Crypto *c, uint32_t num)
 {
     if (num == 0) {
+        free(c->schedule);
+        c->schedule = nullptr;
         free(c->crypto_connections);
         c->crypto_connections = nullptr;
         return 0;
@@ -1746,16 +2685,32 @@ static int realloc_cryptoconnection(Net_Crypto *c, uint32_t num)
     }
 
     c->crypto_connections = newcrypto_connections;
+
+    Crypto_Conn_Schedule *new_schedule = (Crypto_Conn_Schedule *)realloc(c->schedule,
+                                         num * sizeof(Crypto_Conn_Schedule));
+
+    if (new_schedule == nullptr) {
+        return -1;
+    }
+
+    c->schedule = new_schedule;
     return 0;
 }
 
 
-/* Create a new empty crypto connection.
+static const uint8_t *crypto_connection_pk(const void *object, uint32_t crypt_connection_id)
+{
+    const Net_Crypto *c = (const Net_Crypto *)object;
+    return c->crypto_connections[crypt_connection_id].public_key;
+}
+
+/* Create a new empty crypto connection to the peer with real public key
+ * public_key. There must not be one already.
  *
  * return -1 on failure.
  * return connection id on success.
  */
-static int create_crypto_connection(Net_Crypto *c)
+static int create_crypto_connection(Net_Crypto *c, const uint8_t *public_key)
 {
     while (1) { /* TODO(irungentoo): is this really the best way to do this? */
         pthread_mutex_lock(&c->connections_mutex);
@@ -1767,10 +2722,15 @@ static int create_crypto_connection(Net_Crypto *c)
         pthread_mutex_unlock(&c->connections_mutex);
     }
 
+    if (pk_index_reserve(&c->connections_index, c->connections_index.count + 1) == -1) {
+        pthread_mutex_unlock(&c->connections_mutex);
+        return -1;
+    }
+
     int id = -1;
 
     for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        if (c->crypto_connections[i].status == CRYPTO_CONN_FREE) {
+        if (c->schedule[i].status == CRYPTO_CONN_FREE) {
             id = i;
             break;
         }
@@ -1781,6 +2741,7 @@ static int create_crypto_connection(Net_Crypto *c)
             id = c->crypto_connections_length;
             ++c->crypto_connections_length;
             memset(&c->crypto_connections[id], 0, sizeof(Crypto_Connection));
+            memset(&c->schedule[id], 0, sizeof(Crypto_Conn_Schedule));
         }
     }
 
@@ -1804,7 +2765,10 @@ static int create_crypto_connection(Net_Crypto *c)
             return -1;
         }
 
-        c->crypto_connections[id].status = CRYPTO_CONN_NO_CONNECTION;
+        congestion_control_init(&c->crypto_connections[id].congestion, c->congestion_control_type);
+        set_connection_status(c, id, CRYPTO_CONN_NO_CONNECTION);
+        memcpy(c->crypto_connections[id].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        pk_index_add(&c->connections_index, public_key, id);
     }
 
     pthread_mutex_unlock(&c->connections_mutex);
@@ -1826,7 +2790,7 @@ static int wipe_crypto_connection(Net_Crypto *c, int crypt_connection_id)
         return -1;
     }
 
-    const Crypto_Conn_State status = c->crypto_connections[crypt_connection_id].status;
+    const Crypto_Conn_State status = c->schedule[crypt_connection_id].status;
 
     if (status == CRYPTO_CONN_FREE) {
         return -1;
@@ -1834,13 +2798,17 @@ static int wipe_crypto_connection(Net_Crypto *c, int crypt_connection_id)
 
     uint32_t i;
 
+    pk_index_remove(&c->connections_index, c->crypto_connections[crypt_connection_id].public_key);
     pthread_mutex_destroy(c->crypto_connections[crypt_connection_id].mutex);
     free(c->crypto_connections[crypt_connection_id].mutex);
+    kill_packets_array(c->crypto_connections[crypt_connection_id].send_array);
+    kill_packets_array(c->crypto_connections[crypt_connection_id].recv_array);
     crypto_memzero(&c->crypto_connections[crypt_connection_id], sizeof(Crypto_Connection));
+    crypto_memzero(&c->schedule[crypt_connection_id], sizeof(Crypto_Conn_Schedule));
 
     /* check if we can resize the connections array */
     for (i = c->crypto_connections_length; i != 0; --i) {
-        if (c->crypto_connections[i - 1].status != CRYPTO_CONN_FREE) {
+        if (c->schedule[i - 1].status != CRYPTO_CONN_FREE) {
             break;
         }
     }
@@ -1860,17 +2828,13 @@ static int wipe_crypto_connection(Net_Crypto *c, int crypt_connection_id)
  */
 static int getcryptconnection_id(const Net_Crypto *c, const uint8_t *public_key)
 {
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        if (!crypt_connection_id_is_valid(c, i)) {
-            continue;
-        }
+    const uint32_t id = pk_index_find(&c->connections_index, public_key);
 
-        if (public_key_cmp(public_key, c->crypto_connections[i].public_key) == 0) {
-            return i;
-        }
+    if (id == PK_INDEX_NONE || !crypt_connection_id_is_valid(c, id)) {
+        return -1;
     }
 
-    return -1;
+    return id;
 }
 
 /* Add a source to the crypto connection.
@@ -1961,7 +2925,9 @@ static int handle_new_connection_handshake(Net_Crypto *c, IP_Port source, const
         if (public_key_cmp(n_c.dht_public_key, conn->dht_public_key) != 0) {
             connection_kill(c, crypt_connection_id, userdata);
         } else {
-            if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING && conn->status != CRYPTO_CONN_HANDSHAKE_SENT) {
+            const Crypto_Conn_State status = get_schedule(c, crypt_connection_id)->status;
+
+            if (status != CRYPTO_CONN_COOKIE_REQUESTING && status != CRYPTO_CONN_HANDSHAKE_SENT) {
                 free(n_c.cookie);
                 return -1;
             }
@@ -1972,12 +2938,13 @@ static int handle_new_connection_handshake(Net_Crypto *c, IP_Port source, const
 
             crypto_connection_add_source(c, crypt_connection_id, source);
 
-            if (create_send_handshake(c, crypt_connection_id, n_c.cookie, n_c.dht_public_key) != 0) {
+            if (create_send_handshake(c, crypt_connection_id, n_c.cookie, n_c.dht_public_key) != 0
+                    || alloc_packets_arrays(conn) != 0) {
                 free(n_c.cookie);
                 return -1;
             }
 
-            conn->status = CRYPTO_CONN_NOT_CONFIRMED;
+            set_connection_status(c, crypt_connection_id, CRYPTO_CONN_NOT_CONFIRMED);
             free(n_c.cookie);
             return 0;
         }
@@ -1999,7 +2966,7 @@ int accept_crypto_connection(Net_Crypto *c, New_Connection *n_c)
         return -1;
     }
 
-    const int crypt_connection_id = create_crypto_connection(c);
+    const int crypt_connection_id = create_crypto_connection(c, n_c->public_key);
 
     if (crypt_connection_id == -1) {
         LOGGER_ERROR(c->log, "Could not create new crypto connection");
@@ -2023,15 +2990,15 @@ int accept_crypto_connection(Net_Crypto *c, New_Connection *n_c)
     }
 
     conn->connection_number_tcp = connection_number_tcp;
-    memcpy(conn->public_key, n_c->public_key, CRYPTO_PUBLIC_KEY_SIZE);
     memcpy(conn->recv_nonce, n_c->recv_nonce, CRYPTO_NONCE_SIZE);
     memcpy(conn->peersessionpublic_key, n_c->peersessionpublic_key, CRYPTO_PUBLIC_KEY_SIZE);
     random_nonce(conn->sent_nonce);
     crypto_new_keypair(conn->sessionpublic_key, conn->sessionsecret_key);
     encrypt_precompute(conn->peersessionpublic_key, conn->sessionsecret_key, conn->shared_key);
-    conn->status = CRYPTO_CONN_NOT_CONFIRMED;
+    set_connection_status(c, crypt_connection_id, CRYPTO_CONN_NOT_CONFIRMED);
 
-    if (create_send_handshake(c, crypt_connection_id, n_c->cookie, n_c->dht_public_key) != 0) {
+    if (alloc_packets_arrays(conn) != 0
+            || create_send_handshake(c, crypt_connection_id, n_c->cookie, n_c->dht_public_key) != 0) {
         pthread_mutex_lock(&c->tcp_mutex);
         kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
         pthread_mutex_unlock(&c->tcp_mutex);
@@ -2062,7 +3029,7 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
         return crypt_connection_id;
     }
 
-    crypt_connection_id = create_crypto_connection(c);
+    crypt_connection_id = create_crypto_connection(c, real_public_key);
 
     if (crypt_connection_id == -1) {
         return -1;
@@ -2080,10 +3047,9 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
     }
 
     conn->connection_number_tcp = connection_number_tcp;
-    memcpy(conn->public_key, real_public_key, CRYPTO_PUBLIC_KEY_SIZE);
     random_nonce(conn->sent_nonce);
     crypto_new_keypair(conn->sessionpublic_key, conn->sessionsecret_key);
-    conn->status = CRYPTO_CONN_COOKIE_REQUESTING;
+    set_connection_status(c, crypt_connection_id, CRYPTO_CONN_COOKIE_REQUESTING);
     conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
     conn->packet_send_rate_requested = CRYPTO_PACKET_MIN_RATE;
     conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
@@ -2159,7 +3125,15 @@ static int tcp_data_callback(void *object, int crypt_connection_id, const uint8_
     // This unlocks the mutex that at this point is locked by do_tcp before
     // calling do_tcp_connections.
     pthread_mutex_unlock(&c->tcp_mutex);
-    int ret = handle_packet_connection(c, crypt_connection_id, data, length, 0, userdata);
+    int ret;
+
+    if (data[0] == NET_PACKET_CRYPTO_DATA && c->recv_batch != nullptr) {
+        ret = queue_received_data_packet(c, crypt_connection_id, data, length, nullptr, userdata);
+    } else {
+        handle_received_data_packets(c, userdata);
+        ret = handle_packet_connection(c, crypt_connection_id, data, length, 0, userdata);
+    }
+
     pthread_mutex_lock(&c->tcp_mutex);
 
     if (ret != 0) {
@@ -2287,19 +3261,19 @@ static void do_tcp(Net_Crypto *c, void *userdata)
     do_tcp_connections(c->log, c->tcp_c, userdata);
     pthread_mutex_unlock(&c->tcp_mutex);
 
+    /* The data packets received over UDP since the last call and over TCP
+     * just now.
+     */
+    handle_received_data_packets(c, userdata);
+
     uint32_t i;
 
     for (i = 0; i < c->crypto_connections_length; ++i) {
-        Crypto_Connection *conn = get_crypto_connection(c, i);
-
-        if (conn == nullptr) {
-            continue;
-        }
-
-        if (conn->status != CRYPTO_CONN_ESTABLISHED) {
+        if (c->schedule[i].status != CRYPTO_CONN_ESTABLISHED) {
             continue;
         }
 
+        const Crypto_Connection *conn = &c->crypto_connections[i];
         bool direct_connected = 0;
 
         if (!crypto_connection_status(c, i, &direct_connected, nullptr)) {
@@ -2427,6 +3401,18 @@ static int crypto_id_ip_port(const Net_Crypto *c, IP_Port ip_port)
 
 #define CRYPTO_MIN_PACKET_SIZE (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE)
 
+/* Source check of crypto data packets for the receive budget.
+ *
+ * return true if source is the address of an established connection.
+ */
+static bool udp_data_from_connection(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length)
+{
+    const Net_Crypto *c = (const Net_Crypto *)object;
+    const int crypt_connection_id = crypto_id_ip_port(c, *source);
+
+    return crypt_connection_id != -1 && get_schedule(c, crypt_connection_id)->status == CRYPTO_CONN_ESTABLISHED;
+}
+
 /* Handle raw UDP packets coming directly from the socket.
  *
  * Handles:
@@ -2445,6 +3431,19 @@ static int udp_handle_packet(void *object, IP_Port source, const uint8_t *packet
 
     const int crypt_connection_id = crypto_id_ip_port(c, source);
 
+    if (packet[0] == NET_PACKET_CRYPTO_DATA && crypt_connection_id != -1 && c->recv_batch != nullptr) {
+        if (queue_received_data_packet(c, crypt_connection_id, packet, length, &source, userdata) != 0) {
+            return 1;
+        }
+
+        return 0;
+    }
+
+    /* Data packets that came before a packet that changes the connection are
+     * handled before it.
+     */
+    handle_received_data_packets(c, userdata);
+
     if (crypt_connection_id == -1) {
         if (packet[0] != NET_PACKET_CRYPTO_HS) {
             return 1;
@@ -2461,70 +3460,144 @@ static int udp_handle_packet(void *object, IP_Port source, const uint8_t *packet
         return 1;
     }
 
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
-
-    if (conn == nullptr) {
-        return -1;
-    }
-
-    pthread_mutex_lock(conn->mutex);
-
-    if (net_family_is_ipv4(source.ip.family)) {
-        conn->direct_lastrecv_timev4 = mono_time_get(c->mono_time);
-    } else {
-        conn->direct_lastrecv_timev6 = mono_time_get(c->mono_time);
-    }
-
-    pthread_mutex_unlock(conn->mutex);
-    return 0;
+    return set_direct_lastrecv_time(c, crypt_connection_id, &source);
 }
 
-/* The dT for the average packet receiving rate calculations.
- * Also used as the */
-#define PACKET_COUNTER_AVERAGE_INTERVAL 50
+/* The dT for the average packet receiving rate calculations and the
+ * congestion control samples.
+ */
+#define PACKET_COUNTER_AVERAGE_INTERVAL CONGESTION_SAMPLE_INTERVAL
 
 /* Ratio of recv queue size / recv packet rate (in seconds) times
  * the number of ms between request packets to send at that ratio
  */
 #define REQUEST_PACKETS_COMPARE_CONSTANT (0.125 * 100.0)
 
-/* Timeout for increasing speed after congestion event (in ms). */
-#define CONGESTION_EVENT_TIMEOUT 1000
+/* Move an average of rates measured every PACKET_COUNTER_AVERAGE_INTERVAL
+ * towards rate.
+ */
+static void update_rate_average(double *average, double rate)
+{
+    *average += (rate - *average) / STATS_AVERAGE_WEIGHT;
+}
+
+/* return the time in ms at which send pacing lets the next packet of the
+ * connection go.
+ */
+static uint64_t pacing_next_run(const Crypto_Connection *conn)
+{
+    return (uint64_t)conn->next_send_time + 1;
+}
+
+/* return the time in ms at which send_crypto_packets() adds packets sent at
+ * rate to a budget it last added to at last_set.
+ */
+static uint64_t packets_left_refill_time(double rate, uint64_t last_set)
+{
+    return (uint64_t)((1000.0 / rate) + 0.5) + last_set;
+}
 
-/* If the send queue is SEND_QUEUE_RATIO times larger than the
- * calculated link speed the packet send speed will be reduced
- * by a value depending on this number.
+/* return the time at which send_crypto_packets() has something to do for the
+ * connection next, given that it just ran at temp_time.
  */
-#define SEND_QUEUE_RATIO 2.0
+static uint64_t connection_next_run(const Net_Crypto *c, int crypt_connection_id, uint64_t temp_time)
+{
+    const Crypto_Connection *conn = &c->crypto_connections[crypt_connection_id];
+    const Crypto_Conn_Schedule *sched = get_schedule(c, crypt_connection_id);
+    uint64_t next_run = temp_time + CRYPTO_SEND_PACKET_INTERVAL;
+
+    if (conn->temp_packet != nullptr) {
+        next_run = min_u64(next_run, sched->temp_packet_sent_time + CRYPTO_SEND_PACKET_INTERVAL + 1);
+    }
+
+    if (sched->status == CRYPTO_CONN_NOT_CONFIRMED || sched->status == CRYPTO_CONN_ESTABLISHED) {
+        next_run = min_u64(next_run, conn->last_request_packet_sent + CRYPTO_SEND_PACKET_INTERVAL + 1);
+    }
+
+    if (sched->request_packet_interval != 0) {
+        next_run = min_u64(next_run, conn->last_request_packet_sent + sched->request_packet_interval + 1);
+    }
+
+    /* The congestion controllers expect a sample every
+     * PACKET_COUNTER_AVERAGE_INTERVAL while packets move. Samples of idle
+     * connections only hold zeros, so those wait for the next other deadline.
+     */
+    if (sched->status == CRYPTO_CONN_ESTABLISHED
+            && (num_packets_array(conn->send_array) != 0 || conn->packet_counter != 0 || conn->packets_sent != 0
+                || conn->packets_resent != 0 || conn->packets_delivered != 0)) {
+        next_run = min_u64(next_run, conn->packet_counter_set + PACKET_COUNTER_AVERAGE_INTERVAL + 1);
+    }
+
+    /* Queued packets are sent, and an empty send budget refilled, as the send
+     * rate allows.
+     */
+    if (sched->status == CRYPTO_CONN_ESTABLISHED
+            && (num_packets_array(conn->send_array) != 0 || conn->packets_left == 0)) {
+        next_run = min_u64(next_run, packets_left_refill_time(conn->packet_send_rate, conn->last_packets_left_set));
+        next_run = min_u64(next_run, packets_left_refill_time(conn->packet_send_rate_requested,
+                           conn->last_packets_left_requested_set));
+    }
+
+    if (sched->status == CRYPTO_CONN_ESTABLISHED && c->send_pacing
+            && (conn->has_new_packets || conn->pacing_held_back)) {
+        next_run = min_u64(next_run, max_u64(pacing_next_run(conn), temp_time + 1));
+    }
+
+    /* Sending failed, try again as often as before there were deadlines. */
+    if (next_run <= temp_time) {
+        return temp_time + PACKET_COUNTER_AVERAGE_INTERVAL;
+    }
+
+    return next_run;
+}
 
 static void send_crypto_packets(Net_Crypto *c)
 {
     const uint64_t temp_time = current_time_monotonic(c->mono_time);
     double total_send_rate = 0;
     uint32_t peak_request_packet_interval = -1;
+    uint64_t next_run = temp_time + CRYPTO_SEND_PACKET_INTERVAL;
 
     for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        Crypto_Connection *conn = get_crypto_connection(c, i);
+        Crypto_Conn_Schedule *sched = &c->schedule[i];
+
+        if (sched->status == CRYPTO_CONN_FREE || sched->status == CRYPTO_CONN_NO_CONNECTION) {
+            continue;
+        }
+
+        /* Connections only run at the deadlines from their last run, or
+         * after something happened to them.
+         */
+        if (temp_time < sched->next_run) {
+            next_run = min_u64(next_run, sched->next_run);
+            total_send_rate += sched->send_rate;
+
+            if (sched->request_packet_interval != 0 && sched->request_packet_interval < peak_request_packet_interval) {
+                peak_request_packet_interval = sched->request_packet_interval;
+            }
 
-        if (conn == nullptr) {
             continue;
         }
 
-        if ((CRYPTO_SEND_PACKET_INTERVAL + conn->temp_packet_sent_time) < temp_time) {
+        Crypto_Connection *conn = &c->crypto_connections[i];
+        sched->send_rate = 0;
+        sched->request_packet_interval = 0;
+
+        if ((CRYPTO_SEND_PACKET_INTERVAL + sched->temp_packet_sent_time) < temp_time) {
             send_temp_packet(c, i);
         }
 
-        if ((conn->status == CRYPTO_CONN_NOT_CONFIRMED || conn->status == CRYPTO_CONN_ESTABLISHED)
+        if ((sched->status == CRYPTO_CONN_NOT_CONFIRMED || sched->status == CRYPTO_CONN_ESTABLISHED)
                 && (CRYPTO_SEND_PACKET_INTERVAL + conn->last_request_packet_sent) < temp_time) {
             if (send_request_packet(c, i) == 0) {
                 conn->last_request_packet_sent = temp_time;
             }
         }
 
-        if (conn->status == CRYPTO_CONN_ESTABLISHED) {
+        if (sched->status == CRYPTO_CONN_ESTABLISHED) {
             if (conn->packet_recv_rate > CRYPTO_PACKET_MIN_RATE) {
                 double request_packet_interval = (REQUEST_PACKETS_COMPARE_CONSTANT / ((num_packets_array(
-                                                      &conn->recv_array) + 1.0) / (conn->packet_recv_rate + 1.0)));
+                                                      conn->recv_array) + 1.0) / (conn->packet_recv_rate + 1.0)));
 
                 double request_packet_interval2 = ((CRYPTO_PACKET_MIN_RATE / conn->packet_recv_rate) *
                                                    (double)CRYPTO_SEND_PACKET_INTERVAL) + (double)PACKET_COUNTER_AVERAGE_INTERVAL;
@@ -2550,103 +3623,47 @@ static void send_crypto_packets(Net_Crypto *c)
                 if (request_packet_interval < peak_request_packet_interval) {
                     peak_request_packet_interval = request_packet_interval;
                 }
+
+                sched->request_packet_interval = request_packet_interval;
             }
 
             if ((PACKET_COUNTER_AVERAGE_INTERVAL + conn->packet_counter_set) < temp_time) {
-                const double dt = temp_time - conn->packet_counter_set;
-
-                conn->packet_recv_rate = (double)conn->packet_counter / (dt / 1000.0);
-                conn->packet_counter = 0;
-                conn->packet_counter_set = temp_time;
-
-                uint32_t packets_sent = conn->packets_sent;
-                conn->packets_sent = 0;
-
-                uint32_t packets_resent = conn->packets_resent;
-                conn->packets_resent = 0;
-
-                /* conjestion control
-                 *  calculate a new value of conn->packet_send_rate based on some data
-                 */
-
-                unsigned int pos = conn->last_sendqueue_counter % CONGESTION_QUEUE_ARRAY_SIZE;
-                conn->last_sendqueue_size[pos] = num_packets_array(&conn->send_array);
-
-                long signed int sum = 0;
-                sum = (long signed int)conn->last_sendqueue_size[pos] -
-                      (long signed int)conn->last_sendqueue_size[(pos + 1) % CONGESTION_QUEUE_ARRAY_SIZE];
-
-                unsigned int n_p_pos = conn->last_sendqueue_counter % CONGESTION_LAST_SENT_ARRAY_SIZE;
-                conn->last_num_packets_sent[n_p_pos] = packets_sent;
-                conn->last_num_packets_resent[n_p_pos] = packets_resent;
-
-                conn->last_sendqueue_counter = (conn->last_sendqueue_counter + 1) %
-                                               (CONGESTION_QUEUE_ARRAY_SIZE * CONGESTION_LAST_SENT_ARRAY_SIZE);
-
                 bool direct_connected = 0;
                 /* return value can be ignored since the `if` above ensures the connection is established */
                 crypto_connection_status(c, i, &direct_connected, nullptr);
 
+                Congestion_Sample sample;
+                sample.time = temp_time;
+                sample.interval = temp_time - conn->packet_counter_set;
+                sample.packets_sent = conn->packets_sent;
+                sample.packets_resent = conn->packets_resent;
+                sample.packets_delivered = conn->packets_delivered;
+                sample.send_queue = num_packets_array(conn->send_array);
+                sample.min_rtt = conn->rtt_time;
+                sample.rtt = conn->last_rtt_time;
+                sample.last_congestion_event = conn->last_congestion_event;
                 /* When switching from TCP to UDP, don't change the packet send rate for CONGESTION_EVENT_TIMEOUT ms. */
-                if (!(direct_connected && conn->last_tcp_sent + CONGESTION_EVENT_TIMEOUT > temp_time)) {
-                    long signed int total_sent = 0;
-                    long signed int total_resent = 0;
-
-                    // TODO(irungentoo): use real delay
-                    unsigned int delay = (unsigned int)((conn->rtt_time / PACKET_COUNTER_AVERAGE_INTERVAL) + 0.5);
-                    unsigned int packets_set_rem_array = (CONGESTION_LAST_SENT_ARRAY_SIZE - CONGESTION_QUEUE_ARRAY_SIZE);
+                sample.hold_rate = direct_connected && conn->last_tcp_sent + CONGESTION_EVENT_TIMEOUT > temp_time;
 
-                    if (delay > packets_set_rem_array) {
-                        delay = packets_set_rem_array;
-                    }
-
-                    for (unsigned j = 0; j < CONGESTION_QUEUE_ARRAY_SIZE; ++j) {
-                        unsigned int ind = (j + (packets_set_rem_array  - delay) + n_p_pos) % CONGESTION_LAST_SENT_ARRAY_SIZE;
-                        total_sent += conn->last_num_packets_sent[ind];
-                        total_resent += conn->last_num_packets_resent[ind];
-                    }
-
-                    if (sum > 0) {
-                        total_sent -= sum;
-                    } else {
-                        if (total_resent > -sum) {
-                            total_resent = -sum;
-                        }
-                    }
-
-                    /* if queue is too big only allow resending packets. */
-                    uint32_t npackets = num_packets_array(&conn->send_array);
-                    double min_speed = 1000.0 * (((double)(total_sent)) / ((double)(CONGESTION_QUEUE_ARRAY_SIZE) *
-                                                 PACKET_COUNTER_AVERAGE_INTERVAL));
-
-                    double min_speed_request = 1000.0 * (((double)(total_sent + total_resent)) / ((double)(
-                            CONGESTION_QUEUE_ARRAY_SIZE) * PACKET_COUNTER_AVERAGE_INTERVAL));
-
-                    if (min_speed < CRYPTO_PACKET_MIN_RATE) {
-                        min_speed = CRYPTO_PACKET_MIN_RATE;
-                    }
-
-                    double send_array_ratio = (((double)npackets) / min_speed);
-
-                    // TODO(irungentoo): Improve formula?
-                    if (send_array_ratio > SEND_QUEUE_RATIO && CRYPTO_MIN_QUEUE_LENGTH < npackets) {
-                        conn->packet_send_rate = min_speed * (1.0 / (send_array_ratio / SEND_QUEUE_RATIO));
-                    } else if (conn->last_congestion_event + CONGESTION_EVENT_TIMEOUT < temp_time) {
-                        conn->packet_send_rate = min_speed * 1.2;
-                    } else {
-                        conn->packet_send_rate = min_speed * 0.9;
-                    }
-
-                    conn->packet_send_rate_requested = min_speed_request * 1.2;
+                conn->packet_recv_rate = (double)conn->packet_counter / (sample.interval / 1000.0);
+                update_rate_average(&conn->packet_recv_rate_average, conn->packet_recv_rate);
+                update_rate_average(&conn->packet_send_rate_average,
+                                    (double)(conn->packets_sent + conn->packets_resent) / (sample.interval / 1000.0));
+                conn->total_packets_resent += conn->packets_resent;
+                conn->packet_counter = 0;
+                conn->packet_counter_set = temp_time;
+                conn->packets_sent = 0;
+                conn->packets_resent = 0;
+                conn->packets_delivered = 0;
+                conn->last_rtt_time = 0;
 
-                    if (conn->packet_send_rate < CRYPTO_PACKET_MIN_RATE) {
-                        conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
-                    }
+                congestion_control_update(&conn->congestion, &sample, &conn->packet_send_rate,
+                                          &conn->packet_send_rate_requested);
 
-                    if (conn->packet_send_rate_requested < conn->packet_send_rate) {
-                        conn->packet_send_rate_requested = conn->packet_send_rate;
-                    }
-                }
+                pthread_mutex_lock(conn->mutex);
+                shrink_packets_array(conn->send_array);
+                shrink_packets_array(conn->recv_array);
+                pthread_mutex_unlock(conn->mutex);
             }
 
             if (conn->last_packets_left_set == 0 || conn->last_packets_left_requested_set == 0) {
@@ -2655,7 +3672,7 @@ static void send_crypto_packets(Net_Crypto *c)
                 conn->packets_left_requested = CRYPTO_MIN_QUEUE_LENGTH;
                 conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
             } else {
-                if (((uint64_t)((1000.0 / conn->packet_send_rate) + 0.5) + conn->last_packets_left_set) <= temp_time) {
+                if (packets_left_refill_time(conn->packet_send_rate, conn->last_packets_left_set) <= temp_time) {
                     double n_packets = conn->packet_send_rate * (((double)(temp_time - conn->last_packets_left_set)) / 1000.0);
                     n_packets += conn->last_packets_left_rem;
 
@@ -2672,8 +3689,8 @@ static void send_crypto_packets(Net_Crypto *c)
                     conn->last_packets_left_rem = rem;
                 }
 
-                if (((uint64_t)((1000.0 / conn->packet_send_rate_requested) + 0.5) + conn->last_packets_left_requested_set) <=
-                        temp_time) {
+                if (packets_left_refill_time(conn->packet_send_rate_requested, conn->last_packets_left_requested_set)
+                        <= temp_time) {
                     double n_packets = conn->packet_send_rate_requested * (((double)(temp_time - conn->last_packets_left_requested_set)) /
                                        1000.0);
                     n_packets += conn->last_packets_left_requested_rem;
@@ -2691,9 +3708,12 @@ static void send_crypto_packets(Net_Crypto *c)
                 }
             }
 
-            int ret = send_requested_packets(c, i, conn->packets_left_requested);
+            const uint32_t paced = paced_packets(c, conn, temp_time);
+            int ret = send_requested_packets(c, i, min_u32(conn->packets_left_requested, paced));
+            conn->pacing_held_back = paced < conn->packets_left_requested && (ret == -1 || (uint32_t)ret == paced);
 
             if (ret != -1) {
+                pace_sent_packets(c, conn, temp_time, ret, false);
                 conn->packets_left_requested -= ret;
                 conn->packets_resent += ret;
 
@@ -2705,10 +3725,16 @@ static void send_crypto_packets(Net_Crypto *c)
                 }
             }
 
+            reserve_send_array(conn);
+
             if (conn->packet_send_rate > CRYPTO_PACKET_MIN_RATE * 1.5) {
                 total_send_rate += conn->packet_send_rate;
+                sched->send_rate = conn->packet_send_rate;
             }
         }
+
+        sched->next_run = connection_next_run(c, i, temp_time);
+        next_run = min_u64(next_run, sched->next_run);
     }
 
     c->current_sleep_time = -1;
@@ -2726,7 +3752,7 @@ static void send_crypto_packets(Net_Crypto *c)
         }
     }
 
-    sleep_time = CRYPTO_SEND_PACKET_INTERVAL;
+    sleep_time = next_run - temp_time;
 
     if (c->current_sleep_time > sleep_time) {
         c->current_sleep_time = sleep_time;
@@ -2752,7 +3778,14 @@ uint32_t crypto_num_free_sendqueue_slots(const Net_Crypto *c, int crypt_connecti
         return 0;
     }
 
-    uint32_t max_packets = CRYPTO_PACKET_BUFFER_SIZE - num_packets_array(&conn->send_array);
+    if (conn->send_array == nullptr) {
+        return min_u32(conn->packets_left, CRYPTO_PACKET_BUFFER_SIZE);
+    }
+
+    pthread_mutex_lock(conn->mutex);
+    const uint32_t size = on_net_crypto_thread(c) ? CRYPTO_PACKET_BUFFER_SIZE : conn->send_array->size;
+    uint32_t max_packets = size - num_packets_array(conn->send_array);
+    pthread_mutex_unlock(conn->mutex);
 
     if (conn->packets_left < max_packets) {
         return conn->packets_left;
@@ -2787,10 +3820,17 @@ int64_t write_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
         return -1;
     }
 
-    if (conn->status != CRYPTO_CONN_ESTABLISHED) {
+    Crypto_Conn_Schedule *sched = get_schedule(c, crypt_connection_id);
+
+    if (sched->status != CRYPTO_CONN_ESTABLISHED) {
         return -1;
     }
 
+    /* Queued packets and the send budget are send_crypto_packets()'s business
+     * again on its next run.
+     */
+    sched->next_run = 0;
+
     if (congestion_control && conn->packets_left == 0) {
         return -1;
     }
@@ -2828,12 +3868,12 @@ int cryptpacket_received(Net_Crypto *c, int crypt_connection_id, uint32_t packet
 {
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
-    if (conn == nullptr) {
+    if (conn == nullptr || conn->send_array == nullptr) {
         return -1;
     }
 
-    uint32_t num = num_packets_array(&conn->send_array);
-    uint32_t num1 = packet_number - conn->send_array.buffer_start;
+    uint32_t num = num_packets_array(conn->send_array);
+    uint32_t num1 = packet_number - conn->send_array->buffer_start;
 
     if (num >= num1) {
         return -1;
@@ -2867,10 +3907,10 @@ int send_lossy_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
 
     int ret = -1;
 
-    if (conn) {
+    if (conn != nullptr && conn->send_array != nullptr) {
         pthread_mutex_lock(conn->mutex);
-        uint32_t buffer_start = conn->recv_array.buffer_start;
-        uint32_t buffer_end = conn->send_array.buffer_end;
+        uint32_t buffer_start = conn->recv_array->buffer_start;
+        uint32_t buffer_end = conn->send_array->buffer_end;
         pthread_mutex_unlock(conn->mutex);
         ret = send_data_packet_helper(c, crypt_connection_id, buffer_start, buffer_end, data, length);
     }
@@ -2894,7 +3934,7 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id)
     int ret = -1;
 
     if (conn) {
-        if (conn->status == CRYPTO_CONN_ESTABLISHED) {
+        if (get_schedule(c, crypt_connection_id)->status == CRYPTO_CONN_ESTABLISHED) {
             send_kill_packet(c, crypt_connection_id);
         }
 
@@ -2905,8 +3945,15 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id)
         bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv4, crypt_connection_id);
         bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv6, crypt_connection_id);
         clear_temp_packet(c, crypt_connection_id);
-        clear_buffer(&conn->send_array);
-        clear_buffer(&conn->recv_array);
+
+        if (conn->send_array != nullptr) {
+            clear_buffer(c->packet_slab, conn->send_array);
+        }
+
+        if (conn->recv_array != nullptr) {
+            clear_buffer(c->packet_slab, conn->recv_array);
+        }
+
         ret = wipe_crypto_connection(c, crypt_connection_id);
     }
 
@@ -2943,6 +3990,24 @@ bool crypto_connection_status(const Net_Crypto *c, int crypt_connection_id, bool
     return true;
 }
 
+int crypto_connection_stats(const Net_Crypto *c, int crypt_connection_id, Crypto_Connection_Stats *stats)
+{
+    const Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
+    stats->rtt = conn->smoothed_rtt_time;
+    stats->send_rate = conn->packet_send_rate_average;
+    stats->recv_rate = conn->packet_recv_rate_average;
+    stats->send_rate_limit = conn->packet_send_rate;
+    stats->packets_resent = conn->total_packets_resent + conn->packets_resent;
+    stats->send_queue = conn->send_array != nullptr ? num_packets_array(conn->send_array) : 0;
+    crypto_connection_status(c, crypt_connection_id, &stats->direct_connected, nullptr);
+    return 0;
+}
+
 void new_keys(Net_Crypto *c)
 {
     crypto_new_keypair(c->self_public_key, c->self_secret_key);
@@ -2985,10 +4050,22 @@ Net_Crypto *new_net_crypto(const Logger *log, Mono_Time *mono_time, DHT *dht, TC
 
     temp->log = log;
     temp->mono_time = mono_time;
+    temp->thread = pthread_self();
+
+    const uint32_t packet_sizes[] = {
+        PACKET_DATA_SIZE(PACKET_SLAB_SMALL_DATA), PACKET_DATA_SIZE(PACKET_SLAB_MEDIUM_DATA), sizeof(Packet_Data)
+    };
+    temp->packet_slab = new_slab_allocator(packet_sizes, sizeof(packet_sizes) / sizeof(packet_sizes[0]));
+
+    if (temp->packet_slab == nullptr) {
+        free(temp);
+        return nullptr;
+    }
 
     temp->tcp_c = new_tcp_connections(mono_time, dht_get_self_secret_key(dht), proxy_info);
 
     if (temp->tcp_c == nullptr) {
+        kill_slab_allocator(temp->packet_slab);
         free(temp);
         return nullptr;
     }
@@ -2999,6 +4076,7 @@ Net_Crypto *new_net_crypto(const Logger *log, Mono_Time *mono_time, DHT *dht, TC
     if (create_recursive_mutex(&temp->tcp_mutex) != 0 ||
             pthread_mutex_init(&temp->connections_mutex, nullptr) != 0) {
         kill_tcp_connections(temp->tcp_c);
+        kill_slab_allocator(temp->packet_slab);
         free(temp);
         return nullptr;
     }
@@ -3009,11 +4087,13 @@ Net_Crypto *new_net_crypto(const Logger *log, Mono_Time *mono_time, DHT *dht, TC
     new_symmetric_key(temp->secret_symmetric_key);
 
     temp->current_sleep_time = CRYPTO_SEND_PACKET_INTERVAL;
+    pk_index_init(&temp->connections_index, &crypto_connection_pk, temp);
 
     networking_registerhandler(dht_get_net(dht), NET_PACKET_COOKIE_REQUEST, &udp_handle_cookie_request, temp);
     networking_registerhandler(dht_get_net(dht), NET_PACKET_COOKIE_RESPONSE, &udp_handle_packet, temp);
     networking_registerhandler(dht_get_net(dht), NET_PACKET_CRYPTO_HS, &udp_handle_packet, temp);
     networking_registerhandler(dht_get_net(dht), NET_PACKET_CRYPTO_DATA, &udp_handle_packet, temp);
+    networking_register_source_check(dht_get_net(dht), NET_PACKET_CRYPTO_DATA, &udp_data_from_connection, temp);
 
     bs_list_init(&temp->ip_port_list, sizeof(IP_Port), 8);
 
@@ -3023,15 +4103,11 @@ Net_Crypto *new_net_crypto(const Logger *log, Mono_Time *mono_time, DHT *dht, TC
 static void kill_timedout(Net_Crypto *c, void *userdata)
 {
     for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        Crypto_Connection *conn = get_crypto_connection(c, i);
-
-        if (conn == nullptr) {
-            continue;
-        }
+        const Crypto_Conn_Schedule *sched = &c->schedule[i];
 
-        if (conn->status == CRYPTO_CONN_COOKIE_REQUESTING || conn->status == CRYPTO_CONN_HANDSHAKE_SENT
-                || conn->status == CRYPTO_CONN_NOT_CONFIRMED) {
-            if (conn->temp_packet_num_sent < MAX_NUM_SENDPACKET_TRIES) {
+        if (sched->status == CRYPTO_CONN_COOKIE_REQUESTING || sched->status == CRYPTO_CONN_HANDSHAKE_SENT
+                || sched->status == CRYPTO_CONN_NOT_CONFIRMED) {
+            if (sched->temp_packet_num_sent < MAX_NUM_SENDPACKET_TRIES) {
                 continue;
             }
 
@@ -3040,7 +4116,7 @@ static void kill_timedout(Net_Crypto *c, void *userdata)
 
 #if 0
 
-        if (conn->status == CRYPTO_CONN_ESTABLISHED) {
+        if (sched->status == CRYPTO_CONN_ESTABLISHED) {
             // TODO(irungentoo): add a timeout here?
             do_timeout_here();
         }
@@ -3056,12 +4132,111 @@ uint32_t crypto_run_interval(const Net_Crypto *c)
     return c->current_sleep_time;
 }
 
+bool net_crypto_start_workers(Net_Crypto *c, uint16_t num_threads)
+{
+    if (c->workers != nullptr) {
+        return false;
+    }
+
+    c->send_batch = (Crypto_Batch *)calloc(1, sizeof(Crypto_Batch));
+    c->recv_batch = (Crypto_Batch *)calloc(1, sizeof(Crypto_Batch));
+    c->workers = new_crypto_workers(c->log, num_threads);
+
+    if (c->send_batch == nullptr || c->recv_batch == nullptr || c->workers == nullptr) {
+        kill_crypto_workers(c->workers);
+        free(c->recv_batch);
+        free(c->send_batch);
+        c->workers = nullptr;
+        c->recv_batch = nullptr;
+        c->send_batch = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+void net_crypto_set_congestion_control(Net_Crypto *c, Congestion_Control_Type type)
+{
+    c->congestion_control_type = type;
+}
+
+void net_crypto_set_send_pacing(Net_Crypto *c, bool send_pacing)
+{
+    c->send_pacing = send_pacing;
+}
+
+uint32_t net_crypto_packet_buffers_in_use(const Net_Crypto *c)
+{
+    return slab_allocator_in_use(c->packet_slab);
+}
+
+uint32_t net_crypto_packet_buffers_peak(const Net_Crypto *c)
+{
+    return slab_allocator_peak_in_use(c->packet_slab);
+}
+
+void do_net_crypto_send(Net_Crypto *c)
+{
+    if (c->workers == nullptr && !c->send_pacing) {
+        return;
+    }
+
+    const uint64_t temp_time = current_time_monotonic(c->mono_time);
+    networking_batch_start(dht_get_net(c->dht));
+
+    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
+        if (c->schedule[i].status != CRYPTO_CONN_ESTABLISHED) {
+            continue;
+        }
+
+        send_new_packets(c, i);
+
+        const Crypto_Connection *conn = get_crypto_connection(c, i);
+
+        /* Wake up in time for the packets the pacer held back. */
+        if (conn != nullptr && c->send_pacing && conn->has_new_packets) {
+            const uint64_t next_run = max_u64(pacing_next_run(conn), temp_time + 1);
+            c->current_sleep_time = min_u32(c->current_sleep_time, next_run - temp_time);
+        }
+    }
+
+    networking_batch_end(dht_get_net(c->dht));
+}
+
+/* Record the calling thread as the one running do_net_crypto(). */
+static void set_net_crypto_thread(Net_Crypto *c)
+{
+    if (!on_net_crypto_thread(c)) {
+        c->thread = pthread_self();
+    }
+}
+
 /* Main loop. */
 void do_net_crypto(Net_Crypto *c, void *userdata)
 {
+    set_net_crypto_thread(c);
+    networking_batch_start(dht_get_net(c->dht));
     kill_timedout(c, userdata);
     do_tcp(c, userdata);
     send_crypto_packets(c);
+    do_net_crypto_send(c);
+    networking_batch_end(dht_get_net(c->dht));
+}
+
+void do_net_crypto_tcp(Net_Crypto *c, void *userdata)
+{
+    networking_batch_start(dht_get_net(c->dht));
+    do_tcp(c, userdata);
+    networking_batch_end(dht_get_net(c->dht));
+}
+
+void do_net_crypto_connections(Net_Crypto *c, void *userdata)
+{
+    set_net_crypto_thread(c);
+    networking_batch_start(dht_get_net(c->dht));
+    kill_timedout(c, userdata);
+    send_crypto_packets(c);
+    networking_batch_end(dht_get_net(c->dht));
 }
 
 void kill_net_crypto(Net_Crypto *c)
@@ -3075,12 +4250,23 @@ void kill_net_crypto(Net_Crypto *c)
     pthread_mutex_destroy(&c->tcp_mutex);
     pthread_mutex_destroy(&c->connections_mutex);
 
+    if (c->workers != nullptr) {
+        kill_crypto_workers(c->workers);
+        crypto_memzero(c->recv_batch, sizeof(Crypto_Batch));
+        crypto_memzero(c->send_batch, sizeof(Crypto_Batch));
+        free(c->recv_batch);
+        free(c->send_batch);
+    }
+
     kill_tcp_connections(c->tcp_c);
+    kill_slab_allocator(c->packet_slab);
+    pk_index_free(&c->connections_index);
     bs_list_free(&c->ip_port_list);
     networking_registerhandler(dht_get_net(c->dht), NET_PACKET_COOKIE_REQUEST, nullptr, nullptr);
     networking_registerhandler(dht_get_net(c->dht), NET_PACKET_COOKIE_RESPONSE, nullptr, nullptr);
     networking_registerhandler(dht_get_net(c->dht), NET_PACKET_CRYPTO_HS, nullptr, nullptr);
     networking_registerhandler(dht_get_net(c->dht), NET_PACKET_CRYPTO_DATA, nullptr, nullptr);
+    networking_register_source_check(dht_get_net(c->dht), NET_PACKET_CRYPTO_DATA, nullptr, nullptr);
     crypto_memzero(c, sizeof(Net_Crypto));
     free(c);
 }
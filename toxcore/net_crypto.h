@@ -12,6 +12,7 @@
 #include "DHT.h"
 #include "LAN_discovery.h"
 #include "TCP_connection.h"
+#include "congestion_control.h"
 #include "logger.h"
 
 #include <pthread.h>
@@ -46,6 +47,7 @@
 #define PACKET_ID_PADDING 0 // Denotes padding
 #define PACKET_ID_REQUEST 1 // Used to request unreceived packets
 #define PACKET_ID_KILL    2 // Used to kill connection
+#define PACKET_ID_REQUEST_RANGES 3 // Used to request unreceived packets as ranges, see request_ranges.h
 
 #define PACKET_ID_ONLINE 24
 #define PACKET_ID_OFFLINE 25
@@ -71,10 +73,10 @@
 #define CRYPTO_PACKET_BUFFER_SIZE 32768 // Must be a power of 2
 
 /* Minimum packet rate per second. */
-#define CRYPTO_PACKET_MIN_RATE 4.0
+#define CRYPTO_PACKET_MIN_RATE CONGESTION_MIN_RATE
 
 /* Minimum packet queue max length. */
-#define CRYPTO_MIN_QUEUE_LENGTH 64
+#define CRYPTO_MIN_QUEUE_LENGTH CONGESTION_MIN_QUEUE_LENGTH
 
 /* Maximum total size of packets that net_crypto sends. */
 #define MAX_CRYPTO_PACKET_SIZE (uint16_t)1400
@@ -100,11 +102,6 @@
 /* All packets will be padded a number of bytes based on this number. */
 #define CRYPTO_MAX_PADDING 8
 
-/* Base current transfer speed on last CONGESTION_QUEUE_ARRAY_SIZE number of points taken
- * at the dT defined in net_crypto.c */
-#define CONGESTION_QUEUE_ARRAY_SIZE 12
-#define CONGESTION_LAST_SENT_ARRAY_SIZE (CONGESTION_QUEUE_ARRAY_SIZE * 2)
-
 /* Default connection ping in ms. */
 #define DEFAULT_PING_CONNECTION 1000
 #define DEFAULT_TCP_PING_CONNECTION 500
@@ -303,6 +300,24 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id);
 bool crypto_connection_status(const Net_Crypto *c, int crypt_connection_id, bool *direct_connected,
                               unsigned int *online_tcp_relays);
 
+typedef struct Crypto_Connection_Stats {
+    uint64_t rtt;            /* average round trip time in ms, 0 if not measured yet */
+    double send_rate;        /* average packets sent per second, resent ones included */
+    double recv_rate;        /* average packets received per second */
+    double send_rate_limit;  /* packets per second the congestion controller allows */
+    uint64_t packets_resent; /* since the connection was created */
+    uint32_t send_queue;     /* lossless packets sent or waiting, not acknowledged yet */
+    bool direct_connected;
+} Crypto_Connection_Stats;
+
+/* Fill stats with the transport statistics of the connection. Cheap enough to
+ * call for every connection every second.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int crypto_connection_stats(const Net_Crypto *c, int crypt_connection_id, Crypto_Connection_Stats *stats);
+
 /* Generate our public and private keys.
  *  Only call this function the first time the program starts.
  */
@@ -324,12 +339,58 @@ void load_secret_key(Net_Crypto *c, const uint8_t *sk);
 Net_Crypto *new_net_crypto(const Logger *log, Mono_Time *mono_time, DHT *dht, TCP_Proxy_Info *proxy_info);
 
 /* return the optimal interval in ms for running do_net_crypto.
+ *
+ * This is the time from the last run until the next handshake retry, request
+ * packet or send slot of any connection, at most CRYPTO_SEND_PACKET_INTERVAL.
  */
 uint32_t crypto_run_interval(const Net_Crypto *c);
 
 /* Main loop. */
 void do_net_crypto(Net_Crypto *c, void *userdata);
 
+/* The two halves of do_net_crypto(), for callers that schedule them
+ * separately. do_net_crypto_tcp() reads from the TCP relays and should run
+ * on every iteration. do_net_crypto_connections() resends handshakes, sends
+ * queued packets and kills timed out connections; it only needs to run
+ * crypto_run_interval() ms after its last run, or after packets arrived.
+ */
+void do_net_crypto_tcp(Net_Crypto *c, void *userdata);
+void do_net_crypto_connections(Net_Crypto *c, void *userdata);
+
+/* Start num_threads threads that encrypt and decrypt data packets in parallel
+ * batches, at most MAX_CRYPTO_WORKER_THREADS.
+ *
+ * Received data packets are then queued and decrypted together by
+ * do_net_crypto_tcp(). Lossless packets written with write_cryptpacket() are
+ * queued until do_net_crypto_send() encrypts and sends them together. The
+ * order and nonces of the packets on the wire stay the same.
+ *
+ * return true on success.
+ */
+bool net_crypto_start_workers(Net_Crypto *c, uint16_t num_threads);
+
+/* Send the lossless packets queued by write_cryptpacket() since the last call,
+ * as many as send pacing lets go. Does nothing if net_crypto_start_workers()
+ * wasn't called and send pacing is off. Part of do_net_crypto().
+ */
+void do_net_crypto_send(Net_Crypto *c);
+
+/* Set the congestion controller of connections created from now on. */
+void net_crypto_set_congestion_control(Net_Crypto *c, Congestion_Control_Type type);
+
+/* Spread the packets of each connection evenly over time at a little more than
+ * its send rate instead of sending them in bursts. Lossless packets the pacer
+ * holds back wait in the send queue for do_net_crypto_send(), and
+ * crypto_run_interval() gets short enough to send them in time.
+ */
+void net_crypto_set_send_pacing(Net_Crypto *c, bool send_pacing);
+
+/* Number of lossless packets held in the send and receive buffers of all
+ * connections, and the most that ever were at the same time.
+ */
+uint32_t net_crypto_packet_buffers_in_use(const Net_Crypto *c);
+uint32_t net_crypto_packet_buffers_peak(const Net_Crypto *c);
+
 void kill_net_crypto(Net_Crypto *c);
 
 
@@ -0,0 +1,492 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Minimal io_uring wrapper used by the networking code. Talks to the kernel
+ * through the raw system calls so that no liburing is needed.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+// For POLLRDHUP.
+#if defined(NETWORK_USE_IO_URING) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "net_uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccompat.h"
+
+#ifdef NETWORK_USE_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* user_data of requests whose completions are consumed internally. */
+#define NET_URING_INTERNAL UINT64_MAX
+
+/* Buffer group used for the provided receive buffers. */
+#define NET_URING_BUFFER_GROUP 0
+
+struct Net_Uring {
+    int fd;
+
+    void *ring_mem;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t to_submit;
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    struct io_uring_cqe *cqes;
+    uint32_t cq_mask;
+
+    uint8_t *buffers;
+    uint32_t buffer_size;
+    uint16_t buffer_count;
+
+    /* Template for multishot recvmsg: only the name and control lengths are used. */
+    struct msghdr recv_msg;
+};
+
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int sys_io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+Net_Uring *net_uring_new(uint32_t entries)
+{
+    Net_Uring *ring = (Net_Uring *)calloc(1, sizeof(Net_Uring));
+
+    if (ring == nullptr) {
+        return nullptr;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    /* Multishot requests can post many completions per submission. */
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 8;
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+
+    if (ring->fd < 0) {
+        free(ring);
+        return nullptr;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        close(ring->fd);
+        free(ring);
+        return nullptr;
+    }
+
+    const size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    const size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->ring_mem = mmap(nullptr, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                          IORING_OFF_SQ_RING);
+
+    if (ring->ring_mem == MAP_FAILED) {
+        close(ring->fd);
+        free(ring);
+        return nullptr;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->ring_mem, ring->ring_size);
+        close(ring->fd);
+        free(ring);
+        return nullptr;
+    }
+
+    uint8_t *const mem = (uint8_t *)ring->ring_mem;
+    ring->sq_head = (uint32_t *)(mem + params.sq_off.head);
+    ring->sq_tail = (uint32_t *)(mem + params.sq_off.tail);
+    ring->sq_array = (uint32_t *)(mem + params.sq_off.array);
+    ring->sq_mask = *(uint32_t *)(mem + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (uint32_t *)(mem + params.cq_off.head);
+    ring->cq_tail = (uint32_t *)(mem + params.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe *)(mem + params.cq_off.cqes);
+    ring->cq_mask = *(uint32_t *)(mem + params.cq_off.ring_mask);
+
+    ring->recv_msg.msg_namelen = sizeof(struct sockaddr_storage);
+
+    return ring;
+}
+
+void net_uring_kill(Net_Uring *ring)
+{
+    if (ring == nullptr) {
+        return;
+    }
+
+    /* Closing the ring cancels everything still in flight. */
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_mem, ring->ring_size);
+    close(ring->fd);
+    free(ring->buffers);
+    free(ring);
+}
+
+bool net_uring_submit(Net_Uring *ring)
+{
+    while (true) {
+        const int ret = sys_io_uring_enter(ring->fd, ring->to_submit, 0, IORING_ENTER_GETEVENTS);
+
+        if (ret >= 0) {
+            ring->to_submit -= (uint32_t)ret < ring->to_submit ? (uint32_t)ret : ring->to_submit;
+            return true;
+        }
+
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+/* return a zeroed submission queue entry, or NULL if the queue stays full. */
+static struct io_uring_sqe *get_sqe(Net_Uring *ring)
+{
+    uint32_t tail = *ring->sq_tail;
+
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (!net_uring_submit(ring)) {
+            return nullptr;
+        }
+
+        if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            return nullptr;
+        }
+    }
+
+    const uint32_t index = tail & ring->sq_mask;
+    struct io_uring_sqe *const sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+/* Make the entry returned by the last get_sqe visible to the kernel. */
+static void push_sqe(Net_Uring *ring)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ++ring->to_submit;
+}
+
+static bool provide_buffers(Net_Uring *ring, uint16_t first_id, uint16_t count)
+{
+    struct io_uring_sqe *const sqe = get_sqe(ring);
+
+    if (sqe == nullptr) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)(uintptr_t)(ring->buffers + (size_t)first_id * ring->buffer_size);
+    sqe->len = ring->buffer_size;
+    sqe->off = first_id;
+    sqe->buf_group = NET_URING_BUFFER_GROUP;
+    sqe->user_data = NET_URING_INTERNAL;
+    push_sqe(ring);
+    return true;
+}
+
+bool net_uring_add_buffers(Net_Uring *ring, uint16_t count, uint32_t size)
+{
+    if (ring->buffers != nullptr || count == 0) {
+        return false;
+    }
+
+    /* Each buffer starts with the recvmsg header and the source address. */
+    const uint32_t buffer_size = sizeof(struct io_uring_recvmsg_out) + ring->recv_msg.msg_namelen + size;
+    ring->buffers = (uint8_t *)malloc((size_t)count * buffer_size);
+
+    if (ring->buffers == nullptr) {
+        return false;
+    }
+
+    ring->buffer_size = buffer_size;
+    ring->buffer_count = count;
+    return provide_buffers(ring, 0, count);
+}
+
+bool net_uring_return_buffer(Net_Uring *ring, uint16_t buffer_id)
+{
+    if (buffer_id >= ring->buffer_count) {
+        return false;
+    }
+
+    return provide_buffers(ring, buffer_id, 1);
+}
+
+bool net_uring_recvmsg_multishot(Net_Uring *ring, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *const sqe = get_sqe(ring);
+
+    if (sqe == nullptr || ring->buffers == nullptr) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&ring->recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = NET_URING_BUFFER_GROUP;
+    sqe->user_data = user_data;
+    push_sqe(ring);
+    return true;
+}
+
+int net_uring_recvmsg_payload(const Net_Uring *ring, const Net_Uring_Event *event, const void **name,
+                              uint32_t *name_length, const uint8_t **payload)
+{
+    if (!event->has_buffer || event->res < 0 || event->buffer_id >= ring->buffer_count) {
+        return -1;
+    }
+
+    const uint8_t *const buffer = ring->buffers + (size_t)event->buffer_id * ring->buffer_size;
+    const size_t header_size = sizeof(struct io_uring_recvmsg_out) + ring->recv_msg.msg_namelen
+                               + ring->recv_msg.msg_controllen;
+
+    if ((size_t)event->res < header_size || (size_t)event->res > ring->buffer_size) {
+        return -1;
+    }
+
+    struct io_uring_recvmsg_out out;
+    memcpy(&out, buffer, sizeof(out));
+
+    if ((out.flags & MSG_TRUNC) || out.namelen > ring->recv_msg.msg_namelen) {
+        return -1;
+    }
+
+    *name = buffer + sizeof(struct io_uring_recvmsg_out);
+    *name_length = out.namelen;
+    *payload = buffer + header_size;
+    return (int)((size_t)event->res - header_size);
+}
+
+bool net_uring_accept_multishot(Net_Uring *ring, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *const sqe = get_sqe(ring);
+
+    if (sqe == nullptr) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+    push_sqe(ring);
+    return true;
+}
+
+bool net_uring_poll_multishot(Net_Uring *ring, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *const sqe = get_sqe(ring);
+
+    if (sqe == nullptr) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN | POLLRDHUP;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+    push_sqe(ring);
+    return true;
+}
+
+bool net_uring_poll_update(Net_Uring *ring, uint64_t old_user_data, uint64_t new_user_data)
+{
+    struct io_uring_sqe *const sqe = get_sqe(ring);
+
+    if (sqe == nullptr) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = old_user_data;
+    sqe->off = new_user_data;
+    sqe->len = IORING_POLL_UPDATE_USER_DATA;
+    sqe->user_data = NET_URING_INTERNAL;
+    push_sqe(ring);
+    return true;
+}
+
+bool net_uring_cancel_fd(Net_Uring *ring, int fd)
+{
+    /* Wait for the cancellation so that the socket is really gone once the
+     * caller closes it, and a new socket can bind to the same port.
+     */
+    struct io_uring_sync_cancel_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.fd = fd;
+    reg.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    reg.timeout.tv_sec = -1;
+    reg.timeout.tv_nsec = -1;
+
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1) == 0 || errno == ENOENT) {
+        return true;
+    }
+
+    struct io_uring_sqe *const sqe = get_sqe(ring);
+
+    if (sqe == nullptr) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = NET_URING_INTERNAL;
+    push_sqe(ring);
+
+    /* The descriptor is looked up at submission, so submit before it is closed. */
+    return net_uring_submit(ring);
+}
+
+bool net_uring_next_event(Net_Uring *ring, Net_Uring_Event *event)
+{
+    uint32_t head = *ring->cq_head;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *const cqe = &ring->cqes[head & ring->cq_mask];
+        event->user_data = cqe->user_data;
+        event->res = cqe->res;
+        event->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        event->has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+        event->buffer_id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+        ++head;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (event->user_data != NET_URING_INTERNAL) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool net_uring_poll_readable(int32_t res)
+{
+    return res >= 0 && (res & POLLIN);
+}
+
+bool net_uring_poll_hangup(int32_t res)
+{
+    return res < 0 || (res & (POLLERR | POLLHUP | POLLRDHUP));
+}
+
+#else
+
+Net_Uring *net_uring_new(uint32_t entries)
+{
+    return nullptr;
+}
+
+void net_uring_kill(Net_Uring *ring)
+{
+}
+
+bool net_uring_add_buffers(Net_Uring *ring, uint16_t count, uint32_t size)
+{
+    return false;
+}
+
+bool net_uring_return_buffer(Net_Uring *ring, uint16_t buffer_id)
+{
+    return false;
+}
+
+bool net_uring_recvmsg_multishot(Net_Uring *ring, int fd, uint64_t user_data)
+{
+    return false;
+}
+
+int net_uring_recvmsg_payload(const Net_Uring *ring, const Net_Uring_Event *event, const void **name,
+                              uint32_t *name_length, const uint8_t **payload)
+{
+    return -1;
+}
+
+bool net_uring_accept_multishot(Net_Uring *ring, int fd, uint64_t user_data)
+{
+    return false;
+}
+
+bool net_uring_poll_multishot(Net_Uring *ring, int fd, uint64_t user_data)
+{
+    return false;
+}
+
+bool net_uring_poll_update(Net_Uring *ring, uint64_t old_user_data, uint64_t new_user_data)
+{
+    return false;
+}
+
+bool net_uring_cancel_fd(Net_Uring *ring, int fd)
+{
+    return false;
+}
+
+bool net_uring_submit(Net_Uring *ring)
+{
+    return false;
+}
+
+bool net_uring_next_event(Net_Uring *ring, Net_Uring_Event *event)
+{
+    return false;
+}
+
+bool net_uring_poll_readable(int32_t res)
+{
+    return false;
+}
+
+bool net_uring_poll_hangup(int32_t res)
+{
+    return true;
+}
+
+#endif /* NETWORK_USE_IO_URING */
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Minimal io_uring wrapper used by the networking code.
+ *
+ * Supports multishot receives on datagram sockets (into a pool of provided
+ * buffers), multishot accepts on listening sockets and multishot readiness
+ * polls on stream sockets. When built without NETWORK_USE_IO_URING, or when
+ * the kernel refuses to set up a ring, net_uring_new returns NULL and callers
+ * keep using their poll/epoll paths.
+ */
+#ifndef C_TOXCORE_TOXCORE_NET_URING_H
+#define C_TOXCORE_TOXCORE_NET_URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Net_Uring Net_Uring;
+
+typedef struct Net_Uring_Event {
+    uint64_t user_data;
+    /* Result of the operation: bytes received, accepted socket, poll mask or -errno. */
+    int32_t res;
+    /* True if the multishot request that produced this event is still armed. */
+    bool more;
+    /* True if the event consumed a provided buffer, identified by buffer_id. */
+    bool has_buffer;
+    uint16_t buffer_id;
+} Net_Uring_Event;
+
+/* Set up a ring with room for `entries` submissions.
+ *
+ * return NULL if io_uring is unavailable.
+ */
+Net_Uring *net_uring_new(uint32_t entries);
+
+void net_uring_kill(Net_Uring *ring);
+
+/* Allocate `count` receive buffers for datagrams of up to `size` bytes and
+ * hand them to the kernel. Must be called before net_uring_recvmsg_multishot.
+ *
+ * return true on success.
+ */
+bool net_uring_add_buffers(Net_Uring *ring, uint16_t count, uint32_t size);
+
+/* Give a buffer returned in an event back to the kernel.
+ *
+ * return true on success.
+ */
+bool net_uring_return_buffer(Net_Uring *ring, uint16_t buffer_id);
+
+/* Post a multishot recvmsg on fd. Every datagram produces one event holding a
+ * provided buffer, to be decoded with net_uring_recvmsg_payload.
+ *
+ * return true on success.
+ */
+bool net_uring_recvmsg_multishot(Net_Uring *ring, int fd, uint64_t user_data);
+
+/* Decode a datagram received by a multishot recvmsg.
+ *
+ * The source address (a struct sockaddr) is put in name and name_length, the
+ * datagram in payload.
+ *
+ * return length of the payload on success.
+ * return -1 if the event holds no valid datagram.
+ */
+int net_uring_recvmsg_payload(const Net_Uring *ring, const Net_Uring_Event *event, const void **name,
+                              uint32_t *name_length, const uint8_t **payload);
+
+/* Post a multishot accept on listening socket fd. Every accepted connection
+ * produces one event with the new socket in res.
+ *
+ * return true on success.
+ */
+bool net_uring_accept_multishot(Net_Uring *ring, int fd, uint64_t user_data);
+
+/* Post a multishot poll for readability and hang-ups on fd. Every wakeup
+ * produces one event with the poll mask in res.
+ *
+ * return true on success.
+ */
+bool net_uring_poll_multishot(Net_Uring *ring, int fd, uint64_t user_data);
+
+/* Change the user data reported by a multishot poll posted with old_user_data.
+ *
+ * return true on success.
+ */
+bool net_uring_poll_update(Net_Uring *ring, uint64_t old_user_data, uint64_t new_user_data);
+
+/* Cancel all requests on fd. The ring holds a reference to the sockets it
+ * watches, so this must be called before the socket is closed.
+ *
+ * return true on success.
+ */
+bool net_uring_cancel_fd(Net_Uring *ring, int fd);
+
+/* Submit queued requests and run pending completions in one system call.
+ *
+ * return true on success.
+ */
+bool net_uring_submit(Net_Uring *ring);
+
+/* Take the next completion off the ring.
+ *
+ * return true if an event was put in event.
+ * return false if there are no more events.
+ */
+bool net_uring_next_event(Net_Uring *ring, Net_Uring_Event *event);
+
+/* return true if a poll event mask reports data to read. */
+bool net_uring_poll_readable(int32_t res);
+
+/* return true if a poll event mask reports an error or a hang-up. */
+bool net_uring_poll_hangup(int32_t res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_TOXCORE_TOXCORE_NET_URING_H
@@ -24,6 +24,11 @@
 #define _XOPEN_SOURCE 700
 #endif
 
+// For recvmmsg/sendmmsg on Linux.
+#if defined(NETWORK_USE_MMSG) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #if defined(_WIN32) && _WIN32_WINNT >= _WIN32_WINNT_WINXP
 #undef _WIN32_WINNT
 #define _WIN32_WINNT  0x501
@@ -57,6 +62,7 @@
 #endif
 
 #include "network.h"
+#include "net_uring.h"
 
 #ifdef __APPLE__
 #include <mach/clock.h>
@@ -175,12 +181,14 @@ static int inet_pton6(const char *addrString, struct in6_addr *addrbuf)
 #endif
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "logger.h"
 #include "mono_time.h"
+#include "rate_limit.h"
 #include "util.h"
 
 // Disable MSG_NOSIGNAL on systems not supporting it, e.g. Windows, FreeBSD
@@ -412,6 +420,16 @@ bool set_socket_reuseaddr(Socket sock)
     return setsockopt(sock.socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&set, sizeof(set)) == 0;
 }
 
+bool set_socket_reuseport(Socket sock)
+{
+#ifdef SO_REUSEPORT
+    int set = 1;
+    return setsockopt(sock.socket, SOL_SOCKET, SO_REUSEPORT, (const char *)&set, sizeof(set)) == 0;
+#else
+    return false;
+#endif
+}
+
 bool set_socket_dualstack(Socket sock)
 {
     int ipv6only = 0;
@@ -477,8 +495,37 @@ static void loglogdata(const Logger *log, const char *message, const uint8_t *bu
 typedef struct Packet_Handler {
     packet_handler_cb *function;
     void *object;
+    packet_source_cb *source_check;
+    void *source_object;
 } Packet_Handler;
 
+#ifdef NETWORK_USE_MMSG
+/* Reusable buffers for recvmmsg/sendmmsg. Allocated once per UDP socket, so
+ * polling and flushing never touch the heap.
+ */
+typedef struct Net_Batch {
+    struct mmsghdr recv_msgs[NET_BATCH_SIZE];
+    struct iovec recv_iovs[NET_BATCH_SIZE];
+    struct sockaddr_storage recv_addrs[NET_BATCH_SIZE];
+    /* Source of each received packet, unspecified for packets to skip. */
+    IP_Port recv_ip_ports[NET_BATCH_SIZE];
+    uint8_t recv_data[NET_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+
+    pthread_mutex_t send_mutex;
+    struct mmsghdr send_msgs[NET_BATCH_SIZE];
+    struct iovec send_iovs[NET_BATCH_SIZE];
+    struct sockaddr_storage send_addrs[NET_BATCH_SIZE];
+    IP_Port send_ip_ports[NET_BATCH_SIZE];
+    uint8_t send_data[NET_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+    uint32_t send_count;
+    /* A flush failed to send some packets, so the rest of the batch is sent
+     * right away to report failures to the callers. */
+    bool send_failed;
+    /* Nesting depth of networking_batch_start/networking_batch_end. */
+    uint32_t depth;
+} Net_Batch;
+#endif
+
 struct Networking_Core {
     const Logger *log;
     Packet_Handler packethandlers[256];
@@ -487,6 +534,21 @@ struct Networking_Core {
     uint16_t port;
     /* Our UDP socket. */
     Socket sock;
+
+    bool batch_io;
+#ifdef NETWORK_USE_MMSG
+    Net_Batch *batch;
+#endif
+    /* Non-NULL if packets are received through io_uring. */
+    Net_Uring *uring;
+    /* Not owned, NULL if packets are not rate limited. */
+    Rate_Limit *rate_limit;
+
+    /* Packets handled in this networking_poll call, out of poll_budget. */
+    uint32_t poll_budget;
+    uint32_t poll_used;
+    uint64_t class_handled[NET_CLASS_MAX];
+    uint64_t class_dropped[NET_CLASS_MAX];
 };
 
 Family net_family(const Networking_Core *net)
@@ -499,10 +561,14 @@ uint16_t net_port(const Networking_Core *net)
     return net->port;
 }
 
-/* Basic network functions:
- * Function to send packet(data) of length length to ip_port.
+/* Convert ip_port into a socket address that can be passed to sendto on a
+ * socket of our family.
+ *
+ * return 0 on success.
+ * return -1 on failure.
  */
-int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint16_t length)
+static int make_send_addr(const Networking_Core *net, IP_Port ip_port, struct sockaddr_storage *addr,
+                          size_t *addrsize)
 {
     if (net_family_is_unspec(net->family)) { /* Socket not initialized */
         // LOGGER_ERROR(net->log, "attempted to send message of length %u on uninitialised socket", (unsigned)length);
@@ -531,21 +597,17 @@ int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint1
         ip_port.ip.ip.v6 = ip6;
     }
 
-    struct sockaddr_storage addr;
-
-    size_t addrsize;
-
     if (net_family_is_ipv4(ip_port.ip.family)) {
-        struct sockaddr_in *const addr4 = (struct sockaddr_in *)&addr;
+        struct sockaddr_in *const addr4 = (struct sockaddr_in *)addr;
 
-        addrsize = sizeof(struct sockaddr_in);
+        *addrsize = sizeof(struct sockaddr_in);
         addr4->sin_family = AF_INET;
         addr4->sin_port = ip_port.port;
         fill_addr4(ip_port.ip.ip.v4, &addr4->sin_addr);
     } else if (net_family_is_ipv6(ip_port.ip.family)) {
-        struct sockaddr_in6 *const addr6 = (struct sockaddr_in6 *)&addr;
+        struct sockaddr_in6 *const addr6 = (struct sockaddr_in6 *)addr;
 
-        addrsize = sizeof(struct sockaddr_in6);
+        *addrsize = sizeof(struct sockaddr_in6);
         addr6->sin6_family = AF_INET6;
         addr6->sin6_port = ip_port.port;
         fill_addr6(ip_port.ip.ip.v6, &addr6->sin6_addr);
@@ -557,6 +619,21 @@ int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint1
         return -1;
     }
 
+    return 0;
+}
+
+/* Basic network functions:
+ * Function to send packet(data) of length length to ip_port.
+ */
+int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint16_t length)
+{
+    struct sockaddr_storage addr;
+    size_t addrsize;
+
+    if (make_send_addr(net, ip_port, &addr, &addrsize) == -1) {
+        return -1;
+    }
+
     const int res = sendto(net->sock.socket, (const char *)data, length, 0, (struct sockaddr *)&addr, addrsize);
 
     loglogdata(net->log, "O=>", data, length, ip_port, res);
@@ -564,39 +641,132 @@ int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint1
     return res;
 }
 
-/* Function to receive data
- *  ip and port of sender is put into ip_port.
- *  Packet data is put into data.
- *  Packet length is put into length.
+#ifdef NETWORK_USE_MMSG
+/* Send all queued packets. The caller must hold batch->send_mutex.
  */
-static int receivepacket(const Logger *log, Socket sock, IP_Port *ip_port, uint8_t *data, uint32_t *length)
+static void flush_send_queue(Networking_Core *net)
 {
-    memset(ip_port, 0, sizeof(IP_Port));
+    Net_Batch *const batch = net->batch;
+    uint32_t sent = 0;
+
+    while (sent < batch->send_count) {
+        const int res = sendmmsg(net->sock.socket, &batch->send_msgs[sent], batch->send_count - sent, 0);
+
+        if (res <= 0) {
+            /* The first packet failed, the ones after it may still go out. */
+            batch->send_failed = true;
+            loglogdata(net->log, "O=>", batch->send_data[sent], batch->send_iovs[sent].iov_len,
+                       batch->send_ip_ports[sent], -1);
+            ++sent;
+            continue;
+        }
+
+        for (uint32_t i = sent; i < sent + (uint32_t)res; ++i) {
+            loglogdata(net->log, "O=>", batch->send_data[i], batch->send_iovs[i].iov_len,
+                       batch->send_ip_ports[i], batch->send_msgs[i].msg_len);
+        }
+
+        sent += res;
+    }
+
+    batch->send_count = 0;
+}
+#endif
+
+int sendpacket_batch(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint16_t length)
+{
+#ifdef NETWORK_USE_MMSG
+    Net_Batch *const batch = net->batch;
+
+    if (!net->batch_io || batch == nullptr || length > MAX_UDP_PACKET_SIZE) {
+        return sendpacket(net, ip_port, data, length);
+    }
+
     struct sockaddr_storage addr;
-#ifdef OS_WIN32
-    int addrlen = sizeof(addr);
+    size_t addrsize;
+
+    if (make_send_addr(net, ip_port, &addr, &addrsize) == -1) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&batch->send_mutex);
+
+    if (batch->send_count == NET_BATCH_SIZE) {
+        flush_send_queue(net);
+    }
+
+    if (batch->depth == 0 || batch->send_failed) {
+        /* Nobody is going to flush the queue, or the socket is full and the
+         * caller has to know whether this packet went out. */
+        pthread_mutex_unlock(&batch->send_mutex);
+        return sendpacket(net, ip_port, data, length);
+    }
+
+    const uint32_t i = batch->send_count;
+    memcpy(batch->send_data[i], data, length);
+    memcpy(&batch->send_addrs[i], &addr, addrsize);
+    batch->send_ip_ports[i] = ip_port;
+    batch->send_iovs[i].iov_len = length;
+    batch->send_msgs[i].msg_hdr.msg_namelen = addrsize;
+    ++batch->send_count;
+
+    pthread_mutex_unlock(&batch->send_mutex);
+
+    return length;
 #else
-    socklen_t addrlen = sizeof(addr);
+    return sendpacket(net, ip_port, data, length);
 #endif
-    *length = 0;
-    int fail_or_len = recvfrom(sock.socket, (char *) data, MAX_UDP_PACKET_SIZE, 0, (struct sockaddr *)&addr, &addrlen);
+}
 
-    if (fail_or_len < 0) {
-        int error = net_error();
+void networking_batch_start(Networking_Core *net)
+{
+#ifdef NETWORK_USE_MMSG
 
-        if (fail_or_len < 0 && error != TOX_EWOULDBLOCK) {
-            const char *strerror = net_new_strerror(error);
-            LOGGER_ERROR(log, "Unexpected error reading from socket: %u, %s", error, strerror);
-            net_kill_strerror(strerror);
-        }
+    if (net->batch == nullptr) {
+        return;
+    }
 
-        return -1; /* Nothing received. */
+    pthread_mutex_lock(&net->batch->send_mutex);
+    ++net->batch->depth;
+    pthread_mutex_unlock(&net->batch->send_mutex);
+#endif
+}
+
+void networking_batch_end(Networking_Core *net)
+{
+#ifdef NETWORK_USE_MMSG
+
+    if (net->batch == nullptr) {
+        return;
     }
 
-    *length = (uint32_t)fail_or_len;
+    pthread_mutex_lock(&net->batch->send_mutex);
+    assert(net->batch->depth > 0);
+    --net->batch->depth;
+
+    if (net->batch->depth == 0) {
+        flush_send_queue(net);
+        net->batch->send_failed = false;
+    }
+
+    pthread_mutex_unlock(&net->batch->send_mutex);
+#endif
+}
+
+void networking_set_batch_io(Networking_Core *net, bool enabled)
+{
+    net->batch_io = enabled;
+}
 
-    if (addr.ss_family == AF_INET) {
-        struct sockaddr_in *addr_in = (struct sockaddr_in *)&addr;
+/* Convert the source address of a received packet into ip_port.
+ *
+ * return 0 on success.
+ * return -1 on failure.
+ */
+static int make_recv_ip_port(const struct sockaddr_storage *addr, IP_Port *ip_port)
+{
+    if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *addr_in = (const struct sockaddr_in *)addr;
 
         const Family *const family = make_tox_family(addr_in->sin_family);
         assert(family != nullptr);
@@ -608,8 +778,8 @@ static int receivepacket(const Logger *log, Socket sock, IP_Port *ip_port, uint8
         ip_port->ip.family = *family;
         get_ip4(&ip_port->ip.ip.v4, &addr_in->sin_addr);
         ip_port->port = addr_in->sin_port;
-    } else if (addr.ss_family == AF_INET6) {
-        struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)&addr;
+    } else if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *addr_in6 = (const struct sockaddr_in6 *)addr;
         const Family *const family = make_tox_family(addr_in6->sin6_family);
         assert(family != nullptr);
 
@@ -629,6 +799,50 @@ static int receivepacket(const Logger *log, Socket sock, IP_Port *ip_port, uint8
         return -1;
     }
 
+    return 0;
+}
+
+/* Log a receive error, unless it is just the socket running dry.
+ */
+static void log_recv_error(const Logger *log)
+{
+    const int error = net_error();
+
+    if (error != TOX_EWOULDBLOCK) {
+        const char *strerror = net_new_strerror(error);
+        LOGGER_ERROR(log, "Unexpected error reading from socket: %u, %s", error, strerror);
+        net_kill_strerror(strerror);
+    }
+}
+
+/* Function to receive data
+ *  ip and port of sender is put into ip_port.
+ *  Packet data is put into data.
+ *  Packet length is put into length.
+ */
+static int receivepacket(const Logger *log, Socket sock, IP_Port *ip_port, uint8_t *data, uint32_t *length)
+{
+    memset(ip_port, 0, sizeof(IP_Port));
+    struct sockaddr_storage addr;
+#ifdef OS_WIN32
+    int addrlen = sizeof(addr);
+#else
+    socklen_t addrlen = sizeof(addr);
+#endif
+    *length = 0;
+    int fail_or_len = recvfrom(sock.socket, (char *) data, MAX_UDP_PACKET_SIZE, 0, (struct sockaddr *)&addr, &addrlen);
+
+    if (fail_or_len < 0) {
+        log_recv_error(log);
+        return -1; /* Nothing received. */
+    }
+
+    *length = (uint32_t)fail_or_len;
+
+    if (make_recv_ip_port(&addr, ip_port) == -1) {
+        return -1;
+    }
+
     loglogdata(log, "=>O", data, MAX_UDP_PACKET_SIZE, *ip_port, *length);
 
     return 0;
@@ -640,6 +854,275 @@ void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handl
     net->packethandlers[byte].object = object;
 }
 
+void networking_register_source_check(Networking_Core *net, uint8_t byte, packet_source_cb *cb, void *object)
+{
+    net->packethandlers[byte].source_check = cb;
+    net->packethandlers[byte].source_object = object;
+}
+
+static void dispatch_packet(const Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint32_t length,
+                            void *userdata)
+{
+    if (length < 1) {
+        return;
+    }
+
+    const Packet_Handler *const handler = &net->packethandlers[data[0]];
+
+    if (!handler->function) {
+        LOGGER_WARNING(net->log, "[%02u] -- Packet has no handler", data[0]);
+        return;
+    }
+
+    handler->function(handler->object, ip_port, data, length, userdata);
+}
+
+void networking_handle_packet(const Networking_Core *net, IP_Port source, const uint8_t *packet, uint16_t length,
+                              void *userdata)
+{
+    dispatch_packet(net, source, packet, length, userdata);
+}
+
+void networking_set_rate_limit(Networking_Core *net, Rate_Limit *rate_limit)
+{
+    net->rate_limit = rate_limit;
+}
+
+Rate_Limit *networking_get_rate_limit(const Networking_Core *net)
+{
+    return net->rate_limit;
+}
+
+Net_Packet_Class net_packet_class(uint8_t packet_id)
+{
+    switch (packet_id) {
+        case NET_PACKET_CRYPTO_DATA:
+        case NET_PACKET_GC_LOSSLESS:
+        case NET_PACKET_GC_LOSSY:
+            return NET_CLASS_CRYPTO_DATA;
+
+        case NET_PACKET_COOKIE_REQUEST:
+        case NET_PACKET_COOKIE_RESPONSE:
+        case NET_PACKET_CRYPTO_HS:
+        case NET_PACKET_GC_HANDSHAKE:
+            return NET_CLASS_HANDSHAKE;
+
+        default:
+            return NET_CLASS_DHT;
+    }
+}
+
+void networking_set_poll_budget(Networking_Core *net, uint32_t budget)
+{
+    net->poll_budget = budget;
+}
+
+uint64_t networking_class_handled(const Networking_Core *net, Net_Packet_Class packet_class)
+{
+    return net->class_handled[packet_class];
+}
+
+uint64_t networking_class_dropped(const Networking_Core *net, Net_Packet_Class packet_class)
+{
+    return net->class_dropped[packet_class];
+}
+
+/* return true if the crypto data packet comes from an established connection
+ * according to the source check registered for its packet ID.
+ */
+static bool from_established_connection(const Networking_Core *net, const IP_Port *ip_port, const uint8_t *data,
+                                        uint32_t length)
+{
+    const Packet_Handler *const handler = &net->packethandlers[data[0]];
+
+    if (handler->source_check == nullptr) {
+        return false;
+    }
+
+    return handler->source_check(handler->source_object, ip_port, data, (uint16_t)length);
+}
+
+/* Dispatch a packet that just arrived on the socket, unless its source is
+ * over the rate limit for its packet ID, or the poll budget is spent and the
+ * packet is not crypto data from an established connection.
+ */
+static void handle_received(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint32_t length,
+                            void *userdata)
+{
+    if (length < 1) {
+        return;
+    }
+
+    if (net->rate_limit != nullptr && !rate_limit_allow(net->rate_limit, &ip_port.ip, data[0])) {
+        return;
+    }
+
+    const Net_Packet_Class packet_class = net_packet_class(data[0]);
+
+    if (net->poll_budget != 0 && net->poll_used >= net->poll_budget
+            && !(packet_class == NET_CLASS_CRYPTO_DATA && from_established_connection(net, &ip_port, data, length))) {
+        ++net->class_dropped[packet_class];
+        return;
+    }
+
+    ++net->poll_used;
+    ++net->class_handled[packet_class];
+    dispatch_packet(net, ip_port, data, length, userdata);
+}
+
+#ifdef NETWORK_USE_MMSG
+/* Drain the socket NET_BATCH_SIZE packets at a time.
+ */
+static void receive_batches(Networking_Core *net, void *userdata)
+{
+    Net_Batch *const batch = net->batch;
+
+    while (true) {
+        for (uint32_t i = 0; i < NET_BATCH_SIZE; ++i) {
+            batch->recv_msgs[i].msg_hdr.msg_namelen = sizeof(batch->recv_addrs[i]);
+        }
+
+        const int count = recvmmsg(net->sock.socket, batch->recv_msgs, NET_BATCH_SIZE, 0, nullptr);
+
+        if (count <= 0) {
+            log_recv_error(net->log);
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            IP_Port *const ip_port = &batch->recv_ip_ports[i];
+            const uint32_t length = batch->recv_msgs[i].msg_len;
+            memset(ip_port, 0, sizeof(IP_Port));
+
+            if (length < 1 || make_recv_ip_port(&batch->recv_addrs[i], ip_port) == -1) {
+                ip_port->ip.family = net_family_unspec;
+                continue;
+            }
+
+            loglogdata(net->log, "=>O", batch->recv_data[i], MAX_UDP_PACKET_SIZE, *ip_port, length);
+        }
+
+        /* Handle the batch by class, so that crypto data comes before the
+         * packets that could spend the poll budget.
+         */
+        for (uint32_t packet_class = 0; packet_class < NET_CLASS_MAX; ++packet_class) {
+            for (int i = 0; i < count; ++i) {
+                const uint8_t *const data = batch->recv_data[i];
+
+                if (!net_family_is_unspec(batch->recv_ip_ports[i].ip.family)
+                        && net_packet_class(data[0]) == packet_class) {
+                    handle_received(net, batch->recv_ip_ports[i], data, batch->recv_msgs[i].msg_len, userdata);
+                }
+            }
+        }
+
+        if (count < NET_BATCH_SIZE) {
+            /* Short read: the socket is empty. */
+            return;
+        }
+    }
+}
+#endif
+
+/* user_data of the multishot receive posted on the UDP socket. */
+#define NET_URING_RECV 1
+
+/* Tear down the io_uring receive path and go back to polling the socket. */
+static void stop_uring(Networking_Core *net, int32_t res)
+{
+    LOGGER_WARNING(net->log, "io_uring receive failed (%d), falling back to polling the socket", res);
+    net_uring_kill(net->uring);
+    net->uring = nullptr;
+}
+
+/* Hand every datagram completed by the multishot receive to the packet
+ * handlers, give the buffers back and re-arm the receive if the kernel
+ * dropped it.
+ *
+ * return number of events processed.
+ */
+static uint32_t receive_uring_events(Networking_Core *net, void *userdata)
+{
+    Net_Uring_Event event;
+    uint32_t count = 0;
+    bool rearm = false;
+
+    while (net_uring_next_event(net->uring, &event)) {
+        ++count;
+
+        if (event.has_buffer) {
+            const void *name;
+            uint32_t name_length;
+            const uint8_t *payload;
+            const int length = net_uring_recvmsg_payload(net->uring, &event, &name, &name_length, &payload);
+
+            struct sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            IP_Port ip_port = {{{0}}};
+
+            if (length != -1 && name_length <= sizeof(addr)) {
+                memcpy(&addr, name, name_length);
+
+                if (make_recv_ip_port(&addr, &ip_port) != -1) {
+                    loglogdata(net->log, "=>O", payload, MAX_UDP_PACKET_SIZE, ip_port, length);
+                    handle_received(net, ip_port, payload, length, userdata);
+                }
+            }
+
+            net_uring_return_buffer(net->uring, event.buffer_id);
+        } else if (event.res == -EINVAL || event.res == -EOPNOTSUPP) {
+            /* Kernel too old for multishot recvmsg. */
+            stop_uring(net, event.res);
+            return 0;
+        }
+
+        if (!event.more) {
+            /* Multishot requests stop on errors and when buffers run out. */
+            rearm = true;
+        }
+    }
+
+    if (rearm && !net_uring_recvmsg_multishot(net->uring, net->sock.socket, NET_URING_RECV)) {
+        stop_uring(net, 0);
+        return 0;
+    }
+
+    return count;
+}
+
+static void receive_uring(Networking_Core *net, void *userdata)
+{
+    /* Each submit returns the buffers and lets the kernel post new completions. */
+    do {
+        if (!net_uring_submit(net->uring)) {
+            stop_uring(net, -net_error());
+            return;
+        }
+    } while (net->uring != nullptr && receive_uring_events(net, userdata) > 0);
+}
+
+/* Post the multishot receive on the UDP socket.
+ *
+ * return NULL if io_uring is unavailable.
+ */
+static Net_Uring *new_recv_uring(Socket sock)
+{
+    Net_Uring *ring = net_uring_new(NET_URING_ENTRIES);
+
+    if (ring == nullptr) {
+        return nullptr;
+    }
+
+    if (!net_uring_add_buffers(ring, NET_URING_BUFFERS, MAX_UDP_PACKET_SIZE)
+            || !net_uring_recvmsg_multishot(ring, sock.socket, NET_URING_RECV)
+            || !net_uring_submit(ring)) {
+        net_uring_kill(ring);
+        return nullptr;
+    }
+
+    return ring;
+}
+
 void networking_poll(Networking_Core *net, void *userdata)
 {
     if (net_family_is_unspec(net->family)) {
@@ -647,24 +1130,107 @@ void networking_poll(Networking_Core *net, void *userdata)
         return;
     }
 
+    net->poll_used = 0;
+
+    /* Replies sent by the packet handlers are queued and sent together. */
+    networking_batch_start(net);
+
+    if (net->uring != nullptr) {
+        receive_uring(net, userdata);
+
+        if (net->uring != nullptr) {
+            networking_batch_end(net);
+            return;
+        }
+    }
+
+#ifdef NETWORK_USE_MMSG
+
+    if (net->batch_io && net->batch != nullptr) {
+        receive_batches(net, userdata);
+        networking_batch_end(net);
+        return;
+    }
+
+#endif
+
     IP_Port ip_port;
     uint8_t data[MAX_UDP_PACKET_SIZE];
     uint32_t length;
 
     while (receivepacket(net->log, net->sock, &ip_port, data, &length) != -1) {
-        if (length < 1) {
-            continue;
-        }
+        handle_received(net, ip_port, data, length, userdata);
+    }
 
-        if (!(net->packethandlers[data[0]].function)) {
-            LOGGER_WARNING(net->log, "[%02u] -- Packet has no handler", data[0]);
-            continue;
-        }
+    networking_batch_end(net);
+}
+
+bool networking_wait(const Networking_Core *net, uint32_t timeout_ms)
+{
+    if (net_family_is_unspec(net->family)) {
+        return false;
+    }
+
+#ifndef OS_WIN32
 
-        net->packethandlers[data[0]].function(net->packethandlers[data[0]].object, ip_port, data, length, userdata);
+    if (net->sock.socket >= FD_SETSIZE) {
+        return true;
     }
+
+#endif
+
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    FD_SET(net->sock.socket, &readfds);
+
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    return select(net->sock.socket + 1, &readfds, nullptr, nullptr, &timeout) > 0;
 }
 
+#ifdef NETWORK_USE_MMSG
+static Net_Batch *new_net_batch(void)
+{
+    Net_Batch *batch = (Net_Batch *)calloc(1, sizeof(Net_Batch));
+
+    if (batch == nullptr) {
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&batch->send_mutex, nullptr) != 0) {
+        free(batch);
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < NET_BATCH_SIZE; ++i) {
+        batch->recv_iovs[i].iov_base = batch->recv_data[i];
+        batch->recv_iovs[i].iov_len = MAX_UDP_PACKET_SIZE;
+        batch->recv_msgs[i].msg_hdr.msg_iov = &batch->recv_iovs[i];
+        batch->recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->recv_msgs[i].msg_hdr.msg_name = &batch->recv_addrs[i];
+
+        batch->send_iovs[i].iov_base = batch->send_data[i];
+        batch->send_msgs[i].msg_hdr.msg_iov = &batch->send_iovs[i];
+        batch->send_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->send_msgs[i].msg_hdr.msg_name = &batch->send_addrs[i];
+    }
+
+    return batch;
+}
+
+static void kill_net_batch(Net_Batch *batch)
+{
+    if (batch == nullptr) {
+        return;
+    }
+
+    pthread_mutex_destroy(&batch->send_mutex);
+    free(batch);
+}
+#endif
+
 #ifndef VANILLA_NACL
 /* Used for sodium_init() */
 #include <sodium.h>
@@ -721,7 +1287,15 @@ static void at_shutdown(void)
  */
 Networking_Core *new_networking(const Logger *log, IP ip, uint16_t port)
 {
-    return new_networking_ex(log, ip, port, port + (TOX_PORTRANGE_TO - TOX_PORTRANGE_FROM), nullptr);
+    return new_networking_ex(log, ip, port, port + (TOX_PORTRANGE_TO - TOX_PORTRANGE_FROM), false, nullptr);
+}
+
+static Networking_Core *new_networking_internal(const Logger *log, IP ip, uint16_t port_from, uint16_t port_to,
+        bool use_io_uring, bool reuse_port, unsigned int *error);
+
+Networking_Core *new_networking_reuseport(const Logger *log, IP ip, uint16_t port)
+{
+    return new_networking_internal(log, ip, port, port, false, true, nullptr);
 }
 
 /* Initialize networking.
@@ -732,9 +1306,19 @@ Networking_Core *new_networking(const Logger *log, IP ip, uint16_t port)
  *  return Networking_Core object if no problems
  *  return NULL if there are problems.
  *
+ * If use_io_uring is true, packets are received through io_uring where the
+ * kernel supports it.
+ *
  * If error is non NULL it is set to 0 if no issues, 1 if socket related error, 2 if other.
  */
-Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from, uint16_t port_to, unsigned int *error)
+Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from, uint16_t port_to, bool use_io_uring,
+                                   unsigned int *error)
+{
+    return new_networking_internal(log, ip, port_from, port_to, use_io_uring, false, error);
+}
+
+static Networking_Core *new_networking_internal(const Logger *log, IP ip, uint16_t port_from, uint16_t port_to,
+        bool use_io_uring, bool reuse_port, unsigned int *error)
 {
     /* If both from and to are 0, use default port range
      * If one is 0 and the other is non-0, use the non-0 value as only port
@@ -796,6 +1380,17 @@ Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from,
         return nullptr;
     }
 
+#ifdef NETWORK_USE_MMSG
+    temp->batch = new_net_batch();
+
+    if (temp->batch == nullptr) {
+        kill_networking(temp);
+        return nullptr;
+    }
+
+#endif
+    temp->batch_io = true;
+
     /* Functions to increase the size of the send and receive UDP buffers.
      */
     int n = 1024 * 1024 * 2;
@@ -828,6 +1423,18 @@ Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from,
         return nullptr;
     }
 
+    /* Share the port with the other sockets of this process that set SO_REUSEPORT. */
+    if (reuse_port && !set_socket_reuseport(temp->sock)) {
+        LOGGER_ERROR(log, "Failed to set SO_REUSEPORT on socket");
+        kill_networking(temp);
+
+        if (error) {
+            *error = 1;
+        }
+
+        return nullptr;
+    }
+
     /* Bind our socket to port PORT and the given IP address (usually 0.0.0.0 or ::) */
     uint16_t *portptr = nullptr;
     struct sockaddr_storage addr;
@@ -857,7 +1464,7 @@ Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from,
 
         portptr = &addr6->sin6_port;
     } else {
-        free(temp);
+        kill_networking(temp);
         return nullptr;
     }
 
@@ -923,6 +1530,14 @@ Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from,
                 errno = 0;
             }
 
+            if (use_io_uring) {
+                temp->uring = new_recv_uring(temp->sock);
+
+                if (temp->uring == nullptr) {
+                    LOGGER_WARNING(log, "io_uring is not available, polling the socket instead");
+                }
+            }
+
             if (error) {
                 *error = 0;
             }
@@ -979,11 +1594,20 @@ void kill_networking(Networking_Core *net)
         return;
     }
 
+    if (net->uring != nullptr) {
+        /* The ring holds a reference to the socket until the receive is cancelled. */
+        net_uring_cancel_fd(net->uring, net->sock.socket);
+        net_uring_kill(net->uring);
+    }
+
     if (!net_family_is_unspec(net->family)) {
         /* Socket is initialized, so we close it. */
         kill_sock(net->sock);
     }
 
+#ifdef NETWORK_USE_MMSG
+    kill_net_batch(net->batch);
+#endif
     free(net);
 }
 
@@ -404,6 +404,14 @@ bool set_socket_nosigpipe(Socket sock);
  */
 bool set_socket_reuseaddr(Socket sock);
 
+/**
+ * Enable SO_REUSEPORT on socket, so that several sockets can be bound to the
+ * same port and have the kernel spread incoming packets between them.
+ *
+ * @return true on success, false on failure or if the platform lacks it.
+ */
+bool set_socket_reuseport(Socket sock);
+
 /**
  * Set socket to dual (IPv4 + IPv6 socket)
  *
@@ -416,12 +424,122 @@ bool set_socket_dualstack(Socket sock);
 /* Function to send packet(data) of length length to ip_port. */
 int sendpacket(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint16_t length);
 
+/* Maximum number of packets read or written by a single recvmmsg/sendmmsg call. */
+#define NET_BATCH_SIZE 32
+
+/* Size of the io_uring submission queue and number of receive buffers. */
+#define NET_URING_ENTRIES 256
+#define NET_URING_BUFFERS 128
+
+/**
+ * Send a packet, possibly batched with others.
+ *
+ * Between networking_batch_start() and networking_batch_end() the packet is
+ * queued, and all queued packets are sent with a single sendmmsg call when the
+ * outermost batch ends or the queue is full. Outside of a batch, on platforms
+ * without sendmmsg, or when batch I/O is disabled, this is the same as
+ * sendpacket().
+ *
+ * A queued packet counts as sent, even though the sendmmsg call may still fail
+ * to send it. Once a flush failed to send a packet, the packets after it in the
+ * same batch are sent right away, so callers still learn that the socket is
+ * full.
+ *
+ * @return length on success, -1 on failure.
+ */
+int sendpacket_batch(Networking_Core *net, IP_Port ip_port, const uint8_t *data, uint16_t length);
+
+/**
+ * Start queueing packets sent with sendpacket_batch(). Batches nest;
+ * networking_poll() runs its packet handlers inside one.
+ */
+void networking_batch_start(Networking_Core *net);
+
+/**
+ * End a batch started with networking_batch_start(). Ending the outermost
+ * batch sends all queued packets.
+ */
+void networking_batch_end(Networking_Core *net);
+
+/**
+ * Enable or disable recvmmsg/sendmmsg. Enabled by default where supported.
+ * Only useful for benchmarking and tests.
+ */
+void networking_set_batch_io(Networking_Core *net, bool enabled);
+
+/* Per source IP rate limits, see rate_limit.h. */
+typedef struct Rate_Limit Rate_Limit;
+
+/**
+ * Check every packet received on net's socket against rate_limit before
+ * handing it to its handler, and drop the ones over the limit. The limiter is
+ * not owned by net and can be shared with other sockets. NULL disables rate
+ * limiting, which is the default. Packets passed to networking_handle_packet
+ * are not checked.
+ */
+void networking_set_rate_limit(Networking_Core *net, Rate_Limit *rate_limit);
+Rate_Limit *networking_get_rate_limit(const Networking_Core *net);
+
+/* Priority classes of received packets, most important first. */
+typedef enum Net_Packet_Class {
+    /* Data on established friend and group connections. */
+    NET_CLASS_CRYPTO_DATA,
+    /* Cookies and handshakes setting up those connections. */
+    NET_CLASS_HANDSHAKE,
+    /* DHT, onion, LAN discovery and everything else. */
+    NET_CLASS_DHT,
+    NET_CLASS_MAX,
+} Net_Packet_Class;
+
+Net_Packet_Class net_packet_class(uint8_t packet_id);
+
+/* return true if the packet comes from the address of a peer the receiver has
+ * an established connection with.
+ */
+typedef bool packet_source_cb(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length);
+
+/* Function to call on crypto data packets beginning with byte once the poll
+ * budget is spent, to check that they belong to an established connection.
+ * Only packets it accepts are handled over the budget.
+ */
+void networking_register_source_check(Networking_Core *net, uint8_t byte, packet_source_cb *cb, void *object);
+
+/**
+ * Handle at most budget received packets in each networking_poll() call.
+ * The socket is still read until it is empty, so that packets of established
+ * connections don't wait in the kernel behind a flood, but once the budget is
+ * spent, handshakes and DHT packets are dropped. Crypto data that the source
+ * check of its packet ID accepts is always handled, and counts against the
+ * budget; other crypto data is dropped with the rest. Packets read in one batch with
+ * recvmmsg are handled by class, crypto data first. 0, the default, means no
+ * budget.
+ */
+void networking_set_poll_budget(Networking_Core *net, uint32_t budget);
+
+/* Number of received packets of packet_class that were handled, and that were
+ * dropped because the poll budget was spent.
+ */
+uint64_t networking_class_handled(const Networking_Core *net, Net_Packet_Class packet_class);
+uint64_t networking_class_dropped(const Networking_Core *net, Net_Packet_Class packet_class);
+
 /* Function to call when packet beginning with byte is received. */
 void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handler_cb *cb, void *object);
 
 /* Call this several times a second. */
 void networking_poll(Networking_Core *net, void *userdata);
 
+/* Run the handler registered for the packet's first byte, as if the packet
+ * had been received on net's socket.
+ */
+void networking_handle_packet(const Networking_Core *net, IP_Port source, const uint8_t *packet, uint16_t length,
+                              void *userdata);
+
+/* Block until net's socket has packets to read or timeout_ms milliseconds pass.
+ *
+ * return true if there may be packets to read.
+ */
+bool networking_wait(const Networking_Core *net, uint32_t timeout_ms);
+
 /* Connect a socket to the address specified by the ip_port. */
 int net_connect(Socket sock, IP_Port ip_port);
 
@@ -483,12 +601,24 @@ void net_kill_strerror(const char *strerror);
  * return Networking_Core object if no problems
  * return NULL if there are problems.
  *
+ * If use_io_uring is true, packets are received through multishot io_uring
+ * receives where the build and the kernel support it, and through the socket
+ * otherwise.
+ *
  * If error is non NULL it is set to 0 if no issues, 1 if socket related error, 2 if other.
  */
 Networking_Core *new_networking(const Logger *log, IP ip, uint16_t port);
-Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from, uint16_t port_to, unsigned int *error);
+Networking_Core *new_networking_ex(const Logger *log, IP ip, uint16_t port_from, uint16_t port_to, bool use_io_uring,
+                                   unsigned int *error);
 Networking_Core *new_networking_no_udp(const Logger *log);
 
+/* Initialize networking on exactly ip and port with SO_REUSEPORT set, so that
+ * further sockets created this way can share the port.
+ *
+ * return NULL on failure or if the platform doesn't support SO_REUSEPORT.
+ */
+Networking_Core *new_networking_reuseport(const Logger *log, IP ip, uint16_t port);
+
 /* Function to cleanup networking stuff (doesn't do much right now). */
 void kill_networking(Networking_Core *net);
 
@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Persistent cache of DHT nodes for a fast start after a restart.
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "node_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ccompat.h"
+#include "state.h"
+#include "util.h"
+
+/* The file is a header followed by fixed size records, all little endian:
+ *
+ * header: magic (4), version (4), number of nodes (4), reserved (4).
+ * record: public key (32), address family 4 or 6 (1), IP address (16), port
+ *         in network byte order (2), round trip time in ms (4), time first
+ *         seen (8), time last seen (8), time of the last answer (8),
+ *         reserved (9).
+ */
+#define NODE_CACHE_MAGIC 0x6e636f74
+#define NODE_CACHE_VERSION 1
+#define NODE_CACHE_HEADER_SIZE 16
+#define NODE_CACHE_RECORD_SIZE 88
+
+#define HEADER_MAGIC 0
+#define HEADER_VERSION 4
+#define HEADER_NUM_NODES 8
+
+#define RECORD_PUBLIC_KEY 0
+#define RECORD_FAMILY (RECORD_PUBLIC_KEY + CRYPTO_PUBLIC_KEY_SIZE)
+#define RECORD_IP (RECORD_FAMILY + 1)
+#define RECORD_PORT (RECORD_IP + 16)
+#define RECORD_RTT (RECORD_PORT + 2)
+#define RECORD_FIRST_SEEN (RECORD_RTT + 4)
+#define RECORD_LAST_SEEN (RECORD_FIRST_SEEN + 8)
+#define RECORD_LAST_ANSWER (RECORD_LAST_SEEN + 8)
+
+/* Nodes the file has room for when it is created. */
+#define NODE_CACHE_MIN_NODES 256
+#define NODE_CACHE_MAX_NODES (1 << 20)
+
+/* Uptime counts for at most a week in the score. */
+#define NODE_CACHE_MAX_UPTIME (7 * 24 * 60 * 60)
+
+#define NODE_CACHE_NONE UINT32_MAX
+
+struct Node_Cache {
+    const Logger *log;
+
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+
+    /* Number of records the file has room for. */
+    uint32_t capacity;
+    uint32_t max_nodes;
+    uint32_t num_nodes;
+
+    /* Open addressing hash table of record numbers keyed by public key. */
+    uint32_t *index;
+    uint32_t index_mask;
+    uint64_t hash_key;
+};
+
+typedef struct Node_Cache_Score {
+    int64_t score;
+    uint32_t record;
+} Node_Cache_Score;
+
+static uint8_t *get_record(const Node_Cache *cache, uint32_t record)
+{
+    return cache->map + NODE_CACHE_HEADER_SIZE + (size_t)record * NODE_CACHE_RECORD_SIZE;
+}
+
+static uint64_t record_get64(const uint8_t *record, size_t offset)
+{
+    uint64_t value;
+    lendian_bytes_to_host64(&value, record + offset);
+    return value;
+}
+
+static uint32_t record_get32(const uint8_t *record, size_t offset)
+{
+    uint32_t value;
+    lendian_bytes_to_host32(&value, record + offset);
+    return value;
+}
+
+static void set_num_nodes(Node_Cache *cache, uint32_t num_nodes)
+{
+    cache->num_nodes = num_nodes;
+    host_to_lendian_bytes32(cache->map + HEADER_NUM_NODES, num_nodes);
+}
+
+/* Nodes score higher when they answered more recently, have been known for
+ * longer and answered faster. A minute of uptime is worth a minute since the
+ * last answer, and every 10 ms of round trip time costs a minute. Nodes that
+ * never answered come last, the most recently seen first.
+ */
+static int64_t record_score(const uint8_t *record, uint64_t now)
+{
+    const uint64_t first_seen = record_get64(record, RECORD_FIRST_SEEN);
+    const uint64_t last_seen = record_get64(record, RECORD_LAST_SEEN);
+    const uint64_t last_answer = record_get64(record, RECORD_LAST_ANSWER);
+
+    if (last_answer == 0) {
+        return INT64_MIN / 2 + (int64_t)(last_seen / 60);
+    }
+
+    const uint64_t uptime = last_seen > first_seen ? min_u64(last_seen - first_seen, NODE_CACHE_MAX_UPTIME) : 0;
+    const uint64_t since_answer = now > last_answer ? now - last_answer : 0;
+
+    return (int64_t)(uptime / 60) - (int64_t)(since_answer / 60) - record_get32(record, RECORD_RTT) / 10;
+}
+
+static int cmp_score(const void *a, const void *b)
+{
+    Node_Cache_Score score1;
+    Node_Cache_Score score2;
+    memcpy(&score1, a, sizeof(Node_Cache_Score));
+    memcpy(&score2, b, sizeof(Node_Cache_Score));
+
+    /* Best first. */
+    if (score1.score != score2.score) {
+        return score1.score > score2.score ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/* Score all nodes and sort them, best first.
+ *
+ * return NULL on failure.
+ */
+static Node_Cache_Score *sorted_scores(const Node_Cache *cache, uint64_t now)
+{
+    Node_Cache_Score *const scores = (Node_Cache_Score *)calloc(cache->num_nodes + 1, sizeof(Node_Cache_Score));
+
+    if (scores == nullptr) {
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < cache->num_nodes; ++i) {
+        scores[i].score = record_score(get_record(cache, i), now);
+        scores[i].record = i;
+    }
+
+    qsort(scores, cache->num_nodes, sizeof(Node_Cache_Score), cmp_score);
+    return scores;
+}
+
+static uint32_t index_slot(const Node_Cache *cache, const uint8_t *public_key)
+{
+    uint32_t slot = id_hash(public_key, cache->hash_key) & cache->index_mask;
+
+    while (cache->index[slot] != NODE_CACHE_NONE
+            && !id_equal(get_record(cache, cache->index[slot]) + RECORD_PUBLIC_KEY, public_key)) {
+        slot = (slot + 1) & cache->index_mask;
+    }
+
+    return slot;
+}
+
+static void index_rebuild(Node_Cache *cache)
+{
+    for (uint32_t i = 0; i <= cache->index_mask; ++i) {
+        cache->index[i] = NODE_CACHE_NONE;
+    }
+
+    for (uint32_t i = 0; i < cache->num_nodes; ++i) {
+        cache->index[index_slot(cache, get_record(cache, i) + RECORD_PUBLIC_KEY)] = i;
+    }
+}
+
+#ifndef _WIN32
+
+/* Resize the file to have room for capacity records and map it again.
+ *
+ * return false on failure, leaving the old mapping in place.
+ */
+static bool map_file(Node_Cache *cache, uint32_t capacity)
+{
+    const size_t map_size = NODE_CACHE_HEADER_SIZE + (size_t)capacity * NODE_CACHE_RECORD_SIZE;
+
+    if (ftruncate(cache->fd, map_size) != 0) {
+        LOGGER_ERROR(cache->log, "could not resize node cache to %u nodes", capacity);
+        return false;
+    }
+
+    uint8_t *const map = (uint8_t *)mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+
+    if (map == MAP_FAILED) {
+        LOGGER_ERROR(cache->log, "could not map node cache of %u nodes", capacity);
+        return false;
+    }
+
+    if (cache->map != nullptr) {
+        munmap(cache->map, cache->map_size);
+    }
+
+    cache->map = map;
+    cache->map_size = map_size;
+    cache->capacity = capacity;
+    return true;
+}
+
+static bool header_ok(const Node_Cache *cache, size_t file_size)
+{
+    if (file_size < NODE_CACHE_HEADER_SIZE + NODE_CACHE_RECORD_SIZE
+            || (file_size - NODE_CACHE_HEADER_SIZE) % NODE_CACHE_RECORD_SIZE != 0) {
+        return false;
+    }
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_nodes;
+    lendian_bytes_to_host32(&magic, cache->map + HEADER_MAGIC);
+    lendian_bytes_to_host32(&version, cache->map + HEADER_VERSION);
+    lendian_bytes_to_host32(&num_nodes, cache->map + HEADER_NUM_NODES);
+
+    /* The file must hold all the records the header counts. */
+    return magic == NODE_CACHE_MAGIC && version == NODE_CACHE_VERSION
+           && num_nodes <= (file_size - NODE_CACHE_HEADER_SIZE) / NODE_CACHE_RECORD_SIZE;
+}
+
+Node_Cache *node_cache_open(const Logger *log, const char *path, uint32_t max_nodes)
+{
+    if (path == nullptr || max_nodes == 0 || max_nodes > NODE_CACHE_MAX_NODES) {
+        return nullptr;
+    }
+
+    Node_Cache *const cache = (Node_Cache *)calloc(1, sizeof(Node_Cache));
+
+    if (cache == nullptr) {
+        return nullptr;
+    }
+
+    cache->log = log;
+    cache->max_nodes = max_nodes;
+    cache->hash_key = random_u64();
+
+    uint32_t index_size = 1;
+
+    while (index_size < max_nodes * 2) {
+        index_size *= 2;
+    }
+
+    cache->index = (uint32_t *)malloc(index_size * sizeof(uint32_t));
+    cache->index_mask = index_size - 1;
+    cache->fd = open(path, O_RDWR | O_CREAT, 0600);
+
+    if (cache->index == nullptr || cache->fd == -1) {
+        LOGGER_ERROR(log, "could not open node cache %s", path);
+        node_cache_close(cache);
+        return nullptr;
+    }
+
+    struct stat st;
+
+    if (fstat(cache->fd, &st) != 0) {
+        node_cache_close(cache);
+        return nullptr;
+    }
+
+    const size_t file_size = st.st_size;
+    const uint32_t file_capacity = file_size > NODE_CACHE_HEADER_SIZE
+                                   ? (file_size - NODE_CACHE_HEADER_SIZE) / NODE_CACHE_RECORD_SIZE : 0;
+
+    if (!map_file(cache, max_u32(file_capacity, min_u32(NODE_CACHE_MIN_NODES, max_nodes)))) {
+        node_cache_close(cache);
+        return nullptr;
+    }
+
+    if (header_ok(cache, file_size)) {
+        uint32_t num_nodes;
+        lendian_bytes_to_host32(&num_nodes, cache->map + HEADER_NUM_NODES);
+        /* The maximum may be lower than when the file was written. */
+        set_num_nodes(cache, min_u32(num_nodes, max_nodes));
+    } else {
+        if (file_size > 0) {
+            LOGGER_WARNING(log, "%s is not a node cache, starting a new one", path);
+        }
+
+        memset(cache->map, 0, NODE_CACHE_HEADER_SIZE);
+        host_to_lendian_bytes32(cache->map + HEADER_MAGIC, NODE_CACHE_MAGIC);
+        host_to_lendian_bytes32(cache->map + HEADER_VERSION, NODE_CACHE_VERSION);
+        set_num_nodes(cache, 0);
+    }
+
+    index_rebuild(cache);
+    return cache;
+}
+
+void node_cache_close(Node_Cache *cache)
+{
+    if (cache == nullptr) {
+        return;
+    }
+
+    if (cache->map != nullptr) {
+        msync(cache->map, cache->map_size, MS_SYNC);
+        munmap(cache->map, cache->map_size);
+    }
+
+    if (cache->fd != -1) {
+        close(cache->fd);
+    }
+
+    free(cache->index);
+    free(cache);
+}
+
+#else
+
+static bool map_file(Node_Cache *cache, uint32_t capacity)
+{
+    return false;
+}
+
+Node_Cache *node_cache_open(const Logger *log, const char *path, uint32_t max_nodes)
+{
+    LOGGER_WARNING(log, "the node cache needs memory mapped files, which are not supported on this platform");
+    return nullptr;
+}
+
+void node_cache_close(Node_Cache *cache)
+{
+}
+
+#endif
+
+/* Drop the quarter of the nodes with the lowest score, keeping the others in
+ * the order they were added.
+ */
+static void compact(Node_Cache *cache, uint64_t now)
+{
+    const uint32_t kept = cache->num_nodes - max_u32(cache->num_nodes / 4, 1);
+    Node_Cache_Score *const scores = sorted_scores(cache, now);
+
+    if (scores == nullptr) {
+        /* Drop the oldest nodes instead. */
+        memmove(get_record(cache, 0), get_record(cache, cache->num_nodes - kept), (size_t)kept * NODE_CACHE_RECORD_SIZE);
+        set_num_nodes(cache, kept);
+        index_rebuild(cache);
+        return;
+    }
+
+    /* Mark the records to keep, then move them down in order. */
+    for (uint32_t i = 0; i < cache->num_nodes; ++i) {
+        cache->index[i] = 0;
+    }
+
+    for (uint32_t i = 0; i < kept; ++i) {
+        cache->index[scores[i].record] = 1;
+    }
+
+    free(scores);
+
+    uint32_t num_nodes = 0;
+
+    for (uint32_t i = 0; i < cache->num_nodes; ++i) {
+        if (cache->index[i] == 0) {
+            continue;
+        }
+
+        if (num_nodes != i) {
+            memcpy(get_record(cache, num_nodes), get_record(cache, i), NODE_CACHE_RECORD_SIZE);
+        }
+
+        ++num_nodes;
+    }
+
+    set_num_nodes(cache, num_nodes);
+    index_rebuild(cache);
+}
+
+/* Find the record of public_key, or add one. */
+static uint32_t find_or_add(Node_Cache *cache, const uint8_t *public_key, uint64_t now)
+{
+    uint32_t slot = index_slot(cache, public_key);
+
+    if (cache->index[slot] != NODE_CACHE_NONE) {
+        return cache->index[slot];
+    }
+
+    const uint32_t limit = min_u32(cache->capacity, cache->max_nodes);
+
+    if (cache->num_nodes == limit) {
+        if (limit == cache->max_nodes || !map_file(cache, min_u32(cache->capacity * 2, cache->max_nodes))) {
+            compact(cache, now);
+        }
+
+        slot = index_slot(cache, public_key);
+    }
+
+    const uint32_t record_num = cache->num_nodes;
+    uint8_t *const record = get_record(cache, record_num);
+    memset(record, 0, NODE_CACHE_RECORD_SIZE);
+    memcpy(record + RECORD_PUBLIC_KEY, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    host_to_lendian_bytes64(record + RECORD_FIRST_SEEN, now);
+
+    cache->index[slot] = record_num;
+    set_num_nodes(cache, record_num + 1);
+    return record_num;
+}
+
+/* Find or add the record of public_key and store ip_port and the time it was
+ * last seen in it.
+ *
+ * return NULL if the address can't be stored.
+ */
+static uint8_t *update_record(Node_Cache *cache, const uint8_t *public_key, const IP_Port *ip_port, uint64_t now)
+{
+    uint8_t family;
+    size_t ip_size;
+    const uint8_t *ip;
+
+    if (net_family_is_ipv4(ip_port->ip.family)) {
+        family = 4;
+        ip_size = sizeof(ip_port->ip.ip.v4.uint8);
+        ip = ip_port->ip.ip.v4.uint8;
+    } else if (net_family_is_ipv6(ip_port->ip.family)) {
+        family = 6;
+        ip_size = sizeof(ip_port->ip.ip.v6.uint8);
+        ip = ip_port->ip.ip.v6.uint8;
+    } else {
+        return nullptr;
+    }
+
+    uint8_t *const record = get_record(cache, find_or_add(cache, public_key, now));
+    record[RECORD_FAMILY] = family;
+    memset(record + RECORD_IP, 0, 16);
+    memcpy(record + RECORD_IP, ip, ip_size);
+    memcpy(record + RECORD_PORT, &ip_port->port, sizeof(ip_port->port));
+    host_to_lendian_bytes64(record + RECORD_LAST_SEEN, now);
+    return record;
+}
+
+void node_cache_seen(Node_Cache *cache, const uint8_t *public_key, const IP_Port *ip_port, uint64_t now)
+{
+    update_record(cache, public_key, ip_port, now);
+}
+
+void node_cache_answered(Node_Cache *cache, const uint8_t *public_key, const IP_Port *ip_port, uint32_t rtt_ms,
+                         uint64_t now)
+{
+    uint8_t *const record = update_record(cache, public_key, ip_port, now);
+
+    if (record == nullptr) {
+        return;
+    }
+
+    const uint32_t old_rtt = record_get32(record, RECORD_RTT);
+    const uint64_t last_answer = record_get64(record, RECORD_LAST_ANSWER);
+
+    /* Smooth the round trip time like TCP does, with a weight of 1/8. */
+    const uint32_t rtt = last_answer == 0 ? rtt_ms : (uint32_t)(((uint64_t)old_rtt * 7 + rtt_ms) / 8);
+    host_to_lendian_bytes32(record + RECORD_RTT, rtt);
+    host_to_lendian_bytes64(record + RECORD_LAST_ANSWER, now);
+}
+
+uint32_t node_cache_best(const Node_Cache *cache, uint8_t *public_keys, IP_Port *ip_ports, uint32_t max_nodes,
+                         uint64_t now)
+{
+    Node_Cache_Score *const scores = sorted_scores(cache, now);
+
+    if (scores == nullptr) {
+        return 0;
+    }
+
+    uint32_t num = 0;
+
+    for (uint32_t i = 0; i < cache->num_nodes && num < max_nodes; ++i) {
+        const uint8_t *const record = get_record(cache, scores[i].record);
+        const uint8_t family = record[RECORD_FAMILY];
+
+        /* Zeroed or corrupt records aren't nodes. */
+        if (family != 4 && family != 6) {
+            continue;
+        }
+
+        IP_Port *const ip_port = &ip_ports[num];
+
+        memset(ip_port, 0, sizeof(IP_Port));
+
+        if (family == 4) {
+            ip_port->ip.family = net_family_ipv4;
+            memcpy(ip_port->ip.ip.v4.uint8, record + RECORD_IP, sizeof(ip_port->ip.ip.v4.uint8));
+        } else {
+            ip_port->ip.family = net_family_ipv6;
+            memcpy(ip_port->ip.ip.v6.uint8, record + RECORD_IP, sizeof(ip_port->ip.ip.v6.uint8));
+        }
+
+        memcpy(&ip_port->port, record + RECORD_PORT, sizeof(ip_port->port));
+        memcpy(public_keys + num * CRYPTO_PUBLIC_KEY_SIZE, record + RECORD_PUBLIC_KEY, CRYPTO_PUBLIC_KEY_SIZE);
+        ++num;
+    }
+
+    free(scores);
+    return num;
+}
+
+uint32_t node_cache_size(const Node_Cache *cache)
+{
+    return cache->num_nodes;
+}
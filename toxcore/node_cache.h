@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Persistent cache of DHT nodes for a fast start after a restart.
+ *
+ * Every node that talks to us is recorded in a memory mapped file, together
+ * with how long we have known it, when it last answered one of our requests
+ * and how fast it answered. New nodes are appended to the file. When it is
+ * full, it grows up to its maximum size, after which the nodes with the
+ * lowest score are dropped to make room.
+ */
+#ifndef C_TOXCORE_TOXCORE_NODE_CACHE_H
+#define C_TOXCORE_TOXCORE_NODE_CACHE_H
+
+#include "crypto_core.h"
+#include "logger.h"
+#include "network.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default maximum number of nodes kept in the file. */
+#define DEFAULT_NODE_CACHE_NODES 4096
+
+typedef struct Node_Cache Node_Cache;
+
+/* Open the node cache in the file at path, creating it if it doesn't exist. A
+ * file that isn't a node cache is overwritten. At most max_nodes nodes are
+ * kept.
+ *
+ * return NULL on failure, or if memory mapped files are not supported.
+ */
+Node_Cache *node_cache_open(const Logger *log, const char *path, uint32_t max_nodes);
+
+/* Write the cache back to its file and close it. */
+void node_cache_close(Node_Cache *cache);
+
+/* Record that the node with public_key at ip_port sent us a valid packet at
+ * time now, in seconds.
+ */
+void node_cache_seen(Node_Cache *cache, const uint8_t *public_key, const IP_Port *ip_port, uint64_t now);
+
+/* Record that the node answered one of our requests at time now, rtt_ms
+ * milliseconds after we sent it.
+ */
+void node_cache_answered(Node_Cache *cache, const uint8_t *public_key, const IP_Port *ip_port, uint32_t rtt_ms,
+                         uint64_t now);
+
+/* Copy the nodes with the best score at time now to public_keys and ip_ports,
+ * best first. Nodes score higher when they answered more recently, have been
+ * known for longer and answered faster. Nodes that never answered come last.
+ *
+ * return the number of nodes copied, at most max_nodes.
+ */
+uint32_t node_cache_best(const Node_Cache *cache, uint8_t *public_keys, IP_Port *ip_ports, uint32_t max_nodes,
+                         uint64_t now);
+
+/* Number of nodes in the cache. */
+uint32_t node_cache_size(const Node_Cache *cache);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif // C_TOXCORE_TOXCORE_NODE_CACHE_H
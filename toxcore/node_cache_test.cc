@@ -0,0 +1,243 @@
+#include "node_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+struct Logger_Deleter {
+  void operator()(Logger *log) { logger_kill(log); }
+};
+
+using Logger_Ptr = std::unique_ptr<Logger, Logger_Deleter>;
+
+struct Node_Cache_Deleter {
+  void operator()(Node_Cache *cache) { node_cache_close(cache); }
+};
+
+using Node_Cache_Ptr = std::unique_ptr<Node_Cache, Node_Cache_Deleter>;
+
+PublicKey random_pk() {
+  PublicKey pk;
+  random_bytes(pk.data(), pk.size());
+  return pk;
+}
+
+IP_Port ip_port_of(uint8_t last_byte, uint16_t port) {
+  IP_Port ip_port = {{{0}}};
+  ip_init(&ip_port.ip, false);
+  ip_port.ip.ip.v4 = get_ip4_loopback();
+  ip_port.ip.ip.v4.uint8[3] = last_byte;
+  ip_port.port = net_htons(port);
+  return ip_port;
+}
+
+class NodeCache : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char path[] = "/tmp/node_cache_test.XXXXXX";
+    int const fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+    path_ = path;
+    log_.reset(logger_new());
+  }
+
+  void TearDown() override { std::remove(path_.c_str()); }
+
+  Node_Cache *open(uint32_t max_nodes) {
+    return node_cache_open(log_.get(), path_.c_str(), max_nodes);
+  }
+
+  std::vector<PublicKey> best(Node_Cache *cache, uint32_t max_nodes, uint64_t now) {
+    std::vector<uint8_t> keys(max_nodes * CRYPTO_PUBLIC_KEY_SIZE);
+    std::vector<IP_Port> ip_ports(max_nodes);
+    uint32_t const num = node_cache_best(cache, keys.data(), ip_ports.data(), max_nodes, now);
+    std::vector<PublicKey> result(num);
+
+    for (uint32_t i = 0; i < num; ++i) {
+      std::copy(&keys[i * CRYPTO_PUBLIC_KEY_SIZE], &keys[(i + 1) * CRYPTO_PUBLIC_KEY_SIZE],
+                result[i].begin());
+    }
+
+    return result;
+  }
+
+  Logger_Ptr log_;
+  std::string path_;
+};
+
+TEST_F(NodeCache, NodesSurviveReopening) {
+  PublicKey const pk = random_pk();
+  IP_Port const ip_port = ip_port_of(7, 33445);
+
+  {
+    Node_Cache_Ptr const cache(open(16));
+    ASSERT_NE(cache, nullptr);
+    node_cache_seen(cache.get(), pk.data(), &ip_port, 1000);
+    node_cache_answered(cache.get(), pk.data(), &ip_port, 50, 1000);
+    EXPECT_EQ(node_cache_size(cache.get()), 1);
+  }
+
+  Node_Cache_Ptr const cache(open(16));
+  ASSERT_NE(cache, nullptr);
+  EXPECT_EQ(node_cache_size(cache.get()), 1);
+
+  uint8_t key[CRYPTO_PUBLIC_KEY_SIZE];
+  IP_Port stored;
+  ASSERT_EQ(node_cache_best(cache.get(), key, &stored, 1, 1000), 1);
+  EXPECT_TRUE(std::equal(pk.begin(), pk.end(), key));
+  EXPECT_TRUE(ipport_equal(&stored, &ip_port));
+}
+
+TEST_F(NodeCache, SameKeyIsStoredOnce) {
+  Node_Cache_Ptr const cache(open(16));
+  ASSERT_NE(cache, nullptr);
+  PublicKey const pk = random_pk();
+  IP_Port const old_ip_port = ip_port_of(1, 1);
+  IP_Port const new_ip_port = ip_port_of(2, 2);
+
+  node_cache_seen(cache.get(), pk.data(), &old_ip_port, 10);
+  node_cache_seen(cache.get(), pk.data(), &new_ip_port, 20);
+  EXPECT_EQ(node_cache_size(cache.get()), 1);
+
+  uint8_t key[CRYPTO_PUBLIC_KEY_SIZE];
+  IP_Port stored;
+  ASSERT_EQ(node_cache_best(cache.get(), key, &stored, 1, 20), 1);
+  EXPECT_TRUE(ipport_equal(&stored, &new_ip_port));
+}
+
+TEST_F(NodeCache, AnsweringNodesComeFirst) {
+  Node_Cache_Ptr const cache(open(16));
+  ASSERT_NE(cache, nullptr);
+  PublicKey const silent = random_pk();
+  PublicKey const slow = random_pk();
+  PublicKey const fast = random_pk();
+  IP_Port const ip_port = ip_port_of(1, 1);
+
+  node_cache_seen(cache.get(), silent.data(), &ip_port, 100);
+  node_cache_answered(cache.get(), slow.data(), &ip_port, 2000, 100);
+  node_cache_answered(cache.get(), fast.data(), &ip_port, 20, 100);
+
+  std::vector<PublicKey> const nodes = best(cache.get(), 3, 100);
+  ASSERT_EQ(nodes.size(), 3);
+  EXPECT_EQ(nodes[0], fast);
+  EXPECT_EQ(nodes[1], slow);
+  EXPECT_EQ(nodes[2], silent);
+}
+
+TEST_F(NodeCache, LongKnownNodesComeFirst) {
+  Node_Cache_Ptr const cache(open(16));
+  ASSERT_NE(cache, nullptr);
+  PublicKey const old_node = random_pk();
+  PublicKey const new_node = random_pk();
+  IP_Port const ip_port = ip_port_of(1, 1);
+
+  node_cache_seen(cache.get(), old_node.data(), &ip_port, 0);
+  node_cache_seen(cache.get(), new_node.data(), &ip_port, 3600);
+  node_cache_answered(cache.get(), new_node.data(), &ip_port, 20, 7200);
+  node_cache_answered(cache.get(), old_node.data(), &ip_port, 20, 7200);
+
+  std::vector<PublicKey> const nodes = best(cache.get(), 2, 7200);
+  ASSERT_EQ(nodes.size(), 2);
+  EXPECT_EQ(nodes[0], old_node);
+}
+
+TEST_F(NodeCache, KeepsBestNodesWhenFull) {
+  constexpr uint32_t max_nodes = 300;
+  Node_Cache_Ptr const cache(open(max_nodes));
+  ASSERT_NE(cache, nullptr);
+  IP_Port const ip_port = ip_port_of(1, 1);
+
+  std::vector<PublicKey> good;
+
+  for (int i = 0; i < 10; ++i) {
+    good.push_back(random_pk());
+    node_cache_answered(cache.get(), good.back().data(), &ip_port, 10, 1);
+  }
+
+  for (uint32_t i = 0; i < max_nodes * 3; ++i) {
+    node_cache_seen(cache.get(), random_pk().data(), &ip_port, 1);
+    EXPECT_LE(node_cache_size(cache.get()), max_nodes);
+  }
+
+  std::vector<PublicKey> const nodes = best(cache.get(), good.size(), 1);
+  ASSERT_EQ(nodes.size(), good.size());
+
+  for (PublicKey const &pk : good) {
+    EXPECT_NE(std::find(nodes.begin(), nodes.end(), pk), nodes.end());
+  }
+}
+
+// The header is 16 bytes and each record 88, starting with the 32 byte public
+// key followed by the address family.
+constexpr long header_size = 16;
+constexpr long record_size = 88;
+
+TEST_F(NodeCache, TruncatedFilesAreNotTrusted) {
+  {
+    Node_Cache_Ptr const cache(open(16));
+    ASSERT_NE(cache, nullptr);
+
+    for (int i = 0; i < 3; ++i) {
+      IP_Port const ip_port = ip_port_of(i, 1);
+      node_cache_seen(cache.get(), random_pk().data(), &ip_port, 10);
+    }
+  }
+
+  ASSERT_EQ(truncate(path_.c_str(), header_size + record_size), 0);
+
+  Node_Cache_Ptr const cache(open(16));
+  ASSERT_NE(cache, nullptr);
+  EXPECT_EQ(node_cache_size(cache.get()), 0);
+  EXPECT_TRUE(best(cache.get(), 3, 10).empty());
+}
+
+TEST_F(NodeCache, CorruptRecordsAreSkipped) {
+  PublicKey const corrupt = random_pk();
+  PublicKey const good = random_pk();
+  IP_Port const ip_port = ip_port_of(1, 1);
+
+  {
+    Node_Cache_Ptr const cache(open(16));
+    ASSERT_NE(cache, nullptr);
+    node_cache_answered(cache.get(), corrupt.data(), &ip_port, 10, 10);
+    node_cache_seen(cache.get(), good.data(), &ip_port, 10);
+  }
+
+  FILE *const file = fopen(path_.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(fseek(file, header_size + CRYPTO_PUBLIC_KEY_SIZE, SEEK_SET), 0);
+  fputc(0, file);
+  fclose(file);
+
+  Node_Cache_Ptr const cache(open(16));
+  ASSERT_NE(cache, nullptr);
+  std::vector<PublicKey> const nodes = best(cache.get(), 2, 10);
+  ASSERT_EQ(nodes.size(), 1);
+  EXPECT_EQ(nodes[0], good);
+}
+
+TEST_F(NodeCache, OverwritesOtherFiles) {
+  FILE *const file = fopen(path_.c_str(), "wb");
+  ASSERT_NE(file, nullptr);
+  std::vector<uint8_t> const garbage(1000, 0xab);
+  fwrite(garbage.data(), 1, garbage.size(), file);
+  fclose(file);
+
+  Node_Cache_Ptr const cache(open(16));
+  ASSERT_NE(cache, nullptr);
+  EXPECT_EQ(node_cache_size(cache.get()), 0);
+}
+
+}  // namespace
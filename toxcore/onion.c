@@ -281,7 +281,7 @@ int send_onion_packet(Networking_Core *net, const Onion_Path *path, IP_Port dest
         return -1;
     }
 
-    if (sendpacket(net, path->ip_port1, packet, len) != len) {
+    if (sendpacket_batch(net, path->ip_port1, packet, len) != len) {
         return -1;
     }
 
@@ -328,8 +328,12 @@ static int handle_send_initial(void *object, IP_Port source, const uint8_t *pack
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion->mono_time, &onion->shared_keys_1, shared_key, dht_get_self_secret_key(onion->dht),
-                   packet + 1 + CRYPTO_NONCE_SIZE);
+
+    if (!dht_get_shared_key_or_park(onion->dht, onion->shared_keys_1, shared_key, packet + 1 + CRYPTO_NONCE_SIZE,
+                                    source, packet, length)) {
+        return 1;
+    }
+
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
                                      length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE), plain);
 
@@ -375,7 +379,7 @@ int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, IP_Port
 
     data_len += CRYPTO_NONCE_SIZE + len;
 
-    if ((uint32_t)sendpacket(onion->net, send_to, data, data_len) != data_len) {
+    if ((uint32_t)sendpacket_batch(onion->net, send_to, data, data_len) != data_len) {
         return 1;
     }
 
@@ -398,7 +402,7 @@ static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, ui
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion->mono_time, &onion->shared_keys_2, shared_key, dht_get_self_secret_key(onion->dht),
+    get_shared_key(onion->shared_keys_2, shared_key, dht_get_self_secret_key(onion->dht),
                    packet + 1 + CRYPTO_NONCE_SIZE);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
                                      length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_1), plain);
@@ -432,7 +436,7 @@ static int handle_send_1(void *object, IP_Port source, const uint8_t *packet, ui
 
     data_len += CRYPTO_NONCE_SIZE + len;
 
-    if ((uint32_t)sendpacket(onion->net, send_to, data, data_len) != data_len) {
+    if ((uint32_t)sendpacket_batch(onion->net, send_to, data, data_len) != data_len) {
         return 1;
     }
 
@@ -455,7 +459,7 @@ static int handle_send_2(void *object, IP_Port source, const uint8_t *packet, ui
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion->mono_time, &onion->shared_keys_3, shared_key, dht_get_self_secret_key(onion->dht),
+    get_shared_key(onion->shared_keys_3, shared_key, dht_get_self_secret_key(onion->dht),
                    packet + 1 + CRYPTO_NONCE_SIZE);
     int len = decrypt_data_symmetric(shared_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE,
                                      length - (1 + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + RETURN_2), plain);
@@ -498,7 +502,7 @@ static int handle_send_2(void *object, IP_Port source, const uint8_t *packet, ui
 
     data_len += RETURN_3;
 
-    if ((uint32_t)sendpacket(onion->net, send_to, data, data_len) != data_len) {
+    if ((uint32_t)sendpacket_batch(onion->net, send_to, data, data_len) != data_len) {
         return 1;
     }
 
@@ -547,7 +551,7 @@ static int handle_recv_3(void *object, IP_Port source, const uint8_t *packet, ui
     memcpy(data + 1 + RETURN_2, packet + 1 + RETURN_3, length - (1 + RETURN_3));
     uint16_t data_len = 1 + RETURN_2 + (length - (1 + RETURN_3));
 
-    if ((uint32_t)sendpacket(onion->net, send_to, data, data_len) != data_len) {
+    if ((uint32_t)sendpacket_batch(onion->net, send_to, data, data_len) != data_len) {
         return 1;
     }
 
@@ -595,7 +599,7 @@ static int handle_recv_2(void *object, IP_Port source, const uint8_t *packet, ui
     memcpy(data + 1 + RETURN_1, packet + 1 + RETURN_2, length - (1 + RETURN_2));
     uint16_t data_len = 1 + RETURN_1 + (length - (1 + RETURN_2));
 
-    if ((uint32_t)sendpacket(onion->net, send_to, data, data_len) != data_len) {
+    if ((uint32_t)sendpacket_batch(onion->net, send_to, data, data_len) != data_len) {
         return 1;
     }
 
@@ -645,7 +649,7 @@ static int handle_recv_1(void *object, IP_Port source, const uint8_t *packet, ui
         return onion->recv_1_function(onion->callback_object, send_to, packet + (1 + RETURN_1), data_len);
     }
 
-    if ((uint32_t)sendpacket(onion->net, send_to, packet + (1 + RETURN_1), data_len) != data_len) {
+    if ((uint32_t)sendpacket_batch(onion->net, send_to, packet + (1 + RETURN_1), data_len) != data_len) {
         return 1;
     }
 
@@ -676,6 +680,18 @@ Onion *new_onion(Mono_Time *mono_time, DHT *dht)
     new_symmetric_key(onion->secret_symmetric_key);
     onion->timestamp = mono_time_get(onion->mono_time);
 
+    onion->shared_keys_1 = shared_keys_new(DEFAULT_SHARED_KEYS_CAPACITY);
+    onion->shared_keys_2 = shared_keys_new(DEFAULT_SHARED_KEYS_CAPACITY);
+    onion->shared_keys_3 = shared_keys_new(DEFAULT_SHARED_KEYS_CAPACITY);
+
+    if (onion->shared_keys_1 == nullptr || onion->shared_keys_2 == nullptr || onion->shared_keys_3 == nullptr) {
+        shared_keys_free(onion->shared_keys_1);
+        shared_keys_free(onion->shared_keys_2);
+        shared_keys_free(onion->shared_keys_3);
+        free(onion);
+        return nullptr;
+    }
+
     networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_send_initial, onion);
     networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_1, &handle_send_1, onion);
     networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_2, &handle_send_2, onion);
@@ -701,5 +717,9 @@ void kill_onion(Onion *onion)
     networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, nullptr, nullptr);
     networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, nullptr, nullptr);
 
+    dht_forget_shared_keys(onion->dht, onion->shared_keys_1);
+    shared_keys_free(onion->shared_keys_1);
+    shared_keys_free(onion->shared_keys_2);
+    shared_keys_free(onion->shared_keys_3);
     free(onion);
 }
@@ -21,9 +21,9 @@ typedef struct Onion {
     uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
     uint64_t timestamp;
 
-    Shared_Keys shared_keys_1;
-    Shared_Keys shared_keys_2;
-    Shared_Keys shared_keys_3;
+    Shared_Keys *shared_keys_1;
+    Shared_Keys *shared_keys_2;
+    Shared_Keys *shared_keys_3;
 
     onion_recv_1_cb *recv_1_function;
     void *callback_object;
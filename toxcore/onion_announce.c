@@ -36,28 +36,47 @@ typedef struct Onion_Announce_Entry {
     uint8_t ret[ONION_RETURN_3];
     uint8_t data_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint64_t time;
+    /* Neighbours in the list of entries alive, from oldest to newest. */
+    uint16_t older;
+    uint16_t newer;
 } Onion_Announce_Entry;
 
+/* End of the list of entries alive. */
+#define NO_ENTRY ONION_ANNOUNCE_MAX_ENTRIES
+
 struct Onion_Announce {
     Mono_Time *mono_time;
     DHT     *dht;
     Networking_Core *net;
     GC_Announces_List *gc_announces_list;
     Onion_Announce_Entry entries[ONION_ANNOUNCE_MAX_ENTRIES];
+    /* Indices of the entries: the ones that timed out first, then the others
+     * from farthest to closest to us.
+     */
+    uint16_t order[ONION_ANNOUNCE_MAX_ENTRIES];
+    uint16_t num_timed_out;
+    /* Entries alive in the order they were updated, which is the order they
+     * time out in.
+     */
+    uint16_t oldest;
+    uint16_t newest;
     /* This is CRYPTO_SYMMETRIC_KEY_SIZE long just so we can use new_symmetric_key() to fill it */
     uint8_t secret_bytes[CRYPTO_SYMMETRIC_KEY_SIZE];
 
-    Shared_Keys shared_keys_recv;
+    Shared_Keys *shared_keys_recv;
 };
 
+static void update_entry(Onion_Announce *onion_a, uint32_t pos);
+
 uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry)
 {
-    return onion_a->entries[entry].public_key;
+    return onion_a->entries[onion_a->order[entry]].public_key;
 }
 
 void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t time)
 {
-    onion_a->entries[entry].time = time;
+    onion_a->entries[onion_a->order[entry]].time = time;
+    update_entry(onion_a, entry);
 }
 
 /* Create an onion announce request packet in packet of max_packet_length (recommended size ONION_ANNOUNCE_REQUEST_MIN_SIZE).
@@ -227,7 +246,7 @@ int send_announce_request(Networking_Core *net, const Onion_Path *path, Node_for
         return -1;
     }
 
-    if (sendpacket(net, path->ip_port1, packet, len) != len) {
+    if (sendpacket_batch(net, path->ip_port1, packet, len) != len) {
         return -1;
     }
 
@@ -265,7 +284,7 @@ int send_data_request(Networking_Core *net, const Onion_Path *path, IP_Port dest
         return -1;
     }
 
-    if (sendpacket(net, path->ip_port1, packet, len) != len) {
+    if (sendpacket_batch(net, path->ip_port1, packet, len) != len) {
         return -1;
     }
 
@@ -285,87 +304,162 @@ static void generate_ping_id(const Onion_Announce *onion_a, uint64_t time, const
     crypto_sha256(ping_id, data, sizeof(data));
 }
 
-/* check if public key is in entries list
+/* Find the position of the entry alive with public_key, with a binary search
+ * over the entries alive.
  *
- * return -1 if no
- * return position in list if yes
+ * return -1 if there is none.
  */
-static int in_entries(const Onion_Announce *onion_a, const uint8_t *public_key)
+static int alive_position(const Onion_Announce *onion_a, const uint8_t *public_key)
 {
-    unsigned int i;
+    const uint8_t *const self_public_key = dht_get_self_public_key(onion_a->dht);
+    uint32_t low = onion_a->num_timed_out;
+    uint32_t high = ONION_ANNOUNCE_MAX_ENTRIES;
 
-    for (i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-        if (!mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT)
-                && public_key_cmp(onion_a->entries[i].public_key, public_key) == 0) {
-            return i;
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+        const int closest = id_closest(self_public_key, onion_a->entries[onion_a->order[mid]].public_key, public_key);
+
+        if (closest == 0) {
+            return mid;
+        }
+
+        if (closest == 1) {
+            high = mid;
+        } else {
+            low = mid + 1;
         }
     }
 
     return -1;
 }
 
-typedef struct Cmp_data {
-    const Mono_Time *mono_time;
-    const uint8_t *base_public_key;
-    Onion_Announce_Entry entry;
-} Cmp_data;
-
-static int cmp_entry(const void *a, const void *b)
+static void unlink_entry(Onion_Announce *onion_a, uint16_t index)
 {
-    Cmp_data cmp1;
-    Cmp_data cmp2;
-    memcpy(&cmp1, a, sizeof(Cmp_data));
-    memcpy(&cmp2, b, sizeof(Cmp_data));
-    Onion_Announce_Entry entry1 = cmp1.entry;
-    Onion_Announce_Entry entry2 = cmp2.entry;
-    const uint8_t *cmp_public_key = cmp1.base_public_key;
-
-    int t1 = mono_time_is_timeout(cmp1.mono_time, entry1.time, ONION_ANNOUNCE_TIMEOUT);
-    int t2 = mono_time_is_timeout(cmp1.mono_time, entry2.time, ONION_ANNOUNCE_TIMEOUT);
+    Onion_Announce_Entry *const entry = &onion_a->entries[index];
 
-    if (t1 && t2) {
-        return 0;
+    if (entry->older == NO_ENTRY) {
+        onion_a->oldest = entry->newer;
+    } else {
+        onion_a->entries[entry->older].newer = entry->newer;
     }
 
-    if (t1) {
-        return -1;
+    if (entry->newer == NO_ENTRY) {
+        onion_a->newest = entry->older;
+    } else {
+        onion_a->entries[entry->newer].older = entry->older;
     }
+}
 
-    if (t2) {
-        return 1;
+/* Put the entry in the list of entries alive behind the ones updated before
+ * it. That is the newest one unless a test set an older time.
+ */
+static void link_entry(Onion_Announce *onion_a, uint16_t index)
+{
+    Onion_Announce_Entry *const entry = &onion_a->entries[index];
+    uint16_t older = onion_a->newest;
+
+    while (older != NO_ENTRY && onion_a->entries[older].time > entry->time) {
+        older = onion_a->entries[older].older;
     }
 
-    int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
+    entry->older = older;
 
-    if (close == 1) {
-        return 1;
+    if (older == NO_ENTRY) {
+        entry->newer = onion_a->oldest;
+        onion_a->oldest = index;
+    } else {
+        entry->newer = onion_a->entries[older].newer;
+        onion_a->entries[older].newer = index;
     }
 
-    if (close == 2) {
-        return -1;
+    if (entry->newer == NO_ENTRY) {
+        onion_a->newest = index;
+    } else {
+        onion_a->entries[entry->newer].older = index;
     }
+}
 
-    return 0;
+/* Move the entries that timed out since the last call in front of the ones
+ * alive. They come off the front of the list of entries alive, so this only
+ * looks at the entries that timed out and the oldest one still alive.
+ */
+static void expire_entries(Onion_Announce *onion_a)
+{
+    uint16_t *const order = onion_a->order;
+
+    while (onion_a->oldest != NO_ENTRY
+            && mono_time_is_timeout(onion_a->mono_time, onion_a->entries[onion_a->oldest].time, ONION_ANNOUNCE_TIMEOUT)) {
+        const uint16_t index = onion_a->oldest;
+        const int pos = alive_position(onion_a, onion_a->entries[index].public_key);
+
+        unlink_entry(onion_a, index);
+
+        if (pos == -1) {
+            continue;
+        }
+
+        memmove(&order[onion_a->num_timed_out + 1], &order[onion_a->num_timed_out],
+                (pos - onion_a->num_timed_out) * sizeof(uint16_t));
+        order[onion_a->num_timed_out] = index;
+        ++onion_a->num_timed_out;
+    }
 }
 
-static void sort_onion_announce_list(Onion_Announce_Entry *list, unsigned int length, const Mono_Time *mono_time,
-                                     const uint8_t *comp_public_key)
+/* Move the entry at pos, which was just updated, to its place among the
+ * entries alive with a binary search, and to the newest end of the list of
+ * entries alive.
+ */
+static void update_entry(Onion_Announce *onion_a, uint32_t pos)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
-    VLA(Cmp_data, cmp_list, length);
+    uint16_t *const order = onion_a->order;
+    const uint16_t index = order[pos];
+
+    /* Take the entry out. */
+    if (pos < onion_a->num_timed_out) {
+        --onion_a->num_timed_out;
+    } else {
+        unlink_entry(onion_a, index);
+    }
 
-    for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].mono_time = mono_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
+    memmove(&order[pos], &order[pos + 1], (ONION_ANNOUNCE_MAX_ENTRIES - 1 - pos) * sizeof(uint16_t));
+
+    /* Find the first entry alive that is closer than the updated one. */
+    const uint8_t *const self_public_key = dht_get_self_public_key(onion_a->dht);
+    const uint8_t *const public_key = onion_a->entries[index].public_key;
+    uint32_t low = onion_a->num_timed_out;
+    uint32_t high = ONION_ANNOUNCE_MAX_ENTRIES - 1;
+
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+
+        if (id_closest(self_public_key, onion_a->entries[order[mid]].public_key, public_key) == 1) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
     }
 
-    qsort(cmp_list, length, sizeof(Cmp_data), cmp_entry);
+    memmove(&order[low + 1], &order[low], (ONION_ANNOUNCE_MAX_ENTRIES - 1 - low) * sizeof(uint16_t));
+    order[low] = index;
+    link_entry(onion_a, index);
+}
+
+/* check if public key is in entries list
+ *
+ * return -1 if no
+ * return index of the entry if yes
+ */
+static int in_entries(Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    expire_entries(onion_a);
+
+    const int pos = alive_position(onion_a, public_key);
 
-    for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
+    if (pos == -1) {
+        return -1;
     }
+
+    return onion_a->order[pos];
 }
 
 /* add entry to entries list
@@ -377,18 +471,17 @@ static int add_to_entries(Onion_Announce *onion_a, IP_Port ret_ip_port, const ui
                           const uint8_t *data_public_key, const uint8_t *ret)
 {
 
-    int pos = in_entries(onion_a, public_key);
+    expire_entries(onion_a);
 
-    if (pos == -1) {
-        for (unsigned i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-            if (mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].time, ONION_ANNOUNCE_TIMEOUT)) {
-                pos = i;
-            }
-        }
+    int pos = alive_position(onion_a, public_key);
+
+    if (pos == -1 && onion_a->num_timed_out > 0) {
+        pos = onion_a->num_timed_out - 1;
     }
 
     if (pos == -1) {
-        if (id_closest(dht_get_self_public_key(onion_a->dht), public_key, onion_a->entries[0].public_key) == 1) {
+        if (id_closest(dht_get_self_public_key(onion_a->dht), public_key,
+                       onion_a->entries[onion_a->order[0]].public_key) == 1) {
             pos = 0;
         }
     }
@@ -397,15 +490,17 @@ static int add_to_entries(Onion_Announce *onion_a, IP_Port ret_ip_port, const ui
         return -1;
     }
 
-    memcpy(onion_a->entries[pos].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].ret_ip_port = ret_ip_port;
-    memcpy(onion_a->entries[pos].ret, ret, ONION_RETURN_3);
-    memcpy(onion_a->entries[pos].data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].time = mono_time_get(onion_a->mono_time);
+    const uint16_t index = onion_a->order[pos];
+    Onion_Announce_Entry *const entry = &onion_a->entries[index];
 
-    sort_onion_announce_list(onion_a->entries, ONION_ANNOUNCE_MAX_ENTRIES, onion_a->mono_time,
-                             dht_get_self_public_key(onion_a->dht));
-    return in_entries(onion_a, public_key);
+    memcpy(entry->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    entry->ret_ip_port = ret_ip_port;
+    memcpy(entry->ret, ret, ONION_RETURN_3);
+    memcpy(entry->data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    entry->time = mono_time_get(onion_a->mono_time);
+
+    update_entry(onion_a, pos);
+    return index;
 }
 
 static int handle_gca_announce_request(Onion_Announce *onion_a, IP_Port source, const uint8_t *packet, uint16_t length)
@@ -420,7 +515,7 @@ static int handle_gca_announce_request(Onion_Announce *onion_a, IP_Port source,
 
     const uint8_t *packet_public_key = packet + 1 + CRYPTO_NONCE_SIZE;
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion_a->mono_time, &onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
+    get_shared_key(onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
                    packet_public_key);
 
     size_t minimal_size = ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE * 2 + ONION_ANNOUNCE_SENDBACK_DATA_LENGTH;
@@ -553,7 +648,7 @@ static int handle_announce_request(void *object, IP_Port source, const uint8_t *
 
     const uint8_t *packet_public_key = packet + 1 + CRYPTO_NONCE_SIZE;
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion_a->mono_time, &onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
+    get_shared_key(onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
                    packet_public_key);
 
     uint8_t plain[ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_PUBLIC_KEY_SIZE +
@@ -656,7 +751,7 @@ static int handle_announce_request_old(void *object, IP_Port source, const uint8
 
     const uint8_t *packet_public_key = packet + 1 + CRYPTO_NONCE_SIZE;
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    get_shared_key(onion_a->mono_time, &onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
+    get_shared_key(onion_a->shared_keys_recv, shared_key, dht_get_self_secret_key(onion_a->dht),
                    packet_public_key);
 
     uint8_t plain[ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_PUBLIC_KEY_SIZE +
@@ -802,6 +897,21 @@ Onion_Announce *new_onion_announce(Mono_Time *mono_time, DHT *dht, GC_Announces_
     onion_a->net = dht_get_net(dht);
     new_symmetric_key(onion_a->secret_bytes);
 
+    for (uint16_t i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
+        onion_a->order[i] = i;
+    }
+
+    onion_a->num_timed_out = ONION_ANNOUNCE_MAX_ENTRIES;
+    onion_a->oldest = NO_ENTRY;
+    onion_a->newest = NO_ENTRY;
+
+    onion_a->shared_keys_recv = shared_keys_new(DEFAULT_SHARED_KEYS_CAPACITY);
+
+    if (onion_a->shared_keys_recv == nullptr) {
+        free(onion_a);
+        return nullptr;
+    }
+
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST, &handle_announce_request, onion_a);
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST_OLD, &handle_announce_request_old, onion_a);
     networking_registerhandler(onion_a->net, NET_PACKET_ONION_DATA_REQUEST, &handle_data_request, onion_a);
@@ -818,6 +928,7 @@ void kill_onion_announce(Onion_Announce *onion_a)
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST, nullptr, nullptr);
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST_OLD, nullptr, nullptr);
     networking_registerhandler(onion_a->net, NET_PACKET_ONION_DATA_REQUEST, nullptr, nullptr);
+    shared_keys_free(onion_a->shared_keys_recv);
     free(onion_a);
 }
 
@@ -662,9 +662,9 @@ static int client_send_announce_request(Onion_Client *onion_c, uint32_t num, IP_
 }
 
 typedef struct Onion_Client_Cmp_data {
-    const Mono_Time *mono_time;
-    const uint8_t *base_public_key;
-    Onion_Node entry;
+    Pk_Distance distance;
+    bool timed_out;
+    uint32_t index;
 } Onion_Client_Cmp_data;
 
 static int onion_client_cmp_entry(const void *a, const void *b)
@@ -673,56 +673,45 @@ static int onion_client_cmp_entry(const void *a, const void *b)
     Onion_Client_Cmp_data cmp2;
     memcpy(&cmp1, a, sizeof(Onion_Client_Cmp_data));
     memcpy(&cmp2, b, sizeof(Onion_Client_Cmp_data));
-    Onion_Node entry1 = cmp1.entry;
-    Onion_Node entry2 = cmp2.entry;
-    const uint8_t *cmp_public_key = cmp1.base_public_key;
 
-    int t1 = onion_node_timed_out(&entry1, cmp1.mono_time);
-    int t2 = onion_node_timed_out(&entry2, cmp2.mono_time);
-
-    if (t1 && t2) {
+    if (cmp1.timed_out && cmp2.timed_out) {
         return 0;
     }
 
-    if (t1) {
+    if (cmp1.timed_out) {
         return -1;
     }
 
-    if (t2) {
-        return 1;
-    }
-
-    int close = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
-
-    if (close == 1) {
+    if (cmp2.timed_out) {
         return 1;
     }
 
-    if (close == 2) {
-        return -1;
-    }
-
-    return 0;
+    /* Closest entries last. */
+    return pk_distance_cmp(&cmp2.distance, &cmp1.distance);
 }
 
 static void sort_onion_node_list(Onion_Node *list, unsigned int length, const Mono_Time *mono_time,
                                  const uint8_t *comp_public_key)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
+    // Compute whether each entry timed out and its distance once, so that
+    // the comparison function only compares integers.
     VLA(Onion_Client_Cmp_data, cmp_list, length);
 
     for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].mono_time = mono_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
+        cmp_list[i].timed_out = onion_node_timed_out(&list[i], mono_time);
+        pk_distance(&cmp_list[i].distance, comp_public_key, list[i].public_key);
+        cmp_list[i].index = i;
     }
 
     qsort(cmp_list, length, sizeof(Onion_Client_Cmp_data), onion_client_cmp_entry);
 
+    VLA(Onion_Node, sorted, length);
+
     for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
+        sorted[i] = list[cmp_list[i].index];
     }
+
+    memcpy(list, sorted, length * sizeof(Onion_Node));
 }
 
 static int client_add_to_list(Onion_Client *onion_c, uint32_t num, const uint8_t *public_key, IP_Port ip_port,
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Growable ring buffers of the packets in flight on a net_crypto connection.
+ */
+#include "packets_array.h"
+
+#include <stdlib.h>
+
+#include "ccompat.h"
+
+uint32_t num_packets_array(const Packets_Array *array)
+{
+    return array->buffer_end - array->buffer_start;
+}
+
+uint32_t packets_array_slot(const Packets_Array *array, uint32_t number)
+{
+    return number % array->size;
+}
+
+/* Move the packets of the array to a buffer with size slots.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+static int resize_packets_array(Packets_Array *array, uint32_t size)
+{
+    Packet_Data **buffer = (Packet_Data **)calloc(size, sizeof(Packet_Data *));
+
+    if (buffer == nullptr) {
+        return -1;
+    }
+
+    for (uint32_t i = array->buffer_start; i != array->buffer_end; ++i) {
+        buffer[i % size] = array->buffer[packets_array_slot(array, i)];
+    }
+
+    free(array->buffer);
+    array->buffer = buffer;
+    array->size = size;
+    return 0;
+}
+
+int reserve_packets_array(Packets_Array *array, uint32_t num)
+{
+    if (num > PACKETS_ARRAY_MAX_SIZE) {
+        return -1;
+    }
+
+    if (array->peak < num) {
+        array->peak = num;
+    }
+
+    uint32_t size = array->size;
+
+    while (size < num) {
+        size *= 2;
+    }
+
+    if (size == array->size) {
+        return 0;
+    }
+
+    return resize_packets_array(array, size);
+}
+
+void shrink_packets_array(Packets_Array *array)
+{
+    if (array->size > PACKETS_ARRAY_MIN_SIZE && array->peak <= array->size / 4) {
+        /* On failure the array keeps the bigger buffer. */
+        resize_packets_array(array, array->size / 2);
+    }
+
+    array->peak = num_packets_array(array);
+}
+
+Packets_Array *new_packets_array(void)
+{
+    Packets_Array *array = (Packets_Array *)calloc(1, sizeof(Packets_Array));
+
+    if (array == nullptr) {
+        return nullptr;
+    }
+
+    array->buffer = (Packet_Data **)calloc(PACKETS_ARRAY_MIN_SIZE, sizeof(Packet_Data *));
+
+    if (array->buffer == nullptr) {
+        free(array);
+        return nullptr;
+    }
+
+    array->size = PACKETS_ARRAY_MIN_SIZE;
+    return array;
+}
+
+void kill_packets_array(Packets_Array *array)
+{
+    if (array != nullptr) {
+        free(array->buffer);
+        free(array);
+    }
+}
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Growable ring buffers of the packets in flight on a net_crypto connection,
+ * indexed by packet number.
+ *
+ * Packet numbers are 32 bit and wrap around. The buffer always has a power of
+ * 2 slots, so packet number n is in slot n % size on both sides of the wrap.
+ */
+#ifndef C_TOXCORE_TOXCORE_PACKETS_ARRAY_H
+#define C_TOXCORE_TOXCORE_PACKETS_ARRAY_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Arrays start with this many slots and double as packets fill them. Must be
+ * a power of 2.
+ */
+#define PACKETS_ARRAY_MIN_SIZE 32
+
+/* Most slots an array can have. */
+#define PACKETS_ARRAY_MAX_SIZE (UINT32_C(1) << 31)
+
+typedef struct Packet_Data Packet_Data;
+
+typedef struct Packets_Array {
+    /* size slots. There are always at least as many as packets in the array. */
+    Packet_Data **buffer;
+    uint32_t  size;
+    /* Most packets that were in the array since shrink_packets_array() last ran. */
+    uint32_t  peak;
+    uint32_t  buffer_start;
+    uint32_t  buffer_end; /* packet numbers in array: `{buffer_start, buffer_end)` */
+} Packets_Array;
+
+/* Return number of packets in array
+ * Note that holes are counted too.
+ */
+uint32_t num_packets_array(const Packets_Array *array);
+
+/* return the slot of packet number in the array buffer. */
+uint32_t packets_array_slot(const Packets_Array *array, uint32_t number);
+
+/* Double the array buffer until it has slots for num packets from
+ * buffer_start on.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int reserve_packets_array(Packets_Array *array, uint32_t num);
+
+/* Halve the array buffer if the array never used more than a quarter of it
+ * since the last call, so connections done with a bulk transfer give the
+ * memory back a step at a time.
+ */
+void shrink_packets_array(Packets_Array *array);
+
+/* return a new empty array, null on failure. */
+Packets_Array *new_packets_array(void);
+
+/* Free an empty array. The packets it holds are not freed. */
+void kill_packets_array(Packets_Array *array);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif // C_TOXCORE_TOXCORE_PACKETS_ARRAY_H
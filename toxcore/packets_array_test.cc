@@ -0,0 +1,133 @@
+#include "packets_array.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <memory>
+
+namespace {
+
+struct Packets_Array_Deleter {
+  void operator()(Packets_Array *array) { kill_packets_array(array); }
+};
+
+using Packets_Array_Ptr = std::unique_ptr<Packets_Array, Packets_Array_Deleter>;
+
+// Stand-ins for packets: the array only stores the pointers.
+std::array<char, 256> packets;
+
+Packet_Data *packet(uint32_t number) {
+  return reinterpret_cast<Packet_Data *>(&packets[number % packets.size()]);
+}
+
+void add_packet(Packets_Array *array) {
+  ASSERT_EQ(reserve_packets_array(array, num_packets_array(array) + 1), 0);
+  array->buffer[packets_array_slot(array, array->buffer_end)] = packet(array->buffer_end);
+  ++array->buffer_end;
+}
+
+void remove_packet(Packets_Array *array) {
+  array->buffer[packets_array_slot(array, array->buffer_start)] = nullptr;
+  ++array->buffer_start;
+}
+
+void expect_packets(const Packets_Array *array) {
+  for (uint32_t i = array->buffer_start; i != array->buffer_end; ++i) {
+    EXPECT_EQ(array->buffer[packets_array_slot(array, i)], packet(i)) << "packet " << i;
+  }
+}
+
+Packets_Array_Ptr array_at(uint32_t number) {
+  Packets_Array_Ptr array(new_packets_array());
+
+  if (array != nullptr) {
+    array->buffer_start = number;
+    array->buffer_end = number;
+  }
+
+  return array;
+}
+
+TEST(PacketsArray, StartsSmall) {
+  Packets_Array_Ptr const array(new_packets_array());
+  ASSERT_NE(array, nullptr);
+  EXPECT_EQ(array->size, PACKETS_ARRAY_MIN_SIZE);
+  EXPECT_EQ(num_packets_array(array.get()), 0);
+}
+
+TEST(PacketsArray, GrowsAcrossTheWrap) {
+  Packets_Array_Ptr const array = array_at(UINT32_MAX - 40);
+  ASSERT_NE(array, nullptr);
+
+  for (uint32_t i = 0; i < 100; ++i) {
+    add_packet(array.get());
+  }
+
+  EXPECT_EQ(array->size, 128);
+  EXPECT_EQ(array->buffer_end, 59);
+  EXPECT_EQ(num_packets_array(array.get()), 100);
+  expect_packets(array.get());
+}
+
+TEST(PacketsArray, ShrinksAcrossTheWrap) {
+  Packets_Array_Ptr const array = array_at(UINT32_MAX - 100);
+  ASSERT_NE(array, nullptr);
+
+  for (uint32_t i = 0; i < 120; ++i) {
+    add_packet(array.get());
+  }
+
+  for (uint32_t i = 0; i < 110; ++i) {
+    remove_packet(array.get());
+  }
+
+  ASSERT_EQ(array->size, 128);
+
+  // The array held 120 packets since it was last shrunk.
+  shrink_packets_array(array.get());
+  EXPECT_EQ(array->size, 128);
+
+  // Then only the 10 left, a step at a time down to the smallest size.
+  shrink_packets_array(array.get());
+  EXPECT_EQ(array->size, 64);
+  expect_packets(array.get());
+
+  shrink_packets_array(array.get());
+  EXPECT_EQ(array->size, PACKETS_ARRAY_MIN_SIZE);
+  expect_packets(array.get());
+
+  shrink_packets_array(array.get());
+  EXPECT_EQ(array->size, PACKETS_ARRAY_MIN_SIZE);
+
+  // And grows again.
+  for (uint32_t i = 0; i < 30; ++i) {
+    add_packet(array.get());
+  }
+
+  EXPECT_EQ(array->size, 64);
+  EXPECT_EQ(num_packets_array(array.get()), 40);
+  expect_packets(array.get());
+}
+
+TEST(PacketsArray, ReservingKeepsTheArrayFromShrinking) {
+  Packets_Array_Ptr const array(new_packets_array());
+  ASSERT_NE(array, nullptr);
+
+  ASSERT_EQ(reserve_packets_array(array.get(), 200), 0);
+  EXPECT_EQ(array->size, 256);
+
+  shrink_packets_array(array.get());
+  EXPECT_EQ(array->size, 256);
+
+  shrink_packets_array(array.get());
+  EXPECT_EQ(array->size, 128);
+}
+
+TEST(PacketsArray, RefusesTooManyPackets) {
+  Packets_Array_Ptr const array(new_packets_array());
+  ASSERT_NE(array, nullptr);
+  EXPECT_EQ(reserve_packets_array(array.get(), PACKETS_ARRAY_MAX_SIZE + 1), -1);
+  EXPECT_EQ(array->size, PACKETS_ARRAY_MIN_SIZE);
+}
+
+}  // namespace
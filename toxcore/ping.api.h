@@ -15,6 +15,9 @@
 #include "network.h"
 
 #include <stdint.h>
+
+#define PING_PLAIN_SIZE (1 + sizeof(uint64_t))
+#define DHT_PING_SIZE (1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + PING_PLAIN_SIZE + CRYPTO_MAC_SIZE)
 %}
 
 class iP_Port { struct this; }
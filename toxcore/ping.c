@@ -41,8 +41,6 @@ struct Ping {
 };
 
 
-#define PING_PLAIN_SIZE (1 + sizeof(uint64_t))
-#define DHT_PING_SIZE (1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + PING_PLAIN_SIZE + CRYPTO_MAC_SIZE)
 #define PING_DATA_SIZE (CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port))
 
 int32_t ping_send_request(Ping *ping, IP_Port ipp, const uint8_t *public_key)
@@ -87,7 +85,7 @@ int32_t ping_send_request(Ping *ping, IP_Port ipp, const uint8_t *public_key)
         return 1;
     }
 
-    return sendpacket(dht_get_net(ping->dht), ipp, pk, sizeof(pk));
+    return sendpacket_batch(dht_get_net(ping->dht), ipp, pk, sizeof(pk));
 }
 
 static int ping_send_response(Ping *ping, IP_Port ipp, const uint8_t *public_key, uint64_t ping_id,
@@ -118,7 +116,7 @@ static int ping_send_response(Ping *ping, IP_Port ipp, const uint8_t *public_key
         return 1;
     }
 
-    return sendpacket(dht_get_net(ping->dht), ipp, pk, sizeof(pk));
+    return sendpacket_batch(dht_get_net(ping->dht), ipp, pk, sizeof(pk));
 }
 
 static int handle_ping_request(void *object, IP_Port source, const uint8_t *packet, uint16_t length, void *userdata)
@@ -139,8 +137,11 @@ static int handle_ping_request(void *object, IP_Port source, const uint8_t *pack
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
 
     uint8_t ping_plain[PING_PLAIN_SIZE];
+    if (!dht_get_shared_key_recv_or_park(dht, shared_key, packet + 1, source, packet, length)) {
+        return 1;
+    }
+
     // Decrypt ping_id
-    dht_get_shared_key_recv(dht, shared_key, packet + 1);
     rc = decrypt_data_symmetric(shared_key,
                                 packet + 1 + CRYPTO_PUBLIC_KEY_SIZE,
                                 packet + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE,
@@ -0,0 +1,207 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Per source IP rate limits for incoming UDP packets.
+ */
+#include "rate_limit.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "ccompat.h"
+#include "util.h"
+
+/* Buckets are locked in this many stripes, so that sockets on different
+ * threads rarely wait for each other.
+ */
+#define RATE_LIMIT_STRIPES 16
+
+/* Tokens are counted in thousandths of a packet, so that a bucket refills a
+ * little with every millisecond even at low rates.
+ */
+#define RATE_LIMIT_TOKEN 1000
+
+#define RATE_LIMIT_MAX_BURST (UINT32_MAX / RATE_LIMIT_TOKEN)
+
+/* Longest time a bucket is refilled for at once, to keep the arithmetic in range. */
+#define RATE_LIMIT_MAX_REFILL 3600000
+
+typedef struct Rate_Rule {
+    uint32_t rate;
+    uint32_t burst;
+} Rate_Rule;
+
+typedef struct Rate_Bucket {
+    /* High bits of the hash of the source and packet ID using this bucket, 0 if unused. */
+    uint32_t tag;
+    uint32_t tokens;
+    uint64_t last_refill;
+} Rate_Bucket;
+
+typedef struct Rate_Stripe {
+    pthread_mutex_t lock;
+    uint64_t dropped[256];
+} Rate_Stripe;
+
+struct Rate_Limit {
+    Mono_Time *mono_time;
+    uint64_t hash_key;
+
+    Rate_Rule rules[256];
+    Rate_Stripe *stripes;
+    Rate_Bucket buckets[RATE_LIMIT_BUCKETS];
+};
+
+Rate_Limit *rate_limit_new(Mono_Time *mono_time)
+{
+    Rate_Limit *rate_limit = (Rate_Limit *)calloc(1, sizeof(Rate_Limit));
+
+    if (rate_limit == nullptr) {
+        return nullptr;
+    }
+
+    rate_limit->stripes = (Rate_Stripe *)calloc(RATE_LIMIT_STRIPES, sizeof(Rate_Stripe));
+
+    if (rate_limit->stripes == nullptr) {
+        free(rate_limit);
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < RATE_LIMIT_STRIPES; ++i) {
+        if (pthread_mutex_init(&rate_limit->stripes[i].lock, nullptr) != 0) {
+            for (uint32_t j = 0; j < i; ++j) {
+                pthread_mutex_destroy(&rate_limit->stripes[j].lock);
+            }
+
+            free(rate_limit->stripes);
+            free(rate_limit);
+            return nullptr;
+        }
+    }
+
+    rate_limit->mono_time = mono_time;
+    rate_limit->hash_key = random_u64();
+    return rate_limit;
+}
+
+void rate_limit_kill(Rate_Limit *rate_limit)
+{
+    if (rate_limit == nullptr) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < RATE_LIMIT_STRIPES; ++i) {
+        pthread_mutex_destroy(&rate_limit->stripes[i].lock);
+    }
+
+    free(rate_limit->stripes);
+    free(rate_limit);
+}
+
+void rate_limit_set(Rate_Limit *rate_limit, uint8_t packet_id, uint32_t rate, uint32_t burst)
+{
+    rate_limit->rules[packet_id].rate = rate;
+    rate_limit->rules[packet_id].burst = min_u32(max_u32(burst, 1), RATE_LIMIT_MAX_BURST);
+}
+
+static uint64_t mix_u64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+    return x;
+}
+
+/* Hash of the source address, or of its /64 network for IPv6, and the packet
+ * ID. The key is random, so that nobody can pick addresses that collide with
+ * someone else's.
+ */
+static uint64_t source_hash(uint64_t hash_key, const IP *ip, uint8_t packet_id)
+{
+    uint64_t address;
+
+    if (net_family_is_ipv6(ip->family)) {
+        address = ip->ip.v6.uint64[0];
+    } else {
+        address = ip->ip.v4.uint32;
+    }
+
+    const uint64_t kind = ((uint64_t)ip->family.value << 8) | packet_id;
+    return mix_u64(mix_u64(address ^ hash_key) ^ kind);
+}
+
+bool rate_limit_allow(Rate_Limit *rate_limit, const IP *ip, uint8_t packet_id)
+{
+    const Rate_Rule rule = rate_limit->rules[packet_id];
+
+    if (rule.rate == 0) {
+        return true;
+    }
+
+    const uint64_t hash = source_hash(rate_limit->hash_key, ip, packet_id);
+    const uint32_t index = hash % RATE_LIMIT_BUCKETS;
+    const uint32_t tag = (uint32_t)(hash >> 32) | 1;
+    const uint32_t full = rule.burst * RATE_LIMIT_TOKEN;
+    const uint64_t now = current_time_monotonic_coarse(rate_limit->mono_time);
+
+    Rate_Stripe *const stripe = &rate_limit->stripes[index % RATE_LIMIT_STRIPES];
+    Rate_Bucket *const bucket = &rate_limit->buckets[index];
+
+    pthread_mutex_lock(&stripe->lock);
+
+    const uint64_t elapsed = min_u64(now - min_u64(bucket->last_refill, now), RATE_LIMIT_MAX_REFILL);
+    const uint64_t tokens = min_u64(bucket->tokens + elapsed * rule.rate, full);
+
+    if (bucket->tag != tag && (bucket->tag == 0 || tokens == full)) {
+        /* The bucket is unused, or its owner has been quiet for long enough to
+         * have nothing left to lose. Otherwise the new source shares it.
+         */
+        bucket->tag = tag;
+        bucket->tokens = full;
+    } else {
+        bucket->tokens = (uint32_t)tokens;
+    }
+
+    bucket->last_refill = now;
+
+    bool allowed = true;
+
+    if (bucket->tokens >= RATE_LIMIT_TOKEN) {
+        bucket->tokens -= RATE_LIMIT_TOKEN;
+    } else {
+        ++stripe->dropped[packet_id];
+        allowed = false;
+    }
+
+    pthread_mutex_unlock(&stripe->lock);
+    return allowed;
+}
+
+uint64_t rate_limit_dropped(const Rate_Limit *rate_limit, uint8_t packet_id)
+{
+    uint64_t dropped = 0;
+
+    for (uint32_t i = 0; i < RATE_LIMIT_STRIPES; ++i) {
+        Rate_Stripe *const stripe = &rate_limit->stripes[i];
+        pthread_mutex_lock(&stripe->lock);
+        dropped += stripe->dropped[packet_id];
+        pthread_mutex_unlock(&stripe->lock);
+    }
+
+    return dropped;
+}
+
+uint64_t rate_limit_dropped_total(const Rate_Limit *rate_limit)
+{
+    uint64_t dropped = 0;
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        dropped += rate_limit_dropped(rate_limit, i);
+    }
+
+    return dropped;
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Per source IP rate limits for incoming UDP packets.
+ *
+ * Every source IP gets a token bucket for each packet ID that has a limit.
+ * The buckets live in a fixed size hash table, so a flood from many addresses
+ * costs no memory. Addresses whose buckets collide share them, which can only
+ * make their limit stricter. IPv6 addresses are limited per /64 network,
+ * because that's what a single host usually gets.
+ *
+ * The check runs before the packet handlers, so dropped packets never cost a
+ * decryption or a reply. One limiter can be shared by several sockets on
+ * different threads.
+ */
+#ifndef C_TOXCORE_TOXCORE_RATE_LIMIT_H
+#define C_TOXCORE_TOXCORE_RATE_LIMIT_H
+
+#include "mono_time.h"
+#include "network.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of token buckets shared by all sources and packet IDs. */
+#define RATE_LIMIT_BUCKETS 4096
+
+/* return NULL on failure. */
+Rate_Limit *rate_limit_new(Mono_Time *mono_time);
+
+void rate_limit_kill(Rate_Limit *rate_limit);
+
+/* Allow each source IP to send rate packets per second with the given packet
+ * ID, after a burst of up to burst packets. A rate of 0 removes the limit,
+ * which is the default for all packet IDs.
+ */
+void rate_limit_set(Rate_Limit *rate_limit, uint8_t packet_id, uint32_t rate, uint32_t burst);
+
+/* Take a token from the bucket of ip for packet_id.
+ *
+ * return true if the packet may be handled.
+ * return false if it should be dropped.
+ */
+bool rate_limit_allow(Rate_Limit *rate_limit, const IP *ip, uint8_t packet_id);
+
+/* Number of packets with the given packet ID dropped so far. */
+uint64_t rate_limit_dropped(const Rate_Limit *rate_limit, uint8_t packet_id);
+
+/* Number of packets dropped so far, over all packet IDs. */
+uint64_t rate_limit_dropped_total(const Rate_Limit *rate_limit);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif // C_TOXCORE_TOXCORE_RATE_LIMIT_H
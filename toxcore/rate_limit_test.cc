@@ -0,0 +1,120 @@
+#include "rate_limit.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+namespace {
+
+struct Mono_Time_Deleter {
+  void operator()(Mono_Time *mono_time) { mono_time_free(mono_time); }
+};
+
+struct Rate_Limit_Deleter {
+  void operator()(Rate_Limit *rate_limit) { rate_limit_kill(rate_limit); }
+};
+
+using Mono_Time_Ptr = std::unique_ptr<Mono_Time, Mono_Time_Deleter>;
+using Rate_Limit_Ptr = std::unique_ptr<Rate_Limit, Rate_Limit_Deleter>;
+
+uint64_t test_time_callback(Mono_Time *mono_time, void *user_data) {
+  return *static_cast<uint64_t *>(user_data);
+}
+
+IP ip4(uint32_t last) {
+  IP ip;
+  ip_init(&ip, false);
+  ip.ip.v4.uint32 = net_htonl(0x0a000000 | last);
+  return ip;
+}
+
+IP ip6(uint8_t network, uint8_t host) {
+  IP ip;
+  ip_init(&ip, true);
+  ip.ip.v6.uint8[0] = 0x20;
+  ip.ip.v6.uint8[1] = 0x01;
+  ip.ip.v6.uint8[7] = network;
+  ip.ip.v6.uint8[15] = host;
+  return ip;
+}
+
+class RateLimit : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mono_time_.reset(mono_time_new());
+    mono_time_set_current_time_callback(mono_time_.get(), test_time_callback, &time_);
+    rate_limit_.reset(rate_limit_new(mono_time_.get()));
+    ASSERT_NE(rate_limit_, nullptr);
+  }
+
+  uint32_t send(const IP &ip, uint8_t packet_id, uint32_t count) {
+    uint32_t allowed = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+      allowed += rate_limit_allow(rate_limit_.get(), &ip, packet_id);
+    }
+
+    return allowed;
+  }
+
+  uint64_t time_ = 1000;
+  Mono_Time_Ptr mono_time_;
+  Rate_Limit_Ptr rate_limit_;
+};
+
+TEST_F(RateLimit, NoLimitByDefault) {
+  EXPECT_EQ(send(ip4(1), NET_PACKET_GET_NODES, 10000), 10000);
+  EXPECT_EQ(rate_limit_dropped_total(rate_limit_.get()), 0);
+}
+
+TEST_F(RateLimit, BurstThenRate) {
+  rate_limit_set(rate_limit_.get(), NET_PACKET_GET_NODES, 10, 5);
+
+  EXPECT_EQ(send(ip4(1), NET_PACKET_GET_NODES, 20), 5);
+
+  time_ += 100;
+  EXPECT_EQ(send(ip4(1), NET_PACKET_GET_NODES, 20), 1);
+
+  time_ += 1000;
+  EXPECT_EQ(send(ip4(1), NET_PACKET_GET_NODES, 20), 5);
+
+  EXPECT_EQ(rate_limit_dropped(rate_limit_.get(), NET_PACKET_GET_NODES), 15 + 19 + 15);
+  EXPECT_EQ(rate_limit_dropped_total(rate_limit_.get()), 15 + 19 + 15);
+}
+
+TEST_F(RateLimit, OnlyLimitedPacketIdsAreDropped) {
+  rate_limit_set(rate_limit_.get(), NET_PACKET_PING_REQUEST, 1, 1);
+
+  EXPECT_EQ(send(ip4(1), NET_PACKET_PING_REQUEST, 10), 1);
+  EXPECT_EQ(send(ip4(1), NET_PACKET_PING_RESPONSE, 10), 10);
+  EXPECT_EQ(rate_limit_dropped(rate_limit_.get(), NET_PACKET_PING_REQUEST), 9);
+  EXPECT_EQ(rate_limit_dropped(rate_limit_.get(), NET_PACKET_PING_RESPONSE), 0);
+
+  rate_limit_set(rate_limit_.get(), NET_PACKET_PING_REQUEST, 0, 0);
+  EXPECT_EQ(send(ip4(1), NET_PACKET_PING_REQUEST, 10), 10);
+}
+
+TEST_F(RateLimit, FloodDoesNotLimitOtherSources) {
+  rate_limit_set(rate_limit_.get(), NET_PACKET_GET_NODES, 10, 10);
+
+  EXPECT_EQ(send(ip4(1), NET_PACKET_GET_NODES, 1000), 10);
+
+  // Sources that share a bucket with the flood are limited with it, but with
+  // 4096 buckets that's rare.
+  uint32_t allowed = 0;
+
+  for (uint32_t i = 2; i < 102; ++i) {
+    allowed += send(ip4(i), NET_PACKET_GET_NODES, 1);
+  }
+
+  EXPECT_GE(allowed, 95);
+}
+
+TEST_F(RateLimit, Ipv6NetworksShareTheirLimit) {
+  rate_limit_set(rate_limit_.get(), NET_PACKET_GET_NODES, 1, 4);
+
+  EXPECT_EQ(send(ip6(1, 1), NET_PACKET_GET_NODES, 2), 2);
+  EXPECT_EQ(send(ip6(1, 2), NET_PACKET_GET_NODES, 4), 2);
+}
+
+}  // namespace
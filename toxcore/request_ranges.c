@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Ranges of missing packets in net_crypto request packets.
+ */
+#include "request_ranges.h"
+
+#include "ccompat.h"
+
+static uint16_t write_number(uint8_t *data, uint16_t length, uint16_t max_length, uint32_t number)
+{
+    do {
+        if (length >= max_length) {
+            return 0;
+        }
+
+        uint8_t byte = number & 0x7f;
+        number >>= 7;
+
+        if (number != 0) {
+            byte |= 0x80;
+        }
+
+        data[length] = byte;
+        ++length;
+    } while (number != 0);
+
+    return length;
+}
+
+static bool read_number(const uint8_t *data, uint16_t length, uint16_t *offset, uint32_t *number)
+{
+    uint32_t value = 0;
+
+    for (uint32_t shift = 0; shift < 32; shift += 7) {
+        if (*offset >= length) {
+            return false;
+        }
+
+        const uint8_t byte = data[*offset];
+        ++*offset;
+
+        if (shift == 28 && byte > 0x0f) {
+            return false;
+        }
+
+        value |= (uint32_t)(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *number = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint16_t request_range_write(uint8_t *data, uint16_t length, uint16_t max_length, uint32_t received,
+                             uint32_t missing)
+{
+    const uint16_t new_length = write_number(data, length, max_length, received);
+
+    if (new_length == 0) {
+        return 0;
+    }
+
+    return write_number(data, new_length, max_length, missing);
+}
+
+bool request_range_read(const uint8_t *data, uint16_t length, uint16_t *offset, uint32_t *received,
+                        uint32_t *missing)
+{
+    return read_number(data, length, offset, received) && read_number(data, length, offset, missing);
+}
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Ranges of missing packets in net_crypto request packets.
+ *
+ * A range request lists the packets the receiver is missing as ranges rather
+ * than with a byte per missing packet, so a single request can ask for a whole
+ * window lost in a burst. Each range is two numbers: how many packets arrived
+ * since the end of the previous range (or since the buffer start in the packet
+ * header), then how many are missing after them. Only the last range may have
+ * no missing packets; it acknowledges the packets the receiver has after the
+ * last gap.
+ *
+ * Numbers take 7 bits per byte, least significant first, with the high bit set
+ * on all bytes but the last, so small ranges take 2 bytes.
+ */
+#ifndef C_TOXCORE_TOXCORE_REQUEST_RANGES_H
+#define C_TOXCORE_TOXCORE_REQUEST_RANGES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Most bytes a range takes. */
+#define REQUEST_RANGE_MAX_SIZE 10
+
+/* Write the range after the first length bytes of data.
+ *
+ * return the new length on success.
+ * return 0 if the range doesn't fit in max_length bytes.
+ */
+uint16_t request_range_write(uint8_t *data, uint16_t length, uint16_t max_length, uint32_t received,
+                             uint32_t missing);
+
+/* Read the range at *offset in data and move *offset past it.
+ *
+ * return true on success.
+ * return false if data ends inside the range or a number doesn't fit 32 bits.
+ */
+bool request_range_read(const uint8_t *data, uint16_t length, uint16_t *offset, uint32_t *received,
+                        uint32_t *missing);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif // C_TOXCORE_TOXCORE_REQUEST_RANGES_H
@@ -0,0 +1,74 @@
+#include "request_ranges.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+
+namespace {
+
+TEST(RequestRanges, SmallRangesTakeTwoBytes) {
+  std::array<uint8_t, 8> data{};
+  EXPECT_EQ(request_range_write(data.data(), 0, data.size(), 0, 127), 2);
+  EXPECT_EQ(data[0], 0);
+  EXPECT_EQ(data[1], 127);
+}
+
+TEST(RequestRanges, RangesSurviveARoundTrip) {
+  const std::array<std::array<uint32_t, 2>, 5> ranges = {{
+      {0, 1},
+      {128, 0},
+      {300, 16384},
+      {UINT32_MAX, 1},
+      {7, UINT32_MAX},
+  }};
+  std::array<uint8_t, ranges.size() * REQUEST_RANGE_MAX_SIZE> data{};
+  uint16_t length = 0;
+
+  for (const auto &range : ranges) {
+    length = request_range_write(data.data(), length, data.size(), range[0], range[1]);
+    ASSERT_NE(length, 0);
+  }
+
+  uint16_t offset = 0;
+
+  for (const auto &range : ranges) {
+    uint32_t received;
+    uint32_t missing;
+    ASSERT_TRUE(request_range_read(data.data(), length, &offset, &received, &missing));
+    EXPECT_EQ(received, range[0]);
+    EXPECT_EQ(missing, range[1]);
+  }
+
+  EXPECT_EQ(offset, length);
+}
+
+TEST(RequestRanges, RangesThatDontFitAreNotWritten) {
+  std::array<uint8_t, 4> data{};
+  EXPECT_EQ(request_range_write(data.data(), 2, data.size(), 1, 1), 4);
+  EXPECT_EQ(request_range_write(data.data(), 3, data.size(), 1, 1), 0);
+  EXPECT_EQ(request_range_write(data.data(), 0, data.size(), 1000, 1000), 4);
+  EXPECT_EQ(request_range_write(data.data(), 1, data.size(), 1000, 1000), 0);
+}
+
+TEST(RequestRanges, TruncatedRangesAreRejected) {
+  std::array<uint8_t, REQUEST_RANGE_MAX_SIZE> data{};
+  const uint16_t length = request_range_write(data.data(), 0, data.size(), 1000, 1000);
+  ASSERT_EQ(length, 4);
+
+  for (uint16_t i = 0; i < length; ++i) {
+    uint16_t offset = 0;
+    uint32_t received;
+    uint32_t missing;
+    EXPECT_FALSE(request_range_read(data.data(), i, &offset, &received, &missing));
+  }
+}
+
+TEST(RequestRanges, NumbersOver32BitsAreRejected) {
+  const std::array<uint8_t, 6> data = {0xff, 0xff, 0xff, 0xff, 0x1f, 0x00};
+  uint16_t offset = 0;
+  uint32_t received;
+  uint32_t missing;
+  EXPECT_FALSE(request_range_read(data.data(), data.size(), &offset, &received, &missing));
+}
+
+}  // namespace
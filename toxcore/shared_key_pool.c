@@ -0,0 +1,426 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Threads computing shared keys for packets from peers whose key is not cached.
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include "shared_key_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccompat.h"
+#include "crypto_core.h"
+
+#define NO_JOB UINT32_MAX
+
+typedef enum Job_State {
+    /* Waiting in the queue or being computed by a thread. */
+    JOB_STATE_PENDING,
+    /* The shared key is ready for do_shared_key_pool(). */
+    JOB_STATE_DONE,
+} Job_State;
+
+typedef struct Shared_Key_Job {
+    /* Fields only used by the thread parking packets. */
+    bool in_use;
+    void *cache;
+    /* Collected by do_shared_key_pool(), so its key is in the cache. */
+    bool ready;
+
+    /* Written before the job is queued, read by the computing thread. */
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+
+    /* Written by the computing thread before it marks the job done. */
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+    /* Protected by the pool's lock. */
+    Job_State state;
+} Shared_Key_Job;
+
+typedef struct Parked_Packet {
+    uint32_t job;
+    IP_Port source;
+    uint8_t *data;
+    uint16_t length;
+} Parked_Packet;
+
+struct Shared_Key_Pool {
+    const Logger *log;
+    Networking_Core *net;
+    shared_key_pool_store_cb *store_callback;
+
+    pthread_t threads[MAX_SHARED_KEY_POOL_THREADS];
+    uint16_t num_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+
+    /* One job per distinct key being computed, never more than parked packets. */
+    Shared_Key_Job *jobs;
+    uint32_t num_jobs;
+
+    /* Jobs waiting for a thread, protected by the lock. */
+    uint32_t *queue;
+    uint32_t queue_start;
+    uint32_t queue_size;
+    uint32_t num_done;
+
+    Parked_Packet *parked;
+    uint32_t num_parked;
+    uint32_t max_parked;
+    uint32_t peak_parked;
+
+    /* Jobs finished since the last do_shared_key_pool(), collected under the lock. */
+    uint32_t *done;
+
+    bool replaying;
+
+    uint64_t dropped;
+    uint64_t computed;
+};
+
+static void *shared_key_thread(void *arg)
+{
+    Shared_Key_Pool *const pool = (Shared_Key_Pool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (pool->running && pool->queue_size == 0) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+
+        if (!pool->running) {
+            break;
+        }
+
+        const uint32_t index = pool->queue[pool->queue_start];
+        pool->queue_start = (pool->queue_start + 1) % pool->max_parked;
+        --pool->queue_size;
+        pthread_mutex_unlock(&pool->lock);
+
+        Shared_Key_Job *const job = &pool->jobs[index];
+        encrypt_precompute(job->public_key, job->secret_key, job->shared_key);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = JOB_STATE_DONE;
+        ++pool->num_done;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return nullptr;
+}
+
+Shared_Key_Pool *new_shared_key_pool(const Logger *log, Networking_Core *net, uint16_t num_threads,
+                                     uint32_t max_parked, shared_key_pool_store_cb *store_callback)
+{
+    if (net == nullptr || store_callback == nullptr || num_threads == 0 || num_threads > MAX_SHARED_KEY_POOL_THREADS
+            || max_parked == 0) {
+        return nullptr;
+    }
+
+    Shared_Key_Pool *const pool = (Shared_Key_Pool *)calloc(1, sizeof(Shared_Key_Pool));
+
+    if (pool == nullptr) {
+        return nullptr;
+    }
+
+    pool->log = log;
+    pool->net = net;
+    pool->store_callback = store_callback;
+    pool->max_parked = max_parked;
+    pool->running = true;
+
+    pool->jobs = (Shared_Key_Job *)calloc(max_parked, sizeof(Shared_Key_Job));
+    pool->queue = (uint32_t *)calloc(max_parked, sizeof(uint32_t));
+    pool->done = (uint32_t *)calloc(max_parked, sizeof(uint32_t));
+    pool->parked = (Parked_Packet *)calloc(max_parked, sizeof(Parked_Packet));
+
+    if (pool->jobs == nullptr || pool->queue == nullptr || pool->done == nullptr || pool->parked == nullptr) {
+        free(pool->jobs);
+        free(pool->queue);
+        free(pool->done);
+        free(pool->parked);
+        free(pool);
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&pool->lock, nullptr) != 0) {
+        free(pool->jobs);
+        free(pool->queue);
+        free(pool->done);
+        free(pool->parked);
+        free(pool);
+        return nullptr;
+    }
+
+    if (pthread_cond_init(&pool->cond, nullptr) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->jobs);
+        free(pool->queue);
+        free(pool->done);
+        free(pool->parked);
+        free(pool);
+        return nullptr;
+    }
+
+    for (uint16_t i = 0; i < num_threads; ++i) {
+        if (pthread_create(&pool->threads[i], nullptr, shared_key_thread, pool) != 0) {
+            LOGGER_ERROR(log, "failed to start shared key thread %u", i);
+            kill_shared_key_pool(pool);
+            return nullptr;
+        }
+
+        ++pool->num_threads;
+    }
+
+    return pool;
+}
+
+void kill_shared_key_pool(Shared_Key_Pool *pool)
+{
+    if (pool == nullptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = false;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint16_t i = 0; i < pool->num_threads; ++i) {
+        pthread_join(pool->threads[i], nullptr);
+    }
+
+    for (uint32_t i = 0; i < pool->num_parked; ++i) {
+        free(pool->parked[i].data);
+    }
+
+    crypto_memzero(pool->jobs, pool->max_parked * sizeof(Shared_Key_Job));
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->jobs);
+    free(pool->queue);
+    free(pool->done);
+    free(pool->parked);
+    free(pool);
+}
+
+/* Find the job computing the key for public_key and cache, or start one.
+ *
+ * return NO_JOB if no job slot is left.
+ */
+static uint32_t get_job(Shared_Key_Pool *pool, void *cache, const uint8_t *secret_key, const uint8_t *public_key)
+{
+    uint32_t free_index = NO_JOB;
+
+    for (uint32_t i = 0; i < pool->max_parked; ++i) {
+        const Shared_Key_Job *const job = &pool->jobs[i];
+
+        if (!job->in_use) {
+            if (free_index == NO_JOB) {
+                free_index = i;
+            }
+
+            continue;
+        }
+
+        if (job->cache == cache && public_key_cmp(job->public_key, public_key) == 0) {
+            return i;
+        }
+    }
+
+    if (free_index == NO_JOB) {
+        return NO_JOB;
+    }
+
+    Shared_Key_Job *const job = &pool->jobs[free_index];
+    job->in_use = true;
+    job->cache = cache;
+    memcpy(job->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(job->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
+    ++pool->num_jobs;
+
+    pthread_mutex_lock(&pool->lock);
+    job->state = JOB_STATE_PENDING;
+    pool->queue[(pool->queue_start + pool->queue_size) % pool->max_parked] = free_index;
+    ++pool->queue_size;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return free_index;
+}
+
+int shared_key_pool_park(Shared_Key_Pool *pool, void *cache, const uint8_t *secret_key, const uint8_t *public_key,
+                         IP_Port source, const uint8_t *packet, uint16_t length)
+{
+    if (pool->num_parked == pool->max_parked) {
+        ++pool->dropped;
+        return -1;
+    }
+
+    uint8_t *const data = (uint8_t *)malloc(length);
+
+    if (data == nullptr) {
+        ++pool->dropped;
+        return -1;
+    }
+
+    const uint32_t job = get_job(pool, cache, secret_key, public_key);
+
+    if (job == NO_JOB) {
+        free(data);
+        ++pool->dropped;
+        return -1;
+    }
+
+    memcpy(data, packet, length);
+
+    Parked_Packet *const parked = &pool->parked[pool->num_parked];
+    parked->job = job;
+    parked->source = source;
+    parked->data = data;
+    parked->length = length;
+    ++pool->num_parked;
+
+    if (pool->num_parked > pool->peak_parked) {
+        pool->peak_parked = pool->num_parked;
+    }
+
+    return 0;
+}
+
+void shared_key_pool_remove_cache(Shared_Key_Pool *pool, const void *cache)
+{
+    if (pool == nullptr) {
+        return;
+    }
+
+    /* Jobs still being computed are released by do_shared_key_pool(), which
+     * skips storing keys for a NULL cache.
+     */
+    for (uint32_t i = 0; i < pool->max_parked; ++i) {
+        if (pool->jobs[i].in_use && pool->jobs[i].cache == cache) {
+            pool->jobs[i].cache = nullptr;
+        }
+    }
+
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < pool->num_parked; ++i) {
+        Parked_Packet *const parked = &pool->parked[i];
+
+        if (pool->jobs[parked->job].cache == nullptr) {
+            free(parked->data);
+            continue;
+        }
+
+        pool->parked[kept] = *parked;
+        ++kept;
+    }
+
+    pool->num_parked = kept;
+}
+
+void do_shared_key_pool(Shared_Key_Pool *pool, void *userdata)
+{
+    if (pool->num_jobs == 0) {
+        return;
+    }
+
+    uint32_t num_done = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->num_done > 0) {
+        for (uint32_t i = 0; i < pool->max_parked; ++i) {
+            if (pool->jobs[i].in_use && pool->jobs[i].state == JOB_STATE_DONE) {
+                pool->done[num_done] = i;
+                ++num_done;
+            }
+        }
+
+        pool->num_done = 0;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (num_done == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < num_done; ++i) {
+        Shared_Key_Job *const job = &pool->jobs[pool->done[i]];
+
+        job->ready = true;
+
+        if (job->cache != nullptr) {
+            pool->store_callback(job->cache, job->public_key, job->shared_key);
+        }
+
+        ++pool->computed;
+    }
+
+    /* Packets are handled in the order they arrived. A packet handled now
+     * finds its key in the cache, so nothing gets parked while replaying.
+     */
+    pool->replaying = true;
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < pool->num_parked; ++i) {
+        Parked_Packet parked = pool->parked[i];
+
+        if (!pool->jobs[parked.job].ready) {
+            pool->parked[kept] = parked;
+            ++kept;
+            continue;
+        }
+
+        networking_handle_packet(pool->net, parked.source, parked.data, parked.length, userdata);
+        free(parked.data);
+    }
+
+    pool->num_parked = kept;
+    pool->replaying = false;
+
+    for (uint32_t i = 0; i < num_done; ++i) {
+        Shared_Key_Job *const job = &pool->jobs[pool->done[i]];
+        crypto_memzero(job, sizeof(Shared_Key_Job));
+        --pool->num_jobs;
+    }
+}
+
+bool shared_key_pool_replaying(const Shared_Key_Pool *pool)
+{
+    return pool->replaying;
+}
+
+uint32_t shared_key_pool_parked(const Shared_Key_Pool *pool)
+{
+    return pool->num_parked;
+}
+
+uint32_t shared_key_pool_peak_parked(const Shared_Key_Pool *pool)
+{
+    return pool->peak_parked;
+}
+
+uint64_t shared_key_pool_dropped(const Shared_Key_Pool *pool)
+{
+    return pool->dropped;
+}
+
+uint64_t shared_key_pool_computed(const Shared_Key_Pool *pool)
+{
+    return pool->computed;
+}
@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Threads computing shared keys for packets from peers whose key is not cached.
+ *
+ * A packet handler that misses its shared key cache parks the packet here
+ * instead of running the scalar multiplication on the event loop thread. A
+ * worker thread computes the key, and do_shared_key_pool() hands it to the
+ * cache and handles the parked packets again through
+ * networking_handle_packet(), this time finding their key in the cache.
+ */
+#ifndef C_TOXCORE_TOXCORE_SHARED_KEY_POOL_H
+#define C_TOXCORE_TOXCORE_SHARED_KEY_POOL_H
+
+#include "logger.h"
+#include "network.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of worker threads. */
+#define MAX_SHARED_KEY_POOL_THREADS 64
+
+/* Default number of packets that can wait for their key at the same time. */
+#define DEFAULT_SHARED_KEY_POOL_PARKED 256
+
+typedef struct Shared_Key_Pool Shared_Key_Pool;
+
+/* Store a computed shared key in cache, the cache passed to shared_key_pool_park(). */
+typedef void shared_key_pool_store_cb(void *cache, const uint8_t *public_key, const uint8_t *shared_key);
+
+/* Start num_threads threads computing shared keys. Up to max_parked packets
+ * wait for their key at the same time, to be handled again on net.
+ *
+ * return NULL on failure.
+ */
+Shared_Key_Pool *new_shared_key_pool(const Logger *log, Networking_Core *net, uint16_t num_threads,
+                                     uint32_t max_parked, shared_key_pool_store_cb *store_callback);
+
+/* Stop the threads and drop the parked packets. */
+void kill_shared_key_pool(Shared_Key_Pool *pool);
+
+/* Park packet until the shared key between secret_key and public_key has been
+ * computed and stored in cache. Packets waiting for the same key share one
+ * computation.
+ *
+ * return 0 if the packet was parked.
+ * return -1 if it was dropped because too many packets are waiting.
+ */
+int shared_key_pool_park(Shared_Key_Pool *pool, void *cache, const uint8_t *secret_key, const uint8_t *public_key,
+                         IP_Port source, const uint8_t *packet, uint16_t length);
+
+/* Drop the packets waiting for keys to be stored in cache, so that it can be freed. */
+void shared_key_pool_remove_cache(Shared_Key_Pool *pool, const void *cache);
+
+/* Store the computed keys and handle the packets waiting for them. Call this
+ * from the thread that parks packets, with the userdata for the packet
+ * handlers.
+ */
+void do_shared_key_pool(Shared_Key_Pool *pool, void *userdata);
+
+/* Whether do_shared_key_pool() is handling parked packets. A handler must not
+ * park a packet again while this is true, but compute the key itself.
+ */
+bool shared_key_pool_replaying(const Shared_Key_Pool *pool);
+
+/* Number of packets waiting for their key, the most that ever waited at the
+ * same time, packets dropped because the queue was full, and keys computed.
+ */
+uint32_t shared_key_pool_parked(const Shared_Key_Pool *pool);
+uint32_t shared_key_pool_peak_parked(const Shared_Key_Pool *pool);
+uint64_t shared_key_pool_dropped(const Shared_Key_Pool *pool);
+uint64_t shared_key_pool_computed(const Shared_Key_Pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_TOXCORE_TOXCORE_SHARED_KEY_POOL_H
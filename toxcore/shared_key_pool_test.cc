@@ -0,0 +1,181 @@
+#include "shared_key_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
+
+#include "crypto_core.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+using SecretKey = std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE>;
+using SharedKey = std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE>;
+
+constexpr uint8_t TEST_PACKET_ID = NET_PACKET_CRYPTO;
+
+struct Networking_Deleter {
+  void operator()(Networking_Core *net) { kill_networking(net); }
+};
+
+using Networking_Ptr = std::unique_ptr<Networking_Core, Networking_Deleter>;
+
+struct Shared_Key_Pool_Deleter {
+  void operator()(Shared_Key_Pool *pool) { kill_shared_key_pool(pool); }
+};
+
+using Shared_Key_Pool_Ptr = std::unique_ptr<Shared_Key_Pool, Shared_Key_Pool_Deleter>;
+
+struct Cache {
+  std::map<PublicKey, SharedKey> keys;
+};
+
+void store_key(void *cache, const uint8_t *public_key, const uint8_t *shared_key) {
+  PublicKey pk;
+  SharedKey key;
+  std::copy(public_key, public_key + pk.size(), pk.begin());
+  std::copy(shared_key, shared_key + key.size(), key.begin());
+  static_cast<Cache *>(cache)->keys[pk] = key;
+}
+
+struct Handled {
+  Shared_Key_Pool *pool = nullptr;
+  int count = 0;
+  bool replaying = false;
+};
+
+int handle_packet(void *object, IP_Port source, const uint8_t *packet, uint16_t length,
+                  void *userdata) {
+  Handled *handled = static_cast<Handled *>(userdata);
+  ++handled->count;
+  handled->replaying = shared_key_pool_replaying(handled->pool);
+  return 0;
+}
+
+class SharedKeyPool : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+    net_.reset(new_networking_ex(nullptr, ip, 33445, 33545, false, nullptr));
+    ASSERT_NE(net_, nullptr);
+    networking_registerhandler(net_.get(), TEST_PACKET_ID, &handle_packet, nullptr);
+    crypto_new_keypair(self_pk_.data(), self_sk_.data());
+  }
+
+  Shared_Key_Pool *new_pool(uint32_t max_parked) {
+    return new_shared_key_pool(nullptr, net_.get(), 2, max_parked, &store_key);
+  }
+
+  PublicKey random_public_key() {
+    PublicKey pk;
+    SecretKey sk;
+    crypto_new_keypair(pk.data(), sk.data());
+    return pk;
+  }
+
+  int park(Shared_Key_Pool *pool, Cache *cache, PublicKey const &pk) {
+    IP_Port source = {{{0}}};
+    std::array<uint8_t, 10> packet{TEST_PACKET_ID};
+    return shared_key_pool_park(pool, cache, self_sk_.data(), pk.data(), source, packet.data(),
+                                packet.size());
+  }
+
+  // Run the pool until no packet waits for its key anymore.
+  void run(Shared_Key_Pool *pool, Handled *handled) {
+    handled->pool = pool;
+
+    for (int i = 0; i < 1000 && shared_key_pool_parked(pool) > 0; ++i) {
+      do_shared_key_pool(pool, handled);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  Networking_Ptr net_;
+  PublicKey self_pk_;
+  SecretKey self_sk_;
+};
+
+TEST_F(SharedKeyPool, ParkedPacketIsHandledWithComputedKey) {
+  Shared_Key_Pool_Ptr const pool(new_pool(4));
+  ASSERT_NE(pool, nullptr);
+  Cache cache;
+  PublicKey const pk = random_public_key();
+
+  EXPECT_EQ(park(pool.get(), &cache, pk), 0);
+  EXPECT_EQ(shared_key_pool_parked(pool.get()), 1);
+
+  Handled handled;
+  run(pool.get(), &handled);
+
+  EXPECT_EQ(shared_key_pool_parked(pool.get()), 0);
+  EXPECT_EQ(handled.count, 1);
+  EXPECT_TRUE(handled.replaying);
+  EXPECT_FALSE(shared_key_pool_replaying(pool.get()));
+
+  SharedKey expected;
+  encrypt_precompute(pk.data(), self_sk_.data(), expected.data());
+  ASSERT_EQ(cache.keys.count(pk), 1);
+  EXPECT_EQ(cache.keys[pk], expected);
+}
+
+TEST_F(SharedKeyPool, PacketsForTheSameKeyShareOneComputation) {
+  Shared_Key_Pool_Ptr const pool(new_pool(4));
+  ASSERT_NE(pool, nullptr);
+  Cache cache;
+  PublicKey const pk = random_public_key();
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(park(pool.get(), &cache, pk), 0);
+  }
+
+  Handled handled;
+  run(pool.get(), &handled);
+
+  EXPECT_EQ(handled.count, 3);
+  EXPECT_EQ(shared_key_pool_computed(pool.get()), 1);
+  EXPECT_EQ(shared_key_pool_peak_parked(pool.get()), 3);
+}
+
+TEST_F(SharedKeyPool, DropsPacketsWhenFull) {
+  Shared_Key_Pool_Ptr const pool(new_pool(2));
+  ASSERT_NE(pool, nullptr);
+  Cache cache;
+
+  EXPECT_EQ(park(pool.get(), &cache, random_public_key()), 0);
+  EXPECT_EQ(park(pool.get(), &cache, random_public_key()), 0);
+  EXPECT_EQ(park(pool.get(), &cache, random_public_key()), -1);
+  EXPECT_EQ(shared_key_pool_dropped(pool.get()), 1);
+
+  Handled handled;
+  run(pool.get(), &handled);
+
+  EXPECT_EQ(handled.count, 2);
+  EXPECT_EQ(cache.keys.size(), 2);
+}
+
+TEST_F(SharedKeyPool, RemovedCacheGetsNoKeys) {
+  Shared_Key_Pool_Ptr const pool(new_pool(4));
+  ASSERT_NE(pool, nullptr);
+  Cache kept;
+  Cache removed;
+
+  EXPECT_EQ(park(pool.get(), &kept, random_public_key()), 0);
+  EXPECT_EQ(park(pool.get(), &removed, random_public_key()), 0);
+  shared_key_pool_remove_cache(pool.get(), &removed);
+  EXPECT_EQ(shared_key_pool_parked(pool.get()), 1);
+
+  Handled handled;
+  run(pool.get(), &handled);
+
+  EXPECT_EQ(handled.count, 1);
+  EXPECT_EQ(kept.keys.size(), 1);
+  EXPECT_TRUE(removed.keys.empty());
+}
+
+}  // namespace
@@ -0,0 +1,290 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Allocator for many short lived blocks of a few fixed sizes.
+ */
+#include "slab_allocator.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "ccompat.h"
+
+/* Bytes a slab is sized to, it holds at least one block. */
+#define SLAB_BYTES 16384
+
+typedef struct Slab_Class Slab_Class;
+
+typedef struct Slab {
+    Slab_Class *size_class;
+
+    /* Neighbours in the class's list of slabs with free blocks. */
+    struct Slab *prev;
+    struct Slab *next;
+
+    /* Freed blocks, linked through their first bytes. */
+    void *free_blocks;
+    /* Blocks handed out so far from the never used end of the slab. */
+    uint32_t carved;
+    uint32_t used;
+} Slab;
+
+/* Every block starts with the slab it belongs to. The union keeps the block
+ * that follows aligned for 64 bit integers.
+ */
+typedef union Block_Header {
+    Slab *slab;
+    uint64_t align;
+} Block_Header;
+
+#define SLAB_ALIGN sizeof(uint64_t)
+#define SLAB_ROUND_UP(size) (((size) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN)
+
+/* Offset of the first block in a slab. */
+#define SLAB_BLOCKS_OFFSET SLAB_ROUND_UP(sizeof(Slab))
+
+struct Slab_Class {
+    uint32_t block_size;
+    /* Distance between two blocks, header included. */
+    uint32_t stride;
+    uint32_t blocks_per_slab;
+
+    /* Slabs with free blocks, the ones with the most recently freed first. */
+    Slab *partial;
+    /* Number of slabs without any block in use, at most 1. */
+    uint32_t empty_slabs;
+};
+
+struct Slab_Allocator {
+    pthread_mutex_t lock;
+
+    Slab_Class classes[MAX_SLAB_CLASSES];
+    uint8_t num_classes;
+
+    uint32_t in_use;
+    uint32_t peak_in_use;
+    uint32_t slabs;
+};
+
+Slab_Allocator *new_slab_allocator(const uint32_t *block_sizes, uint8_t num_classes)
+{
+    if (num_classes == 0 || num_classes > MAX_SLAB_CLASSES) {
+        return nullptr;
+    }
+
+    for (uint8_t i = 0; i < num_classes; ++i) {
+        if (block_sizes[i] == 0 || block_sizes[i] > UINT32_MAX / 2 || (i > 0 && block_sizes[i] <= block_sizes[i - 1])) {
+            return nullptr;
+        }
+    }
+
+    Slab_Allocator *const slab = (Slab_Allocator *)calloc(1, sizeof(Slab_Allocator));
+
+    if (slab == nullptr) {
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&slab->lock, nullptr) != 0) {
+        free(slab);
+        return nullptr;
+    }
+
+    for (uint8_t i = 0; i < num_classes; ++i) {
+        Slab_Class *const size_class = &slab->classes[i];
+        size_class->block_size = block_sizes[i];
+
+        /* A freed block holds the pointer to the next free block. */
+        const uint32_t block_size = block_sizes[i] < sizeof(void *) ? sizeof(void *) : block_sizes[i];
+        size_class->stride = SLAB_ROUND_UP(sizeof(Block_Header) + block_size);
+        size_class->blocks_per_slab = (SLAB_BYTES - SLAB_BLOCKS_OFFSET) / size_class->stride;
+
+        if (size_class->blocks_per_slab == 0) {
+            size_class->blocks_per_slab = 1;
+        }
+    }
+
+    slab->num_classes = num_classes;
+    return slab;
+}
+
+void kill_slab_allocator(Slab_Allocator *slab)
+{
+    if (slab == nullptr) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < slab->num_classes; ++i) {
+        Slab *next = slab->classes[i].partial;
+
+        while (next != nullptr) {
+            Slab *const s = next;
+            next = s->next;
+            free(s);
+        }
+    }
+
+    pthread_mutex_destroy(&slab->lock);
+    free(slab);
+}
+
+static void unlink_slab(Slab_Class *size_class, Slab *s)
+{
+    if (s->prev != nullptr) {
+        s->prev->next = s->next;
+    } else {
+        size_class->partial = s->next;
+    }
+
+    if (s->next != nullptr) {
+        s->next->prev = s->prev;
+    }
+
+    s->prev = nullptr;
+    s->next = nullptr;
+}
+
+static void push_slab(Slab_Class *size_class, Slab *s)
+{
+    s->prev = nullptr;
+    s->next = size_class->partial;
+
+    if (s->next != nullptr) {
+        s->next->prev = s;
+    }
+
+    size_class->partial = s;
+}
+
+/* Only the slab header is written, the blocks are handed out in order and the
+ * pages they're on are only touched when they are.
+ */
+static Slab *new_slab(Slab_Class *size_class)
+{
+    Slab *const s = (Slab *)malloc(SLAB_BLOCKS_OFFSET + (size_t)size_class->stride * size_class->blocks_per_slab);
+
+    if (s == nullptr) {
+        return nullptr;
+    }
+
+    s->size_class = size_class;
+    s->prev = nullptr;
+    s->next = nullptr;
+    s->free_blocks = nullptr;
+    s->carved = 0;
+    s->used = 0;
+    return s;
+}
+
+void *slab_alloc(Slab_Allocator *slab, uint32_t size)
+{
+    Slab_Class *size_class = nullptr;
+
+    for (uint8_t i = 0; i < slab->num_classes; ++i) {
+        if (size <= slab->classes[i].block_size) {
+            size_class = &slab->classes[i];
+            break;
+        }
+    }
+
+    if (size_class == nullptr) {
+        return nullptr;
+    }
+
+    pthread_mutex_lock(&slab->lock);
+    Slab *s = size_class->partial;
+
+    if (s == nullptr) {
+        s = new_slab(size_class);
+
+        if (s == nullptr) {
+            pthread_mutex_unlock(&slab->lock);
+            return nullptr;
+        }
+
+        push_slab(size_class, s);
+        ++size_class->empty_slabs;
+        ++slab->slabs;
+    }
+
+    void *block;
+
+    if (s->free_blocks != nullptr) {
+        block = s->free_blocks;
+        s->free_blocks = *(void **)block;
+    } else {
+        Block_Header *const header = (Block_Header *)((uint8_t *)s + SLAB_BLOCKS_OFFSET
+                                     + (size_t)size_class->stride * s->carved);
+        header->slab = s;
+        block = header + 1;
+        ++s->carved;
+    }
+
+    if (s->used == 0) {
+        --size_class->empty_slabs;
+    }
+
+    ++s->used;
+
+    if (s->used == size_class->blocks_per_slab) {
+        unlink_slab(size_class, s);
+    }
+
+    ++slab->in_use;
+
+    if (slab->in_use > slab->peak_in_use) {
+        slab->peak_in_use = slab->in_use;
+    }
+
+    pthread_mutex_unlock(&slab->lock);
+    return block;
+}
+
+void slab_free(Slab_Allocator *slab, void *block)
+{
+    if (block == nullptr) {
+        return;
+    }
+
+    Slab *const s = ((Block_Header *)block - 1)->slab;
+    Slab_Class *const size_class = s->size_class;
+
+    pthread_mutex_lock(&slab->lock);
+
+    if (s->used == size_class->blocks_per_slab) {
+        push_slab(size_class, s);
+    }
+
+    *(void **)block = s->free_blocks;
+    s->free_blocks = block;
+    --s->used;
+    --slab->in_use;
+
+    if (s->used == 0) {
+        if (size_class->empty_slabs == 0) {
+            ++size_class->empty_slabs;
+        } else {
+            unlink_slab(size_class, s);
+            free(s);
+            --slab->slabs;
+        }
+    }
+
+    pthread_mutex_unlock(&slab->lock);
+}
+
+uint32_t slab_allocator_in_use(const Slab_Allocator *slab)
+{
+    return slab->in_use;
+}
+
+uint32_t slab_allocator_peak_in_use(const Slab_Allocator *slab)
+{
+    return slab->peak_in_use;
+}
+
+uint32_t slab_allocator_slabs(const Slab_Allocator *slab)
+{
+    return slab->slabs;
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Allocator for many short lived blocks of a few fixed sizes.
+ *
+ * Each size class hands out blocks from slabs of about 16 KiB that hold many
+ * blocks of its size. A freed block goes back to its slab and is reused by the
+ * next allocation of the class, so a steady flow of allocations and frees
+ * doesn't go through malloc at all. A slab is freed when its last block is,
+ * except one per class that is kept for the next allocation.
+ */
+#ifndef C_TOXCORE_TOXCORE_SLAB_ALLOCATOR_H
+#define C_TOXCORE_TOXCORE_SLAB_ALLOCATOR_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of size classes. */
+#define MAX_SLAB_CLASSES 8
+
+typedef struct Slab_Allocator Slab_Allocator;
+
+/* Create an allocator with num_classes size classes. block_sizes must be in
+ * increasing order.
+ *
+ * return NULL on failure.
+ */
+Slab_Allocator *new_slab_allocator(const uint32_t *block_sizes, uint8_t num_classes);
+
+/* Free the allocator. All its blocks must have been freed. */
+void kill_slab_allocator(Slab_Allocator *slab);
+
+/* Allocate a block of the smallest class that holds size bytes. The block is
+ * aligned for any of the integer types and not initialised. Thread safe.
+ *
+ * return NULL if size is larger than the largest class or memory ran out.
+ */
+void *slab_alloc(Slab_Allocator *slab, uint32_t size);
+
+/* Give back a block from slab_alloc(). Does nothing if block is NULL. Thread
+ * safe.
+ */
+void slab_free(Slab_Allocator *slab, void *block);
+
+/* Number of blocks allocated, the most that ever were at the same time, and
+ * the number of slabs holding them.
+ */
+uint32_t slab_allocator_in_use(const Slab_Allocator *slab);
+uint32_t slab_allocator_peak_in_use(const Slab_Allocator *slab);
+uint32_t slab_allocator_slabs(const Slab_Allocator *slab);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_TOXCORE_TOXCORE_SLAB_ALLOCATOR_H
@@ -0,0 +1,104 @@
+#include "slab_allocator.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+
+struct Slab_Allocator_Deleter {
+  void operator()(Slab_Allocator *slab) { kill_slab_allocator(slab); }
+};
+
+using Slab_Allocator_Ptr = std::unique_ptr<Slab_Allocator, Slab_Allocator_Deleter>;
+
+constexpr uint32_t block_sizes[] = {16, 128, 1400};
+
+TEST(SlabAllocator, RejectsInvalidClasses) {
+  const uint32_t unordered[] = {128, 16};
+  EXPECT_EQ(new_slab_allocator(block_sizes, 0), nullptr);
+  EXPECT_EQ(new_slab_allocator(block_sizes, MAX_SLAB_CLASSES + 1), nullptr);
+  EXPECT_EQ(new_slab_allocator(unordered, 2), nullptr);
+}
+
+TEST(SlabAllocator, RejectsBlocksLargerThanTheLargestClass) {
+  Slab_Allocator_Ptr slab(new_slab_allocator(block_sizes, 3));
+  ASSERT_NE(slab, nullptr);
+
+  EXPECT_EQ(slab_alloc(slab.get(), 1401), nullptr);
+  EXPECT_EQ(slab_allocator_in_use(slab.get()), 0);
+}
+
+TEST(SlabAllocator, BlocksDoNotOverlap) {
+  Slab_Allocator_Ptr slab(new_slab_allocator(block_sizes, 3));
+  ASSERT_NE(slab, nullptr);
+
+  std::vector<std::pair<uint8_t *, uint32_t>> blocks;
+
+  for (uint32_t i = 0; i < 3000; ++i) {
+    const uint32_t size = 1 + (i * 7) % 1400;
+    uint8_t *block = static_cast<uint8_t *>(slab_alloc(slab.get(), size));
+    ASSERT_NE(block, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(block) % sizeof(uint64_t), 0);
+    memset(block, i & 0xff, size);
+    blocks.emplace_back(block, size);
+  }
+
+  EXPECT_EQ(slab_allocator_in_use(slab.get()), 3000);
+
+  for (uint32_t i = 0; i < blocks.size(); ++i) {
+    for (uint32_t j = 0; j < blocks[i].second; ++j) {
+      ASSERT_EQ(blocks[i].first[j], i & 0xff) << "block " << i;
+    }
+
+    slab_free(slab.get(), blocks[i].first);
+  }
+
+  EXPECT_EQ(slab_allocator_in_use(slab.get()), 0);
+  EXPECT_EQ(slab_allocator_peak_in_use(slab.get()), 3000);
+}
+
+TEST(SlabAllocator, KeepsOneEmptySlabPerClass) {
+  Slab_Allocator_Ptr slab(new_slab_allocator(block_sizes, 3));
+  ASSERT_NE(slab, nullptr);
+
+  std::vector<void *> blocks;
+
+  for (uint32_t i = 0; i < 1000; ++i) {
+    blocks.push_back(slab_alloc(slab.get(), 1400));
+    ASSERT_NE(blocks.back(), nullptr);
+  }
+
+  EXPECT_GT(slab_allocator_slabs(slab.get()), 1);
+
+  for (void *block : blocks) {
+    slab_free(slab.get(), block);
+  }
+
+  EXPECT_EQ(slab_allocator_slabs(slab.get()), 1);
+
+  // The kept slab is used again rather than a new one.
+  void *block = slab_alloc(slab.get(), 1000);
+  EXPECT_EQ(slab_allocator_slabs(slab.get()), 1);
+  slab_free(slab.get(), block);
+}
+
+TEST(SlabAllocator, ReusesFreedBlocks) {
+  Slab_Allocator_Ptr slab(new_slab_allocator(block_sizes, 3));
+  ASSERT_NE(slab, nullptr);
+
+  void *first = slab_alloc(slab.get(), 100);
+  void *second = slab_alloc(slab.get(), 100);
+  slab_free(slab.get(), first);
+
+  EXPECT_EQ(slab_alloc(slab.get(), 128), first);
+
+  slab_free(slab.get(), first);
+  slab_free(slab.get(), second);
+  slab_free(slab.get(), nullptr);
+  EXPECT_EQ(slab_allocator_in_use(slab.get()), 0);
+}
+
+}  // namespace
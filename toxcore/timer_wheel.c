@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Hierarchical timer wheel.
+ */
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+
+#include "ccompat.h"
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/* Timers whose deadline has higher bits than this differ from the current
+ * time in more than the levels cover.
+ */
+#define TIMER_WHEEL_SPAN_BITS (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)
+
+/* Lists after the slots of all levels. */
+#define TIMER_LIST_DUE (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+#define TIMER_LIST_EXPIRED (TIMER_LIST_DUE + 1)
+#define TIMER_LIST_OVERFLOW (TIMER_LIST_DUE + 2)
+#define TIMER_NUM_LISTS (TIMER_LIST_DUE + 3)
+
+struct Timer_Wheel {
+    /* Every timer with an earlier or equal deadline has been moved to the
+     * expired list. Each level only has timers in slots after the one now is
+     * in, with the same higher bits as now.
+     */
+    uint64_t now;
+
+    /* Bit i of occupied[level] is set if slot i of the level has timers. */
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    Timer *lists[TIMER_NUM_LISTS];
+};
+
+static unsigned int trailing_zeros(uint64_t word)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(word);
+#else
+    unsigned int zeros = 0;
+
+    while ((word & 1) == 0) {
+        word >>= 1;
+        ++zeros;
+    }
+
+    return zeros;
+#endif
+}
+
+static uint32_t time_digit(uint64_t time, uint32_t level)
+{
+    return (time >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+void timer_init(Timer *timer, timer_cb *callback, void *object)
+{
+    timer->callback = callback;
+    timer->object = object;
+    timer->deadline = 0;
+    timer->list = -1;
+    timer->next = nullptr;
+    timer->prev_next = nullptr;
+}
+
+bool timer_is_scheduled(const Timer *timer)
+{
+    return timer->list != -1;
+}
+
+uint64_t timer_deadline(const Timer *timer)
+{
+    return timer->deadline;
+}
+
+Timer_Wheel *timer_wheel_new(uint64_t now)
+{
+    Timer_Wheel *wheel = (Timer_Wheel *)calloc(1, sizeof(Timer_Wheel));
+
+    if (wheel == nullptr) {
+        return nullptr;
+    }
+
+    wheel->now = now;
+    return wheel;
+}
+
+void timer_wheel_kill(Timer_Wheel *wheel)
+{
+    if (wheel == nullptr) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < TIMER_NUM_LISTS; ++i) {
+        for (Timer *timer = wheel->lists[i]; timer != nullptr; timer = timer->next) {
+            timer->list = -1;
+        }
+    }
+
+    free(wheel);
+}
+
+static void list_push(Timer_Wheel *wheel, Timer *timer, uint32_t list)
+{
+    Timer **const head = &wheel->lists[list];
+
+    timer->list = list;
+    timer->next = *head;
+    timer->prev_next = head;
+
+    if (*head != nullptr) {
+        (*head)->prev_next = &timer->next;
+    }
+
+    *head = timer;
+
+    if (list < TIMER_LIST_DUE) {
+        wheel->occupied[list / TIMER_WHEEL_SLOTS] |= UINT64_C(1) << (list % TIMER_WHEEL_SLOTS);
+    }
+}
+
+static void list_remove(Timer_Wheel *wheel, Timer *timer)
+{
+    const uint32_t list = timer->list;
+
+    *timer->prev_next = timer->next;
+
+    if (timer->next != nullptr) {
+        timer->next->prev_next = timer->prev_next;
+    }
+
+    if (list < TIMER_LIST_DUE && wheel->lists[list] == nullptr) {
+        wheel->occupied[list / TIMER_WHEEL_SLOTS] &= ~(UINT64_C(1) << (list % TIMER_WHEEL_SLOTS));
+    }
+
+    timer->list = -1;
+    timer->next = nullptr;
+    timer->prev_next = nullptr;
+}
+
+/* Put a timer in the list for its deadline, relative to the wheel's time.
+ * Deadlines that have passed go to the expired list, which is only used
+ * while the wheel runs.
+ */
+static void insert(Timer_Wheel *wheel, Timer *timer, uint32_t past_list)
+{
+    const uint64_t deadline = timer->deadline;
+
+    if (deadline <= wheel->now) {
+        list_push(wheel, timer, past_list);
+        return;
+    }
+
+    const uint64_t diff = deadline ^ wheel->now;
+
+    if ((diff >> TIMER_WHEEL_SPAN_BITS) != 0) {
+        list_push(wheel, timer, TIMER_LIST_OVERFLOW);
+        return;
+    }
+
+    /* The highest bit that differs picks the level. */
+    uint32_t level = TIMER_WHEEL_LEVELS - 1;
+
+    while ((diff >> (level * TIMER_WHEEL_BITS)) == 0) {
+        --level;
+    }
+
+    list_push(wheel, timer, level * TIMER_WHEEL_SLOTS + time_digit(deadline, level));
+}
+
+void timer_wheel_schedule(Timer_Wheel *wheel, Timer *timer, uint64_t deadline)
+{
+    if (timer_is_scheduled(timer)) {
+        list_remove(wheel, timer);
+    }
+
+    timer->deadline = deadline;
+    insert(wheel, timer, TIMER_LIST_DUE);
+}
+
+void timer_wheel_cancel(Timer_Wheel *wheel, Timer *timer)
+{
+    if (timer_is_scheduled(timer)) {
+        list_remove(wheel, timer);
+    }
+}
+
+/* return the next time after the wheel's time at which a slot must be
+ * handled, UINT64_MAX if there is none.
+ */
+static uint64_t next_event(const Timer_Wheel *wheel)
+{
+    uint64_t next = UINT64_MAX;
+
+    if (wheel->lists[TIMER_LIST_OVERFLOW] != nullptr) {
+        next = ((wheel->now >> TIMER_WHEEL_SPAN_BITS) + 1) << TIMER_WHEEL_SPAN_BITS;
+    }
+
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        const uint32_t digit = time_digit(wheel->now, level);
+
+        if (digit == TIMER_WHEEL_SLOTS - 1) {
+            continue;
+        }
+
+        const uint64_t later = wheel->occupied[level] & ~((UINT64_C(2) << digit) - 1);
+
+        if (later == 0) {
+            continue;
+        }
+
+        const uint32_t shift = level * TIMER_WHEEL_BITS;
+        const uint64_t above = (wheel->now >> (shift + TIMER_WHEEL_BITS)) << (shift + TIMER_WHEEL_BITS);
+        const uint64_t start = above | ((uint64_t)trailing_zeros(later) << shift);
+
+        if (start < next) {
+            next = start;
+        }
+    }
+
+    return next;
+}
+
+/* Move all timers of a list to where they belong at the wheel's time. */
+static void cascade(Timer_Wheel *wheel, uint32_t list)
+{
+    Timer *timer = wheel->lists[list];
+
+    while (timer != nullptr) {
+        Timer *const next = timer->next;
+        list_remove(wheel, timer);
+        insert(wheel, timer, TIMER_LIST_EXPIRED);
+        timer = next;
+    }
+}
+
+/* Advance the wheel's time to the next event, if it's no later than until. */
+static bool advance(Timer_Wheel *wheel, uint64_t until)
+{
+    const uint64_t event = next_event(wheel);
+
+    if (event > until) {
+        return false;
+    }
+
+    wheel->now = event;
+
+    if ((event & ((UINT64_C(1) << TIMER_WHEEL_SPAN_BITS) - 1)) == 0) {
+        cascade(wheel, TIMER_LIST_OVERFLOW);
+    }
+
+    /* Upper levels first, so that level 0 sees what they moved down. */
+    for (uint32_t level = TIMER_WHEEL_LEVELS; level-- > 0;) {
+        const uint32_t shift = level * TIMER_WHEEL_BITS;
+
+        if ((event & ((UINT64_C(1) << shift) - 1)) != 0) {
+            continue;
+        }
+
+        const uint32_t digit = time_digit(event, level);
+
+        if (wheel->occupied[level] & (UINT64_C(1) << digit)) {
+            cascade(wheel, level * TIMER_WHEEL_SLOTS + digit);
+        }
+    }
+
+    return true;
+}
+
+uint32_t timer_wheel_run(Timer_Wheel *wheel, uint64_t now, void *userdata)
+{
+    cascade(wheel, TIMER_LIST_DUE);
+
+    while (advance(wheel, now)) {
+        /* Nothing else to do: advance() moves the expired timers. */
+    }
+
+    if (now > wheel->now) {
+        wheel->now = now;
+    }
+
+    uint32_t fired = 0;
+
+    /* Callbacks may cancel timers that expired with theirs, so take them from
+     * the list one at a time.
+     */
+    while (wheel->lists[TIMER_LIST_EXPIRED] != nullptr) {
+        Timer *const timer = wheel->lists[TIMER_LIST_EXPIRED];
+        list_remove(wheel, timer);
+        timer->callback(timer->object, userdata);
+        ++fired;
+    }
+
+    return fired;
+}
+
+static uint64_t earliest_deadline(const Timer *timer)
+{
+    uint64_t deadline = UINT64_MAX;
+
+    for (; timer != nullptr; timer = timer->next) {
+        if (timer->deadline < deadline) {
+            deadline = timer->deadline;
+        }
+    }
+
+    return deadline;
+}
+
+uint64_t timer_wheel_next_deadline(const Timer_Wheel *wheel)
+{
+    if (wheel->lists[TIMER_LIST_DUE] != nullptr) {
+        return wheel->now;
+    }
+
+    /* Timers on a level expire before all timers on the levels above, and
+     * those in a slot before all timers in later slots.
+     */
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        if (wheel->occupied[level] != 0) {
+            const uint32_t slot = trailing_zeros(wheel->occupied[level]);
+            return earliest_deadline(wheel->lists[level * TIMER_WHEEL_SLOTS + slot]);
+        }
+    }
+
+    return earliest_deadline(wheel->lists[TIMER_LIST_OVERFLOW]);
+}
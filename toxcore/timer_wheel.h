@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2016-2020 The TokTok team.
+ */
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Timers are kept in 4 levels of 64 slots each. A level 0 slot holds the
+ * timers that expire in one millisecond, a level 1 slot those that expire
+ * in one 64 ms span, and so on, so advancing the wheel only touches the
+ * slots that were passed and the timers in them. Timers further away than
+ * the top level covers wait on a separate list until the wheel wraps around.
+ *
+ * Timers are embedded in their owner's struct and never allocated by the
+ * wheel. Time is in milliseconds, usually from current_time_monotonic().
+ */
+#ifndef C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+#define C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Timer_Wheel Timer_Wheel;
+
+typedef void timer_cb(void *object, void *userdata);
+
+/* The fields are only used by timer_wheel.c. */
+typedef struct Timer {
+    timer_cb *callback;
+    void *object;
+
+    uint64_t deadline;
+
+    /* List the timer is in, -1 if it's not scheduled. */
+    int16_t list;
+    struct Timer *next;
+    struct Timer **prev_next;
+} Timer;
+
+/* Prepare a timer that calls callback with object when it expires. */
+void timer_init(Timer *timer, timer_cb *callback, void *object);
+
+/* return true if the timer is scheduled and has not fired yet. */
+bool timer_is_scheduled(const Timer *timer);
+
+/* return the time the timer was last scheduled for. */
+uint64_t timer_deadline(const Timer *timer);
+
+/* Create a wheel whose current time is now.
+ *
+ * return nullptr on failure.
+ */
+Timer_Wheel *timer_wheel_new(uint64_t now);
+
+/* Free the wheel. Timers still scheduled on it are left unscheduled. */
+void timer_wheel_kill(Timer_Wheel *wheel);
+
+/* Schedule the timer to fire at deadline, moving it if it was already
+ * scheduled. A deadline that has passed fires on the next timer_wheel_run().
+ */
+void timer_wheel_schedule(Timer_Wheel *wheel, Timer *timer, uint64_t deadline);
+
+/* Unschedule the timer. Does nothing if it isn't scheduled. */
+void timer_wheel_cancel(Timer_Wheel *wheel, Timer *timer);
+
+/* Advance the wheel to now and call the callbacks of the expired timers, in
+ * no particular order. Callbacks may schedule and cancel any timer,
+ * including their own.
+ *
+ * return the number of timers that fired.
+ */
+uint32_t timer_wheel_run(Timer_Wheel *wheel, uint64_t now, void *userdata);
+
+/* return the earliest deadline of the scheduled timers, or the wheel's time
+ * if that has passed. UINT64_MAX if no timer is scheduled.
+ */
+uint64_t timer_wheel_next_deadline(const Timer_Wheel *wheel);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif // C_TOXCORE_TOXCORE_TIMER_WHEEL_H
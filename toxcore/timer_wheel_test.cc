@@ -0,0 +1,177 @@
+#include "timer_wheel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Timer_Wheel_Deleter {
+  void operator()(Timer_Wheel *wheel) { timer_wheel_kill(wheel); }
+};
+
+using Timer_Wheel_Ptr = std::unique_ptr<Timer_Wheel, Timer_Wheel_Deleter>;
+
+struct Fired {
+  std::vector<uint64_t> deadlines;
+  uint64_t now = 0;
+  bool late = false;
+};
+
+struct Test_Timer {
+  Timer timer;
+  Fired *fired;
+};
+
+void record_fired(void *object, void *userdata) {
+  Test_Timer *test_timer = static_cast<Test_Timer *>(object);
+  Fired *fired = static_cast<Fired *>(userdata);
+  fired->deadlines.push_back(timer_deadline(&test_timer->timer));
+
+  if (timer_deadline(&test_timer->timer) > fired->now) {
+    fired->late = true;
+  }
+}
+
+TEST(TimerWheel, FiresAtDeadline) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(1000));
+  ASSERT_NE(wheel, nullptr);
+  EXPECT_EQ(timer_wheel_next_deadline(wheel.get()), UINT64_MAX);
+
+  Test_Timer t;
+  timer_init(&t.timer, record_fired, &t);
+  EXPECT_FALSE(timer_is_scheduled(&t.timer));
+
+  timer_wheel_schedule(wheel.get(), &t.timer, 1500);
+  EXPECT_TRUE(timer_is_scheduled(&t.timer));
+  EXPECT_EQ(timer_wheel_next_deadline(wheel.get()), 1500);
+
+  Fired fired;
+  fired.now = 1499;
+  EXPECT_EQ(timer_wheel_run(wheel.get(), 1499, &fired), 0);
+  EXPECT_EQ(timer_wheel_next_deadline(wheel.get()), 1500);
+
+  fired.now = 1500;
+  EXPECT_EQ(timer_wheel_run(wheel.get(), 1500, &fired), 1);
+  EXPECT_FALSE(timer_is_scheduled(&t.timer));
+  EXPECT_EQ(timer_wheel_next_deadline(wheel.get()), UINT64_MAX);
+}
+
+TEST(TimerWheel, PastDeadlineFiresOnNextRun) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(1000));
+  Test_Timer t;
+  timer_init(&t.timer, record_fired, &t);
+  timer_wheel_schedule(wheel.get(), &t.timer, 10);
+  EXPECT_EQ(timer_wheel_next_deadline(wheel.get()), 1000);
+
+  Fired fired;
+  fired.now = 1000;
+  EXPECT_EQ(timer_wheel_run(wheel.get(), 1000, &fired), 1);
+}
+
+TEST(TimerWheel, CancelAndReschedule) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(0));
+  Test_Timer a, b;
+  timer_init(&a.timer, record_fired, &a);
+  timer_init(&b.timer, record_fired, &b);
+
+  timer_wheel_schedule(wheel.get(), &a.timer, 100);
+  timer_wheel_schedule(wheel.get(), &b.timer, 200);
+  timer_wheel_cancel(wheel.get(), &a.timer);
+  timer_wheel_schedule(wheel.get(), &b.timer, 5000);
+
+  Fired fired;
+  fired.now = 4999;
+  EXPECT_EQ(timer_wheel_run(wheel.get(), 4999, &fired), 0);
+  fired.now = 5000;
+  EXPECT_EQ(timer_wheel_run(wheel.get(), 5000, &fired), 1);
+  EXPECT_EQ(fired.deadlines, std::vector<uint64_t>{5000});
+}
+
+struct Periodic {
+  Timer timer;
+  Timer_Wheel *wheel;
+  uint64_t period;
+  uint32_t count = 0;
+};
+
+void reschedule_periodic(void *object, void *userdata) {
+  Periodic *periodic = static_cast<Periodic *>(object);
+  ++periodic->count;
+  timer_wheel_schedule(periodic->wheel, &periodic->timer, timer_deadline(&periodic->timer) + periodic->period);
+}
+
+TEST(TimerWheel, CallbackCanRescheduleItself) {
+  Timer_Wheel_Ptr wheel(timer_wheel_new(0));
+  Periodic periodic;
+  periodic.wheel = wheel.get();
+  periodic.period = 50;
+  timer_init(&periodic.timer, reschedule_periodic, &periodic);
+  timer_wheel_schedule(wheel.get(), &periodic.timer, 50);
+
+  for (uint64_t now = 0; now <= 1000; now += 10) {
+    timer_wheel_run(wheel.get(), now, nullptr);
+  }
+
+  EXPECT_EQ(periodic.count, 20);
+  EXPECT_EQ(timer_deadline(&periodic.timer), 1050);
+}
+
+TEST(TimerWheel, MatchesSortedDeadlines) {
+  std::mt19937_64 rng(42);
+  const uint64_t start = 123456789;
+  Timer_Wheel_Ptr wheel(timer_wheel_new(start));
+
+  std::vector<Test_Timer> timers(2000);
+  std::vector<uint64_t> expected;
+
+  for (Test_Timer &t : timers) {
+    timer_init(&t.timer, record_fired, &t);
+    // Spread the deadlines over all levels and beyond.
+    const uint64_t range = UINT64_C(1) << (rng() % 30);
+    const uint64_t deadline = start + rng() % range;
+    timer_wheel_schedule(wheel.get(), &t.timer, deadline);
+    expected.push_back(deadline);
+  }
+
+  std::sort(expected.begin(), expected.end());
+
+  Fired fired;
+  uint64_t now = start;
+
+  while (fired.deadlines.size() < timers.size()) {
+    const uint64_t next_deadline = timer_wheel_next_deadline(wheel.get());
+    ASSERT_EQ(next_deadline, expected[fired.deadlines.size()]);
+
+    // Sometimes wake up early, sometimes exactly, sometimes late.
+    switch (rng() % 3) {
+      case 0:
+        now = std::max(now, next_deadline - std::min<uint64_t>(next_deadline, rng() % 100));
+        break;
+
+      case 1:
+        now = std::max(now, next_deadline);
+        break;
+
+      default:
+        now = std::max(now, next_deadline + rng() % 1000);
+        break;
+    }
+
+    fired.now = now;
+    timer_wheel_run(wheel.get(), now, &fired);
+
+    const size_t due = std::upper_bound(expected.begin(), expected.end(), now) - expected.begin();
+    ASSERT_EQ(fired.deadlines.size(), due);
+  }
+
+  EXPECT_FALSE(fired.late);
+  std::sort(fired.deadlines.begin(), fired.deadlines.end());
+  EXPECT_EQ(fired.deadlines, expected);
+  EXPECT_EQ(timer_wheel_next_deadline(wheel.get()), UINT64_MAX);
+}
+
+}  // namespace
@@ -399,6 +399,26 @@ enum class PROXY_TYPE {
   SOCKS5,
 }
 
+/**
+ * Algorithm deciding how fast friend connections send.
+ *
+ * @deprecated All UPPER_CASE enum type names are deprecated. Use the
+ *   Camel_Snake_Case versions, instead.
+ */
+enum class CONGESTION_CONTROL {
+  /**
+   * Follows the growth of the send queue. Fills the buffers on the path
+   * before slowing down, which adds delay for everything else sent on it.
+   */
+  QUEUE,
+  /**
+   * Measures the bandwidth of the path from the rate at which packets are
+   * acknowledged and sends at about that rate, like BBR. Slows down when
+   * the round trip time grows, which keeps the queueing delay low.
+   */
+  DELAY,
+}
+
 /**
  * Type of savedata to create the Tox instance from.
  *
@@ -624,6 +644,91 @@ static class options {
        * Default: false.
        */
       bool thread_safety;
+
+      /**
+       * Receive UDP packets and accept TCP relay connections through io_uring
+       * on Linux. Falls back to the regular socket polling if toxcore was
+       * built without io_uring support or the kernel does not provide it.
+       *
+       * Default: false.
+       */
+      bool io_uring;
+
+      /**
+       * Number of DHT shared keys kept in each of the DHT's caches of
+       * recently used keys. Computing a shared key is expensive, so a node
+       * that talks to many peers, such as a bootstrap node, benefits from a
+       * larger cache. When a cache is full, the least recently used key is
+       * dropped.
+       *
+       * Default: 0, which uses the built-in capacity.
+       */
+      uint32_t shared_key_cache_capacity;
+
+      /**
+       * Number of threads computing the DHT shared keys missing from the
+       * caches. Packets from peers whose key is not cached wait for a thread
+       * to compute it instead of blocking ${tox.iterate}. At most 64.
+       *
+       * Default: 0, which computes the keys in ${tox.iterate}.
+       */
+      uint16_t shared_key_threads;
+
+      /**
+       * Path of a file in which to keep a cache of the DHT nodes this
+       * instance has seen, with how long each has been around and how fast
+       * it answers. On the next start, the best of them are used to
+       * bootstrap, so the instance connects without waiting for the nodes
+       * in the savedata to be tried one by one. The file is memory mapped
+       * and created if it doesn't exist. If it can't be opened, the instance
+       * runs without the cache.
+       *
+       * Default: NULL, which disables the cache.
+       */
+      string node_cache_path;
+
+      /**
+       * Maximum number of UDP packets handled in each ${tox.iterate} call.
+       * Packets keep being read until the socket is empty, so that a flood
+       * of DHT requests doesn't keep friends' data waiting in the kernel,
+       * but once this many are handled, handshakes and DHT packets are
+       * dropped. Data from the address of an established friend or group
+       * connection is always handled; other data packets are dropped too.
+       *
+       * Default: 0, which handles all packets.
+       */
+      uint32_t receive_budget;
+
+      /**
+       * Number of threads encrypting and decrypting the data packets of
+       * friend connections, for bulk transfers that would otherwise keep one
+       * core busy. Received packets are decrypted in parallel batches, and
+       * lossless packets are queued and encrypted in parallel batches at the
+       * end of ${tox.iterate}, so a packet sent between two ${tox.iterate} calls
+       * leaves with the next one. At most 64.
+       *
+       * Default: 0, which encrypts and decrypts each packet in ${tox.iterate}.
+       */
+      uint16_t crypto_threads;
+
+      /**
+       * Congestion control algorithm of friend connections. Unknown values
+       * use the default.
+       *
+       * Default: ${CONGESTION_CONTROL.QUEUE}.
+       */
+      CONGESTION_CONTROL congestion_control;
+
+      /**
+       * Spread the packets of each friend connection evenly over time at a
+       * little more than its send rate, instead of sending them in bursts
+       * that overflow small router buffers. Packets held back wait for a
+       * later ${tox.iterate}, so clients should call it as often as
+       * ${tox.iteration_interval} asks for.
+       *
+       * Default: false.
+       */
+      bool send_pacing;
     }
   }
 
@@ -1509,6 +1614,75 @@ namespace friend {
 
 }
 
+%{
+/**
+ * Transport statistics of the connection to a friend or group peer, written by
+ * tox_friend_get_transport_stats and tox_group_peer_get_transport_stats.
+ *
+ * Rates are in packets per second, averaged over about the last second. For
+ * group peers, only lossless packets are counted.
+ */
+typedef struct Tox_Transport_Stats {
+
+    /**
+     * TOX_CONNECTION_UDP when directly connected, TOX_CONNECTION_TCP when
+     * connected through a TCP relay. When TOX_CONNECTION_NONE, all other
+     * members are 0.
+     */
+    TOX_CONNECTION connection;
+
+    /**
+     * Average round trip time in milliseconds, 0 if not measured yet.
+     */
+    uint32_t rtt;
+
+    /**
+     * Packets sent per second, resent ones included.
+     */
+    uint32_t send_rate;
+
+    /**
+     * Packets received per second.
+     */
+    uint32_t recv_rate;
+
+    /**
+     * Packets per second the congestion control allows. Always 0 for group
+     * peers.
+     */
+    uint32_t send_rate_limit;
+
+    /**
+     * Lossless packets sent again since the connection was made.
+     */
+    uint64_t packets_resent;
+
+    /**
+     * Lossless packets sent or waiting to be sent and not acknowledged yet.
+     */
+    uint32_t send_queue;
+
+} Tox_Transport_Stats;
+%}
+
+namespace friend {
+
+  /**
+   * Write the transport statistics of the connection to a friend to `stats`.
+   *
+   * This takes constant time and does not allocate, so it can be called for
+   * every friend every second.
+   *
+   * @param friend_number The friend number of the friend to query.
+   * @param stats A valid Tox_Transport_Stats to write to.
+   *
+   * @return true on success.
+   */
+  bool get_transport_stats(uint32_t friend_number, Tox_Transport_Stats *stats)
+      with error for query;
+
+}
+
 
 /*******************************************************************************
  *
@@ -3297,6 +3471,10 @@ namespace group {
        * The ID passed did not designate a valid peer.
        */
       PEER_NOT_FOUND,
+      /**
+       * A NULL pointer was passed to write the result to.
+       */
+      NULL,
     }
 
     uint8_t[length <= MAX_NAME_LENGTH] name {
@@ -3369,6 +3547,19 @@ namespace group {
        get(uint32_t group_number, uint32_t peer_id) with error for query;
     }
 
+    /**
+     * Write the transport statistics of the connection to the peer designated by
+     * the given ID to `stats`. See tox_friend_get_transport_stats.
+     *
+     * @param group_number The group number of the group we wish to query.
+     * @param peer_id The ID of the peer whose connection we want to query.
+     * @param stats A valid Tox_Transport_Stats to write to.
+     *
+     * @return true on success.
+     */
+    bool get_transport_stats(uint32_t group_number, uint32_t peer_id, Tox_Transport_Stats *stats)
+        with error for query;
+
     /**
      * This event is triggered when a peer changes their nickname.
      */
@@ -4405,6 +4596,7 @@ typedef TOX_ERR_GROUP_IS_CONNECTED Tox_Err_Group_Is_Connected;
 typedef TOX_USER_STATUS Tox_User_Status;
 typedef TOX_MESSAGE_TYPE Tox_Message_Type;
 typedef TOX_PROXY_TYPE Tox_Proxy_Type;
+typedef TOX_CONGESTION_CONTROL Tox_Congestion_Control;
 typedef TOX_SAVEDATA_TYPE Tox_Savedata_Type;
 typedef TOX_LOG_LEVEL Tox_Log_Level;
 typedef TOX_CONNECTION Tox_Connection;
@@ -26,6 +26,7 @@
 #include "Messenger.h"
 #include "group.h"
 #include "group_chats.h"
+#include "group_connection.h"
 #include "group_moderation.h"
 #include "logger.h"
 #include "mono_time.h"
@@ -637,6 +638,24 @@ Tox *tox_new(const struct Tox_Options *options, Tox_Err_New *error)
     m_options.tcp_server_port = tox_options_get_tcp_port(opts);
     m_options.hole_punching_enabled = tox_options_get_hole_punching_enabled(opts);
     m_options.local_discovery_enabled = tox_options_get_local_discovery_enabled(opts);
+    m_options.io_uring = tox_options_get_experimental_io_uring(opts);
+    m_options.shared_key_cache_capacity = tox_options_get_experimental_shared_key_cache_capacity(opts);
+    m_options.shared_key_threads = tox_options_get_experimental_shared_key_threads(opts);
+    m_options.node_cache_path = tox_options_get_experimental_node_cache_path(opts);
+    m_options.receive_budget = tox_options_get_experimental_receive_budget(opts);
+    m_options.crypto_threads = tox_options_get_experimental_crypto_threads(opts);
+    m_options.send_pacing = tox_options_get_experimental_send_pacing(opts);
+
+    switch (tox_options_get_experimental_congestion_control(opts)) {
+        case TOX_CONGESTION_CONTROL_DELAY:
+            m_options.congestion_control = CONGESTION_CONTROL_DELAY;
+            break;
+
+        case TOX_CONGESTION_CONTROL_QUEUE:
+        default:
+            m_options.congestion_control = CONGESTION_CONTROL_QUEUE;
+            break;
+    }
 
     m_options.log_callback = (logger_cb *)tox_options_get_log_callback(opts);
     m_options.log_context = tox;
@@ -1014,6 +1033,7 @@ void tox_iterate(Tox *tox, void *user_data)
     tox->non_const_user_data = user_data;
     do_messenger(tox->m, &tox_data);
     do_groupchats(tox->m->conferences_object, &tox_data);
+    do_net_crypto_send(tox->m->net_crypto);
 
     unlock(tox);
 }
@@ -1522,6 +1542,47 @@ void tox_callback_friend_typing(Tox *tox, tox_friend_typing_cb *callback)
     tox->friend_typing_callback = callback;
 }
 
+static uint32_t rate_to_u32(double rate)
+{
+    return rate < UINT32_MAX ? (uint32_t)(rate + 0.5) : UINT32_MAX;
+}
+
+bool tox_friend_get_transport_stats(const Tox *tox, uint32_t friend_number, Tox_Transport_Stats *stats,
+                                    Tox_Err_Friend_Query *error)
+{
+    assert(tox != nullptr);
+
+    if (!stats) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_NULL);
+        return 0;
+    }
+
+    Crypto_Connection_Stats crypto_stats;
+    lock(tox);
+    const int ret = m_get_friend_transport_stats(tox->m, friend_number, &crypto_stats);
+    unlock(tox);
+
+    if (ret == -1) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_FRIEND_NOT_FOUND);
+        return 0;
+    }
+
+    memset(stats, 0, sizeof(Tox_Transport_Stats));
+
+    if (ret == 1) {
+        stats->connection = crypto_stats.direct_connected ? TOX_CONNECTION_UDP : TOX_CONNECTION_TCP;
+        stats->rtt = crypto_stats.rtt < UINT32_MAX ? crypto_stats.rtt : UINT32_MAX;
+        stats->send_rate = rate_to_u32(crypto_stats.send_rate);
+        stats->recv_rate = rate_to_u32(crypto_stats.recv_rate);
+        stats->send_rate_limit = rate_to_u32(crypto_stats.send_rate_limit);
+        stats->packets_resent = crypto_stats.packets_resent;
+        stats->send_queue = crypto_stats.send_queue;
+    }
+
+    SET_ERROR_PARAMETER(error, TOX_ERR_FRIEND_QUERY_OK);
+    return 1;
+}
+
 bool tox_self_set_typing(Tox *tox, uint32_t friend_number, bool typing, Tox_Err_Set_Typing *error)
 {
     assert(tox != nullptr);
@@ -2596,6 +2657,96 @@ void *tox_get_av_object(const Tox *tox)
     return object;
 }
 
+uint64_t tox_dht_shared_key_cache_hits(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const DHT *dht = tox->m->dht;
+    const uint64_t hits = shared_keys_hits(dht_get_shared_keys_recv(dht))
+                          + shared_keys_hits(dht_get_shared_keys_sent(dht));
+    unlock(tox);
+    return hits;
+}
+
+uint64_t tox_dht_shared_key_cache_misses(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const DHT *dht = tox->m->dht;
+    const uint64_t misses = shared_keys_misses(dht_get_shared_keys_recv(dht))
+                            + shared_keys_misses(dht_get_shared_keys_sent(dht));
+    unlock(tox);
+    return misses;
+}
+
+uint64_t tox_dht_shared_key_cache_evictions(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const DHT *dht = tox->m->dht;
+    const uint64_t evictions = shared_keys_evictions(dht_get_shared_keys_recv(dht))
+                               + shared_keys_evictions(dht_get_shared_keys_sent(dht));
+    unlock(tox);
+    return evictions;
+}
+
+uint32_t tox_dht_shared_key_pool_parked(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const Shared_Key_Pool *pool = dht_get_shared_key_pool(tox->m->dht);
+    const uint32_t parked = pool != nullptr ? shared_key_pool_parked(pool) : 0;
+    unlock(tox);
+    return parked;
+}
+
+uint32_t tox_dht_shared_key_pool_peak_parked(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const Shared_Key_Pool *pool = dht_get_shared_key_pool(tox->m->dht);
+    const uint32_t peak_parked = pool != nullptr ? shared_key_pool_peak_parked(pool) : 0;
+    unlock(tox);
+    return peak_parked;
+}
+
+uint64_t tox_dht_shared_key_pool_dropped(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const Shared_Key_Pool *pool = dht_get_shared_key_pool(tox->m->dht);
+    const uint64_t dropped = pool != nullptr ? shared_key_pool_dropped(pool) : 0;
+    unlock(tox);
+    return dropped;
+}
+
+uint32_t tox_packet_buffers_in_use(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const uint32_t in_use = net_crypto_packet_buffers_in_use(tox->m->net_crypto);
+    unlock(tox);
+    return in_use;
+}
+
+uint32_t tox_packet_buffers_peak(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const uint32_t peak = net_crypto_packet_buffers_peak(tox->m->net_crypto);
+    unlock(tox);
+    return peak;
+}
+
+uint64_t tox_self_get_time_to_udp(const Tox *tox)
+{
+    assert(tox != nullptr);
+    lock(tox);
+    const uint64_t time_to_udp = tox->m->time_to_udp;
+    unlock(tox);
+    return time_to_udp;
+}
+
 uint16_t tox_self_get_udp_port(const Tox *tox, Tox_Err_Get_Port *error)
 {
     assert(tox != nullptr);
@@ -3148,6 +3299,43 @@ bool tox_group_peer_get_public_key(const Tox *tox, uint32_t group_number, uint32
     return 1;
 }
 
+bool tox_group_peer_get_transport_stats(const Tox *tox, uint32_t group_number, uint32_t peer_id,
+                                        Tox_Transport_Stats *stats, Tox_Err_Group_Peer_Query *error)
+{
+    if (stats == nullptr) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_PEER_QUERY_NULL);
+        return 0;
+    }
+
+    const GC_Chat *chat = gc_get_group(tox->m->group_handler, group_number);
+
+    if (chat == nullptr) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_PEER_QUERY_GROUP_NOT_FOUND);
+        return 0;
+    }
+
+    GC_Connection_Stats gc_stats;
+
+    if (gc_get_peer_transport_stats(chat, peer_id, &gc_stats) == -1) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_PEER_QUERY_PEER_NOT_FOUND);
+        return 0;
+    }
+
+    SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_PEER_QUERY_OK);
+    memset(stats, 0, sizeof(Tox_Transport_Stats));
+
+    if (gc_stats.handshaked) {
+        stats->connection = gc_stats.direct_connected ? TOX_CONNECTION_UDP : TOX_CONNECTION_TCP;
+        stats->rtt = gc_stats.rtt < UINT32_MAX ? gc_stats.rtt : UINT32_MAX;
+        stats->send_rate = rate_to_u32(gc_stats.send_rate);
+        stats->recv_rate = rate_to_u32(gc_stats.recv_rate);
+        stats->packets_resent = gc_stats.packets_resent;
+        stats->send_queue = gc_stats.send_queue;
+    }
+
+    return 1;
+}
+
 bool tox_group_set_topic(Tox *tox, uint32_t group_number, const uint8_t *topic, size_t length,
                          Tox_Err_Group_Topic_Set *error)
 {
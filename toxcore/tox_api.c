@@ -60,6 +60,14 @@ ACCESSORS(tox_log_cb *, log_, callback)
 ACCESSORS(void *, log_, user_data)
 ACCESSORS(bool,, local_discovery_enabled)
 ACCESSORS(bool,, experimental_thread_safety)
+ACCESSORS(bool,, experimental_io_uring)
+ACCESSORS(uint32_t,, experimental_shared_key_cache_capacity)
+ACCESSORS(uint16_t,, experimental_shared_key_threads)
+ACCESSORS(const char *,, experimental_node_cache_path)
+ACCESSORS(uint32_t,, experimental_receive_budget)
+ACCESSORS(uint16_t,, experimental_crypto_threads)
+ACCESSORS(Tox_Congestion_Control,, experimental_congestion_control)
+ACCESSORS(bool,, experimental_send_pacing)
 
 //!TOKSTYLE+
 
@@ -85,6 +93,14 @@ void tox_options_default(struct Tox_Options *options)
         tox_options_set_hole_punching_enabled(options, true);
         tox_options_set_local_discovery_enabled(options, true);
         tox_options_set_experimental_thread_safety(options, false);
+        tox_options_set_experimental_io_uring(options, false);
+        tox_options_set_experimental_shared_key_cache_capacity(options, 0);
+        tox_options_set_experimental_shared_key_threads(options, 0);
+        tox_options_set_experimental_node_cache_path(options, nullptr);
+        tox_options_set_experimental_receive_budget(options, 0);
+        tox_options_set_experimental_crypto_threads(options, 0);
+        tox_options_set_experimental_congestion_control(options, TOX_CONGESTION_CONTROL_QUEUE);
+        tox_options_set_experimental_send_pacing(options, false);
     }
 }
 
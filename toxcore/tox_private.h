@@ -37,6 +37,37 @@ void tox_callback_friend_lossless_packet_per_pktid(Tox *tox, tox_friend_lossless
 void tox_set_av_object(Tox *tox, void *object);
 void *tox_get_av_object(const Tox *tox);
 
+/**
+ * Counters of the DHT's shared key caches, summed over the caches for
+ * received and sent packets: lookups that found a cached key, lookups that
+ * had to compute the key, and keys dropped to make room for new ones.
+ */
+uint64_t tox_dht_shared_key_cache_hits(const Tox *tox);
+uint64_t tox_dht_shared_key_cache_misses(const Tox *tox);
+uint64_t tox_dht_shared_key_cache_evictions(const Tox *tox);
+
+/**
+ * With experimental_shared_key_threads set: the number of packets waiting for
+ * their shared key, the most that waited at the same time, and the number of
+ * packets dropped because too many were waiting. All 0 otherwise.
+ */
+uint32_t tox_dht_shared_key_pool_parked(const Tox *tox);
+uint32_t tox_dht_shared_key_pool_peak_parked(const Tox *tox);
+uint64_t tox_dht_shared_key_pool_dropped(const Tox *tox);
+
+/**
+ * Number of lossless packets held in the send and receive buffers of all
+ * friend connections, and the most that ever were at the same time.
+ */
+uint32_t tox_packet_buffers_in_use(const Tox *tox);
+uint32_t tox_packet_buffers_peak(const Tox *tox);
+
+/**
+ * Milliseconds from tox_new until the instance first had a UDP connection to
+ * the network, as reported by tox_self_get_connection_status. 0 until then.
+ */
+uint64_t tox_self_get_time_to_udp(const Tox *tox);
+
 #ifdef __cplusplus
 }
 #endif
@@ -91,6 +91,138 @@ uint32_t id_copy(uint8_t *dest, const uint8_t *src)
     return CRYPTO_PUBLIC_KEY_SIZE;
 }
 
+uint32_t id_hash(const uint8_t *id, uint64_t hash_key)
+{
+    uint64_t low;
+    uint64_t high;
+    memcpy(&low, id, sizeof(low));
+    memcpy(&high, id + sizeof(low), sizeof(high));
+
+    uint64_t hash = (low ^ hash_key) * UINT64_C(0x9e3779b97f4a7c15);
+    hash = (hash ^ high ^ (hash >> 29)) * UINT64_C(0xbf58476d1ce4e5b9);
+    hash ^= hash >> 32;
+
+    return (uint32_t)hash;
+}
+
+#define PK_INDEX_MIN_SIZE 16
+
+void pk_index_init(Pk_Index *index, pk_index_get_pk_cb *get_pk, const void *object)
+{
+    memset(index, 0, sizeof(Pk_Index));
+    index->hash_key = random_u64();
+    index->get_pk = get_pk;
+    index->object = object;
+}
+
+void pk_index_free(Pk_Index *index)
+{
+    free(index->slots);
+    index->slots = nullptr;
+    index->size = 0;
+    index->count = 0;
+}
+
+/* Slot of the entry with public key pk, or of the empty slot where it would go. */
+static uint32_t pk_index_slot(const Pk_Index *index, const uint8_t *pk)
+{
+    const uint32_t mask = index->size - 1;
+    uint32_t slot = id_hash(pk, index->hash_key) & mask;
+
+    while (index->slots[slot] != PK_INDEX_NONE
+            && !id_equal(index->get_pk(index->object, index->slots[slot]), pk)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+int pk_index_reserve(Pk_Index *index, uint32_t num)
+{
+    if (num * 2 <= index->size) {
+        return 0;
+    }
+
+    uint32_t size = index->size == 0 ? PK_INDEX_MIN_SIZE : index->size;
+
+    while (num * 2 > size) {
+        size *= 2;
+    }
+
+    uint32_t *const slots = (uint32_t *)malloc(size * sizeof(uint32_t));
+
+    if (slots == nullptr) {
+        return -1;
+    }
+
+    uint32_t *const old_slots = index->slots;
+    const uint32_t old_size = index->size;
+    index->slots = slots;
+    index->size = size;
+
+    for (uint32_t i = 0; i < size; ++i) {
+        slots[i] = PK_INDEX_NONE;
+    }
+
+    for (uint32_t i = 0; i < old_size; ++i) {
+        if (old_slots[i] != PK_INDEX_NONE) {
+            slots[pk_index_slot(index, index->get_pk(index->object, old_slots[i]))] = old_slots[i];
+        }
+    }
+
+    free(old_slots);
+    return 0;
+}
+
+uint32_t pk_index_find(const Pk_Index *index, const uint8_t *pk)
+{
+    if (index->count == 0) {
+        return PK_INDEX_NONE;
+    }
+
+    return index->slots[pk_index_slot(index, pk)];
+}
+
+void pk_index_add(Pk_Index *index, const uint8_t *pk, uint32_t entry)
+{
+    index->slots[pk_index_slot(index, pk)] = entry;
+    ++index->count;
+}
+
+void pk_index_move(Pk_Index *index, const uint8_t *pk, uint32_t entry)
+{
+    index->slots[pk_index_slot(index, pk)] = entry;
+}
+
+void pk_index_remove(Pk_Index *index, const uint8_t *pk)
+{
+    const uint32_t mask = index->size - 1;
+    uint32_t slot = pk_index_slot(index, pk);
+    uint32_t next = slot;
+
+    /* Move later entries of the probe sequence back so that lookups don't
+     * stop at the hole. */
+    while (true) {
+        next = (next + 1) & mask;
+        const uint32_t entry = index->slots[next];
+
+        if (entry == PK_INDEX_NONE) {
+            break;
+        }
+
+        const uint32_t home = id_hash(index->get_pk(index->object, entry), index->hash_key) & mask;
+
+        /* The entry can fill the hole if its home slot doesn't lie cyclically in (slot, next]. */
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            index->slots[slot] = entry;
+            slot = next;
+        }
+    }
+
+    index->slots[slot] = PK_INDEX_NONE;
+    --index->count;
+}
+
 /* id_str should be of length at least IDSTRING_LEN */
 char *id_to_string(const uint8_t *pk, char *id_str, size_t length)
 {
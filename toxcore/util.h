@@ -42,6 +42,54 @@ bool chat_id_equal(const uint8_t *dest, const uint8_t *src);
 
 uint32_t id_copy(uint8_t *dest, const uint8_t *src); /* return value is CLIENT_ID_SIZE */
 
+/* Hash of an id for hash tables, keyed with a random hash_key so that peers
+ * can't pick ids that collide.
+ */
+uint32_t id_hash(const uint8_t *id, uint64_t hash_key);
+
+/* Empty slot in a Pk_Index. */
+#define PK_INDEX_NONE UINT32_MAX
+
+/* Returns the public key of entry in the array indexed by a Pk_Index. */
+typedef const uint8_t *pk_index_get_pk_cb(const void *object, uint32_t entry);
+
+/* Open addressing hash table from public keys to the entries of an array
+ * kept by its user, who gives the public key of an entry with get_pk.
+ */
+typedef struct Pk_Index {
+    uint32_t *slots;
+    uint32_t size;
+    uint32_t count;
+    uint64_t hash_key;
+    pk_index_get_pk_cb *get_pk;
+    const void *object;
+} Pk_Index;
+
+void pk_index_init(Pk_Index *index, pk_index_get_pk_cb *get_pk, const void *object);
+void pk_index_free(Pk_Index *index);
+
+/* Make room for num entries, keeping the index at most half full so that
+ * probe sequences stay short.
+ *
+ * return -1 on failure.
+ * return 0 on success.
+ */
+int pk_index_reserve(Pk_Index *index, uint32_t num);
+
+/* return the entry with public key pk or PK_INDEX_NONE if there is none. */
+uint32_t pk_index_find(const Pk_Index *index, const uint8_t *pk);
+
+/* Add entry with public key pk, which must not be in the index yet. Room for
+ * it must have been made with pk_index_reserve().
+ */
+void pk_index_add(Pk_Index *index, const uint8_t *pk, uint32_t entry);
+
+/* Point the public key pk, which must be in the index, to entry. */
+void pk_index_move(Pk_Index *index, const uint8_t *pk, uint32_t entry);
+
+/* Remove the public key pk, which must be in the index. */
+void pk_index_remove(Pk_Index *index, const uint8_t *pk);
+
 // For printing purposes
 char *id_toa(const uint8_t *id);
 
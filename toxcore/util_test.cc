@@ -2,6 +2,8 @@
 
 #include <gtest/gtest.h>
 
+#include <cstring>
+
 #include "crypto_core.h"
 
 namespace {
@@ -29,4 +31,65 @@ TEST(Util, IdCopyMakesKeysEqual) {
   EXPECT_TRUE(id_equal(pk1, pk2));
 }
 
+const uint8_t *test_key_pk(const void *object, uint32_t entry) {
+  const uint8_t(*keys)[CRYPTO_PUBLIC_KEY_SIZE] = static_cast<const uint8_t(*)[CRYPTO_PUBLIC_KEY_SIZE]>(object);
+  return keys[entry];
+}
+
+TEST(Util, PkIndexFindsAddedKeys) {
+  constexpr uint32_t num_keys = 100;
+  uint8_t keys[num_keys][CRYPTO_PUBLIC_KEY_SIZE];
+  uint8_t sk[CRYPTO_SECRET_KEY_SIZE];
+
+  Pk_Index index;
+  pk_index_init(&index, &test_key_pk, keys);
+  EXPECT_EQ(pk_index_find(&index, keys[0]), PK_INDEX_NONE);
+
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    crypto_new_keypair(keys[i], sk);
+    ASSERT_EQ(pk_index_reserve(&index, i + 1), 0);
+    pk_index_add(&index, keys[i], i);
+  }
+
+  EXPECT_GE(index.size, num_keys * 2);
+
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    EXPECT_EQ(pk_index_find(&index, keys[i]), i);
+  }
+
+  pk_index_free(&index);
+}
+
+TEST(Util, PkIndexKeepsOtherKeysAfterRemoving) {
+  constexpr uint32_t num_keys = 100;
+  uint8_t keys[num_keys][CRYPTO_PUBLIC_KEY_SIZE];
+  uint8_t sk[CRYPTO_SECRET_KEY_SIZE];
+
+  Pk_Index index;
+  pk_index_init(&index, &test_key_pk, keys);
+  ASSERT_EQ(pk_index_reserve(&index, num_keys), 0);
+
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    crypto_new_keypair(keys[i], sk);
+    pk_index_add(&index, keys[i], i);
+  }
+
+  for (uint32_t i = 0; i < num_keys; i += 2) {
+    pk_index_remove(&index, keys[i]);
+  }
+
+  EXPECT_EQ(index.count, num_keys / 2);
+
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    EXPECT_EQ(pk_index_find(&index, keys[i]), i % 2 == 0 ? PK_INDEX_NONE : i);
+  }
+
+  // Move the last key into the place of the first removed one.
+  memcpy(keys[0], keys[num_keys - 1], CRYPTO_PUBLIC_KEY_SIZE);
+  pk_index_move(&index, keys[0], 0);
+  EXPECT_EQ(pk_index_find(&index, keys[0]), 0);
+
+  pk_index_free(&index);
+}
+
 }  // namespace